@@ -0,0 +1,381 @@
+// YCSB-style benchmark for the Storage engine.
+//
+// Build next to the engine:
+//   g++ -std=c++17 -O2 -pthread bench.cpp -o bench
+//
+// Usage:
+//   ./bench [--workload A|B|C|D|E|F|all] [--records N] [--ops N] [--threads N]
+//           [--row-size BYTES] [--distribution zipfian|uniform] [--db DIR]
+//           [--fresh] [--json PATH] [--verbose]
+//
+// Workloads (as defined by YCSB):
+//   A  50% read / 50% update            D  95% read / 5% insert, reads favour recent keys
+//   B  95% read / 5% update             E  95% short range scan / 5% insert
+//   C  100% read                        F  50% read / 50% read-modify-write
+//
+// Worker threads share one Storage, which serializes operations on its own engine
+// lock; --threads measures throughput and latency under that contention.
+//
+// The database directory (--db, benchDB by default) is deleted and recreated. A
+// directory that already holds files is only deleted with --fresh.
+#define YARAB_NO_MAIN
+#include "tewsst.cpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+enum class OpType { Read, Update, Insert, Scan, ReadModifyWrite, Count };
+
+static const char* opName(OpType op) {
+    switch (op) {
+        case OpType::Read: return "read";
+        case OpType::Update: return "update";
+        case OpType::Insert: return "insert";
+        case OpType::Scan: return "scan";
+        case OpType::ReadModifyWrite: return "read_modify_write";
+        default: return "unknown";
+    }
+}
+
+struct WorkloadSpec {
+    char name;
+    double read = 0, update = 0, insert = 0, scan = 0, readModifyWrite = 0;
+    bool readLatest = false;  // Workload D draws keys near the newest insert
+};
+
+static std::optional<WorkloadSpec> workloadFor(char name) {
+    WorkloadSpec w;
+    w.name = name;
+    switch (name) {
+        case 'A': w.read = 0.5; w.update = 0.5; break;
+        case 'B': w.read = 0.95; w.update = 0.05; break;
+        case 'C': w.read = 1.0; break;
+        case 'D': w.read = 0.95; w.insert = 0.05; w.readLatest = true; break;
+        case 'E': w.scan = 0.95; w.insert = 0.05; break;
+        case 'F': w.read = 0.5; w.readModifyWrite = 0.5; break;
+        default: return std::nullopt;
+    }
+    return w;
+}
+
+// Zipfian generator over [0, n) following Gray et al., as used by YCSB (theta 0.99).
+// Ranks are scrambled with a hash so the hot keys are spread over the key space.
+class ZipfianGenerator {
+private:
+    uint64_t items;
+    double theta, zetan, alpha, eta;
+
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+
+public:
+    explicit ZipfianGenerator(uint64_t n, double zipfTheta = 0.99) : items(n), theta(zipfTheta) {
+        zetan = zeta(items, theta);
+        double zeta2 = zeta(2, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    uint64_t rank(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta)) return 1;
+        return static_cast<uint64_t>(items * std::pow(eta * u - eta + 1, alpha)) % items;
+    }
+
+    uint64_t next(std::mt19937_64& rng) const {
+        uint64_t r = rank(rng);
+        // FNV-1a scramble
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < 8; ++i) {
+            h ^= (r >> (i * 8)) & 0xFF;
+            h *= 0x100000001b3ULL;
+        }
+        return h % items;
+    }
+};
+
+struct BenchConfig {
+    std::string workloads = "A";
+    uint64_t records = 1000;
+    uint64_t operations = 1000;
+    int threads = 1;
+    size_t rowSize = 100;
+    bool zipfian = true;
+    std::string dbName = "benchDB";
+    std::string jsonPath;
+    bool fresh = false;
+    bool verbose = false;
+};
+
+struct OpStats {
+    std::vector<uint64_t> latenciesNs;
+    uint64_t failures = 0;
+};
+
+struct WorkloadResult {
+    char name;
+    double seconds = 0;
+    uint64_t operations = 0;
+    OpStats perOp[static_cast<int>(OpType::Count)];
+};
+
+static std::string randomValue(std::mt19937_64& rng, size_t length) {
+    // Only alphanumerics, so a value fills exactly its length of the stored row (a ')' is stored twice)
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+    std::string value(length, 'x');
+    for (auto& c : value) c = alphabet[pick(rng)];
+    return value;
+}
+
+static Tuple makeRow(int64_t id, std::mt19937_64& rng, size_t rowSize) {
+    Tuple tuple;
+    tuple.addAttribute("id", 1, std::to_string(id));
+    tuple.addAttribute("field0", 2, randomValue(rng, rowSize));
+    return tuple;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(std::ceil(p * sorted.size())) - 1;
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static WorkloadResult runWorkload(Storage& storage, const BenchConfig& config,
+                                  const WorkloadSpec& spec, const std::string& tableName) {
+    // Load phase
+    {
+        std::mt19937_64 rng(42);
+        storage.createTable(config.dbName, tableName, {{"id", "int"}, {"field0", "string"}});
+        for (uint64_t i = 0; i < config.records; ++i) {
+            if (!storage.insert(config.dbName, tableName, makeRow(static_cast<int64_t>(i), rng, config.rowSize))) {
+                throw std::runtime_error("load failed at record " + std::to_string(i));
+            }
+        }
+    }
+
+    std::atomic<int64_t> nextInsertId(static_cast<int64_t>(config.records));
+    std::atomic<uint64_t> remaining(config.operations);
+    std::vector<WorkloadResult> perThread(config.threads);
+    ZipfianGenerator zipf(std::max<uint64_t>(config.records, 2));
+
+    auto worker = [&](int threadIndex) {
+        std::mt19937_64 rng(1000 + threadIndex);
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        WorkloadResult& result = perThread[threadIndex];
+
+        auto chooseKey = [&]() -> int64_t {
+            int64_t inserted = nextInsertId.load();
+            if (spec.readLatest) {
+                // Latest: zipfian distance back from the newest key
+                int64_t back = static_cast<int64_t>(zipf.rank(rng));
+                return std::max<int64_t>(0, inserted - 1 - back);
+            }
+            if (config.zipfian) {
+                return static_cast<int64_t>(zipf.next(rng));
+            }
+            return std::uniform_int_distribution<int64_t>(0, static_cast<int64_t>(config.records) - 1)(rng);
+        };
+
+        while (true) {
+            uint64_t left = remaining.load();
+            if (left == 0 || !remaining.compare_exchange_weak(left, left - 1)) {
+                if (left == 0) break;
+                continue;
+            }
+
+            double r = coin(rng);
+            OpType op;
+            if ((r -= spec.read) < 0) op = OpType::Read;
+            else if ((r -= spec.update) < 0) op = OpType::Update;
+            else if ((r -= spec.insert) < 0) op = OpType::Insert;
+            else if ((r -= spec.scan) < 0) op = OpType::Scan;
+            else op = OpType::ReadModifyWrite;
+
+            int64_t key = op == OpType::Insert ? nextInsertId.fetch_add(1) : chooseKey();
+            Tuple row = makeRow(key, rng, config.rowSize);
+            size_t scanLength = std::uniform_int_distribution<size_t>(1, 100)(rng);
+
+            bool ok = true;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                switch (op) {
+                    case OpType::Read:
+                        storage.get(config.dbName, tableName, std::to_string(key));
+                        break;
+                    case OpType::Update:
+                        ok = storage.updateTupleInTable(config.dbName, tableName, std::to_string(key), row);
+                        break;
+                    case OpType::Insert:
+                        ok = storage.insert(config.dbName, tableName, row).has_value();
+                        break;
+                    case OpType::Scan:
+                        storage.scanRange(config.dbName, tableName, key, scanLength);
+                        break;
+                    case OpType::ReadModifyWrite:
+                        storage.get(config.dbName, tableName, std::to_string(key));
+                        ok = storage.updateTupleInTable(config.dbName, tableName, std::to_string(key), row);
+                        break;
+                    default:
+                        break;
+                }
+            } catch (const std::exception&) {
+                ok = false;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+            OpStats& stats = result.perOp[static_cast<int>(op)];
+            stats.latenciesNs.push_back(static_cast<uint64_t>(elapsed.count()));
+            if (!ok) stats.failures++;
+            result.operations++;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < config.threads; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    WorkloadResult total;
+    total.name = spec.name;
+    total.seconds = std::chrono::duration<double>(elapsed).count();
+    for (auto& result : perThread) {
+        total.operations += result.operations;
+        for (int op = 0; op < static_cast<int>(OpType::Count); ++op) {
+            auto& from = result.perOp[op];
+            auto& to = total.perOp[op];
+            to.latenciesNs.insert(to.latenciesNs.end(), from.latenciesNs.begin(), from.latenciesNs.end());
+            to.failures += from.failures;
+        }
+    }
+    for (auto& stats : total.perOp) {
+        std::sort(stats.latenciesNs.begin(), stats.latenciesNs.end());
+    }
+    return total;
+}
+
+static void printResult(const WorkloadResult& result) {
+    std::printf("Workload %c: %llu ops in %.3f s, %.1f ops/s\n", result.name,
+                static_cast<unsigned long long>(result.operations), result.seconds,
+                result.seconds > 0 ? result.operations / result.seconds : 0.0);
+    std::printf("  %-18s %10s %10s %12s %12s %12s\n", "operation", "count", "failed", "p50 (us)", "p99 (us)", "p999 (us)");
+    for (int op = 0; op < static_cast<int>(OpType::Count); ++op) {
+        const OpStats& stats = result.perOp[op];
+        if (stats.latenciesNs.empty()) continue;
+        std::printf("  %-18s %10zu %10llu %12.1f %12.1f %12.1f\n", opName(static_cast<OpType>(op)),
+                    stats.latenciesNs.size(), static_cast<unsigned long long>(stats.failures),
+                    percentile(stats.latenciesNs, 0.50) / 1000.0, percentile(stats.latenciesNs, 0.99) / 1000.0,
+                    percentile(stats.latenciesNs, 0.999) / 1000.0);
+    }
+}
+
+static void writeJson(const std::string& path, const BenchConfig& config, const std::vector<WorkloadResult>& results) {
+    std::ofstream out(path, std::ios::trunc);
+    out << "{\n  \"config\": {\"records\": " << config.records << ", \"operations\": " << config.operations
+        << ", \"threads\": " << config.threads << ", \"row_size\": " << config.rowSize
+        << ", \"distribution\": \"" << (config.zipfian ? "zipfian" : "uniform") << "\"},\n  \"workloads\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const WorkloadResult& result = results[i];
+        out << (i ? "," : "") << "\n    {\"name\": \"" << result.name << "\", \"operations\": " << result.operations
+            << ", \"seconds\": " << result.seconds
+            << ", \"throughput\": " << (result.seconds > 0 ? result.operations / result.seconds : 0.0)
+            << ", \"ops\": {";
+        bool first = true;
+        for (int op = 0; op < static_cast<int>(OpType::Count); ++op) {
+            const OpStats& stats = result.perOp[op];
+            if (stats.latenciesNs.empty()) continue;
+            out << (first ? "" : ", ") << "\"" << opName(static_cast<OpType>(op)) << "\": {\"count\": "
+                << stats.latenciesNs.size() << ", \"failed\": " << stats.failures
+                << ", \"p50_ns\": " << percentile(stats.latenciesNs, 0.50)
+                << ", \"p99_ns\": " << percentile(stats.latenciesNs, 0.99)
+                << ", \"p999_ns\": " << percentile(stats.latenciesNs, 0.999) << "}";
+            first = false;
+        }
+        out << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+        try {
+            if (arg == "--workload") config.workloads = value();
+            else if (arg == "--records") config.records = std::stoull(value());
+            else if (arg == "--ops") config.operations = std::stoull(value());
+            else if (arg == "--threads") config.threads = std::max(1, std::stoi(value()));
+            else if (arg == "--row-size") config.rowSize = std::stoull(value());
+            else if (arg == "--distribution") config.zipfian = value() != "uniform";
+            else if (arg == "--db") config.dbName = value();
+            else if (arg == "--json") config.jsonPath = value();
+            else if (arg == "--fresh") config.fresh = true;
+            else if (arg == "--verbose") config.verbose = true;
+            else throw std::invalid_argument("unknown option " + arg);
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "bench: %s\n", e.what());
+            return 2;
+        }
+    }
+    if (config.workloads == "all") config.workloads = "ABCDEF";
+
+    std::error_code error;
+    if (!config.fresh && fs::exists(config.dbName, error) &&
+        (!fs::is_directory(config.dbName, error) || !fs::is_empty(config.dbName, error))) {
+        std::fprintf(stderr, "bench: %s is not an empty directory; pass --fresh to delete it\n",
+                     config.dbName.c_str());
+        return 2;
+    }
+
+    // Results are printed with printf; the engine's debug and error lines on the
+    // iostreams would bury them, so they are only shown with --verbose
+    if (!config.verbose) {
+        std::cout.setstate(std::ios::badbit);
+        std::cerr.setstate(std::ios::badbit);
+    }
+
+    Storage storage;
+    fs::remove_all(config.dbName);
+    storage.createDatabase(config.dbName);
+
+    std::vector<WorkloadResult> results;
+    for (char name : config.workloads) {
+        std::optional<WorkloadSpec> spec = workloadFor(static_cast<char>(std::toupper(name)));
+        if (!spec) {
+            std::fprintf(stderr, "bench: unknown workload %c\n", name);
+            return 2;
+        }
+        try {
+            results.push_back(runWorkload(storage, config, *spec, std::string("usertable_") + spec->name));
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "bench: workload %c failed: %s\n", spec->name, e.what());
+            return 1;
+        }
+        printResult(results.back());
+    }
+
+    if (!config.jsonPath.empty()) {
+        writeJson(config.jsonPath, config, results);
+    }
+    return 0;
+}
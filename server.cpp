@@ -0,0 +1,422 @@
+// Network server for the Storage engine. One process owns a single Storage, so every
+// client shares its buffer pool, dictionaries and redo logs, and all writes go through
+// one path instead of several processes rewriting the same files.
+//
+// Build next to the engine (Linux, epoll):
+//   g++ -std=c++17 -O2 -pthread server.cpp -o yarab_server
+//
+// Usage:
+//   ./yarab_server [--port N] [--bind ADDR] [--unix PATH] [--verbose]
+//
+// Serves the protocol in yarab_protocol.h on TCP (default 127.0.0.1:7070) and/or a
+// Unix socket; yarab_client.h is the matching client. A single epoll loop reads what
+// each socket has, runs every complete request in it in order, and sends the whole
+// batch of responses with one write, so a pipelining client pays one round trip per
+// batch instead of one per request. A connection whose unsent responses pass
+// OUTPUT_HIGH_WATER bytes is not read from, and its buffered requests wait, until
+// the client has taken them below the mark. Database and table names are restricted to
+// [A-Za-z0-9_-], relative to the server's working directory. SIGINT or SIGTERM stops
+// the server cleanly (redo logs are checkpointed on the way out).
+#define YARAB_NO_MAIN
+#include "tewsst.cpp"
+#include "yarab_protocol.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+constexpr size_t OUTPUT_HIGH_WATER = 4 << 20; // Unsent response bytes at which a connection stops being read
+
+struct ServerConfig {
+    std::string bindAddress = "127.0.0.1";
+    int port = 7070;                // 0 disables TCP
+    std::string unixPath;           // Empty disables the Unix socket
+    bool verbose = false;
+};
+
+struct Connection {
+    int fd = -1;
+    std::string input;              // Bytes received, not yet parsed
+    size_t inputOffset = 0;         // Start of the first unparsed frame
+    std::string output;             // Responses not yet sent
+    size_t outputOffset = 0;
+    uint32_t interest = 0;          // Events registered with epoll
+    bool backlogged = false;        // Complete frames left in input while output was over the mark
+    bool closing = false;           // Peer is gone: close once the output is flushed
+
+    size_t unsent() const {
+        return output.size() - outputOffset;
+    }
+
+    // Whether more requests may be read from the socket
+    bool reading() const {
+        return !closing && unsent() < OUTPUT_HIGH_WATER;
+    }
+};
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int) {
+    stopRequested = 1;
+}
+
+static bool validName(const std::string& name) {
+    return !name.empty() && name.size() <= 64 && std::all_of(name.begin(), name.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+    });
+}
+
+static int listenTcp(const std::string& address, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1 ||
+        bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int listenUnix(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Run one request against the engine and append its response frame
+static void execute(Storage& storage, const char* body, size_t length, std::string& output) {
+    WireReader request(body, length);
+    uint32_t requestId = request.get<uint32_t>();
+    uint8_t opcode = request.get<uint8_t>();
+    std::string dbName = request.getString();
+    std::string tableName = request.getString();
+
+    uint8_t status = WIRE_BAD_REQUEST;
+    std::vector<WireRow> rows;
+    if (request.good() && validName(dbName) && validName(tableName)) {
+        try {
+            if (opcode == WIRE_INSERT || opcode == WIRE_UPDATE) {
+                std::string id = opcode == WIRE_UPDATE ? request.getString() : std::string();
+                std::vector<WireAttribute> attributes = request.getTypedRow();
+                if (request.good()) {
+                    Tuple tuple;
+                    for (const WireAttribute& attribute : attributes) {
+                        tuple.addAttribute(attribute.name, attribute.type, attribute.value);
+                    }
+                    if (opcode == WIRE_INSERT) {
+                        std::optional<int64_t> inserted = storage.insert(dbName, tableName, tuple);
+                        if (inserted) {
+                            rows.push_back({{"id", std::to_string(*inserted)}});
+                        }
+                        status = inserted ? WIRE_OK : WIRE_FAILED;
+                    } else {
+                        status = storage.updateTupleInTable(dbName, tableName, id, tuple) ? WIRE_OK : WIRE_FAILED;
+                    }
+                }
+            } else if (opcode == WIRE_GET) {
+                std::string id = request.getString();
+                if (request.good()) {
+                    rows.push_back(storage.get(dbName, tableName, id)); // Throws out_of_range for a missing row
+                    status = WIRE_OK;
+                }
+            } else if (opcode == WIRE_DELETE) {
+                std::string id = request.getString();
+                if (request.good() && !storage.checkTupleExists(dbName, tableName, id)) {
+                    status = WIRE_NOT_FOUND;
+                } else if (request.good()) {
+                    status = storage.deleteTupleFromTable(dbName, tableName, id) ? WIRE_OK : WIRE_FAILED;
+                }
+            } else if (opcode == WIRE_SCAN) {
+                int64_t startId = request.get<int64_t>();
+                uint32_t count = request.get<uint32_t>();
+                if (request.good()) {
+                    rows = storage.scanRange(dbName, tableName, startId, count);
+                    status = WIRE_OK;
+                }
+            }
+        } catch (const std::invalid_argument&) {
+            status = WIRE_BAD_REQUEST;
+        } catch (const std::out_of_range&) {
+            status = WIRE_NOT_FOUND;
+        } catch (const std::exception& e) {
+            std::cerr << "Error server: Request " << requestId << " failed: " << e.what() << std::endl;
+            status = WIRE_FAILED;
+            rows.clear();
+        }
+    }
+
+    WireWriter response(output);
+    response.beginFrame();
+    response.put(requestId);
+    response.put(status);
+    response.put(static_cast<uint32_t>(rows.size()));
+    for (const WireRow& row : rows) {
+        response.putRow(row);
+    }
+    response.endFrame();
+}
+
+// Run the complete frames in the connection's input until its output passes the
+// high-water mark. Returns false on a malformed stream.
+static bool processInput(Storage& storage, Connection& connection) {
+    connection.backlogged = false;
+    for (;;) {
+        size_t available = connection.input.size() - connection.inputOffset;
+        uint32_t length;
+        if (available < sizeof(length)) {
+            break;
+        }
+        std::memcpy(&length, connection.input.data() + connection.inputOffset, sizeof(length));
+        if (length > WIRE_MAX_FRAME) {
+            return false;
+        }
+        if (available < sizeof(length) + length) {
+            break;
+        }
+        if (connection.unsent() >= OUTPUT_HIGH_WATER) {
+            connection.backlogged = true;
+            break;
+        }
+        execute(storage, connection.input.data() + connection.inputOffset + sizeof(length), length, connection.output);
+        connection.inputOffset += sizeof(length) + length;
+    }
+    // Drop consumed bytes once they dominate the buffer
+    if (connection.inputOffset > 0 && connection.inputOffset * 2 >= connection.input.size()) {
+        connection.input.erase(0, connection.inputOffset);
+        connection.inputOffset = 0;
+    }
+    return true;
+}
+
+// Send as much buffered output as the socket takes. Returns false on a socket error.
+static bool flushOutput(Connection& connection) {
+    while (connection.outputOffset < connection.output.size()) {
+        ssize_t sent = send(connection.fd, connection.output.data() + connection.outputOffset,
+                            connection.output.size() - connection.outputOffset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.outputOffset += static_cast<size_t>(sent);
+    }
+    connection.output.clear();
+    connection.outputOffset = 0;
+    return true;
+}
+
+static int runServer(const ServerConfig& config) {
+    Storage storage;
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        std::perror("yarab_server: epoll_create1");
+        return 1;
+    }
+
+    std::vector<int> listeners;
+    if (config.port > 0) {
+        int fd = listenTcp(config.bindAddress, config.port);
+        if (fd < 0) {
+            std::fprintf(stderr, "yarab_server: cannot listen on %s:%d: %s\n", config.bindAddress.c_str(), config.port,
+                         std::strerror(errno));
+            return 1;
+        }
+        listeners.push_back(fd);
+    }
+    if (!config.unixPath.empty()) {
+        int fd = listenUnix(config.unixPath);
+        if (fd < 0) {
+            std::fprintf(stderr, "yarab_server: cannot listen on %s: %s\n", config.unixPath.c_str(), std::strerror(errno));
+            return 1;
+        }
+        listeners.push_back(fd);
+    }
+    if (listeners.empty()) {
+        std::fprintf(stderr, "yarab_server: nothing to listen on\n");
+        return 2;
+    }
+    for (int fd : listeners) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    std::unordered_map<int, Connection> connections;
+    // Read while the connection may take more requests and write while it has output.
+    // EPOLLRDHUP goes with EPOLLIN: once the peer has closed it stays raised, so a
+    // connection still flushing its last responses would wake the loop on every wait.
+    auto updateInterest = [&](Connection& connection) {
+        uint32_t interest = (connection.reading() ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u) |
+                            (connection.unsent() > 0 ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        if (interest != connection.interest) {
+            epoll_event event{};
+            event.events = interest;
+            event.data.fd = connection.fd;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.interest = interest;
+        }
+    };
+
+    std::string endpoints;
+    if (config.port > 0) {
+        endpoints = config.bindAddress + ":" + std::to_string(config.port);
+    }
+    if (!config.unixPath.empty()) {
+        endpoints += (endpoints.empty() ? "" : " and ") + config.unixPath;
+    }
+    std::fprintf(stderr, "yarab_server: listening on %s\n", endpoints.c_str());
+
+    std::vector<epoll_event> events(256);
+    std::vector<char> readBuffer(64 << 10);
+    while (!stopRequested) {
+        int ready = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::perror("yarab_server: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (std::find(listeners.begin(), listeners.end(), fd) != listeners.end()) {
+                for (;;) {
+                    int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (client < 0) {
+                        break;
+                    }
+                    int on = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Fails harmlessly on Unix sockets
+                    epoll_event event{};
+                    event.events = EPOLLIN | EPOLLRDHUP;
+                    event.data.fd = client;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event);
+                    connections[client].fd = client;
+                    connections[client].interest = event.events;
+                }
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue;
+            }
+            Connection& connection = it->second;
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && connection.reading()) {
+                for (;;) {
+                    ssize_t received = recv(fd, readBuffer.data(), readBuffer.size(), 0);
+                    if (received > 0) {
+                        connection.input.append(readBuffer.data(), static_cast<size_t>(received));
+                        continue;
+                    }
+                    if (received < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        connection.closing = true; // Peer closed: answer what it sent, then close
+                    }
+                    break;
+                }
+            }
+            // Requests held back by the high-water mark run as the output drains
+            bool healthy = true;
+            do {
+                if (!processInput(storage, connection)) {
+                    std::fprintf(stderr, "yarab_server: dropping connection %d: oversized frame\n", fd);
+                    connection.input.clear();
+                    connection.inputOffset = 0;
+                    connection.output.clear();
+                    connection.outputOffset = 0;
+                    connection.closing = true;
+                }
+                healthy = flushOutput(connection);
+            } while (healthy && connection.backlogged && connection.unsent() < OUTPUT_HIGH_WATER);
+            if (!healthy || (connection.closing && connection.output.empty())) {
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                connections.erase(it);
+                continue;
+            }
+            updateInterest(connection);
+        }
+    }
+
+    for (auto& [fd, connection] : connections) {
+        close(fd);
+    }
+    for (int fd : listeners) {
+        close(fd);
+    }
+    if (!config.unixPath.empty()) {
+        unlink(config.unixPath.c_str());
+    }
+    close(epollFd);
+    std::fprintf(stderr, "yarab_server: stopped\n");
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    ServerConfig config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+            return argv[++i];
+        };
+        try {
+            if (arg == "--port") config.port = std::stoi(value());
+            else if (arg == "--bind") config.bindAddress = value();
+            else if (arg == "--unix") config.unixPath = value();
+            else if (arg == "--verbose") config.verbose = true;
+            else throw std::invalid_argument("unknown option " + arg);
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "yarab_server: %s\n", e.what());
+            return 2;
+        }
+    }
+
+    // The engine traces every request it serves on stdout; a server runs for long, so
+    // that tracing is dropped unless --verbose. Its errors stay on stderr.
+    if (!config.verbose) {
+        std::cout.setstate(std::ios::badbit);
+    }
+
+    struct sigaction action{};
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    return runServer(config);
+}
@@ -0,0 +1,1257 @@
+// Regression tests for the Storage engine.
+//
+// Build next to the engine:
+//   g++ -std=c++17 -O2 -pthread tests.cpp -o tests
+// (-std=c++20 also builds the tests of the coroutine API)
+//
+// Usage:
+//   ./tests
+//
+// Each test works in its own database under the current directory, removed when it
+// passes. The engine's debug output is silenced; failures are reported on stderr and
+// the exit status is the number of failed checks.
+#define YARAB_NO_MAIN
+#include "tewsst.cpp"
+#include "yarab_protocol.h"
+
+#include <cstdio>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                                   \
+        }                                                                                 \
+    } while (0)
+
+// Whole contents of a file, empty if it cannot be read
+static std::string fileBytes(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// String values holding the characters of the row form, key(type|value), read back
+// unchanged through every path that writes or parses rows
+static void testValuesWithRowSyntax() {
+    const std::string db = "test_row_syntax";
+    fs::remove_all(db);
+    const std::map<std::string, std::string> schema = {{"id", "int"}, {"name", "string"}, {"city", "string"}};
+    const std::vector<std::string> values = {"a(b|c)d)", ")", "))", "x)(y", "|(|)|", "end)"};
+
+    Storage storage;
+    storage.createDatabase(db);
+    TableOptions options;
+    options.dictionaryColumns = {"city"};
+    CHECK(storage.createTable(db, "t", schema, options));
+    for (size_t i = 0; i < values.size(); ++i) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(i + 1));
+        tuple.addAttribute("name", TYPE_STRING, values[i]);
+        tuple.addAttribute("city", TYPE_STRING, values[values.size() - 1 - i]);
+        CHECK(storage.insert(db, "t", tuple));
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        std::map<std::string, std::string> row = storage.get(db, "t", std::to_string(i + 1));
+        CHECK(row["name"] == values[i]);
+        CHECK(row["city"] == values[values.size() - 1 - i]);
+    }
+
+    std::vector<std::map<std::string, std::string>> rows = storage.query(db, "t", "");
+    CHECK(rows.size() == values.size());
+    for (const auto& row : rows) {
+        size_t i = std::stoul(row.at("id")) - 1;
+        CHECK(i < values.size() && row.at("name") == values[i]);
+    }
+
+    Tuple updated;
+    updated.addAttribute("name", TYPE_STRING, "up)date");
+    updated.addAttribute("city", TYPE_STRING, "(c)");
+    CHECK(storage.updateTupleInTable(db, "t", "1", updated));
+    CHECK(storage.get(db, "t", "1")["name"] == "up)date");
+    CHECK(storage.get(db, "t", "1")["city"] == "(c)");
+
+    // Attribute names cannot hold the row syntax
+    Tuple badKey;
+    badKey.addAttribute("id", TYPE_INT, "100");
+    badKey.addAttribute("name", TYPE_STRING, "n");
+    badKey.addAttribute("city", TYPE_STRING, "c");
+    badKey.addAttribute("x(y", TYPE_STRING, "z");
+    CHECK(!storage.insert(db, "t", badKey));
+    CHECK(!storage.createTable(db, "bad", {{"id", "int"}, {"a|b", "string"}}));
+
+    // Bulk-loaded fields are escaped like inserted ones
+    const std::string csvPath = db + "/load.csv";
+    {
+        std::ofstream csv(csvPath);
+        csv << "id,name,city\n200,\"p(q|r)s)\",\"))\"\n";
+    }
+    CHECK(storage.createTable(db, "loaded", schema));
+    CHECK(storage.bulkLoad(db, "loaded", csvPath));
+    CHECK(storage.get(db, "loaded", "200")["name"] == "p(q|r)s)");
+    CHECK(storage.get(db, "loaded", "200")["city"] == "))");
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// An incremental backup after a small change holds the changed pages, the table
+// headers and the metadata appended since, however large the tables are; the chain
+// restores the database as it was at each backup
+static void testIncrementalBackupSize() {
+    const std::string db = "test_backup";
+    const std::string backupDir = "test_backup_dir";
+    const std::string restored = "test_backup_restored";
+    for (const std::string& dir : {db, backupDir, restored}) {
+        fs::remove_all(dir);
+    }
+    auto row = [](int64_t id, const std::string& name) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, name);
+        tuple.addAttribute("city", TYPE_STRING, "city" + std::to_string(id % 50));
+        return tuple;
+    };
+    const uint64_t headerBytes = 8192; // Metadata header at the start of a table file
+    // Sidecar tails and entry framing of one table, well above what a one-row change appends
+    const uint64_t perTableSlack = 2048;
+
+    Storage storage;
+    storage.createDatabase(db);
+    TableOptions options;
+    options.dictionaryColumns = {"city"};
+    CHECK(storage.createTable(db, "t", {{"id", "int"}, {"name", "string"}, {"city", "string"}}, options));
+    for (int64_t id = 1; id <= 5000; ++id) {
+        CHECK(storage.insert(db, "t", row(id, std::string(100, 'a' + id % 26))));
+    }
+    std::optional<BackupStats> base = storage.backupDatabase(db, backupDir);
+    CHECK(base && base->sequence == 1 && base->pagesCopied > 100);
+
+    CHECK(storage.updateTupleInTable(db, "t", "2500", row(2500, "changed")));
+    std::optional<BackupStats> increment = storage.backupDatabase(db, backupDir);
+    CHECK(increment && increment->sequence == 2 && increment->tablesCopiedWhole == 0);
+    CHECK(increment && increment->pagesCopied <= 3);
+    CHECK(increment && increment->bytesWritten <=
+                           headerBytes + increment->pagesCopied * PAGE_SIZE + perTableSlack);
+    std::vector<std::map<std::string, std::string>> atIncrement = storage.query(db, "t", "");
+
+    // A checkpoint replaces the snapshot, which the next backup copies again
+    CHECK(storage.checkpointTable(db, "t"));
+    CHECK(storage.insert(db, "t", row(6000, "after checkpoint")));
+    CHECK(storage.deleteTupleFromTable(db, "t", "17"));
+    std::optional<BackupStats> afterCheckpoint = storage.backupDatabase(db, backupDir);
+    CHECK(afterCheckpoint && afterCheckpoint->tablesCopiedWhole == 0);
+    std::vector<std::map<std::string, std::string>> latest = storage.query(db, "t", "");
+
+    CHECK(storage.restoreDatabase(backupDir, restored, 2));
+    CHECK(storage.query(restored, "t", "") == atIncrement);
+    fs::remove_all(restored);
+    CHECK(storage.restoreDatabase(backupDir, restored));
+    CHECK(storage.query(restored, "t", "") == latest);
+    CHECK(storage.get(restored, "t", "2500")["name"] == "changed");
+
+    if (failures == 0) {
+        for (const std::string& dir : {db, backupDir, restored}) {
+            fs::remove_all(dir);
+        }
+    }
+}
+
+// Counts read off the wire are checked against the bytes left in the frame before
+// anything is sized by them
+static void testWireCountsBoundedByFrame() {
+    std::string frame;
+    WireWriter writer(frame);
+    writer.put(static_cast<uint32_t>(0xFFFFFFFF)); // Row count of a response
+    writer.put(static_cast<uint16_t>(0));          // One empty row
+    WireReader hostile(frame.data(), frame.size());
+    CHECK(hostile.getCount<uint32_t>(sizeof(uint16_t)) == 0);
+    CHECK(!hostile.good());
+
+    frame.clear();
+    writer.put(static_cast<uint32_t>(1));
+    writer.put(static_cast<uint16_t>(0));
+    WireReader honest(frame.data(), frame.size());
+    CHECK(honest.getCount<uint32_t>(sizeof(uint16_t)) == 1);
+    CHECK(honest.good());
+
+    frame.clear();
+    writer.put(static_cast<uint16_t>(60000));      // Attribute count of a typed row, with no attributes
+    WireReader typed(frame.data(), frame.size());
+    CHECK(typed.getTypedRow().empty());
+    CHECK(!typed.good());
+}
+
+// A crash that loses the last page writes and tears the last redo record: recovery
+// replays every intact commit, drops the torn one, and later commits survive a restart
+static void testRedoLogCutMidRecord() {
+    const std::string db = "test_redo_cut";
+    const std::string crashed = "test_redo_cut_crashed";
+    fs::remove_all(db);
+    fs::remove_all(crashed);
+    auto row = [](int64_t id) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, "name" + std::to_string(id));
+        return tuple;
+    };
+    const std::string table = "/t.HAD";
+
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        CHECK(storage.createTable(db, "t", {{"id", "int"}, {"name", "string"}}));
+        for (int64_t id = 1; id <= 100; ++id) {
+            CHECK(storage.insert(db, "t", row(id)));
+        }
+        // The table as a crash would leave it if none of the writes below reached it
+        fs::create_directory(crashed);
+        for (const std::string& file : {table, table + ".snap", table + ".mlog"}) {
+            fs::copy_file(db + file, crashed + file);
+        }
+        uint64_t syncsBefore = storage.stats().fileSyncs;
+        for (int64_t id = 101; id <= 120; ++id) {
+            CHECK(storage.insert(db, "t", row(id)));
+        }
+        CHECK(storage.stats().fileSyncs - syncsBefore >= 20); // Each commit syncs its record
+        fs::copy_file(RedoLog::logPath(db + table), RedoLog::logPath(crashed + table));
+    }
+    const std::string log = RedoLog::logPath(crashed + table);
+    fs::resize_file(log, fs::file_size(log) - 100); // Inside the record of row 120
+
+    {
+        Storage storage;
+        for (int64_t id = 1; id <= 119; ++id) {
+            CHECK(storage.get(crashed, "t", std::to_string(id))["name"] == "name" + std::to_string(id));
+        }
+        CHECK(!storage.checkTupleExists(crashed, "t", "120"));
+        CHECK(storage.insert(crashed, "t", row(120)));
+        CHECK(storage.insert(crashed, "t", row(121)));
+    }
+    {
+        Storage storage;
+        CHECK(storage.query(crashed, "t", "").size() == 121);
+        CHECK(storage.get(crashed, "t", "121")["name"] == "name121");
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+        fs::remove_all(crashed);
+    }
+}
+
+// A crash at any step of a two-table commit leaves both tables changed or neither:
+// before the decision file recovery discards the transaction, after it recovery
+// finishes it, wherever the database directory has been moved to since
+static void testTransactionCrashSteps() {
+    const std::string db = "test_txn_crash";
+    fs::remove_all(db);
+    auto row = [](int64_t id, const std::string& name) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, name);
+        return tuple;
+    };
+    std::vector<std::pair<std::string, std::string>> images;  // Step, copy of the database at it
+
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        for (const std::string table : {"a", "b"}) {
+            CHECK(storage.createTable(db, table, {{"id", "int"}, {"name", "string"}}));
+            for (int64_t id = 1; id <= 50; ++id) {
+                CHECK(storage.insert(db, table, row(id, table + std::to_string(id))));
+            }
+        }
+        storage.setCommitStepHook([&](const std::string& step) {
+            std::string image = db + "_" + std::to_string(images.size());
+            fs::remove_all(image);
+            fs::copy(db, image, fs::copy_options::recursive);
+            images.emplace_back(step, image);
+        });
+        CHECK(storage.beginTransaction());
+        CHECK(storage.updateTupleInTable(db, "a", "5", row(5, "changed")));
+        CHECK(storage.deleteTupleFromTable(db, "a", "7"));
+        CHECK(storage.insert(db, "b", row(51, "b51")));
+        CHECK(storage.commit());
+    }
+    CHECK(images.size() == 4); // logged, decided, written, written
+
+    for (const auto& [step, image] : images) {
+        bool committed = step != "logged";
+        bool decided = false;
+        for (const auto& entry : fs::directory_iterator(image)) {
+            decided = decided || entry.path().extension() == ".txn";
+        }
+        CHECK(decided == committed);
+        Storage storage;
+        CHECK(storage.recoverDatabase(image));
+        CHECK(storage.get(image, "a", "5")["name"] == (committed ? "changed" : "a5"));
+        CHECK(storage.checkTupleExists(image, "a", "7") != committed);
+        CHECK(storage.checkTupleExists(image, "b", "51") == committed);
+        CHECK(storage.query(image, "b", "").size() == (committed ? 51u : 50u));
+        for (const auto& entry : fs::directory_iterator(image)) {
+            CHECK(entry.path().extension() != ".txn");
+        }
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+        for (const auto& [step, image] : images) {
+            fs::remove_all(image);
+        }
+    }
+}
+
+// A bulk load that fails anywhere, even in a chunk after rows with new dictionary
+// values were packed, leaves the dictionary file as it was; one that succeeds adds
+// each new value once
+static void testFailedBulkLoadKeepsDictionary() {
+    const std::string db = "test_bulk_dictionary";
+    fs::remove_all(db);
+    Storage storage;
+    storage.createDatabase(db);
+    TableOptions options;
+    options.dictionaryColumns = {"city"};
+    CHECK(storage.createTable(db, "t", {{"id", "int"}, {"city", "string"}}, options));
+    Tuple tuple;
+    tuple.addAttribute("id", TYPE_INT, "1");
+    tuple.addAttribute("city", TYPE_STRING, "old");
+    CHECK(storage.insert(db, "t", tuple));
+    const std::string dictPath = TableDictionary::dictionaryPath(db + "/t.HAD");
+    const std::string before = fileBytes(dictPath);
+
+    // More than one 4 MiB chunk of rows with new values, then a bad last line
+    const std::string csvPath = db + "/load.csv";
+    auto writeCsv = [&](const std::string& lastLine) {
+        std::ofstream csv(csvPath);
+        csv << "id,city\n";
+        for (int id = 2; id <= 120000; ++id) {
+            csv << id << ",city" << id % 100 << "-padding-to-fill-the-chunks\n";
+        }
+        csv << lastLine << "\n";
+    };
+    for (const std::string lastLine : {"120001,notanumber,extra", "5000,another", "1,another", "x,another"}) {
+        writeCsv(lastLine);
+        CHECK(!storage.bulkLoad(db, "t", csvPath));
+        CHECK(fileBytes(dictPath) == before);
+        CHECK(storage.query(db, "t", "").size() == 1);
+    }
+
+    writeCsv("120001,old");
+    CHECK(storage.bulkLoad(db, "t", csvPath));
+    size_t added = 0;
+    for (int city = 0; city < 100; ++city) {
+        added += 2 + 4 + ("city" + std::to_string(city) + "-padding-to-fill-the-chunks").size();
+    }
+    CHECK(fileBytes(dictPath).size() == before.size() + added);
+    CHECK(storage.get(db, "t", "1")["city"] == "old");
+    CHECK(storage.get(db, "t", "120001")["city"] == "old");
+    CHECK(storage.get(db, "t", "1234")["city"] == "city34-padding-to-fill-the-chunks");
+    CHECK(storage.query(db, "t", "").size() == 120001);
+
+    // Codes staged by the load are the ones a fresh process reads back
+    Storage reopened;
+    CHECK(reopened.get(db, "t", "119999")["city"] == "city99-padding-to-fill-the-chunks");
+    tuple.setAttribute("id", TYPE_INT, "120002");
+    tuple.setAttribute("city", TYPE_STRING, "city7-padding-to-fill-the-chunks");
+    CHECK(reopened.insert(db, "t", tuple));
+    CHECK(fileBytes(dictPath).size() == before.size() + added);
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// A GROUP BY whose spilled partitions still outgrow a tiny memory budget splits them
+// again on further hash bits, and returns what it returns with the default budget
+static void testAggregateRespill() {
+    const std::string db = "test_aggregate_respill";
+    fs::remove_all(db);
+    Storage storage;
+    storage.createDatabase(db);
+    CHECK(storage.createTable(db, "t", {{"id", "int"}, {"g", "int"}, {"name", "string"}, {"score", "double"}}));
+    for (int id = 1; id <= 3000; ++id) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("g", TYPE_INT, std::to_string(id % 1000));
+        tuple.addAttribute("name", TYPE_STRING, "n" + std::to_string(id * 7919 % 3001));
+        tuple.addAttribute("score", TYPE_DOUBLE, std::to_string(id % 13 * 0.5));
+        CHECK(storage.insert(db, "t", tuple));
+    }
+    const std::vector<std::string> aggregates = {"COUNT(*)", "SUM(score)", "MIN(name)", "MAX(name)", "AVG(score)"};
+    auto byGroup = [](std::vector<std::map<std::string, std::string>> rows) {
+        std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.at("g") < b.at("g"); });
+        return rows;
+    };
+    std::vector<std::map<std::string, std::string>> expected = byGroup(storage.aggregate(db, "t", {"g"}, aggregates));
+    CHECK(expected.size() == 1000);
+
+    // One thread, so the debug output can be captured
+    std::ostringstream debug;
+    std::streambuf* previous = std::cout.rdbuf(debug.rdbuf());
+    std::cout.clear();
+    std::vector<std::map<std::string, std::string>> tiny =
+        byGroup(storage.aggregate(db, "t", {"g"}, aggregates, "", 1, 1));
+    std::cout.rdbuf(previous);
+    std::cout.setstate(std::ios::badbit);
+    CHECK(tiny == expected);
+    CHECK(debug.str().find(" at level 1") != std::string::npos);
+
+    CHECK(byGroup(storage.aggregate(db, "t", {"g"}, aggregates, "", 4, 16 << 10)) == expected);
+    for (const auto& entry : fs::directory_iterator(db)) {
+        CHECK(entry.path().filename().string().find(".aggregate") == std::string::npos);
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// A join whose partitions still outgrow a tiny memory budget partitions them again
+// on further hash bits and returns the pairs it returns with the default budget; a
+// -0.0 key matches 0.0
+static void testJoinRepartition() {
+    const std::string db = "test_join_repartition";
+    fs::remove_all(db);
+    Storage storage;
+    storage.createDatabase(db);
+    CHECK(storage.createTable(db, "a", {{"id", "int"}, {"k", "double"}}));
+    CHECK(storage.createTable(db, "b", {{"id", "int"}, {"k", "double"}, {"label", "string"}}));
+    auto insert = [&](const std::string& table, int id, const std::string& k) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("k", TYPE_DOUBLE, k);
+        if (table == "b") {
+            tuple.addAttribute("label", TYPE_STRING, "label" + std::to_string(id));
+        }
+        CHECK(storage.insert(db, table, tuple));
+    };
+    for (int id = 1; id <= 1500; ++id) {
+        insert("a", id, std::to_string(id % 300 + 1));
+    }
+    insert("a", 1501, "-0.0");
+    for (int id = 1; id <= 2800; ++id) {
+        insert("b", id, std::to_string(id % 400)); // Each key seven times
+    }
+
+    auto sorted = [](std::vector<std::map<std::string, std::string>> rows) {
+        std::sort(rows.begin(), rows.end());
+        return rows;
+    };
+    JoinInput a{"a", "k", {}, ""};
+    JoinInput b{"b", "k", {}, ""};
+    std::vector<std::map<std::string, std::string>> expected = sorted(storage.join(db, a, b));
+    CHECK(expected.size() == 1501 * 7);
+    size_t zeroMatches = 0;
+    for (const auto& row : expected) {
+        zeroMatches += row.at("a.id") == "1501";
+    }
+    CHECK(zeroMatches == 7);
+
+    std::ostringstream debug;
+    std::streambuf* previous = std::cout.rdbuf(debug.rdbuf());
+    std::cout.clear();
+    std::vector<std::map<std::string, std::string>> tiny = sorted(storage.join(db, a, b, 1));
+    std::cout.rdbuf(previous);
+    std::cout.setstate(std::ios::badbit);
+    CHECK(tiny == expected);
+    CHECK(debug.str().find("Partition at level 1 passed") != std::string::npos);
+
+    CHECK(sorted(storage.join(db, a, b, 64 << 10)) == expected);
+    for (const auto& entry : fs::directory_iterator(db)) {
+        CHECK(entry.path().filename().string().find(".join") == std::string::npos);
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// A compressed table holds the same rows as an uncompressed one in a fraction of the
+// file, through inserts, updates that grow pages out of their extents, incompressible
+// rows, deletes and a reopen
+static void testPageCompression() {
+    const std::string db = "test_page_compression";
+    fs::remove_all(db);
+    const std::map<std::string, std::string> schema = {{"id", "int"}, {"name", "string"}};
+    auto row = [](int id, const std::string& name) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, name);
+        return tuple;
+    };
+    std::mt19937 random(7);
+    auto noise = [&random](size_t length) {
+        std::string text(length, ' ');
+        for (char& c : text) {
+            c = static_cast<char>('!' + random() % 90);
+        }
+        return text;
+    };
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        TableOptions compressed;
+        compressed.compressPages = true;
+        CHECK(storage.createTable(db, "c", schema, compressed));
+        CHECK(storage.createTable(db, "u", schema));
+        for (int id = 1; id <= 1000; ++id) {
+            std::string name = std::string(100, 'a' + id % 3) + std::to_string(id);
+            CHECK(storage.insert(db, "c", row(id, name)));
+            CHECK(storage.insert(db, "u", row(id, name)));
+        }
+        CHECK(fs::file_size(db + "/c.HAD") * 3 < fs::file_size(db + "/u.HAD"));
+
+        for (int id = 1; id <= 1000; id += 50) {
+            std::string name = noise(300);
+            CHECK(storage.updateTupleInTable(db, "c", std::to_string(id), row(id, name)));
+            CHECK(storage.updateTupleInTable(db, "u", std::to_string(id), row(id, name)));
+        }
+        for (int id = 2; id <= 1000; id += 7) {
+            CHECK(storage.deleteTupleFromTable(db, "c", std::to_string(id)));
+            CHECK(storage.deleteTupleFromTable(db, "u", std::to_string(id)));
+        }
+    }
+
+    Storage storage;
+    auto sorted = [](std::vector<std::map<std::string, std::string>> rows) {
+        std::sort(rows.begin(), rows.end(),
+                  [](const auto& a, const auto& b) { return std::stoi(a.at("id")) < std::stoi(b.at("id")); });
+        return rows;
+    };
+    std::vector<std::map<std::string, std::string>> fromCompressed = sorted(storage.query(db, "c", ""));
+    CHECK(fromCompressed.size() == 1000 - 143);
+    CHECK(fromCompressed == sorted(storage.query(db, "u", "")));
+    CHECK(storage.get(db, "c", "101")["name"].size() == 300);
+    CHECK(storage.get(db, "c", "3")["name"] == std::string(100, 'a') + "3");
+    CHECK(!storage.checkTupleExists(db, "c", "9"));
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// Dictionary-encoded columns read back as their strings through insert, update,
+// query and export, and rows the table rejects add nothing to the dictionary
+static void testDictionaryColumns() {
+    const std::string db = "test_dictionary_columns";
+    fs::remove_all(db);
+    Storage storage;
+    storage.createDatabase(db);
+    TableOptions options;
+    options.dictionaryColumns = {"city"};
+    CHECK(storage.createTable(db, "t", {{"id", "int"}, {"city", "string"}, {"score", "int"}}, options));
+    const std::vector<std::string> cities = {"Cairo", "Giza", "Luxor", "Aswan"};
+    auto row = [](const std::string& id, const std::string& city, int type, const std::string& score) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, id);
+        tuple.addAttribute("city", TYPE_STRING, city);
+        tuple.addAttribute("score", type, score);
+        return tuple;
+    };
+    for (int id = 1; id <= 40; ++id) {
+        CHECK(storage.insert(db, "t", row(std::to_string(id), cities[id % cities.size()], TYPE_INT, std::to_string(id))));
+    }
+    const std::string dictPath = TableDictionary::dictionaryPath(db + "/t.HAD");
+    const std::string before = fileBytes(dictPath);
+
+    // Rejected: a duplicate id, a wrongly typed column, a missing column
+    CHECK(!storage.insert(db, "t", row("5", "Alexandria", TYPE_INT, "1")));
+    CHECK(!storage.insert(db, "t", row("41", "Alexandria", TYPE_STRING, "high")));
+    Tuple missing;
+    missing.addAttribute("id", TYPE_INT, "42");
+    missing.addAttribute("city", TYPE_STRING, "Alexandria");
+    CHECK(!storage.insert(db, "t", missing));
+    CHECK(!storage.updateTupleInTable(db, "t", "99", row("99", "Alexandria", TYPE_INT, "1")));
+    CHECK(fileBytes(dictPath) == before);
+
+    CHECK(storage.updateTupleInTable(db, "t", "7", row("7", "Alexandria", TYPE_INT, "70")));
+    CHECK(fileBytes(dictPath).size() > before.size());
+    CHECK(storage.get(db, "t", "7")["city"] == "Alexandria");
+    CHECK(storage.get(db, "t", "8")["city"] == cities[0]);
+    CHECK(storage.selectWhereEquals(db, "t", "city", "Giza").size() == 10);
+    CHECK(storage.selectWhereEquals(db, "t", "city", "Alexandria").size() == 1);
+    CHECK(storage.selectWhereEquals(db, "t", "city", "Paris").empty());
+
+    std::map<std::string, std::string> cityOf;
+    for (const auto& found : storage.query(db, "t", "")) {
+        cityOf[found.at("id")] = found.at("city");
+    }
+    CHECK(cityOf.size() == 40);
+    CHECK(cityOf["7"] == "Alexandria" && cityOf["9"] == "Giza");
+
+    const std::string csvPath = db + "/export.csv";
+    CHECK(storage.exportTable(db, "t", csvPath));
+    std::ifstream csv(csvPath);
+    std::string line;
+    std::getline(csv, line);
+    auto split = [](const std::string& text) {
+        std::vector<std::string> fields;
+        std::stringstream in(text);
+        for (std::string field; std::getline(in, field, ',');) {
+            fields.push_back(field);
+        }
+        return fields;
+    };
+    std::vector<std::string> header = split(line);
+    size_t idColumn = std::find(header.begin(), header.end(), "id") - header.begin();
+    size_t cityColumn = std::find(header.begin(), header.end(), "city") - header.begin();
+    CHECK(idColumn < header.size() && cityColumn < header.size());
+    size_t lines = 0;
+    while (std::getline(csv, line) && idColumn < header.size() && cityColumn < header.size()) {
+        std::vector<std::string> fields = split(line);
+        CHECK(fields.size() == header.size() && cityOf[fields[idColumn]] == fields[cityColumn]);
+        ++lines;
+    }
+    CHECK(lines == 40);
+
+    // A fresh process decodes the same codes
+    Storage reopened;
+    CHECK(reopened.get(db, "t", "7")["city"] == "Alexandria");
+    CHECK(reopened.get(db, "t", "10")["city"] == "Luxor");
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// Vacuum packs the live rows of a plain and a compressed table into fewer pages and a
+// smaller file, drops the tombstones, and keeps every row, including rows inserted and
+// deleted while it runs in the background
+static void testVacuum() {
+    const std::string db = "test_vacuum";
+    fs::remove_all(db);
+    auto row = [](int id) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, std::string(200, 'a' + id % 26));
+        return tuple;
+    };
+    Storage storage;
+    storage.createDatabase(db);
+    TableOptions compressed;
+    compressed.compressPages = true;
+    for (const std::string table : {"plain", "packed"}) {
+        CHECK(storage.createTable(db, table, {{"id", "int"}, {"name", "string"}},
+                                  table == "packed" ? compressed : TableOptions()));
+        for (int id = 1; id <= 900; ++id) {
+            CHECK(storage.insert(db, table, row(id)));
+        }
+        for (int id = 1; id <= 900; ++id) {
+            if (id % 3 != 0) {
+                CHECK(storage.deleteTupleFromTable(db, table, std::to_string(id)));
+            }
+        }
+        uint64_t sizeBefore = fs::file_size(db + "/" + table + ".HAD");
+
+        VacuumOptions options;
+        options.batchPages = 4;
+        options.pause = std::chrono::milliseconds(1);
+        std::future<std::optional<VacuumStats>> running = storage.vacuumTableAsync(db, table, options);
+        for (int id = 901; id <= 930; ++id) {
+            CHECK(storage.insert(db, table, row(id)));
+        }
+        CHECK(storage.deleteTupleFromTable(db, table, "3"));
+        std::optional<VacuumStats> stats = running.get();
+        CHECK(stats.has_value());
+        if (stats) {
+            CHECK(stats->pagesAfter < stats->pagesBefore);
+            CHECK(stats->tombstonesDropped >= 600);
+            CHECK(stats->bytesReclaimed > 0);
+        }
+        CHECK(fs::file_size(db + "/" + table + ".HAD") < sizeBefore);
+
+        std::vector<std::map<std::string, std::string>> rows = storage.query(db, table, "");
+        CHECK(rows.size() == 300 - 1 + 30);
+        for (const auto& found : rows) {
+            int id = std::stoi(found.at("id"));
+            CHECK((id % 3 == 0 || id > 900) && id != 3 && found.at("name") == std::string(200, 'a' + id % 26));
+        }
+        CHECK(storage.insert(db, table, row(1000)));
+        CHECK(storage.get(db, table, "1000")["name"] == std::string(200, 'a' + 1000 % 26));
+    }
+
+    Storage reopened;
+    for (const std::string table : {"plain", "packed"}) {
+        CHECK(reopened.query(db, table, "").size() == 300 - 1 + 30 + 1);
+        CHECK(reopened.get(db, table, "897")["name"] == std::string(200, 'a' + 897 % 26));
+        CHECK(!reopened.checkTupleExists(db, table, "2"));
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// The batch pipeline returns what a row-at-a-time reading of the same data gives, for
+// filters, projections, limits and sorts over more rows than one batch holds
+static void testQueryPipeline() {
+    const std::string db = "test_query_pipeline";
+    fs::remove_all(db);
+    Storage storage;
+    storage.createDatabase(db);
+    TableOptions options;
+    options.dictionaryColumns = {"city"};
+    CHECK(storage.createTable(db, "t", {{"id", "int"}, {"age", "int"}, {"city", "string"}, {"score", "double"}},
+                              options));
+    struct Row {
+        int64_t id;
+        int64_t age;
+        std::string city;
+        double score;
+    };
+    const std::vector<std::string> cities = {"Cairo", "Giza", "O'Hara", "Luxor"};
+    std::vector<Row> reference;
+    const std::string csvPath = db + "/rows.csv";
+    {
+        std::ofstream csv(csvPath);
+        csv << "id,age,city,score\n";
+        for (int64_t id = 1; id <= 5000; ++id) {
+            Row row{id, id * 37 % 60, cities[id * 7 % cities.size()], static_cast<double>(id * 13 % 50) / 10};
+            reference.push_back(row);
+            csv << row.id << ',' << row.age << ',' << row.city << ',' << row.score << '\n';
+        }
+    }
+    CHECK(storage.bulkLoad(db, "t", csvPath));
+
+    // Filter
+    std::set<std::string> expectedIds;
+    for (const Row& row : reference) {
+        if (row.age >= 30 && (row.city == "Cairo" || !(row.score < 2.5))) {
+            expectedIds.insert(std::to_string(row.id));
+        }
+    }
+    std::set<std::string> ids;
+    for (const auto& found : storage.query(db, "t", "age >= 30 AND (city = 'Cairo' OR NOT score < 2.5)")) {
+        ids.insert(found.at("id"));
+    }
+    CHECK(ids == expectedIds);
+    size_t quoted = std::count_if(reference.begin(), reference.end(), [](const Row& row) { return row.city == "O'Hara"; });
+    CHECK(storage.query(db, "t", "city = 'O''Hara'").size() == quoted);
+
+    // Projection and limit: page order is id order for a bulk-loaded table
+    std::vector<std::map<std::string, std::string>> limited = storage.query(db, "t", "age < 10", {"id", "city"}, 25);
+    CHECK(limited.size() == 25);
+    auto next = reference.begin();
+    for (const auto& found : limited) {
+        next = std::find_if(next, reference.end(), [](const Row& row) { return row.age < 10; });
+        CHECK(next != reference.end() && found.size() == 2 && found.at("id") == std::to_string(next->id) &&
+              found.at("city") == next->city);
+        if (next != reference.end()) {
+            ++next;
+        }
+    }
+
+    // Sort with a limit, ties broken by the second key
+    std::vector<Row> byScore = reference;
+    std::sort(byScore.begin(), byScore.end(),
+              [](const Row& a, const Row& b) { return a.score != b.score ? a.score > b.score : a.id < b.id; });
+    std::vector<std::map<std::string, std::string>> top = storage.query(db, "t", "", {"id"}, 30, "score DESC, id");
+    CHECK(top.size() == 30);
+    for (size_t i = 0; i < top.size(); ++i) {
+        CHECK(top[i].at("id") == std::to_string(byScore[i].id));
+    }
+
+    // Batches never exceed QUERY_BATCH_ROWS and together hold every row
+    std::unique_ptr<QueryOperator> plan = storage.openQuery(db, "t", "", {"id"});
+    ColumnBatch batch;
+    size_t rows = 0;
+    size_t batches = 0;
+    while (plan->next(batch)) {
+        CHECK(batch.selectedCount() > 0 && batch.selectedCount() <= QUERY_BATCH_ROWS);
+        rows += batch.selectedCount();
+        ++batches;
+    }
+    plan.reset();
+    CHECK(rows == reference.size() && batches >= 3);
+
+    bool rejected = false;
+    try {
+        storage.query(db, "t", "age >= AND city = 'x'");
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+    rejected = false;
+    try {
+        storage.query(db, "t", "height > 3");
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// The row-ID filter never rules out a row the table has, through deletes, updates, a
+// vacuum and restarts, and rules out IDs the table never had
+static void testIdFilterAfterChanges() {
+    const std::string db = "test_id_filter";
+    fs::remove_all(db);
+    auto row = [](int id, const std::string& name) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, name);
+        return tuple;
+    };
+    auto present = [](int id) {
+        return id <= 430 && !(id <= 200 && id % 2 == 0);
+    };
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        CHECK(storage.createTable(db, "t", {{"id", "int"}, {"name", "string"}}));
+        for (int id = 1; id <= 400; ++id) {
+            CHECK(storage.insert(db, "t", row(id, std::string(100, 'a' + id % 26))));
+        }
+        CHECK(storage.checkTupleExists(db, "t", "1"));  // Loads the filter
+        for (int id = 2; id <= 200; id += 2) {
+            CHECK(storage.deleteTupleFromTable(db, "t", std::to_string(id)));
+        }
+        for (int id = 201; id <= 250; ++id) {
+            CHECK(storage.updateTupleInTable(db, "t", std::to_string(id), row(id, "updated")));
+        }
+        CHECK(storage.vacuumTable(db, "t").has_value());
+        for (int id = 401; id <= 420; ++id) {
+            CHECK(storage.insert(db, "t", row(id, "late")));
+        }
+        for (int id = 1; id <= 420; ++id) {
+            CHECK(storage.checkTupleExists(db, "t", std::to_string(id)) == present(id));
+        }
+        CHECK(storage.get(db, "t", "230")["name"] == "updated");
+    }
+    CHECK(fs::exists(IdBloomFilter::filterPath(db + "/t.HAD")));
+
+    // Rows added by an instance that never loaded the filter leave the saved one stale
+    {
+        Storage storage;
+        for (int id = 421; id <= 430; ++id) {
+            CHECK(storage.insert(db, "t", row(id, "later")));
+        }
+    }
+
+    Storage reopened;
+    for (int id = 1; id <= 430; ++id) {
+        CHECK(reopened.checkTupleExists(db, "t", std::to_string(id)) == present(id));
+    }
+    CHECK(reopened.get(db, "t", "425")["name"] == "later");
+    std::ostringstream errors;
+    std::streambuf* saved = std::cerr.rdbuf(errors.rdbuf());
+    std::cerr.clear();
+    for (int id = 1001; id <= 1100; ++id) {
+        CHECK(!reopened.checkTupleExists(db, "t", std::to_string(id)));
+    }
+    std::cerr.rdbuf(saved);
+    std::cerr.setstate(std::ios::badbit);
+    size_t ruledOut = 0;
+    for (size_t at = errors.str().find("via row ID filter"); at != std::string::npos;
+         at = errors.str().find("via row ID filter", at + 1)) {
+        ++ruledOut;
+    }
+    CHECK(ruledOut >= 95);
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// Zone maps never skip a page holding a matching row, through deletes, updates, a
+// vacuum and restarts, and still skip the pages they rule out
+static void testZoneMapsAfterChanges() {
+    const std::string db = "test_zone_maps";
+    fs::remove_all(db);
+    auto row = [](int id, int val) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("val", TYPE_INT, std::to_string(val));
+        tuple.addAttribute("pad", TYPE_STRING, std::string(150, 'p'));
+        return tuple;
+    };
+    std::map<int, int> values;
+    auto matches = [&](Storage& storage, const std::string& dbName, int low, int high) {
+        std::set<std::string> expected;
+        for (const auto& [id, val] : values) {
+            if (val >= low && val < high) {
+                expected.insert(std::to_string(id));
+            }
+        }
+        std::set<std::string> ids;
+        for (const auto& found : storage.query(dbName, "t", "val >= " + std::to_string(low) + " AND val < " +
+                                                            std::to_string(high), {"id"})) {
+            ids.insert(found.at("id"));
+        }
+        return ids == expected;
+    };
+    // The table spans about 45 pages; a narrow range needs only a few of them
+    auto skipsPages = [&](Storage& storage, const std::string& dbName) {
+        uint64_t before = storage.stats().pagesSkipped;
+        bool same = matches(storage, dbName, 500, 520);
+        return same && storage.stats().pagesSkipped - before >= 30;
+    };
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        CHECK(storage.createTable(db, "t", {{"id", "int"}, {"val", "int"}, {"pad", "string"}}));
+        for (int id = 1; id <= 1000; ++id) {
+            CHECK(storage.insert(db, "t", row(id, id)));
+            values[id] = id;
+        }
+        CHECK(skipsPages(storage, db));
+        for (int id = 500; id <= 510; ++id) {
+            CHECK(storage.deleteTupleFromTable(db, "t", std::to_string(id)));
+            values.erase(id);
+        }
+        for (int id = 600; id <= 610; ++id) {
+            CHECK(storage.updateTupleInTable(db, "t", std::to_string(id), row(id, 5000)));
+            values[id] = 5000;
+        }
+        CHECK(storage.updateTupleInTable(db, "t", "100", row(100, 515)));
+        values[100] = 515;
+        CHECK(skipsPages(storage, db));
+        CHECK(matches(storage, db, 5000, 5001) && matches(storage, db, 595, 615));
+        CHECK(storage.vacuumTable(db, "t").has_value());
+        CHECK(skipsPages(storage, db));
+        CHECK(matches(storage, db, 5000, 5001) && matches(storage, db, 90, 110));
+    }
+    CHECK(fs::exists(TableZoneMap::zonePath(db + "/t.HAD")));
+
+    // An instance that writes before it scans leaves no stale zone file behind, even
+    // if it stops before ~Storage() (the copy is the table as a crash would leave it)
+    const std::string crashed = db + "_crashed";
+    fs::remove_all(crashed);
+    {
+        Storage storage;
+        CHECK(storage.updateTupleInTable(db, "t", "300", row(300, 9000)));
+        values[300] = 9000;
+        CHECK(storage.deleteTupleFromTable(db, "t", "512"));
+        values.erase(512);
+        fs::copy(db, crashed, fs::copy_options::recursive);
+    }
+
+    for (const std::string& copy : {db, crashed}) {
+        Storage reopened;
+        CHECK(skipsPages(reopened, copy));
+        CHECK(matches(reopened, copy, 5000, 5001) && matches(reopened, copy, 9000, 9001) &&
+              matches(reopened, copy, 0, 2000));
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+        fs::remove_all(crashed);
+    }
+}
+
+// Rows of range and hash partitioned tables land in the partition their id maps to,
+// and scans and queries across partition bounds see them in id order, before and
+// after a restart
+static void testPartitionRouting() {
+    const std::string db = "test_partition_routing";
+    fs::remove_all(db);
+    auto row = [](int id, const std::string& name) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, name);
+        return tuple;
+    };
+    auto idsOf = [](const std::vector<std::map<std::string, std::string>>& rows) {
+        std::vector<int> ids;
+        for (const auto& found : rows) {
+            ids.push_back(std::stoi(found.at("id")));
+        }
+        return ids;
+    };
+    auto span = [](int first, int last) {
+        std::vector<int> ids;
+        for (int id = first; id <= last; ++id) {
+            if (id < 100 || id > 105) { // Deleted below
+                ids.push_back(id);
+            }
+        }
+        return ids;
+    };
+    TablePartitioning layouts[2];
+    layouts[0].kind = PARTITION_RANGE;
+    layouts[0].count = 4;
+    layouts[0].bounds = {100, 200, 300};
+    layouts[1].kind = PARTITION_HASH;
+    layouts[1].count = 4;
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        TableOptions ranged;
+        ranged.partitionBy = PARTITION_RANGE;
+        ranged.rangeBounds = layouts[0].bounds;
+        TableOptions hashed;
+        hashed.partitionBy = PARTITION_HASH;
+        hashed.hashPartitions = 4;
+        CHECK(storage.createTable(db, "ranged", {{"id", "int"}, {"name", "string"}}, ranged));
+        CHECK(storage.createTable(db, "hashed", {{"id", "int"}, {"name", "string"}}, hashed));
+        for (const std::string table : {"ranged", "hashed"}) {
+            for (int step = 0; step < 400; ++step) {
+                int id = step * 173 % 400 + 1; // Every id once, out of order
+                CHECK(storage.insert(db, table, row(id, "n" + std::to_string(id))));
+            }
+            for (int id = 100; id <= 105; ++id) {
+                CHECK(storage.deleteTupleFromTable(db, table, std::to_string(id)));
+            }
+            CHECK(storage.updateTupleInTable(db, table, "250", row(250, "changed")));
+        }
+    }
+
+    Storage storage;
+    for (int layout = 0; layout < 2; ++layout) {
+        const std::string table = layout == 0 ? "ranged" : "hashed";
+        size_t total = 0;
+        for (uint32_t index = 0; index < 4; ++index) {
+            std::vector<int> ids = idsOf(storage.query(db, TablePartitioning::partitionName(table, index), ""));
+            CHECK(!ids.empty());
+            for (int id : ids) {
+                CHECK(layouts[layout].partitionOf(id) == index);
+            }
+            total += ids.size();
+        }
+        CHECK(total == 400 - 6);
+
+        CHECK(idsOf(storage.scanRange(db, table, 90, 20)) == span(90, 115));
+        CHECK(idsOf(storage.scanRange(db, table, 195, 10)) == span(195, 204));
+        CHECK(idsOf(storage.scanRange(db, table, 290, 500)) == span(290, 400));
+        CHECK(idsOf(storage.scanRange(db, table, -5, 3)) == span(1, 3));
+        CHECK(storage.scanRange(db, table, 401, 10).empty());
+
+        std::vector<int> ids = idsOf(storage.query(db, table, "id >= 95 AND id < 305"));
+        std::sort(ids.begin(), ids.end());
+        CHECK(ids == span(95, 304));
+        CHECK(idsOf(storage.query(db, table, "", {"id"}, 5, "id DESC")) == std::vector<int>({400, 399, 398, 397, 396}));
+        CHECK(idsOf(storage.query(db, table, "id > 97", {"id"}, 4, "id")) == std::vector<int>({98, 99, 106, 107}));
+        CHECK(storage.get(db, table, "250")["name"] == "changed");
+        CHECK(storage.get(db, table, "299")["name"] == "n299");
+        CHECK(!storage.checkTupleExists(db, table, "103") && storage.checkTupleExists(db, table, "300"));
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+
+// Ids of an auto-increment table are never handed out twice: not across a chunk
+// boundary, not after a restart, and not by a copy of the table taken before exit
+static void testSequenceAcrossRestarts() {
+    const std::string db = "test_sequence";
+    const std::string crashed = db + "_crashed";
+    fs::remove_all(db);
+    fs::remove_all(crashed);
+    auto unnumbered = [](const std::string& name) {
+        Tuple tuple;
+        tuple.addAttribute("name", TYPE_STRING, name);
+        return tuple;
+    };
+    std::set<int64_t> used;
+    auto insertRows = [&](Storage& storage, const std::string& dbName, int rows) {
+        int64_t last = 0;
+        for (int i = 0; i < rows; ++i) {
+            std::optional<int64_t> id = storage.insert(dbName, "t", unnumbered("row"));
+            CHECK(id && *id > last && used.insert(*id).second);
+            if (id) {
+                last = *id;
+            }
+        }
+        return last;
+    };
+    int64_t last = 0;
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        TableOptions options;
+        options.autoIncrementId = true;
+        CHECK(storage.createTable(db, "t", {{"id", "int"}, {"name", "string"}}, options));
+        CHECK(storage.insert(db, "t", unnumbered("first")) == 1);
+        used.insert(1);
+        last = insertRows(storage, db, static_cast<int>(ID_SEQUENCE_CHUNK) + 50);
+        CHECK(last == ID_SEQUENCE_CHUNK + 51);  // Consecutive across the chunk boundary
+
+        // An explicit id is kept and skipped by the sequence
+        Tuple explicitRow = unnumbered("explicit");
+        explicitRow.addAttribute("id", TYPE_INT, std::to_string(last + 1));
+        CHECK(storage.insert(db, "t", explicitRow) == last + 1);
+        used.insert(last + 1);
+        last = insertRows(storage, db, 1);
+        CHECK(storage.get(db, "t", std::to_string(last))["name"] == "row");
+        CHECK(storage.deleteTupleFromTable(db, "t", std::to_string(last)));
+        fs::copy(db, crashed, fs::copy_options::recursive);
+    }
+
+    // The rest of the reserved chunk is left unused; later ids follow it, past the
+    // deleted row, and the copy recovers every row it had
+    const std::set<int64_t> handedOut = used;
+    for (const std::string& copy : {db, crashed}) {
+        used = handedOut;
+        Storage storage;
+        CHECK(insertRows(storage, copy, 3) > last);
+        std::set<int64_t> stored;
+        for (const auto& found : storage.query(copy, "t", "", {"id"})) {
+            stored.insert(std::stoll(found.at("id")));
+        }
+        used.erase(last);
+        CHECK(stored == used);
+    }
+    {
+        Storage storage;
+        int64_t highest = std::stoll(storage.query(db, "t", "", {"id"}, 1, "id DESC").at(0).at("id"));
+        CHECK(insertRows(storage, db, 1) > highest);
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+        fs::remove_all(crashed);
+    }
+}
+
+#ifdef YARAB_HAS_COROUTINES
+// Two coroutine scans in flight on one I/O thread take turns page by page, and
+// return what the blocking scans return
+static void testAsyncScansInterleave() {
+    const std::string db = "test_async_scans";
+    fs::remove_all(db);
+    std::vector<std::map<std::string, std::string>> expectedRange;
+    std::vector<std::map<std::string, std::string>> expectedEquals;
+    {
+        Storage storage;
+        storage.createDatabase(db);
+        CHECK(storage.createTable(db, "t", {{"id", "int"}, {"name", "string"}, {"group", "int"}}));
+        for (int i = 1; i <= 2000; ++i) {
+            Tuple tuple;
+            tuple.addAttribute("id", TYPE_INT, std::to_string(i));
+            tuple.addAttribute("name", TYPE_STRING, std::string(200, 'a' + i % 26));
+            tuple.addAttribute("group", TYPE_INT, std::to_string(i % 7));
+            CHECK(storage.insert(db, "t", tuple));
+        }
+        expectedRange = storage.scanRange(db, "t", 10, 1500);
+        expectedEquals = storage.selectWhereEquals(db, "t", "group", "3");
+
+        RunLoopExecutor io;
+        storage.setAsyncExecutors(&io, nullptr);
+        std::future<std::vector<std::map<std::string, std::string>>> range =
+            startTask(storage.scanRangeAsync(db, "t", 10, 1500));
+        std::future<std::vector<std::map<std::string, std::string>>> equals =
+            startTask(storage.selectWhereEqualsAsync(db, "t", "group", "3"));
+        size_t polls = 0;
+        size_t bothRan = 0; // Polls that ran a step of each scan
+        while (size_t steps = io.poll()) {
+            ++polls;
+            bothRan += steps == 2;
+        }
+        CHECK(polls > 10);
+        CHECK(bothRan > 10);
+        CHECK(range.get() == expectedRange);
+        CHECK(equals.get() == expectedEquals);
+    }
+
+    // A Storage destroyed with a scan in flight on its own pool lets the scan finish
+    std::future<std::vector<std::map<std::string, std::string>>> pending;
+    {
+        Storage storage;
+        pending = startTask(storage.scanRangeAsync(db, "t", 10, 1500));
+    }
+    CHECK(pending.get() == expectedRange);
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+// Scans on a thread pool read their pages with the engine lock released while another
+// thread updates every row: each row is seen either as it was or as updated, and no
+// page read before an update is left cached after it
+static void testAsyncScansDuringUpdates() {
+    const std::string db = "test_async_updates";
+    fs::remove_all(db);
+    const int rows = 1200; // Four rows a page, more pages than the buffer pool holds
+    auto row = [](int id, char fill) {
+        Tuple tuple;
+        tuple.addAttribute("id", TYPE_INT, std::to_string(id));
+        tuple.addAttribute("name", TYPE_STRING, std::string(900, fill));
+        tuple.addAttribute("group", TYPE_INT, std::to_string(id % 7));
+        return tuple;
+    };
+    Storage storage;
+    storage.createDatabase(db);
+    CHECK(storage.createTable(db, "t", {{"id", "int"}, {"name", "string"}, {"group", "int"}}));
+    for (int id = 1; id <= rows; ++id) {
+        CHECK(storage.insert(db, "t", row(id, 'a' + id % 26)));
+    }
+
+    std::vector<std::future<std::vector<std::map<std::string, std::string>>>> ranges;
+    std::vector<std::future<std::vector<std::map<std::string, std::string>>>> equals;
+    for (int scan = 0; scan < 4; ++scan) {
+        ranges.push_back(startTask(storage.scanRangeAsync(db, "t", 1, rows)));
+        equals.push_back(startTask(storage.selectWhereEqualsAsync(db, "t", "group", "3")));
+    }
+    for (int id = rows; id >= 1; --id) {
+        storage.updateTupleInTable(db, "t", std::to_string(id), row(id, 'z'));
+    }
+    auto seenAsWasOrUpdated = [](const std::map<std::string, std::string>& found) {
+        int id = std::stoi(found.at("id"));
+        const std::string& name = found.at("name");
+        return name == std::string(900, 'z') || name == std::string(900, 'a' + id % 26);
+    };
+    for (auto& range : ranges) {
+        std::vector<std::map<std::string, std::string>> found = range.get();
+        CHECK(found.size() == static_cast<size_t>(rows));
+        for (size_t i = 0; i < found.size(); ++i) {
+            CHECK(found[i].at("id") == std::to_string(i + 1) && seenAsWasOrUpdated(found[i]));
+        }
+    }
+    for (auto& matches : equals) {
+        std::vector<std::map<std::string, std::string>> found = matches.get();
+        std::set<std::string> ids;
+        for (const auto& match : found) {
+            CHECK(match.at("group") == "3" && seenAsWasOrUpdated(match));
+            ids.insert(match.at("id"));
+        }
+        CHECK(ids.size() == static_cast<size_t>((rows - 3) / 7 + 1)); // A row moved by its update may show twice
+    }
+    std::vector<std::map<std::string, std::string>> after = startTask(storage.scanRangeAsync(db, "t", 1, rows)).get();
+    CHECK(after.size() == static_cast<size_t>(rows));
+    for (const auto& found : after) {
+        CHECK(found.at("name") == std::string(900, 'z'));
+    }
+
+    if (failures == 0) {
+        fs::remove_all(db);
+    }
+}
+#endif
+
+int main() {
+    std::cout.setstate(std::ios::badbit);
+    std::cerr.setstate(std::ios::badbit);
+
+    testValuesWithRowSyntax();
+    testIncrementalBackupSize();
+    testWireCountsBoundedByFrame();
+    testRedoLogCutMidRecord();
+    testTransactionCrashSteps();
+    testFailedBulkLoadKeepsDictionary();
+    testAggregateRespill();
+    testJoinRepartition();
+    testPageCompression();
+    testDictionaryColumns();
+    testVacuum();
+    testQueryPipeline();
+    testIdFilterAfterChanges();
+    testZoneMapsAfterChanges();
+    testPartitionRouting();
+    testSequenceAcrossRestarts();
+#ifdef YARAB_HAS_COROUTINES
+    testAsyncScansInterleave();
+    testAsyncScansDuringUpdates();
+#endif
+
+    std::cerr.clear();
+    std::printf("%s (%d failed checks)\n", failures == 0 ? "PASS" : "FAIL", failures);
+    return failures;
+}
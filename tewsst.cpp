@@ -10,94 +10,803 @@
 #include <algorithm>
 #include <unordered_set> 
 #include <optional>
+#include <variant>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <string_view>
+#include <charconv>
+#include <numeric>
+#include <functional>
+#include <condition_variable>
+#include <deque>
+#include <utility>
+#include <random>
+#include <cmath>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+// The coroutine API (Storage::*Async) is compiled when building as C++20 or later
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define YARAB_HAS_COROUTINES 1
+#endif
 namespace fs = std::filesystem;
 using namespace  std;
 
 // Constants
 constexpr size_t PAGE_SIZE = 4096; // 4 KB
 
+// On-disk format versioning. Version 1 files have no magic and use 16-bit
+// page counts / map sizes; they are converted by Storage::upgradeTable().
+constexpr uint32_t FILE_MAGIC = 0x32444148;  // "HAD2"
+constexpr uint16_t FORMAT_VERSION = 3;       // 3: row map kept in snapshot + delta log; 2: 64-bit IDs, inline map
+
+// Metadata sidecar files. "<table>.HAD.snap" holds the row map as of the last
+// checkpoint, "<table>.HAD.mlog" the delta records written since then.
+constexpr uint32_t SNAPSHOT_MAGIC = 0x53444148;      // "HADS"
+constexpr uint32_t METADATA_LOG_MAGIC = 0x4c444148;  // "HADL"
+constexpr uint64_t MIN_CHECKPOINT_RECORDS = 4096;    // Log length that always triggers a checkpoint
+
+// Redo log "<table>.HAD.wal": every change is appended there (page images plus its
+// metadata deltas, as one checksummed record) before the table file is touched.
+// Layout: [magic][u16 version][u16 0][u64 LSN of the first record], then records of
+// [u32 body length][u32 checksum][body]. A record's LSN is its byte position in the
+// log stream, so LSNs keep growing across checkpoints. Version 2 added the records
+// of transactions spanning several tables.
+constexpr uint32_t REDO_LOG_MAGIC = 0x57444148;      // "HADW"
+constexpr uint16_t REDO_LOG_VERSION = 2;
+constexpr uint64_t REDO_CHECKPOINT_BYTES = 1 << 20;  // Log growth that triggers a fuzzy checkpoint
+
+// Per-table option bits, stored in the first word of the header's reserved area
+constexpr uint32_t TABLE_FLAG_COMPRESSED = 0x1;      // Pages are LZ-compressed into variable-size extents
+constexpr uint32_t TABLE_FLAG_AUTO_INCREMENT = 0x2;  // Rows inserted without an id are numbered by the table's sequence
+constexpr int64_t ID_SEQUENCE_CHUNK = 1024;          // Ids reserved from a table's sequence per metadata write
+constexpr uint32_t EXTENT_GRANULE = 256;             // Compressed extents are allocated in these units
+
+// Attribute type codes stored with every value of a serialized row
+constexpr int TYPE_INT = 1;
+constexpr int TYPE_STRING = 2;
+constexpr int TYPE_DOUBLE = 3;
+
+// Dictionary-encoded string columns. Rows store the integer code with this
+// attribute type; the values live in "<table>.HAD.dict".
+constexpr int TYPE_DICTIONARY_CODE = 4;
+constexpr uint32_t DICTIONARY_MAGIC = 0x44444148;    // "HADD"
+
+// Row-ID filter "<table>.HAD.bloom" (see IdBloomFilter)
+constexpr uint32_t ID_FILTER_MAGIC = 0x46444148;     // "HADF"
+constexpr uint16_t ID_FILTER_VERSION = 1;
+constexpr uint64_t ID_FILTER_MIN_KEYS = 1024;        // Smallest capacity a filter is sized for
+
+// Per-page column summaries "<table>.HAD.zone" (see TableZoneMap)
+constexpr uint32_t ZONE_MAP_MAGIC = 0x5a444148;      // "HADZ"
+constexpr uint16_t ZONE_MAP_VERSION = 1;
+constexpr size_t ZONE_TEXT_PREFIX = 32;              // Bytes of a string bound kept in a zone
+
+// Partitioning descriptor "<table>.HAD.parts" of a partitioned table (see TablePartitioning)
+constexpr uint32_t PARTITION_MAGIC = 0x50444148;     // "HADP"
+constexpr uint16_t PARTITION_VERSION = 1;
+constexpr uint32_t MAX_PARTITIONS = 1024;
+
+// Pages written since a table's last backup "<table>.HAD.changes" (see PageChangeMap)
+constexpr uint32_t CHANGE_MAP_MAGIC = 0x43444148;    // "HADC"
+constexpr uint16_t CHANGE_MAP_VERSION = 2;
+
+// Database backup "<backup dir>/backup.<sequence>" (see Storage::backupDatabase())
+constexpr uint32_t BACKUP_MAGIC = 0x42444148;        // "HADB"
+constexpr uint16_t BACKUP_VERSION = 1;
+
+// Binary table export: [magic][u16 version][u16 column count][(u16 length, name, u8 type) per column],
+// then per row a presence bitmap (bit i = column i present) followed by the present values:
+// int64 / double as 8 native-endian bytes, strings as u32 length + bytes.
+constexpr uint32_t EXPORT_MAGIC = 0x58444148;        // "HADX"
+constexpr uint16_t EXPORT_VERSION = 1;
+
+// Engine-wide I/O and operation counters. Every thread owns one block and is the only
+// writer to it, so bumps are plain relaxed load/store pairs with no locked instructions;
+// Storage::stats() sums the blocks of live threads and the totals of exited ones.
+struct EngineCounters {
+    std::atomic<uint64_t> pagesRead{0};
+    std::atomic<uint64_t> pagesWritten{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<uint64_t> fileOpens{0};
+    std::atomic<uint64_t> metadataDeserializeCalls{0};
+    std::atomic<uint64_t> metadataDeserializeBytes{0};
+    std::atomic<uint64_t> metadataSerializeCalls{0};
+    std::atomic<uint64_t> metadataSerializeBytes{0};
+    std::atomic<uint64_t> rowsDecoded{0};
+    std::atomic<uint64_t> pagesSkipped{0};
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> lookupRowsDecoded{0};
+    std::atomic<uint64_t> bufferPoolHits{0};
+    std::atomic<uint64_t> bufferPoolMisses{0};
+    std::atomic<uint64_t> dictionaryCacheHits{0};
+    std::atomic<uint64_t> dictionaryCacheMisses{0};
+    std::atomic<uint64_t> fileSyncs{0};
+
+    // Add this block's counts to another block
+    void addTo(EngineCounters& total) const {
+        total.pagesRead.fetch_add(pagesRead.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.pagesWritten.fetch_add(pagesWritten.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.bytesRead.fetch_add(bytesRead.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.bytesWritten.fetch_add(bytesWritten.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.fileOpens.fetch_add(fileOpens.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.metadataDeserializeCalls.fetch_add(metadataDeserializeCalls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.metadataDeserializeBytes.fetch_add(metadataDeserializeBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.metadataSerializeCalls.fetch_add(metadataSerializeCalls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.metadataSerializeBytes.fetch_add(metadataSerializeBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.rowsDecoded.fetch_add(rowsDecoded.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.pagesSkipped.fetch_add(pagesSkipped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.lookups.fetch_add(lookups.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.lookupRowsDecoded.fetch_add(lookupRowsDecoded.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.bufferPoolHits.fetch_add(bufferPoolHits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.bufferPoolMisses.fetch_add(bufferPoolMisses.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.dictionaryCacheHits.fetch_add(dictionaryCacheHits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.dictionaryCacheMisses.fetch_add(dictionaryCacheMisses.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.fileSyncs.fetch_add(fileSyncs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+};
+
+class CounterRegistry {
+private:
+    std::mutex mutex;
+    std::vector<std::shared_ptr<EngineCounters>> blocks;  // Blocks of live threads
+    EngineCounters retired;                               // Counts of threads that have exited
+
+public:
+    static CounterRegistry& instance() {
+        static CounterRegistry registry;
+        return registry;
+    }
+
+    std::shared_ptr<EngineCounters> registerThread() {
+        auto block = std::make_shared<EngineCounters>();
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks.push_back(block);
+        return block;
+    }
+
+    // Fold an exiting thread's block into the retired totals and forget it, so threads
+    // started per query do not make the registry grow
+    void retireThread(const std::shared_ptr<EngineCounters>& block) {
+        std::lock_guard<std::mutex> lock(mutex);
+        block->addTo(retired);
+        blocks.erase(std::remove(blocks.begin(), blocks.end(), block), blocks.end());
+    }
+
+    // Add the counts of every thread, live or exited, to total. Holding the lock keeps
+    // a thread that exits meanwhile from being counted twice.
+    void sumInto(EngineCounters& total) {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.addTo(total);
+        for (const auto& block : blocks) {
+            block->addTo(total);
+        }
+    }
+};
+
+// Counter block of the calling thread, retired when the thread exits
+inline EngineCounters& engineCounters() {
+    struct ThreadBlock {
+        std::shared_ptr<EngineCounters> block = CounterRegistry::instance().registerThread();
+        ~ThreadBlock() {
+            CounterRegistry::instance().retireThread(block);
+        }
+    };
+    thread_local ThreadBlock thread;
+    return *thread.block;
+}
+
+// Single-writer increment: only the owning thread ever stores to its block
+inline void bumpCounter(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Durability. Stream flushes only reach the page cache; these force data to the disk.
+// A rename is only durable once the directory holding it is synced.
+
+// fsync a file (fdatasync when only its contents and size matter)
+inline bool syncFile(const std::string& path, bool dataOnly = false) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error syncFile: Unable to open " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    bumpCounter(engineCounters().fileOpens);
+    bumpCounter(engineCounters().fileSyncs);
+    bool ok = (dataOnly ? ::fdatasync(fd) : ::fsync(fd)) == 0;
+    if (!ok) {
+        std::cerr << "Error syncFile: Unable to sync " << path << ": " << std::strerror(errno) << std::endl;
+    }
+    ::close(fd);
+    return ok;
+}
+
+// fsync the directory holding path, making a file created or renamed there durable
+inline bool syncParentDirectory(const std::string& path) {
+    fs::path parent = fs::path(path).parent_path();
+    std::string directory = parent.empty() ? "." : parent.string();
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        std::cerr << "Error syncParentDirectory: Unable to open " << directory << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    bumpCounter(engineCounters().fileOpens);
+    bumpCounter(engineCounters().fileSyncs);
+    bool ok = ::fsync(fd) == 0;
+    if (!ok) {
+        std::cerr << "Error syncParentDirectory: Unable to sync " << directory << ": " << std::strerror(errno) << std::endl;
+    }
+    ::close(fd);
+    return ok;
+}
+
+// Replace target with a fully written temporary file: sync the file, rename it over
+// target, then sync the directory. A crash leaves either the old file or the new one.
+inline void renameDurably(const std::string& tmpPath, const std::string& target) {
+    if (!syncFile(tmpPath)) {
+        throw std::runtime_error("unable to sync " + tmpPath);
+    }
+    fs::rename(tmpPath, target);
+    if (!syncParentDirectory(target)) {
+        throw std::runtime_error("unable to sync the directory of " + target);
+    }
+}
+
+// Append bytes to a file and fdatasync it before returning
+inline bool appendDurably(const std::string& path, std::string_view bytes) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Error appendDurably: Unable to open " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    bumpCounter(engineCounters().fileOpens);
+    bool ok = true;
+    for (size_t written = 0; ok && written < bytes.size();) {
+        ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = n > 0;
+        written += ok ? static_cast<size_t>(n) : 0;
+    }
+    if (ok) {
+        bumpCounter(engineCounters().fileSyncs);
+        ok = ::fdatasync(fd) == 0;
+    }
+    if (!ok) {
+        std::cerr << "Error appendDurably: Unable to append to " << path << ": " << std::strerror(errno) << std::endl;
+    }
+    ::close(fd);
+    return ok;
+}
+
+// HDR-style latency histogram: log-linear buckets with 32 sub-buckets per power of
+// two, so any recorded value is reported within ~3% while covering 1 ns .. 2^63 ns in
+// 1920 fixed buckets. Recording is a single relaxed atomic increment.
+class LatencyHistogram {
+private:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maxValue{0};
+
+    static size_t bucketFor(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BUCKET_BITS;
+        uint64_t sub = (value >> shift) - SUB_BUCKETS;
+        return static_cast<size_t>(SUB_BUCKETS + shift * SUB_BUCKETS + sub);
+    }
+
+    // Midpoint of the values that land in a bucket
+    static uint64_t valueFor(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        uint64_t shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+        uint64_t sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+        uint64_t lower = (SUB_BUCKETS + sub) << shift;
+        return lower + ((uint64_t(1) << shift) >> 1);
+    }
+
+public:
+    void record(uint64_t value) {
+        buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = maxValue.load(std::memory_order_relaxed);
+        while (value > seen && !maxValue.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return maxValue.load(std::memory_order_relaxed);
+    }
+
+    double mean() const {
+        uint64_t n = count();
+        return n == 0 ? 0.0 : static_cast<double>(sum.load(std::memory_order_relaxed)) / n;
+    }
+
+    // Value at quantile q (0..1)
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * n);
+        if (rank >= n) rank = n - 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > rank) {
+                return std::min(valueFor(i), max());
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        maxValue.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Records the lifetime of a scope into a histogram, in nanoseconds
+class LatencyTimer {
+private:
+    LatencyHistogram& histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit LatencyTimer(LatencyHistogram& target) : histogram(target), start(std::chrono::steady_clock::now()) {}
+
+    ~LatencyTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+};
+
+// Collects trace spans (Chrome trace-event "complete" events) while enabled.
+// Disabled tracing costs one relaxed load per span.
+class Tracer {
+public:
+    struct Event {
+        const char* name;
+        uint64_t startUs;
+        uint64_t durationUs;
+        uint32_t threadId;
+    };
+
+private:
+    static constexpr size_t MAX_EVENTS = 1000000;
+
+    std::atomic<bool> enabled{false};
+    std::mutex mutex;
+    std::vector<Event> events;
+    uint64_t dropped = 0;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+public:
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool on) {
+        enabled.store(on, std::memory_order_relaxed);
+    }
+
+    uint64_t nowUs() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    static uint32_t currentThreadId() {
+        static std::atomic<uint32_t> nextId{1};
+        thread_local uint32_t id = nextId.fetch_add(1);
+        return id;
+    }
+
+    void add(const Event& event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (events.size() >= MAX_EVENTS) {
+            dropped++;
+            return;
+        }
+        events.push_back(event);
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.clear();
+        dropped = 0;
+    }
+
+    // Write the collected spans as Chrome trace-event JSON (chrome://tracing, Perfetto)
+    bool exportChromeTrace(const std::string& path) {
+        std::vector<Event> snapshot;
+        uint64_t droppedEvents;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshot = events;
+            droppedEvents = dropped;
+        }
+        std::ofstream out(path, std::ios::trunc);
+        out << "{\"traceEvents\":[";
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            const Event& e = snapshot[i];
+            out << (i ? ",\n" : "\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"yarab\",\"ph\":\"X\",\"ts\":" << e.startUs
+                << ",\"dur\":" << e.durationUs << ",\"pid\":1,\"tid\":" << e.threadId << "}";
+        }
+        out << "\n],\"otherData\":{\"droppedEvents\":" << droppedEvents << "}}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+// RAII trace span; names must be string literals
+class TraceSpan {
+private:
+    const char* name;
+    uint64_t startUs = 0;
+    bool active;
+
+public:
+    explicit TraceSpan(const char* spanName) : name(spanName), active(Tracer::instance().isEnabled()) {
+        if (active) {
+            startUs = Tracer::instance().nowUs();
+        }
+    }
+
+    ~TraceSpan() {
+        if (active) {
+            Tracer& tracer = Tracer::instance();
+            tracer.add({name, startUs, tracer.nowUs() - startUs, Tracer::currentThreadId()});
+        }
+    }
+};
+
+// Per-thread monotonic arena for the temporaries of one storage operation
+// (decoded rows and their attribute strings). An ArenaScope marks the operation;
+// nested scopes share the outermost one, which releases everything when it ends.
+// Outside any scope the arena hands out the default (heap) resource.
+class OperationArena {
+private:
+    static constexpr size_t INITIAL_BYTES = 64 * 1024; // Reused by every operation on the thread
+
+    std::unique_ptr<char[]> initial;
+    std::pmr::monotonic_buffer_resource buffer;
+    int depth = 0;
+
+    OperationArena()
+        : initial(new char[INITIAL_BYTES]),
+          buffer(initial.get(), INITIAL_BYTES, std::pmr::new_delete_resource()) {}
+
+    friend class ArenaScope;
+
+public:
+    static OperationArena& current() {
+        thread_local OperationArena arena;
+        return arena;
+    }
+
+    std::pmr::memory_resource* resource() {
+        return depth > 0 ? &buffer : std::pmr::get_default_resource();
+    }
+};
+
+// Memory resource for temporaries of the operation running on this thread
+inline std::pmr::memory_resource* operationResource() {
+    return OperationArena::current().resource();
+}
+
+// RAII scope of one storage operation on the thread's arena
+class ArenaScope {
+private:
+    OperationArena& arena;
+
+public:
+    ArenaScope() : arena(OperationArena::current()) {
+        ++arena.depth;
+    }
+
+    ~ArenaScope() {
+        if (--arena.depth == 0) {
+            arena.buffer.release();
+        }
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
 // Slot structure represents a tuple's metadata location
 struct Slot {
     uint16_t offset;  // Offset of the tuple in the page
     uint16_t length;  // Length of the tuple
 };
 
-// Tuple class for dynamic schema logic
+// Tuple class for dynamic schema logic. Values are held natively: ints and
+// dictionary codes as int64_t, doubles as double, strings as pmr strings. Rows
+// written by insert() are laid out in schema order, so a column's schema
+// position is also its index in the tuple.
 class Tuple {
+public:
+    using Value = std::variant<int64_t, double, std::pmr::string>;
+
+    // Attribute strings come from the tuple's memory resource. A copy of a tuple
+    // always lives on the default resource, so copies can outlive an ArenaScope.
+    struct Attribute {
+        std::pmr::string key;
+        int type;
+        Value value;
+    };
+
+    // Type code of a value added without an explicit type
+    static int typeOf(const Value& value) {
+        switch (value.index()) {
+        case 0: return TYPE_INT;
+        case 1: return TYPE_DOUBLE;
+        default: return TYPE_STRING;
+        }
+    }
+
+    // Parse the text form of a value of the given type into value. Unknown types
+    // are kept as text. Returns false if the text is not a valid value of the type.
+    static bool parseValue(int type, std::string_view text, Value& value, std::pmr::memory_resource* resource) {
+        const char* first = text.data();
+        const char* last = text.data() + text.size();
+        if (type == TYPE_INT || type == TYPE_DICTIONARY_CODE) {
+            int64_t number = 0;
+            auto [end, error] = std::from_chars(first, last, number);
+            if (error != std::errc() || end != last) {
+                return false;
+            }
+            value = number;
+        } else if (type == TYPE_DOUBLE) {
+            double number = 0;
+            auto [end, error] = std::from_chars(first, last, number);
+            if (error != std::errc() || end != last) {
+                return false;
+            }
+            value = number;
+        } else if (std::pmr::string* str = std::get_if<std::pmr::string>(&value)) {
+            str->assign(text); // Reuse the string already held
+        } else {
+            value.emplace<std::pmr::string>(text, resource);
+        }
+        return true;
+    }
+
+    // Append the text form of a value (shortest round-trip form for doubles)
+    static void formatValue(const Value& value, std::string& out) {
+        char buffer[32];
+        if (const int64_t* number = std::get_if<int64_t>(&value)) {
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *number).ptr);
+        } else if (const double* number = std::get_if<double>(&value)) {
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), *number).ptr);
+        } else {
+            out.append(std::get<std::pmr::string>(value));
+        }
+    }
+
+    static std::string valueToString(const Value& value) {
+        std::string out;
+        formatValue(value, out);
+        return out;
+    }
+
 private:
-    std::vector<std::pair<std::string, std::pair<int, std::string>>> attributes;
+    std::pmr::vector<Attribute> attributes;
 
-public:
+    std::pmr::memory_resource* resource() const {
+        return attributes.get_allocator().resource();
+    }
+
+    Attribute* find(std::string_view key) {
+        for (auto& attr : attributes) {
+            if (attr.key == key) {
+                return &attr;
+            }
+        }
+        return nullptr;
+    }
 
-    void addAttribute(const std::string& key, int type, const std::string& value) {
-        // for (auto& attr : attributes) {
-        //     if (attr.first == key) {
-        //         attr.second = {type, value};
-        //         std::cout << "[DEBUG addAttribute] Updated attribute: " << key << " with value: " << value << std::endl;
- 
-        //         return;
-        //     }
-        // }
-        attributes.push_back({key, {type, value}});
+public:
+    Tuple() = default;
+    explicit Tuple(std::pmr::memory_resource* resource) : attributes(resource) {}
+
+    // Add an attribute from its text form; throws std::invalid_argument if the
+    // text is not a valid value of the type
+    void addAttribute(std::string_view key, int type, std::string_view value) {
+        Value parsed;
+        if (!parseValue(type, value, parsed, resource())) {
+            throw std::invalid_argument("Invalid value for attribute " + std::string(key) + ": " + std::string(value));
+        }
+        attributes.push_back({std::pmr::string(key, resource()), type, std::move(parsed)});
         std::cout << "[DEBUG addAttribute] Added new attribute: " << key << " with value: " << value << std::endl;
- 
     }
 
-std::string serialize() const {
-    std::ostringstream oss;
-    for (const auto& attr : attributes) {
-        // Serialize attr.first, attr.second.first, and attr.second.second
-        oss << attr.first << "(" << attr.second.first << "|" << attr.second.second << ")";
+    // Add a typed attribute; the type code follows the value's type
+    void addAttribute(std::string_view key, Value value) {
+        addValue(key, typeOf(value), std::move(value));
+    }
+
+    void addValue(std::string_view key, int type, Value value) {
+        attributes.push_back({std::pmr::string(key, resource()), type, std::move(value)});
+    }
+
+    // Replace the type and value of an existing attribute, adding it if absent
+    void setAttribute(std::string_view key, int type, std::string_view value) {
+        Attribute* attr = find(key);
+        if (!attr) {
+            addAttribute(key, type, value);
+            return;
+        }
+        if (!parseValue(type, value, attr->value, resource())) {
+            throw std::invalid_argument("Invalid value for attribute " + std::string(key) + ": " + std::string(value));
+        }
+        attr->type = type;
+    }
+
+    void setValue(std::string_view key, int type, Value value) {
+        if (Attribute* attr = find(key)) {
+            attr->type = type;
+            attr->value = std::move(value);
+            return;
+        }
+        addValue(key, type, std::move(value));
     }
-    std::string result = oss.str();
+
+std::string serialize() const {
+    std::string result;
+    serializeTo(result);
     std::cout << "[DEBUG Tuple serialize] Serialized tuple: " << result << std::endl;
     return result;
 }
 
-bool deserialize(const std::string& data) {
-    attributes.clear();  // Clear the attributes vector to start fresh
-    std::istringstream iss(data);  // Create a stringstream from the input data
-    std::string token;  // To store each token extracted from the data
+// Append the row form, key(type|value) per attribute, to out. A ')' inside a string
+// value is written twice (see tokenEnd()); keys cannot hold '(', ')' or '|'.
+void serializeTo(std::string& out) const {
+    for (const auto& attr : attributes) {
+        out.append(attr.key);
+        out.push_back('(');
+        out.append(std::to_string(attr.type));
+        out.push_back('|');
+        if (const std::pmr::string* text = std::get_if<std::pmr::string>(&attr.value)) {
+            for (char c : *text) {
+                out.push_back(c);
+                if (c == ')') {
+                    out.push_back(')');
+                }
+            }
+        } else {
+            formatValue(attr.value, out);
+        }
+        out.push_back(')');
+    }
+}
+
+// End of the first token of a row: the first ')' that is not doubled. Keys never start
+// with ')', so a token end followed by the next token cannot look like a doubled ')',
+// and rows written before values could hold ')' parse as before.
+static size_t tokenEnd(std::string_view row) {
+    size_t close = row.find(')');
+    while (close != std::string_view::npos && close + 1 < row.size() && row[close + 1] == ')') {
+        close = row.find(')', close + 2);
+    }
+    return close;
+}
+
+// A value as written by serializeTo(), with doubled ')' made single again; scratch
+// holds the result when anything had to be undone
+static std::string_view unescapeValue(std::string_view value, std::string& scratch) {
+    if (value.find("))") == std::string_view::npos) {
+        return value;
+    }
+    scratch.clear();
+    for (size_t i = 0; i < value.size(); ++i) {
+        scratch.push_back(value[i]);
+        if (value[i] == ')' && i + 1 < value.size() && value[i + 1] == ')') {
+            ++i;
+        }
+    }
+    return scratch;
+}
+
+// True if a name can be stored as an attribute key in the row form
+static bool isValidKey(std::string_view key) {
+    return !key.empty() && key.find_first_of("()|") == std::string_view::npos;
+}
 
-    // Process the data string token by token, delimited by ';'
-    while (std::getline(iss, token, ')')) {
+// Parse "key(type|value)" tokens straight out of the row bytes. Attributes
+// already held by this tuple are overwritten in place, so decoding rows one
+// after another into the same tuple reuses their strings.
+bool deserialize(std::string_view data) {
+    bumpCounter(engineCounters().rowsDecoded);
+    size_t count = 0;  // Attributes decoded so far
+    std::string scratch;
+
+    // Process the data token by token, delimited by ')'
+    while (!data.empty()) {
+        size_t closePos = tokenEnd(data);
+        std::string_view token = data.substr(0, closePos);
+        data.remove_prefix(closePos == std::string_view::npos ? data.size() : closePos + 1);
         if (token.empty()) continue;  // Skip empty tokens (just in case)
 
-        // Find the position of the colon ':' in the token
+        // Find the position of the '(' in the token
         auto colonPos = token.find('(');
-        if (colonPos == std::string::npos) {
+        if (colonPos == std::string_view::npos) {
             std::cerr << "[ERROR Tuple deserialize] Malformed token: " << token << std::endl;
             continue;
         }
 
-        // Extract the key
-        std::string key = token.substr(0, colonPos);
-
-        // Extract the part after the colon and split by comma to get the values
-        std::string values = token.substr(colonPos + 1);
+        // Split the key from the "type|value" part
+        std::string_view key = token.substr(0, colonPos);
+        std::string_view values = token.substr(colonPos + 1);
         auto commaPos = values.find('|');
-        if (commaPos == std::string::npos) {
+        if (commaPos == std::string_view::npos) {
             std::cerr << "[ERROR Tuple deserialize] Malformed value part: " << values << std::endl;
             continue;
         }
 
-        // Extract first and second parts of the value
-        std::string valueFirst = values.substr(0, commaPos);
-        std::string valueSecond = values.substr(commaPos + 1);
+        std::string_view valueFirst = values.substr(0, commaPos);
+        std::string_view valueSecond = unescapeValue(values.substr(commaPos + 1), scratch);
 
         // If all components are valid, add them as an attribute
         if (!key.empty() && !valueFirst.empty() && !valueSecond.empty()) {
-            try {
-                int firstValue = std::stoi(valueFirst);  // Convert the first part to an integer
-                addAttribute(key, firstValue, valueSecond);
-            } catch (const std::exception& e) {
-                std::cerr << "[ERROR Tuple deserialize] Failed to convert valueFirst to int: " << valueFirst << ". Exception: " << e.what() << std::endl;
+            int type = 0;
+            auto [end, error] = std::from_chars(valueFirst.data(), valueFirst.data() + valueFirst.size(), type);
+            if (error != std::errc()) {
+                std::cerr << "[ERROR Tuple deserialize] Failed to convert valueFirst to int: " << valueFirst << std::endl;
+                continue;
+            }
+            if (count == attributes.size()) {
+                attributes.push_back({std::pmr::string(resource()), type, int64_t(0)});
             }
+            Attribute& attr = attributes[count];
+            if (!parseValue(type, valueSecond, attr.value, resource())) {
+                std::cerr << "[ERROR Tuple deserialize] Invalid value for type " << type << ": " << valueSecond << std::endl;
+                continue;
+            }
+            attr.key.assign(key);
+            attr.type = type;
+            ++count;
         } else {
             std::cerr << "[ERROR Tuple deserialize] Invalid key, valueFirst, or valueSecond: " 
                       << key << " - " << valueFirst << " - " << valueSecond << std::endl;
         }
     }
+    attributes.resize(count, Attribute{std::pmr::string(resource()), 0, int64_t(0)});
 
     bool success = !attributes.empty();
     std::cout << "[DEBUG Tuple deserialize] Deserialization " << (success ? "succeeded" : "failed") 
@@ -105,26 +814,63 @@ bool deserialize(const std::string& data) {
     return success;
 }
 
+    // Attributes in row order, without copying them
+    const std::pmr::vector<Attribute>& getAttributes() const {
+        return attributes;
+    }
 
-std::map<std::string, std::pair<int, std::string>> getAttributes() const {
-    // Create an empty map to store the attributes
-    std::map<std::string, std::pair<int, std::string>> attributesMap;
+    size_t size() const {
+        return attributes.size();
+    }
 
-    // Iterate through each attribute in the 'attributes' vector
-    for (const auto& attr : attributes) {
-        // For each attribute, insert it into the map. The key is 'attr.first' (the attribute name),
-        // and the value is 'attr.second' (the pair containing the type and value)
-        attributesMap[attr.first] = attr.second;
+    // Attribute at a column index
+    const Attribute& at(size_t column) const {
+        return attributes.at(column);
+    }
+
+    // Index of an attribute, checking the hinted index (usually its schema position) first
+    std::optional<size_t> columnIndex(std::string_view key, size_t hint = 0) const {
+        if (hint < attributes.size() && attributes[hint].key == key) {
+            return hint;
+        }
+        for (size_t i = 0; i < attributes.size(); ++i) {
+            if (attributes[i].key == key) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    const Value* findValue(std::string_view key) const {
+        std::optional<size_t> column = columnIndex(key);
+        return column ? &attributes[*column].value : nullptr;
+    }
+
+    // Integer attribute (e.g. "id"), or nullopt if absent or not an integer
+    std::optional<int64_t> getInt(std::string_view key) const {
+        const Value* value = findValue(key);
+        if (value) {
+            if (const int64_t* number = std::get_if<int64_t>(value)) {
+                return *number;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Name -> value map of the row, as returned to callers
+    std::map<std::string, std::string> getValueMap() const {
+        std::map<std::string, std::string> values;
+        for (const auto& attr : attributes) {
+            values.insert_or_assign(std::string(attr.key), valueToString(attr.value));
+        }
+        return values;
     }
 
-    // Return the populated map
-    return attributesMap;
-}
     std::string getAttributeValue(const std::string& key) const {
     for (const auto& attr : attributes) {
-        std::cout << "[DEBUG getAttributeValue] Found attribute: " << key << " with value: " << attr.second.second << std::endl;
-        if (attr.first == key) {
-            return attr.second.second; // Return the value of the key
+        if (std::string_view(attr.key) == key) {
+            std::cout << "[DEBUG getAttributeValue] Found attribute: " << key << std::endl;
+            return valueToString(attr.value); // Return the value of the key
         }
     }
     std::cerr << "[WARNING getAttributeValue] Attribute not found: " << key << std::endl;
@@ -133,18 +879,88 @@ std::map<std::string, std::pair<int, std::string>> getAttributes() const {
     }
 };
 
+// One metadata change, appended to the metadata log instead of rewriting the header
+struct MetadataDelta {
+    static constexpr uint8_t PAGE_COUNT = 1;  // value = new page count
+    static constexpr uint8_t MAP_ENTRY = 2;   // key = row ID, value = page ID (-2 = deleted)
+    static constexpr uint8_t PAGE_EXTENT = 3; // key = page ID, value = offset << 16 | capacity
+    static constexpr uint8_t ID_SEQUENCE = 4; // value = last id reserved from the auto-increment sequence
+    static constexpr size_t RECORD_SIZE = 1 + 2 * sizeof(int64_t);
+
+    uint8_t kind;
+    int64_t key;
+    int64_t value;
+};
+
+// Location of a compressed page inside the table file
+struct PageExtent {
+    uint64_t offset = 0;    // Byte offset of the extent
+    uint32_t capacity = 0;  // Bytes reserved for the page (a multiple of EXTENT_GRANULE)
+};
+
 class FileMetadata {
 private:
     static const int SCHEMA_SIZE = 512;        // Fixed size for schema
     static const int RESERVED_SIZE = 508;     // Reserved for future use
     //static const int MAP_ENTRIES = 896;       // 7 KB / 8 bytes per (tuple_id, page_id)
     static const int METADATA_SIZE = 8192;    // Total metadata size (8 KB)
+    static const int ID_SEQUENCE_OFFSET = 8;  // Last reserved auto-increment id, after the flags word
 
     // Schema and number of pages in the file
     std::map<std::string, std::string> schema; // Maps attribute name to its type (e.g., "id" -> "int")
-    uint16_t pageCount=0;
+    uint64_t pageCount=0;
     char reserved[RESERVED_SIZE]={0};             // Reserved for future features
-    std::map<int, int> tupleToPageMap;
+    std::map<int64_t, int64_t> tupleToPageMap;    // Row ID -> page ID (-1 / -2 mark deleted rows)
+    uint16_t formatVersion = FORMAT_VERSION;      // Version the header was read from
+
+    // Incremental persistence state
+    std::vector<MetadataDelta> pendingDeltas;     // Changes not yet written to the log
+    bool headerDirty = true;                      // Header/snapshot must be rewritten (new or upgraded metadata)
+    uint64_t checkpointGeneration = 0;            // Generation shared by the snapshot and its log
+    uint64_t logRecordCount = 0;                  // Records in the log since the last checkpoint
+
+    // Page directory for compressed tables: page ID -> extent. Uncompressed tables
+    // address pages directly through getPagePosition().
+    std::vector<PageExtent> pageDirectory;
+    uint64_t extentEnd = METADATA_SIZE;           // First free byte after the last extent
+
+    void applyPageExtent(uint32_t pageID, const PageExtent& extent) {
+        if (pageDirectory.size() <= pageID) {
+            pageDirectory.resize(pageID + 1);
+        }
+        pageDirectory[pageID] = extent;
+        extentEnd = std::max<uint64_t>(extentEnd, extent.offset + extent.capacity);
+    }
+
+    void recordDelta(uint8_t kind, int64_t key, int64_t value) {
+        pendingDeltas.push_back({kind, key, value});
+    }
+
+    // Apply one delta to the in-memory state; false for an unknown kind
+    bool applyDelta(const MetadataDelta& delta) {
+        if (delta.kind == MetadataDelta::PAGE_COUNT) {
+            pageCount = static_cast<uint64_t>(delta.value);
+        } else if (delta.kind == MetadataDelta::MAP_ENTRY) {
+            tupleToPageMap[delta.key] = delta.value;
+        } else if (delta.kind == MetadataDelta::PAGE_EXTENT) {
+            PageExtent extent;
+            extent.offset = static_cast<uint64_t>(delta.value) >> 16;
+            extent.capacity = static_cast<uint32_t>(delta.value & 0xFFFF);
+            applyPageExtent(static_cast<uint32_t>(delta.key), extent);
+        } else if (delta.kind == MetadataDelta::ID_SEQUENCE) {
+            raiseIdSequence(delta.value);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // The sequence only moves forward, whatever order its records are applied in
+    void raiseIdSequence(int64_t lastReserved) {
+        if (lastReserved > getIdSequence()) {
+            std::memcpy(reserved + ID_SEQUENCE_OFFSET, &lastReserved, sizeof(lastReserved));
+        }
+    }
 
 
 public:
@@ -156,44 +972,201 @@ public:
     // Set the schema for the table
     void setSchema(const std::map<std::string, std::string>& tableSchema) {
         schema = tableSchema;
+        headerDirty = true;
     }
 
     // Set the number of pages in the file
-    void setPageCount(uint16_t count) {
+    void setPageCount(uint64_t count) {
         pageCount = count;
+        recordDelta(MetadataDelta::PAGE_COUNT, 0, static_cast<int64_t>(count));
     }
 
-     // Member variable to keep track of the next page ID
-    uint32_t nextPageID = 1;
+    uint32_t getTableFlags() const {
+        uint32_t flags;
+        std::memcpy(&flags, reserved, sizeof(flags));
+        return flags;
+    }
 
-    // Method to get the next page ID
-    uint32_t getNextPageID() {
-        return nextPageID;
+    void setTableFlags(uint32_t flags) {
+        std::memcpy(reserved, &flags, sizeof(flags));
+        headerDirty = true;
     }
 
-    void incrementPageID() {
-    if (nextPageID >= pageCount) {
-        std::cerr << "Warning incrementPageID: Attempting to access invalid page ID: " << nextPageID << "\n";
-        pageCount++;  // Ensure page count is incremented when creating new pages
+    bool isCompressed() const {
+        return (getTableFlags() & TABLE_FLAG_COMPRESSED) != 0;
     }
-    nextPageID++;
-}
 
+    bool isAutoIncrement() const {
+        return (getTableFlags() & TABLE_FLAG_AUTO_INCREMENT) != 0;
+    }
 
-    // Add a tuple-to-page mapping
-    void addTupleToPageMap(int tupleId, int pageId) {
-        if (tupleToPageMap.find(tupleId) != tupleToPageMap.end()) {
-        std::cerr << "Warning addTupleToPageMap: Overwriting existing mapping for Tuple ID " << tupleId << ".\n";
+    // Last id reserved from the auto-increment sequence; 0 before the first reservation
+    int64_t getIdSequence() const {
+        int64_t lastReserved;
+        std::memcpy(&lastReserved, reserved + ID_SEQUENCE_OFFSET, sizeof(lastReserved));
+        return lastReserved;
+    }
+
+    // Reserve the next count ids of the sequence and return the first
+    int64_t reserveIds(int64_t count) {
+        int64_t first = getIdSequence() + 1;
+        raiseIdSequence(first + count - 1);
+        recordDelta(MetadataDelta::ID_SEQUENCE, 0, first + count - 1);
+        return first;
+    }
+
+    // Extent of a compressed page, if the page has been written
+    std::optional<PageExtent> getPageExtent(uint32_t pageID) const {
+        if (pageID >= pageDirectory.size() || pageDirectory[pageID].capacity == 0) {
+            return std::nullopt;
         }
-        tupleToPageMap[tupleId] = pageId;
+        return pageDirectory[pageID];
+    }
 
+    // Reserve space for a compressed page. The last extent in the file (normally the
+    // tail page being filled) grows in place; otherwise the page moves to the end of
+    // the file and its old extent is abandoned.
+    PageExtent allocateExtent(uint32_t pageID, size_t bytes) {
+        PageExtent extent;
+        extent.offset = extentEnd;
+        std::optional<PageExtent> current = getPageExtent(pageID);
+        if (current && current->offset + current->capacity == extentEnd) {
+            extent.offset = current->offset;
+            extentEnd = current->offset;
+        }
+        extent.capacity = static_cast<uint32_t>((bytes + EXTENT_GRANULE - 1) / EXTENT_GRANULE * EXTENT_GRANULE);
+        applyPageExtent(pageID, extent);
+        recordDelta(MetadataDelta::PAGE_EXTENT, pageID, static_cast<int64_t>(extent.offset << 16 | extent.capacity));
+        return extent;
     }
 
-    // Mark a tuple as deleted in the page map
-    void removeTupleFromPageMap(int tupleId) {
-        tupleToPageMap[tupleId] = -2; // Mark as deleted
+    // Move a page's extent (vacuum slides extents down over freed space)
+    void setPageExtent(uint32_t pageID, const PageExtent& extent) {
+        applyPageExtent(pageID, extent);
+        recordDelta(MetadataDelta::PAGE_EXTENT, pageID, static_cast<int64_t>(extent.offset << 16 | extent.capacity));
     }
-    bool hasTupleInPageMap(int tupleID) const {
+
+    // Shrink the table to its first count pages, dropping their extents
+    void truncatePages(uint64_t count) {
+        setPageCount(count);
+        if (pageDirectory.size() > count) {
+            pageDirectory.resize(count);
+        }
+        extentEnd = METADATA_SIZE;
+        for (const PageExtent& extent : pageDirectory) {
+            extentEnd = std::max<uint64_t>(extentEnd, extent.offset + extent.capacity);
+        }
+        headerDirty = true;
+    }
+
+    static std::string snapshotPath(const std::string& filePath) {
+        return filePath + ".snap";
+    }
+
+    static std::string logPath(const std::string& filePath) {
+        return filePath + ".mlog";
+    }
+
+    // Length of the whole records at the start of a log of logSize bytes; anything
+    // after them is a torn record that the next load truncates
+    static uint64_t wholeLogBytes(uint64_t logSize) {
+        if (logSize < LOG_HEADER_SIZE) {
+            return 0;
+        }
+        return logSize - (logSize - LOG_HEADER_SIZE) % MetadataDelta::RECORD_SIZE;
+    }
+
+    // Page IDs are dense, so the next page to append always gets ID == pageCount
+    uint32_t getNextPageID() const {
+        return static_cast<uint32_t>(pageCount);
+    }
+
+    void incrementPageID() {
+    if (pageCount >= std::numeric_limits<uint32_t>::max()) {
+        throw std::overflow_error("incrementPageID: Page ID space exhausted");
+    }
+    pageCount++;
+    recordDelta(MetadataDelta::PAGE_COUNT, 0, static_cast<int64_t>(pageCount));
+}
+
+    // True when the header was read from a pre-versioned (16-bit) file
+    bool isLegacyFormat() const {
+        return formatVersion < FORMAT_VERSION;
+    }
+
+    uint16_t getFormatVersion() const {
+        return formatVersion;
+    }
+
+
+    // Add a tuple-to-page mapping
+    void addTupleToPageMap(int64_t tupleId, int64_t pageId) {
+        if (tupleToPageMap.find(tupleId) != tupleToPageMap.end()) {
+        std::cerr << "Warning addTupleToPageMap: Overwriting existing mapping for Tuple ID " << tupleId << ".\n";
+        }
+        tupleToPageMap[tupleId] = pageId;
+        recordDelta(MetadataDelta::MAP_ENTRY, tupleId, pageId);
+
+    }
+
+    // Add many row -> page mappings at once, ids sorted ascending. Each insert is
+    // hinted with the previous one, so ids above the current maximum build the map
+    // bottom-up in linear time. No delta is logged per row: the header is marked
+    // dirty and the next serialize() checkpoints instead.
+    void addTupleMappings(const std::vector<std::pair<int64_t, int64_t>>& sortedMappings) {
+        if (sortedMappings.empty()) {
+            return;
+        }
+        auto hint = tupleToPageMap.lower_bound(sortedMappings.front().first);
+        for (const auto& [tupleId, pageId] : sortedMappings) {
+            hint = tupleToPageMap.insert_or_assign(hint, tupleId, pageId);
+            ++hint;
+        }
+        headerDirty = true;
+    }
+
+    // Changes made since the last serialize(), in order
+    const std::vector<MetadataDelta>& getPendingDeltas() const {
+        return pendingDeltas;
+    }
+
+    // Re-apply a delta taken from the redo log. Deltas assign absolute values, so
+    // replaying one the metadata already holds is harmless.
+    bool replayDelta(const MetadataDelta& delta) {
+        if (!applyDelta(delta)) {
+            return false;
+        }
+        recordDelta(delta.kind, delta.key, delta.value);
+        return true;
+    }
+
+    // Point a row at the page it was moved to
+    void relocateTuple(int64_t tupleId, int64_t pageId) {
+        tupleToPageMap[tupleId] = pageId;
+        recordDelta(MetadataDelta::MAP_ENTRY, tupleId, pageId);
+    }
+
+    // Rebuild the row map without its deleted-row entries; returns how many were dropped.
+    // Erasures cannot be logged as deltas, so the header is marked for a checkpoint.
+    uint64_t dropTombstones() {
+        std::map<int64_t, int64_t> live;
+        for (const auto& [tupleId, pageId] : tupleToPageMap) {
+            if (pageId >= 0) {
+                live.emplace_hint(live.end(), tupleId, pageId);
+            }
+        }
+        uint64_t dropped = tupleToPageMap.size() - live.size();
+        tupleToPageMap.swap(live);
+        headerDirty = true;
+        return dropped;
+    }
+
+    // Mark a tuple as deleted in the page map
+    void removeTupleFromPageMap(int64_t tupleId) {
+        tupleToPageMap[tupleId] = -2; // Mark as deleted
+        recordDelta(MetadataDelta::MAP_ENTRY, tupleId, -2);
+    }
+    bool hasTupleInPageMap(int64_t tupleID) const {
         auto it = tupleToPageMap.find(tupleID);
         // Return true if tuple exists and is not marked as deleted (-1 or -2)
         return it != tupleToPageMap.end() && it->second != -1 && it->second != -2;
@@ -205,16 +1178,16 @@ public:
     }
 
     // Get the number of pages in the file
-    uint16_t getPageCount() const {
+    uint64_t getPageCount() const {
         return pageCount;
     }
 
     // Get the tuple-to-page map
-    const std::map<int, int>& getTupleToPageMap() const {
+    const std::map<int64_t, int64_t>& getTupleToPageMap() const {
         
         return tupleToPageMap;
     }
-    int getPageIDForTuple(int tupleID) const {
+    int64_t getPageIDForTuple(int64_t tupleID) const {
     auto it = tupleToPageMap.find(tupleID);
     if (it == tupleToPageMap.end()) return -1; // Tuple does not exist
     if (it->second == -1 || it->second == -2) return -2; // Tuple is deleted
@@ -222,23 +1195,30 @@ public:
 }
 
 
-    std::streampos getPagePosition(int pageID) const {
-    if (pageID < 0 || pageID > pageCount) {
+    // pageID == pageCount is allowed so callers can address the page about to be appended
+    std::streampos getPagePosition(int64_t pageID) const {
+    if (pageID < 0 || static_cast<uint64_t>(pageID) > pageCount) {
         std::cerr << "Error getPagePosition: Invalid pageID: " << pageID << " (pageCount: " << pageCount << ")\n";
         throw std::out_of_range("Invalid pageID: " + std::to_string(pageID));
     }
-    return std::streampos(METADATA_SIZE+ (pageID * 4096));
+    return std::streampos(METADATA_SIZE + static_cast<std::streamoff>(pageID) * static_cast<std::streamoff>(PAGE_SIZE));
 }
 
+    // Position of a page under the version 1 layout, used only while upgrading
+    static std::streampos getLegacyPagePosition(uint32_t pageID) {
+        return std::streampos(METADATA_SIZE + static_cast<std::streamoff>(pageID) * 4096);
+    }
+
 
-    void setTupleAsDeleted(int tupleID) {
+    void setTupleAsDeleted(int64_t tupleID) {
     tupleToPageMap[tupleID] = -2;
+    recordDelta(MetadataDelta::MAP_ENTRY, tupleID, -2);
     std::cout << "[DEBUG setTupleAsDeleted] Tuple " << tupleID << " marked as deleted." << std::endl;
 }
 
 
 
-    bool hasTupleWithID(int tupleID) const {
+    bool hasTupleWithID(int64_t tupleID) const {
     auto it = tupleToPageMap.find(tupleID);
     if (it == tupleToPageMap.end()) {
         std::cout << "[DEBUG hasTupleWithID] Tuple " << tupleID << " not found in the map." << std::endl;
@@ -253,55 +1233,188 @@ public:
 
 
     // FileMetadata class
+    // Persist pending changes. Only the delta records are appended to the metadata log;
+    // the header and snapshot are rewritten when the schema changed or the log grew past
+    // the checkpoint threshold.
 void serialize(std::fstream& dbFile, const std::string& filePath) {
+    TraceSpan span("metadata_write");
+    uint64_t threshold = std::max<uint64_t>(MIN_CHECKPOINT_RECORDS, tupleToPageMap.size() / 2);
+    if (headerDirty || logRecordCount + pendingDeltas.size() > threshold) {
+        checkpoint(dbFile, filePath);
+        return;
+    }
+    if (pendingDeltas.empty()) {
+        return;
+    }
+
+    std::ofstream log(logPath(filePath), std::ios::binary | std::ios::app);
+    bumpCounter(engineCounters().fileOpens);
+    if (!log) {
+        throw std::runtime_error("Error File Metadata serialize: Unable to open metadata log for " + filePath);
+    }
+    std::string records;
+    records.reserve(pendingDeltas.size() * MetadataDelta::RECORD_SIZE);
+    for (const auto& delta : pendingDeltas) {
+        records.push_back(static_cast<char>(delta.kind));
+        records.append(reinterpret_cast<const char*>(&delta.key), sizeof(delta.key));
+        records.append(reinterpret_cast<const char*>(&delta.value), sizeof(delta.value));
+    }
+    log.write(records.data(), records.size());
+    log.flush();
+    if (!log) {
+        throw std::runtime_error("Error File Metadata serialize: Failed to append to metadata log for " + filePath);
+    }
+    logRecordCount += pendingDeltas.size();
+    pendingDeltas.clear();
+    bumpCounter(engineCounters().metadataSerializeCalls);
+    bumpCounter(engineCounters().metadataSerializeBytes, records.size());
+
+    std::cout << "[DEBUG File Metadata serialize] Appended delta records, log now holds " << logRecordCount << ".\n";
+}
+
+    // Fold the log into a fresh snapshot: write the snapshot under a new generation,
+    // rewrite the header, then restart the log. A log whose generation does not match
+    // the snapshot is ignored on load, so a crash between the steps is harmless.
+void checkpoint(std::fstream& dbFile, const std::string& filePath) {
+    TraceSpan span("metadata_checkpoint");
     if (!dbFile.is_open() || !dbFile) {
         // Attempt to reopen the file in read-write binary mode
+        dbFile.close();
+        dbFile.clear();
         dbFile.open(filePath, std::ios::in | std::ios::out | std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
         if (!dbFile.is_open()) {
             throw std::runtime_error("Error File Metadata serialize: Unable to reopen the file stream.");
         }
     }
 
     try {
+        uint64_t generation = checkpointGeneration + 1;
+        size_t snapshotBytes = 0;
+
+        // Write the snapshot next to the table and swap it in
+        std::string snapPath = snapshotPath(filePath);
+        std::string tmpPath = snapPath + ".tmp";
+        {
+            std::ostringstream out(std::ios::binary);
+            uint32_t magic = SNAPSHOT_MAGIC;
+            uint64_t mapSize = tupleToPageMap.size();
+            out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+            out.write(reinterpret_cast<const char*>(&generation), sizeof(generation));
+            out.write(reinterpret_cast<const char*>(&pageCount), sizeof(pageCount));
+            out.write(reinterpret_cast<const char*>(&mapSize), sizeof(mapSize));
+            for (const auto& [tupleId, pageId] : tupleToPageMap) {
+                out.write(reinterpret_cast<const char*>(&tupleId), sizeof(tupleId));
+                out.write(reinterpret_cast<const char*>(&pageId), sizeof(pageId));
+            }
+            uint64_t directorySize = pageDirectory.size();
+            out.write(reinterpret_cast<const char*>(&directorySize), sizeof(directorySize));
+            for (const auto& extent : pageDirectory) {
+                out.write(reinterpret_cast<const char*>(&extent.offset), sizeof(extent.offset));
+                out.write(reinterpret_cast<const char*>(&extent.capacity), sizeof(extent.capacity));
+            }
+            std::string snapshot = out.str();
+            snapshotBytes = snapshot.size();
+            std::ofstream snapFile(tmpPath, std::ios::binary | std::ios::trunc);
+            bumpCounter(engineCounters().fileOpens);
+            snapFile.write(snapshot.data(), snapshot.size());
+            snapFile.flush();
+            if (!snapFile) {
+                throw std::runtime_error("unable to write snapshot " + tmpPath);
+            }
+        }
+        renameDurably(tmpPath, snapPath);
+
+        // Build the header in memory first so an oversized header never spills into page 0
+        std::ostringstream out(std::ios::binary);
+
+        // Serialize the version tag
+        uint32_t magic = FILE_MAGIC;
+        uint16_t version = FORMAT_VERSION;
+        out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+
         // Serialize the schema
         uint16_t schemaSize = schema.size();
-        dbFile.write(reinterpret_cast<char*>(&schemaSize), sizeof(schemaSize));
+        out.write(reinterpret_cast<char*>(&schemaSize), sizeof(schemaSize));
         for (const auto& [key, value] : schema) {
             uint16_t keySize = key.size();
             uint16_t valueSize = value.size();
-            dbFile.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
-            dbFile.write(key.c_str(), keySize);
-            dbFile.write(reinterpret_cast<const char*>(&valueSize), sizeof(valueSize));
-            dbFile.write(value.c_str(), valueSize);
+            out.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+            out.write(key.c_str(), keySize);
+            out.write(reinterpret_cast<const char*>(&valueSize), sizeof(valueSize));
+            out.write(value.c_str(), valueSize);
         }
 
-        // Serialize page count
-        dbFile.write(reinterpret_cast<char*>(&pageCount), sizeof(pageCount));
+        // Serialize page count (the snapshot and log take precedence on load)
+        out.write(reinterpret_cast<char*>(&pageCount), sizeof(pageCount));
 
         // Serialize reserved space
-        dbFile.write(reserved, RESERVED_SIZE);
+        out.write(reserved, RESERVED_SIZE);
 
-        // Serialize the tuple-to-page map
-        uint16_t mapSize = tupleToPageMap.size();
-        dbFile.write(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
-        for (const auto& [tupleId, pageId] : tupleToPageMap) {
-            dbFile.write(reinterpret_cast<const char*>(&tupleId), sizeof(tupleId));
-            dbFile.write(reinterpret_cast<const char*>(&pageId), sizeof(pageId));
+        std::string header = out.str();
+        if (header.size() > METADATA_SIZE) {
+            throw std::length_error("header of " + std::to_string(header.size()) +
+                                    " bytes exceeds the " + std::to_string(METADATA_SIZE) + " byte metadata region");
+        }
+        dbFile.seekp(0);
+        dbFile.write(header.data(), header.size());
+        dbFile.flush();
+        // Restarting the log below drops its records, the id sequence among them, so the
+        // header must be on disk first
+        if (!dbFile || !syncFile(filePath)) {
+            throw std::runtime_error("unable to sync " + filePath);
+        }
+        bumpCounter(engineCounters().metadataSerializeCalls);
+        bumpCounter(engineCounters().metadataSerializeBytes, header.size() + snapshotBytes);
+
+        // Restart the log under the new generation
+        std::ofstream log(logPath(filePath), std::ios::binary | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        uint32_t logMagic = METADATA_LOG_MAGIC;
+        log.write(reinterpret_cast<const char*>(&logMagic), sizeof(logMagic));
+        log.write(reinterpret_cast<const char*>(&generation), sizeof(generation));
+        if (!log) {
+            throw std::runtime_error("unable to reset metadata log for " + filePath);
         }
 
-        std::cout << "[DEBUG File Metadata serialize] FileMetadata serialized successfully.\n";
+        checkpointGeneration = generation;
+        logRecordCount = 0;
+        pendingDeltas.clear();
+        headerDirty = false;
+        formatVersion = FORMAT_VERSION;
+
+        std::cout << "[DEBUG File Metadata serialize] FileMetadata checkpointed (generation " << generation << ").\n";
 
     } catch (const std::exception& e) {
         throw std::runtime_error(std::string("Serialization failed: ") + e.what());
     }
 }
-    // Deserialize the metadata from a file
-void deserialize(std::fstream& file) {
+    // Deserialize the metadata from a file: the header, then the snapshot, then the log tail
+void deserialize(std::fstream& file, const std::string& filePath) {
+    TraceSpan span("metadata_decode");
     if (!file.is_open() || !file) {
         throw std::runtime_error("Error File Metadata deserialize : File stream is not open or valid during deserialization.");
     }
 
     try {
+        // Version 1 headers start directly with the schema size, so probe for the magic first
+        std::streampos start = file.tellg();
+        uint32_t magic = 0;
+        file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        if (file && magic == FILE_MAGIC) {
+            file.read(reinterpret_cast<char*>(&formatVersion), sizeof(formatVersion));
+            if (formatVersion > FORMAT_VERSION) {
+                throw std::runtime_error("unsupported format version " + std::to_string(formatVersion));
+            }
+        } else {
+            file.clear();
+            file.seekg(start);
+            formatVersion = 1;
+            std::cout << "[DEBUG File Metadata deserialize] Reading legacy (version 1) header.\n";
+        }
+        bool legacy = formatVersion == 1;
+
         // Deserialize schema
         uint16_t schemaSize;
         file.read(reinterpret_cast<char*>(&schemaSize), sizeof(schemaSize));
@@ -320,25 +1433,44 @@ void deserialize(std::fstream& file) {
         }
 
         // Deserialize page count
-        file.read(reinterpret_cast<char*>(&pageCount), sizeof(pageCount));
-        if (pageCount == 0) {
-        //std::cerr << "Warning File Metadata deserialize: Page count is 0, initializing to 1.\n";
-        //pageCount = 1;
+        if (legacy) {
+            uint16_t legacyPageCount;
+            file.read(reinterpret_cast<char*>(&legacyPageCount), sizeof(legacyPageCount));
+            pageCount = legacyPageCount;
+        } else {
+            file.read(reinterpret_cast<char*>(&pageCount), sizeof(pageCount));
         }
         // Deserialize reserved space
         file.read(reserved, RESERVED_SIZE);
 
-        // Deserialize tuple-to-page map
-        uint16_t mapSize;
-        file.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
         tupleToPageMap.clear();
-        for (uint16_t i = 0; i < mapSize; ++i) {
-            int tupleId, pageId;
-            file.read(reinterpret_cast<char*>(&tupleId), sizeof(tupleId));
-            file.read(reinterpret_cast<char*>(&pageId), sizeof(pageId));
-            tupleToPageMap[tupleId] = pageId;
+        pendingDeltas.clear();
+        uint64_t sidecarBytes = 0;
+        if (formatVersion >= 3) {
+            headerDirty = false;
+            sidecarBytes = loadSnapshotAndLog(filePath);
+        } else {
+            // Versions 1 and 2 keep the tuple-to-page map inline after the header
+            uint64_t mapSize;
+            if (legacy) {
+                uint16_t legacyMapSize;
+                file.read(reinterpret_cast<char*>(&legacyMapSize), sizeof(legacyMapSize));
+                mapSize = legacyMapSize;
+            } else {
+                file.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
+            }
+            for (uint64_t i = 0; i < mapSize && file; ++i) {
+                int32_t tupleId, pageId;
+                file.read(reinterpret_cast<char*>(&tupleId), sizeof(tupleId));
+                file.read(reinterpret_cast<char*>(&pageId), sizeof(pageId));
+                tupleToPageMap[tupleId] = pageId;
+            }
+            headerDirty = true; // The next write converts the file to the current layout
         }
 
+        bumpCounter(engineCounters().metadataDeserializeCalls);
+        bumpCounter(engineCounters().metadataDeserializeBytes, static_cast<uint64_t>(file.tellg() - start) + sidecarBytes);
+
         std::cout << "[DEBUG File Metadata deserialize] FileMetadata deserialized successfully.\n";
 
     } catch (const std::exception& e) {
@@ -346,8 +1478,150 @@ void deserialize(std::fstream& file) {
     }
 }
 
+    // Bring metadata deserialized earlier up to date with the table's files: replay the
+    // log records appended since, or deserialize again if the table was checkpointed
+    // meanwhile or this copy holds unsaved changes. One small read when nothing changed.
+void refresh(std::fstream& file, const std::string& filePath) {
+    auto reload = [&]() {
+        file.clear();
+        file.seekg(0);
+        deserialize(file, filePath);
+    };
+    if (headerDirty || !pendingDeltas.empty() || formatVersion < FORMAT_VERSION) {
+        reload();
+        return;
+    }
+    std::ifstream log(logPath(filePath), std::ios::binary | std::ios::ate);
+    bumpCounter(engineCounters().fileOpens);
+    uint64_t size = log ? static_cast<uint64_t>(log.tellg()) : 0;
+    log.seekg(0);
+    if (!log || !logMatchesSnapshot(log) || size < loggedBytes()) {
+        reload();
+        return;
+    }
+    if (size == loggedBytes()) {
+        return;
+    }
+    uint64_t before = loggedBytes();
+    log.seekg(static_cast<std::streamoff>(before));
+    replayLogRecords(log);
+    log.close();
+    truncateLog(filePath, loggedBytes());
+    bumpCounter(engineCounters().metadataDeserializeBytes, loggedBytes() - before);
+}
+
+private:
+    // Load the checkpointed map, then replay the delta records written since
+    // Returns the number of sidecar bytes read
+uint64_t loadSnapshotAndLog(const std::string& filePath) {
+    uint64_t bytesRead = 0;
+    checkpointGeneration = 0;
+    logRecordCount = 0;
+    pageDirectory.clear();
+    extentEnd = METADATA_SIZE;
+
+    std::ifstream snapFile(snapshotPath(filePath), std::ios::binary);
+    bumpCounter(engineCounters().fileOpens);
+    if (snapFile) {
+        uint32_t magic = 0;
+        uint64_t mapSize = 0;
+        snapFile.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        if (magic != SNAPSHOT_MAGIC) {
+            throw std::runtime_error("corrupt metadata snapshot for " + filePath);
+        }
+        snapFile.read(reinterpret_cast<char*>(&checkpointGeneration), sizeof(checkpointGeneration));
+        snapFile.read(reinterpret_cast<char*>(&pageCount), sizeof(pageCount));
+        snapFile.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
+        std::vector<int64_t> entries(mapSize * 2);
+        snapFile.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(int64_t));
+        if (!snapFile) {
+            throw std::runtime_error("truncated metadata snapshot for " + filePath);
+        }
+        bytesRead += sizeof(magic) + 3 * sizeof(uint64_t) + entries.size() * sizeof(int64_t);
+        // Entries were written in key order, so hinted inserts keep the load linear
+        for (uint64_t i = 0; i < mapSize; ++i) {
+            tupleToPageMap.emplace_hint(tupleToPageMap.end(), entries[2 * i], entries[2 * i + 1]);
+        }
+
+        // Page directory (absent in snapshots written before compression existed)
+        uint64_t directorySize = 0;
+        if (snapFile.read(reinterpret_cast<char*>(&directorySize), sizeof(directorySize))) {
+            for (uint64_t i = 0; i < directorySize && snapFile; ++i) {
+                PageExtent extent;
+                snapFile.read(reinterpret_cast<char*>(&extent.offset), sizeof(extent.offset));
+                snapFile.read(reinterpret_cast<char*>(&extent.capacity), sizeof(extent.capacity));
+                if (extent.capacity > 0) {
+                    applyPageExtent(static_cast<uint32_t>(i), extent);
+                }
+            }
+            bytesRead += sizeof(directorySize) + directorySize * (sizeof(uint64_t) + sizeof(uint32_t));
+        }
+    }
+
+    std::ifstream log(logPath(filePath), std::ios::binary);
+    bumpCounter(engineCounters().fileOpens);
+    if (!log || !logMatchesSnapshot(log)) {
+        std::cout << "[DEBUG File Metadata deserialize] Ignoring stale metadata log.\n";
+        headerDirty = true; // Records appended to this log would be ignored on load, so checkpoint first
+        return bytesRead;
+    }
+    replayLogRecords(log);
+    log.close();
+    truncateLog(filePath, loggedBytes());
+    return bytesRead + loggedBytes();
+}
+
+static constexpr uint64_t LOG_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+    // Bytes of the log reflected in memory
+uint64_t loggedBytes() const {
+    return LOG_HEADER_SIZE + logRecordCount * MetadataDelta::RECORD_SIZE;
+}
+
+    // Read the log header; true if the log continues the loaded snapshot
+bool logMatchesSnapshot(std::istream& log) const {
+    uint32_t magic = 0;
+    uint64_t generation = 0;
+    log.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    log.read(reinterpret_cast<char*>(&generation), sizeof(generation));
+    return log && magic == METADATA_LOG_MAGIC && generation == checkpointGeneration;
+}
+
+    // Apply the records from the current log position on
+void replayLogRecords(std::istream& log) {
+    char record[MetadataDelta::RECORD_SIZE];
+    while (log.read(record, sizeof(record))) {
+        MetadataDelta delta;
+        delta.kind = static_cast<uint8_t>(record[0]);
+        std::memcpy(&delta.key, record + 1, sizeof(delta.key));
+        std::memcpy(&delta.value, record + 1 + sizeof(delta.key), sizeof(delta.value));
+        if (!applyDelta(delta)) {
+            break; // Torn or unknown record: stop at the last good one
+        }
+        logRecordCount++;
+    }
+}
+
+    // Cut the log after its last good record. Records appended after a torn one would
+    // otherwise be skipped, with it, on every later load.
+static void truncateLog(const std::string& filePath, uint64_t validBytes) {
+    std::error_code error;
+    uint64_t size = fs::file_size(logPath(filePath), error);
+    if (!error && size > validBytes) {
+        std::cout << "[DEBUG File Metadata deserialize] Truncating metadata log after " << validBytes << " bytes.\n";
+        fs::resize_file(logPath(filePath), validBytes, error);
+        if (error) {
+            throw std::runtime_error("unable to truncate metadata log for " + filePath + ": " + error.message());
+        }
+    }
+}
+
+public:
+
     void printMetadata() const {
     std::cout << "=== File Metadata ===\n";
+    std::cout << "Format Version: " << formatVersion << "\n";
+    std::cout << "Compressed Pages: " << (isCompressed() ? "yes" : "no") << "\n";
 
     // Print schema
     std::cout << "Schema:\n";
@@ -384,12 +1658,145 @@ void deserialize(std::fstream& file) {
 
 // Page represents a logical page within a database file
 struct PageMetadata {
-    uint16_t pageID;        // Unique page identifier
+    uint32_t pageID;        // Unique page identifier
     uint16_t slotCount;     // Number of active slots
     uint16_t freeSpace;     // Remaining free space in bytes
     uint16_t freeSpaceEnd;  // Offset where free space ends (starting from the back)
 };
 
+// Page header as written by version 1 files (16-bit page IDs)
+struct LegacyPageMetadata {
+    uint16_t pageID;
+    uint16_t slotCount;
+    uint16_t freeSpace;
+    uint16_t freeSpaceEnd;
+};
+
+// Small LZ77 codec (LZ4-style block format) used for compressed tables.
+// Each sequence is a token byte (literal length << 4 | match length - 4), optional
+// length extension bytes, the literals, then a 16-bit match offset. The final
+// sequence carries literals only.
+class PageCodec {
+private:
+    static constexpr int HASH_BITS = 12;
+    static constexpr size_t MIN_MATCH = 4;
+
+    static uint32_t read32(const char* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // Write a length that did not fit in its token nibble
+    static bool writeLength(size_t length, char* dst, size_t& op, size_t capacity) {
+        while (length >= 255) {
+            if (op >= capacity) return false;
+            dst[op++] = static_cast<char>(255);
+            length -= 255;
+        }
+        if (op >= capacity) return false;
+        dst[op++] = static_cast<char>(length);
+        return true;
+    }
+
+    static bool readLength(const unsigned char* src, size_t n, size_t& ip, size_t& length) {
+        unsigned char b;
+        do {
+            if (ip >= n) return false;
+            b = src[ip++];
+            length += b;
+        } while (b == 255);
+        return true;
+    }
+
+    static bool emitSequence(const char* literals, size_t literalLength, size_t offset, size_t matchLength,
+                             char* dst, size_t& op, size_t capacity) {
+        if (op >= capacity) return false;
+        size_t tokenPos = op++;
+        unsigned char token = static_cast<unsigned char>(std::min<size_t>(literalLength, 15) << 4);
+        if (literalLength >= 15 && !writeLength(literalLength - 15, dst, op, capacity)) return false;
+        if (op + literalLength > capacity) return false;
+        std::memcpy(dst + op, literals, literalLength);
+        op += literalLength;
+        if (matchLength > 0) {
+            size_t code = matchLength - MIN_MATCH;
+            token |= static_cast<unsigned char>(std::min<size_t>(code, 15));
+            if (op + 2 > capacity) return false;
+            dst[op++] = static_cast<char>(offset & 0xFF);
+            dst[op++] = static_cast<char>(offset >> 8);
+            if (code >= 15 && !writeLength(code - 15, dst, op, capacity)) return false;
+        }
+        dst[tokenPos] = static_cast<char>(token);
+        return true;
+    }
+
+public:
+    // Returns the compressed size, or 0 if the output would not fit in `capacity`
+    static size_t compress(const char* src, size_t n, char* dst, size_t capacity) {
+        std::vector<int32_t> table(size_t(1) << HASH_BITS, -1);
+        size_t op = 0;
+        size_t anchor = 0;
+        size_t ip = 0;
+        // Leave the tail as literals so match probing never reads past the input
+        size_t limit = n > MIN_MATCH + 1 ? n - MIN_MATCH - 1 : 0;
+
+        while (ip < limit) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+            int32_t ref = table[hash];
+            table[hash] = static_cast<int32_t>(ip);
+
+            if (ref >= 0 && ip - ref <= 0xFFFF && read32(src + ref) == sequence) {
+                size_t matchLength = MIN_MATCH;
+                while (ip + matchLength < n && src[ref + matchLength] == src[ip + matchLength]) {
+                    ++matchLength;
+                }
+                if (!emitSequence(src + anchor, ip - anchor, ip - ref, matchLength, dst, op, capacity)) {
+                    return 0;
+                }
+                ip += matchLength;
+                anchor = ip;
+            } else {
+                ++ip;
+            }
+        }
+        if (!emitSequence(src + anchor, n - anchor, 0, 0, dst, op, capacity)) {
+            return 0;
+        }
+        return op;
+    }
+
+    // Decompress exactly `expected` bytes; false on malformed input
+    static bool decompress(const char* source, size_t n, char* dst, size_t expected) {
+        const unsigned char* src = reinterpret_cast<const unsigned char*>(source);
+        size_t ip = 0;
+        size_t op = 0;
+        while (ip < n) {
+            unsigned char token = src[ip++];
+            size_t literalLength = token >> 4;
+            if (literalLength == 15 && !readLength(src, n, ip, literalLength)) return false;
+            if (ip + literalLength > n || op + literalLength > expected) return false;
+            std::memcpy(dst + op, src + ip, literalLength);
+            ip += literalLength;
+            op += literalLength;
+            if (ip == n) break; // Last sequence has no match
+
+            if (ip + 2 > n) return false;
+            size_t offset = src[ip] | (size_t(src[ip + 1]) << 8);
+            ip += 2;
+            size_t matchLength = token & 0x0F;
+            if (matchLength == 15 && !readLength(src, n, ip, matchLength)) return false;
+            matchLength += MIN_MATCH;
+            if (offset == 0 || offset > op || op + matchLength > expected) return false;
+            // Byte-wise copy: matches may overlap their own output
+            for (size_t i = 0; i < matchLength; ++i, ++op) {
+                dst[op] = dst[op - offset];
+            }
+        }
+        return op == expected;
+    }
+};
+
 class Page {
 private:
 
@@ -399,7 +1806,7 @@ private:
     
 public:
 
-    Page(uint16_t id) {
+    Page(uint32_t id) {
     metadata.pageID = id;
     metadata.slotCount = 0;
     metadata.freeSpace = PAGE_SIZE - sizeof(PageMetadata);
@@ -415,6 +1822,18 @@ public:
     size_t getFreeSpace() const {
         return metadata.freeSpace;
     }
+
+    // Bytes taken by live rows and their slots. Deletes do not return space to
+    // getFreeSpace(), so this is what a compacted copy of the page would use.
+    size_t liveBytes() const {
+        size_t bytes = 0;
+        for (const Slot& slot : slots) {
+            if (slot.length > 0) {
+                bytes += slot.length + sizeof(Slot);
+            }
+        }
+        return bytes;
+    }
     
     uint16_t getTupleCount() const {
         return metadata.slotCount;  // Return the number of slots/tuples
@@ -423,48 +1842,61 @@ public:
     const std::vector<Slot>& getSlots() const {
         return slots;
     }
+    // Visit the bytes of every live row in slot order (quiet, for full-table scans)
+    template <typename Fn>
+    void forEachRow(Fn&& fn) const {
+        for (const Slot& slot : slots) {
+            if (slot.length != 0 && slot.offset + slot.length <= PAGE_SIZE) {
+                fn(std::string_view(data + slot.offset, slot.length));
+            }
+        }
+    }
+
+    // Bytes of the row in a slot; empty for a deleted or damaged slot (quiet, for scans)
+    std::string_view rowAt(size_t index) const {
+        const Slot& slot = slots[index];
+        if (slot.length == 0 || slot.offset + slot.length > PAGE_SIZE) {
+            return std::string_view();
+        }
+        return std::string_view(data + slot.offset, slot.length);
+    }
+
     Slot getSlot(size_t index) const {
         if (index < slots.size()) {
             return slots[index];
         }
         throw std::out_of_range("Slot index out of range");
     }
-    bool addTuple(const std::string& tuple, FileMetadata& fileMetadata, int tupleId) {
-        std::cout << "Debug addTuple: Attempting to add tuple. Free space: " << metadata.freeSpace
-                << ", Tuple size: " << tuple.size() + sizeof(Slot) << std::endl;
-
-        // Check if there's enough space for the tuple and slot metadata
+    // Copy a serialized row into the page and give it a slot, without touching the
+    // row map. Returns false if the row and its slot do not fit.
+    bool placeTuple(std::string_view tuple) {
         if (metadata.freeSpace < tuple.size() + sizeof(Slot)) {
-            std::cout << "Debug addTuple: Not enough space to add tuple.\n";
-            return false; // Not enough space
+            return false;
         }
 
-        // Calculate the offset where the tuple will be placed
+        // Rows grow down from the end of the page, slots up from the header
         uint16_t tupleOffset = metadata.freeSpaceEnd - tuple.size();
-        // Debug: Log tuple offset calculation
-        std::cout << "Debug addTuple: Calculating tuple offset. Free space end: " << metadata.freeSpaceEnd
-              << ", Tuple size: " << tuple.size() << std::endl;
-
-
-        // Safety check to prevent writing out of bounds
-        if (tupleOffset < sizeof(PageMetadata) + slots.size() * sizeof(Slot)) {
-            std::cerr << "Error addTuple: Not enough space for tuple and slot metadata.\n";
+        if (tupleOffset < sizeof(PageMetadata) + (slots.size() + 1) * sizeof(Slot)) {
             return false;
         }
+        std::memcpy(data + tupleOffset, tuple.data(), tuple.size());
+        slots.push_back({tupleOffset, static_cast<uint16_t>(tuple.size())});
 
-        // Insert the tuple into the page's data array
-        std::memcpy(data + tupleOffset, tuple.c_str(), tuple.size());
-        std::cout << "Debug addTuple: Tuple added at offset: " << tupleOffset << " with size: " << tuple.size() << std::endl;
-
-
-        // Create a new slot for the tuple
-        Slot slot = {tupleOffset, static_cast<uint16_t>(tuple.size())};
-        slots.push_back(slot);
-
-        // Update page metadata
         metadata.freeSpaceEnd = tupleOffset;
         metadata.freeSpace -= (tuple.size() + sizeof(Slot));
         metadata.slotCount++;
+        return true;
+    }
+
+    bool addTuple(const std::string& tuple, FileMetadata& fileMetadata, int64_t tupleId) {
+        std::cout << "Debug addTuple: Attempting to add tuple. Free space: " << metadata.freeSpace
+                << ", Tuple size: " << tuple.size() + sizeof(Slot) << std::endl;
+
+        if (!placeTuple(tuple)) {
+            std::cout << "Debug addTuple: Not enough space to add tuple.\n";
+            return false; // Not enough space
+        }
+        std::cout << "Debug addTuple: Tuple added at offset: " << metadata.freeSpaceEnd << " with size: " << tuple.size() << std::endl;
         std::cout << "Debug addTuple: Slot count after adding tuple: " << metadata.slotCount << std::endl;
 
 
@@ -479,55 +1911,82 @@ public:
         return true;
     }
 
-    void serialize(std::fstream& dbFile) {
-        if (!dbFile) {
-            std::cerr << "Error page serialize: File stream is not open or valid.\n";
-            return;
+    // On-disk frame is exactly PAGE_SIZE bytes:
+    // [PageMetadata][active slots][free space ... ][tuple bytes]
+    // Deleted slots are dropped here, so slot indices are compacted on every write.
+    bool toFrame(char* frame) const {
+        std::memcpy(frame, data, PAGE_SIZE);
+
+        // Collect the active slots
+        std::vector<Slot> activeSlots;
+        for (const auto& slot : slots) {
+            if (slot.length > 0) {
+                activeSlots.push_back(slot);
+            }
         }
 
-        // Write the page metadata
-        dbFile.write(reinterpret_cast<char*>(&metadata), sizeof(PageMetadata));
-        if (!dbFile) {
-            std::cerr << "Error  page serialize: Failed to write page metadata.\n";
-            return;
+        PageMetadata header = metadata;
+        header.slotCount = static_cast<uint16_t>(activeSlots.size());
+        size_t slotBytes = activeSlots.size() * sizeof(Slot);
+        if (sizeof(PageMetadata) + slotBytes > header.freeSpaceEnd) {
+            std::cerr << "Error page toFrame: Slot directory overlaps tuple data.\n";
+            return false;
         }
-        std::cout << "Debug  page serialize: Serialized page metadata (PageID: " << metadata.pageID << ", SlotCount: " << metadata.slotCount << ")\n";
+        std::memcpy(frame, &header, sizeof(PageMetadata));
+        if (slotBytes > 0) {
+            std::memcpy(frame + sizeof(PageMetadata), activeSlots.data(), slotBytes);
+        }
+        return true;
+    }
 
-        // Count and write the number of active slots
-        uint16_t activeSlotCount = 0;
-        for (const auto& slot : slots) {
-            if (slot.length > 0) {
-                ++activeSlotCount;
+    bool fromFrame(const char* frame) {
+        std::memcpy(&metadata, frame, sizeof(PageMetadata));
+
+        // Clear existing slots and prepare to load new ones
+        slots.clear();
+        const char* slotArea = frame + sizeof(PageMetadata);
+        for (int i = 0; i < metadata.slotCount; ++i) {
+            if (sizeof(PageMetadata) + (i + 1) * sizeof(Slot) > PAGE_SIZE) {
+                std::cerr << "Error page fromFrame: Slot directory runs past the page end.\n";
+                break;
+            }
+            Slot slot;
+            std::memcpy(&slot, slotArea + i * sizeof(Slot), sizeof(Slot));
+
+            // Ensure that the slot has a valid length and does not exceed the page size
+            if (slot.length > 0 && slot.offset + slot.length <= PAGE_SIZE) {
+                slots.push_back(slot);
+            } else {
+                // Log error if the slot is invalid
+                std::cerr << "Error page fromFrame: Invalid slot at index " << i << ". Offset: " << slot.offset
+                          << ", Length: " << slot.length << std::endl;
             }
         }
-        dbFile.write(reinterpret_cast<char*>(&activeSlotCount), sizeof(activeSlotCount));
+        metadata.slotCount = static_cast<uint16_t>(slots.size());
+
+        std::memcpy(data, frame, PAGE_SIZE);
+        return true;
+    }
+
+    void serialize(std::fstream& dbFile) {
         if (!dbFile) {
-            std::cerr << "Error  page serialize: Failed to write active slot count.\n";
+            std::cerr << "Error page serialize: File stream is not open or valid.\n";
             return;
         }
 
-        std::cout << "Debug  page serialize: Active slots count: " << activeSlotCount << std::endl;
-
-        // Serialize each active slot
-        for (const auto& slot : slots) {
-            if (slot.length > 0) {
-                dbFile.write(reinterpret_cast<const char*>(&slot), sizeof(Slot));
-                if (!dbFile) {
-                    std::cerr << "Error  page serialize: Failed to write slot metadata.\n";
-                    return;
-                }
-                std::cout << "Debug  page serialize: Serialized Slot. Offset: " << slot.offset 
-                        << ", Length: " << slot.length << std::endl;
-            }
+        char frame[PAGE_SIZE];
+        if (!toFrame(frame)) {
+            dbFile.setstate(std::ios::failbit);
+            return;
         }
 
-        // Write the page data
-        dbFile.write(data, PAGE_SIZE);
+        // Write the whole frame in one call
+        dbFile.write(frame, PAGE_SIZE);
         if (!dbFile) {
             std::cerr << "Error  page serialize: Failed to write page data.\n";
             return;
         }
-        std::cout << "Debug  page serialize: Finished serializing page.\n";
+        std::cout << "Debug  page serialize: Serialized page (PageID: " << metadata.pageID << ", SlotCount: " << metadata.slotCount << ")\n";
 }
 
 void deserialize(std::istream& dbFile) {
@@ -538,65 +1997,75 @@ void deserialize(std::istream& dbFile) {
         return;
     }
 
-    // Read the page metadata
-    dbFile.read(reinterpret_cast<char*>(&metadata), sizeof(PageMetadata));
+    // Read the whole frame
+    char frame[PAGE_SIZE];
+    dbFile.read(frame, PAGE_SIZE);
     if (!dbFile) {
-        std::cerr << "Error page deserialize: Failed to read page metadata.\n";
+        std::cerr << "Error page deserialize: Failed to read page frame.\n";
         return;
     }
-    std::cout << "Debug page deserialize: Deserialized page metadata successfully. PageID: " << metadata.pageID
+    fromFrame(frame);
+
+    std::cout << "Debug page deserialize: Finished deserializing page. PageID: " << metadata.pageID
               << ", SlotCount: " << metadata.slotCount << "\n";
 
-    // Read the number of slots
-    uint16_t slotCount;
+}
+
+// Read a page record written by a version 1 file:
+// [LegacyPageMetadata][uint16 slot count][slots][PAGE_SIZE bytes of data]
+bool deserializeLegacy(std::istream& dbFile) {
+    LegacyPageMetadata legacy;
+    dbFile.read(reinterpret_cast<char*>(&legacy), sizeof(legacy));
+    uint16_t slotCount = 0;
     dbFile.read(reinterpret_cast<char*>(&slotCount), sizeof(slotCount));
     if (!dbFile) {
-        std::cerr << "Error page deserialize: Failed to read slot count.\n";
-        return;
+        std::cerr << "Error page deserializeLegacy: Failed to read legacy page header.\n";
+        return false;
     }
-    std::cout << "Debug page deserialize: Slot count from file: " << slotCount << std::endl;
-
-    // Clear existing slots and prepare to load new ones
-    slots.clear();
-    for (int i = 0; i < slotCount; ++i) {
-        Slot slot;
-        dbFile.read(reinterpret_cast<char*>(&slot), sizeof(Slot));
 
-         // Debugging output for each slot
-        if (dbFile) {
-            std::cout << "Deserialized Slot: Offset = " << slot.offset << ", Length = " << slot.length << std::endl;
-        } else {
-            std::cerr << "Error page deserialize: Failed to read slot " << i << std::endl;
-            return;
-        }
+    std::vector<Slot> legacySlots(slotCount);
+    if (slotCount > 0) {
+        dbFile.read(reinterpret_cast<char*>(legacySlots.data()), slotCount * sizeof(Slot));
+    }
+    dbFile.read(data, PAGE_SIZE);
+    if (!dbFile) {
+        std::cerr << "Error page deserializeLegacy: Failed to read legacy page body.\n";
+        return false;
+    }
 
-        // Ensure that the slot has a valid length and does not exceed the page size
+    // Legacy pages never reserved room for the slot directory at the front of the data
+    // area, so rebuild the layout: keep valid tuples and recompute the free-space bounds.
+    slots.clear();
+    uint16_t lowestOffset = PAGE_SIZE;
+    for (const auto& slot : legacySlots) {
         if (slot.length > 0 && slot.offset + slot.length <= PAGE_SIZE) {
             slots.push_back(slot);
-            std::cout << "Debug page deserialize: Slot added. Offset: " << slot.offset 
-                      << ", Length: " << slot.length << std::endl;
-        } else {
-            // Log error if the slot is invalid
-            std::cerr << "Error page deserialize: Invalid slot at index " << i << ". Offset: " << slot.offset
-                      << ", Length: " << slot.length << std::endl;
+            lowestOffset = std::min(lowestOffset, slot.offset);
         }
     }
-
-    // Read the page data
-    dbFile.read(data, PAGE_SIZE);
-    if (!dbFile) {
-        std::cerr << "Error page deserialize: Failed to read page data.\n";
-        return;
+    size_t directoryEnd = sizeof(PageMetadata) + slots.size() * sizeof(Slot);
+    if (directoryEnd > lowestOffset) {
+        std::cerr << "Error page deserializeLegacy: Page " << legacy.pageID << " is too full to convert.\n";
+        return false;
     }
+    std::memset(data, 0, directoryEnd);
 
-    std::cout << "Debug page deserialize: Finished deserializing page. PageID: " << metadata.pageID << "\n";
+    metadata.pageID = legacy.pageID;
+    metadata.slotCount = static_cast<uint16_t>(slots.size());
+    metadata.freeSpaceEnd = lowestOffset;
+    metadata.freeSpace = static_cast<uint16_t>(lowestOffset - directoryEnd);
+    return true;
+}
 
+void setPageID(uint32_t id) {
+    metadata.pageID = id;
 }
 
 
-std::string getTupleIndex(const std::string& tablePath, uint16_t tupleID) {
+std::string getTupleIndex(const std::string& tablePath, int64_t tupleID) {
     std::fstream dbFile;
     dbFile.open(tablePath, std::ios::in | std::ios::binary);
+    bumpCounter(engineCounters().fileOpens);
     if (!dbFile.is_open()) {
         std::cerr << "Error getTupleIndex: Unable to open file: " << tablePath << std::endl;
         return "";
@@ -604,7 +2073,7 @@ std::string getTupleIndex(const std::string& tablePath, uint16_t tupleID) {
 
     // Deserialize file metadata (assumed at the beginning of the file)
     FileMetadata fileMetadata;
-    fileMetadata.deserialize(dbFile);
+    fileMetadata.deserialize(dbFile, tablePath);
 
      // Check for deserialization success
     if (dbFile.fail()) {
@@ -621,12 +2090,13 @@ std::string getTupleIndex(const std::string& tablePath, uint16_t tupleID) {
         return "";
     }
 
-    uint16_t pageID = it->second;
+    uint32_t pageID = static_cast<uint32_t>(it->second);
     std::cout << "Debug getTupleIndex: Found tuple with ID " << tupleID << " on page " << pageID << std::endl;
 
     // Use your getPagePosition function to get the page position
     uint64_t pagePosition = fileMetadata.getPagePosition(pageID); // Assuming getPagePosition handles the offset correctly
     std::cout << "Debug getTupleIndex: Seeking to page position " << pagePosition << std::endl;
+    dbFile.seekg(pagePosition, std::ios::beg);
 
     // Deserialize the page
     Page page(pageID);
@@ -639,7 +2109,7 @@ std::string getTupleIndex(const std::string& tablePath, uint16_t tupleID) {
     }
 
     // Map the tupleID to the correct slot index
-    uint16_t slotIndex = -1;
+    int slotIndex = -1;
     for (uint16_t i = 0; i < page.getTupleCount(); ++i) {
         // Assuming the tuple ID is stored in the tuple itself, you could compare here
         std::string tupleData = page.getTupleData(i);  // Retrieve the tuple data
@@ -672,6 +2142,11 @@ std::string getTupleIndex(const std::string& tablePath, uint16_t tupleID) {
 
 
     std::string getTupleData(uint16_t index) const {
+        return std::string(getTupleView(index));
+    }
+
+    // Row bytes of a slot as a view into the page, valid while the page is
+    std::string_view getTupleView(uint16_t index) const {
          // Debug: Check if the index is valid
         std::cout << "Debug getTupleData: Retrieving tuple at index " << index << std::endl;
 
@@ -686,13 +2161,25 @@ std::string getTupleIndex(const std::string& tablePath, uint16_t tupleID) {
         const Slot& slot = slots[index];
         std::cout << "Debug getTupleData: Tuple found. Offset: " << slot.offset << ", Length: " << slot.length << std::endl;
 
-        return std::string(data + slot.offset, slot.length);
+        return std::string_view(data + slot.offset, slot.length);
     }
     
-
-bool deleteTuple(uint16_t slotIndex, int tupleID, const std::string& tablePath) {
-    std::cout << "Debug deleteTuple: Attempting to delete tuple with ID " << tupleID << " at slot index " << slotIndex << std::endl;
-
+    // Delete the row in a slot from the page only; the caller updates the row map
+    bool clearSlot(uint16_t slotIndex) {
+        if (slotIndex >= slots.size() || slots[slotIndex].length == 0) {
+            return false;
+        }
+        Slot& slot = slots[slotIndex];
+        std::memset(data + slot.offset, 0, slot.length);
+        slot.length = 0;
+        slot.offset = 0;
+        metadata.slotCount--;
+        return true;
+    }
+
+bool deleteTuple(uint16_t slotIndex, int64_t tupleID, const std::string& tablePath) {
+    std::cout << "Debug deleteTuple: Attempting to delete tuple with ID " << tupleID << " at slot index " << slotIndex << std::endl;
+
     if (slotIndex >= slots.size() || slots[slotIndex].length == 0) {
         std::cerr << "Error deleteTuple: Tuple not found or already deleted at slot index " << slotIndex << std::endl;
         return false;  // Tuple not found or already deleted
@@ -702,6 +2189,7 @@ bool deleteTuple(uint16_t slotIndex, int tupleID, const std::string& tablePath)
     
     // Open the file to update the tuple-to-page map
     std::fstream dbFile(tablePath, std::ios::in | std::ios::out | std::ios::binary);
+    bumpCounter(engineCounters().fileOpens);
     if (!dbFile.is_open()) {
         std::cerr << "Error deleteTuple: Unable to open file: " << tablePath << std::endl;
         return false;
@@ -709,20 +2197,15 @@ bool deleteTuple(uint16_t slotIndex, int tupleID, const std::string& tablePath)
     
     // Deserialize the file metadata
     FileMetadata fileMetadata;
-    fileMetadata.deserialize(dbFile);
+    fileMetadata.deserialize(dbFile, tablePath);
     
     // Remove the tuple from the page map (mark as deleted)
     fileMetadata.removeTupleFromPageMap(tupleID);
     std::cout << "Debug deleteTuple: Tuple with ID " << tupleID << " is marked as deleted in the page map." << std::endl;
     
-    // Clear the data associated with the slot
-    std::memset(data + slot.offset, 0, slot.length);
-    std::cout << "Debug deleteTuple: Cleared data at offset " << slot.offset << ", Length: " << slot.length << std::endl;
-
-    // Reset the slot metadata to mark the tuple as deleted
-    slot.length = 0;
-    slot.offset = 0;
-    metadata.slotCount--;
+    // Clear the data associated with the slot and mark the slot as deleted
+    std::cout << "Debug deleteTuple: Clearing data at offset " << slot.offset << ", Length: " << slot.length << std::endl;
+    clearSlot(slotIndex);
     std::cout << "Debug deleteTuple: Slot marked as deleted. Remaining slot count: " << metadata.slotCount << std::endl;
 
     
@@ -737,23 +2220,20 @@ bool deleteTuple(uint16_t slotIndex, int tupleID, const std::string& tablePath)
     return true;
 }
 
-    int getTupleIndexByID(const std::string& id) const {
+    int getTupleIndexByID(int64_t id) const {
         std::cout << "Debug getTupleIndexByID: Searching for tuple with ID " << id << std::endl;
 
     // Iterate over all slots to find the tuple with the matching ID
+    Tuple tuple(operationResource());
     for (size_t i = 0; i < slots.size(); ++i) {
         if (slots[i].length == 0) {
             continue;  // Skip empty slots
         }
 
-        // Extract tuple data from the page
-        std::string tupleData(data + slots[i].offset, slots[i].length);
-
-        // Deserialize the tuple
-        Tuple tuple;
-        if (tuple.deserialize(tupleData)) {
-            std::string tupleID = tuple.getAttributeValue("id");
-            std::cout << "Debug getTupleIndexByID: Checking tuple ID " << tupleID << " at slot " << i << std::endl;
+        // Deserialize the tuple straight from the page
+        if (tuple.deserialize(std::string_view(data + slots[i].offset, slots[i].length))) {
+            std::optional<int64_t> tupleID = tuple.getInt("id");
+            std::cout << "Debug getTupleIndexByID: Checking tuple at slot " << i << std::endl;
 
             // Compare the deserialized ID with the requested ID
             if (tupleID == id) {
@@ -770,691 +2250,8723 @@ bool deleteTuple(uint16_t slotIndex, int tupleID, const std::string& tablePath)
 }
 };
 
-class Storage {
+// LRU cache of decoded pages shared by every table a Storage instance touches.
+// Compressed pages are decompressed once when they enter the pool. Writes go
+// through to disk and refresh the cached copy.
+class BufferPool {
+private:
+    struct Entry {
+        std::string tablePath;
+        uint32_t pageID;
+        Page page;
+    };
 
-    private:
-    std::vector<Page> pages;
-    uint32_t nextPageID = 1; // Unique page ID counter
+    size_t capacity;
+    std::list<Entry> lru;  // Most recently used at the front
+    std::map<std::pair<std::string, uint32_t>, std::list<Entry>::iterator> index;
+    std::map<std::string, uint64_t> writeCounts;  // Page writes and invalidations per table
 
-    private:
-    std::map<std::string, std::map<std::string, std::map<std::string, Tuple>>> databases;
+public:
+    explicit BufferPool(size_t capacityInPages = 256) : capacity(capacityInPages) {}
 
-    public:
-    bool createDatabase(const std::string& dbName) {
-        if (!fs::exists(dbName)) {
-            if (fs::create_directory(dbName)) {
-                std::cout << "Database folder created: " << dbName << std::endl;
-            } else {
-                std::cerr << "Error: Database could not be created.\n";
-                return false;
-            }
+    bool lookup(const std::string& tablePath, uint32_t pageID, Page& out) {
+        auto it = index.find({tablePath, pageID});
+        if (it == index.end()) {
+            bumpCounter(engineCounters().bufferPoolMisses);
+            return false;
         }
+        bumpCounter(engineCounters().bufferPoolHits);
+        lru.splice(lru.begin(), lru, it->second);
+        out = it->second->page;
         return true;
     }
 
-    bool tableExists(const std::string& dbName, const std::string& tableName) {
-        std::string tablePath = dbName + "/" + tableName + ".HAD";
-        return fs::exists(tablePath);
+    bool contains(const std::string& tablePath, uint32_t pageID) const {
+        return index.count({tablePath, pageID}) > 0;
     }
 
-    bool createTable(const std::string& dbName, const std::string& tableName, const std::map<std::string, std::string>& schema) {
-    std::string tablePath = dbName + "/" + tableName + ".HAD";
-    std::cout << "Debug createTable: Creating table at path: " << tablePath << std::endl;
+    void put(const std::string& tablePath, const Page& page) {
+        if (capacity == 0) {
+            return;
+        }
+        auto key = std::make_pair(tablePath, page.getPageID());
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->page = page;
+            lru.splice(lru.begin(), lru, it->second);
+            return;
+        }
+        lru.push_front({tablePath, page.getPageID(), page});
+        index[key] = lru.begin();
+        if (lru.size() > capacity) {
+            index.erase({lru.back().tablePath, lru.back().pageID});
+            lru.pop_back();
+        }
+    }
 
-    // Check if the table file already exists
-    if (fs::exists(tablePath)) {
-        std::cout << "Table already exists: " << tablePath << std::endl;
-        return true; // Table exists, so continue
+    // Count a write to pages of a table, made before the write starts
+    void noteWrite(const std::string& tablePath) {
+        ++writeCounts[tablePath];
     }
 
-    // Create a new table file
-    std::fstream newTable(tablePath, std::ios::binary | std::ios::out | std::ios::in | std::ios::trunc);
-    if (newTable) {
-        // Initialize metadata
-        FileMetadata metadata;
-        metadata.setPageCount(0); // Start with 0 pages
-        metadata.setSchema(schema); // Use the provided schema
-        std::cout << "Debug createTable: Initialized metadata with 0 pages and provided schema." << std::endl;
+    // Changes every time pages of the table are written or the table is invalidated.
+    // Every writer calls noteWrite() or invalidateTable(), so a page read from disk
+    // while the count stayed the same is the page as it stands.
+    uint64_t writeCount(const std::string& tablePath) const {
+        auto it = writeCounts.find(tablePath);
+        return it == writeCounts.end() ? 0 : it->second;
+    }
 
-        
-        // Serialize metadata to the file
-        metadata.serialize(newTable,tablePath);  // This will write metadata
-        if (newTable) {
-            std::cout << "Debug createTable: Serialized metadata to table file successfully." << std::endl;
-        } else {
-            std::cerr << "Error createTable: Failed to write metadata to table file." << std::endl;
+    // Drop every cached page of a table (after it is deleted or rewritten)
+    void invalidateTable(const std::string& tablePath) {
+        ++writeCounts[tablePath];
+        for (auto it = lru.begin(); it != lru.end();) {
+            if (it->tablePath == tablePath) {
+                index.erase({it->tablePath, it->pageID});
+                it = lru.erase(it);
+            } else {
+                ++it;
+            }
         }
-        std::cout << "Size of FileMetadata: " << sizeof(metadata) << " bytes" << std::endl;
-        newTable.close();
-        std::cout << "Created new table with metadata: " << tablePath << std::endl;
-        return true;
+    }
+};
+
+// Redo log of one table (see REDO_LOG_MAGIC). It also keeps the dirty page table:
+// pages whose logged image may not have reached the table file yet, each with the
+// LSN of the first record that dirtied it. A fuzzy checkpoint writes that table to
+// the log and drops every record older than the oldest dirty page, without waiting
+// for any page write.
+class RedoLog {
+public:
+    static constexpr uint8_t COMMIT = 1;      // [u32 pages][(u32 page ID, frame) per page][u32 deltas][delta records]
+    static constexpr uint8_t CHECKPOINT = 2;  // [u64 redo LSN][u32 dirty pages][(u32 page ID, u64 first LSN) per page]
+    static constexpr uint8_t TRANSACTION = 3; // [u32 length][decision file path, relative to the table's
+                                              // directory][COMMIT payload]; only counts once the
+                                              // transaction's decision file exists
+    static constexpr size_t HEADER_SIZE = 16;
+    static constexpr size_t RECORD_PREFIX = 2 * sizeof(uint32_t);  // Body length and checksum
+
+    struct Record {
+        uint8_t kind;
+        uint64_t lsn;
+        std::string payload;
+    };
+
+private:
+    std::string tablePath;
+    std::string path;
+    uint64_t baseLSN = 0;   // LSN of the first record in the file
+    uint64_t endLSN = 0;    // LSN the next record gets
+    uint64_t checkpointLSN = 0;  // endLSN right after the last checkpoint
+    bool created = false;   // The file exists and its header matches baseLSN
+    std::map<uint32_t, uint64_t> dirtyPages;
+
+    static void appendRecord(std::string& out, uint8_t kind, uint64_t lsn, const std::string& payload) {
+        std::string body;
+        body.reserve(1 + sizeof(lsn) + payload.size());
+        body.push_back(static_cast<char>(kind));
+        body.append(reinterpret_cast<const char*>(&lsn), sizeof(lsn));
+        body += payload;
+        uint32_t length = static_cast<uint32_t>(body.size());
+        uint32_t sum = checksum(body);
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+        out += body;
     }
 
-    std::cerr << "Error createTable: Failed to create table file at path: " << tablePath << std::endl;
-    return false;
-}
+    static std::string header(uint64_t firstLSN) {
+        std::string out;
+        uint32_t magic = REDO_LOG_MAGIC;
+        uint16_t version = REDO_LOG_VERSION;
+        uint16_t unused = 0;
+        out.append(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        out.append(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.append(reinterpret_cast<const char*>(&unused), sizeof(unused));
+        out.append(reinterpret_cast<const char*>(&firstLSN), sizeof(firstLSN));
+        return out;
+    }
 
-// Function to delete a table from the database
-bool deleteTable(const std::string& tablePath) {
-    std::cout << "Debug deleteTable: Attempting to delete table at path: " << tablePath << std::endl;
+public:
+    explicit RedoLog(const std::string& tablePath) : tablePath(tablePath), path(logPath(tablePath)) {}
 
-    if (fs::exists(tablePath)) {
-        std::cout << "Debug deleteTable: Table found, proceeding to delete..." << std::endl;
+    static std::string logPath(const std::string& tablePath) {
+        return tablePath + ".wal";
+    }
 
-        try {
-            fs::remove(tablePath); // Remove the table file
-           std::cout << "Debug deleteTable: Table deleted successfully: " << tablePath << std::endl;
+    // FNV-1a; catches records torn by a crash mid-append
+    static uint32_t checksum(std::string_view bytes) {
+        uint32_t hash = 2166136261u;
+        for (char c : bytes) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+        return hash;
+    }
+
+    // Read every intact record. A missing file is an empty log; reading stops at the
+    // first torn or corrupt record. nextLSN receives the LSN after the last good record.
+    static bool readRecords(const std::string& tablePath, std::vector<Record>& records, uint64_t& nextLSN) {
+        records.clear();
+        nextLSN = 0;
+        std::ifstream in(logPath(tablePath), std::ios::binary | std::ios::ate);
+        bumpCounter(engineCounters().fileOpens);
+        if (!in) {
             return true;
-        } catch (const fs::filesystem_error& e) {
-            std::cerr << "Error deleting table: " << e.what() << std::endl;
         }
-    } else {
-        std::cerr << "Error deleteTable: Table not found: " << tablePath << std::endl;
+        const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+        in.seekg(0);
+        uint32_t magic = 0;
+        uint16_t version = 0;
+        uint16_t unused = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&unused), sizeof(unused));
+        in.read(reinterpret_cast<char*>(&nextLSN), sizeof(nextLSN));
+        if (!in || magic != REDO_LOG_MAGIC || version > REDO_LOG_VERSION) {
+            std::cerr << "Error RedoLog: Unreadable redo log header for " << tablePath << std::endl;
+            return false;
+        }
+        uint64_t bytesRead = HEADER_SIZE;
+        std::string body;
+        for (;;) {
+            uint32_t length = 0;
+            uint32_t sum = 0;
+            in.read(reinterpret_cast<char*>(&length), sizeof(length));
+            in.read(reinterpret_cast<char*>(&sum), sizeof(sum));
+            if (!in || length < 1 + sizeof(uint64_t) || length > fileSize - bytesRead - RECORD_PREFIX) {
+                break; // Torn: the length itself may be garbage
+            }
+            body.resize(length);
+            if (!in.read(body.data(), length) || checksum(body) != sum) {
+                break;
+            }
+            Record record;
+            record.kind = static_cast<uint8_t>(body[0]);
+            std::memcpy(&record.lsn, body.data() + 1, sizeof(record.lsn));
+            if (record.lsn != nextLSN) {
+                break;
+            }
+            record.payload.assign(body, 1 + sizeof(uint64_t), std::string::npos);
+            records.push_back(std::move(record));
+            nextLSN += RECORD_PREFIX + length;
+            bytesRead += RECORD_PREFIX + length;
+        }
+        bumpCounter(engineCounters().bytesRead, bytesRead);
+        return true;
     }
-    return false;
-}
 
-// Helper function to load a page from the table
-Page loadPageByID(const std::string& tablePath, uint32_t pageID) {
-    std::cout << "Debug loadPageByID: Attempting to load page with ID: " << pageID << " from table: " << tablePath << std::endl;
+    // Position the log after recovery: the next record gets LSN next, no page is dirty.
+    // The file is rewritten by the following checkpoint().
+    void restart(uint64_t next) {
+        baseLSN = endLSN = next;
+        dirtyPages.clear();
+        created = false;
+    }
 
-    std::fstream dbFile(tablePath, std::ios::in | std::ios::binary);
-    if (!dbFile.is_open()) {
-        throw std::runtime_error("Failed to open table file: " + tablePath);
+    // Append a record and fdatasync it, so it is on disk before any page it covers is
+    // written; returns its LSN
+    std::optional<uint64_t> append(uint8_t kind, const std::string& payload) {
+        if (!created && !checkpoint()) {
+            return std::nullopt;
+        }
+        std::string bytes;
+        appendRecord(bytes, kind, endLSN, payload);
+        if (!appendDurably(path, bytes)) {
+            std::cerr << "Error RedoLog: Failed to append to " << path << std::endl;
+            return std::nullopt;
+        }
+        bumpCounter(engineCounters().bytesWritten, bytes.size());
+        uint64_t lsn = endLSN;
+        endLSN += bytes.size();
+        return lsn;
     }
-    std::cout << "Debug loadPageByID: Successfully opened table file." << std::endl;
 
-    // Read file metadata
-    FileMetadata fileMetadata;
-    fileMetadata.deserialize(dbFile);
-    std::cout << "Debug loadPageByID: File metadata deserialized successfully." << std::endl;
+    void markDirty(uint32_t pageID, uint64_t lsn) {
+        dirtyPages.emplace(pageID, lsn);  // Keeps the earliest LSN
+    }
 
-    uint32_t pagePosition = fileMetadata.getPagePosition(pageID);
-    std::cout << "Debug loadPageByID: Calculated page position for page ID " << pageID << ": " << pagePosition << std::endl;
+    void markClean(uint32_t pageID) {
+        dirtyPages.erase(pageID);
+    }
 
-    dbFile.seekg(pagePosition, std::ios::beg);
-    if (!dbFile) {
-        throw std::runtime_error("Failed to seek to page position: " + std::to_string(pagePosition));
+    bool hasDirtyPages() const {
+        return !dirtyPages.empty();
     }
-    std::cout << "Debug loadPageByID: Seeked to page position successfully." << std::endl;
 
-    // Load the page from the file
-    Page page(pageID);
-    page.deserialize(dbFile);
-    std::cout << "Debug loadPageByID: Page with ID " << pageID << " loaded successfully." << std::endl;
+    bool checkpointDue() const {
+        return endLSN - baseLSN >= REDO_CHECKPOINT_BYTES;
+    }
 
-    dbFile.close();
-    return page;
-}
+    // Records were appended since the last checkpoint
+    bool hasNewRecords() const {
+        return created && endLSN > checkpointLSN;
+    }
 
-std::vector<Tuple> getTuplesFromPage(const Page& page) {
-    std::vector<Tuple> tuples;
-    std::cout << "Debug getTuplesFromPage: Retrieving tuples from page. Total slot count: " << page.getTupleCount() << std::endl;
+    // Fuzzy checkpoint: keep the records from the oldest dirty page's LSN on, followed
+    // by a checkpoint record holding the dirty page table. The new file is swapped in
+    // with a rename, so a crash leaves either the old log or the new one.
+    bool checkpoint() {
+        TraceSpan span("redo_checkpoint");
+        uint64_t redoLSN = endLSN;
+        for (const auto& [pageID, lsn] : dirtyPages) {
+            redoLSN = std::min(redoLSN, lsn);
+        }
 
-    // Iterate through the slots in the page
-    for (size_t i = 0; i < page.getTupleCount(); ++i) {
-        try {
-            // Retrieve tuple data from the page using the slot index
-            std::string tupleData = page.getTupleData(i);
-            std::cout << "Debug getTuplesFromPage: Retrieved tuple data from slot " << i << ". Data length: " << tupleData.size() << std::endl;
+        // The records dropped below are the only durable copy of the page writes and
+        // metadata deltas they cover until the table and its metadata log are synced
+        if (!created || redoLSN > baseLSN) {
+            for (const std::string& covered : {tablePath, FileMetadata::logPath(tablePath)}) {
+                if (fs::exists(covered) && !syncFile(covered)) {
+                    std::cerr << "Error RedoLog: Failed to sync " << covered << " for a checkpoint" << std::endl;
+                    return false;
+                }
+            }
+        }
 
-            // Deserialize the tuple data into a Tuple object
-            Tuple tuple;
-           if (tuple.deserialize(tupleData)) {
-                tuples.push_back(tuple); // Add the tuple to the result
-                std::cout << "Debug getTuplesFromPage: Tuple deserialized successfully at slot " << i << std::endl;
-            } else {
-                std::cerr << "Error getTuplesFromPage: Failed to deserialize tuple data at slot " << i << std::endl;
+        std::string bytes = header(redoLSN);
+        if (redoLSN < endLSN) {
+            std::ifstream in(path, std::ios::binary);
+            bumpCounter(engineCounters().fileOpens);
+            std::string kept(endLSN - redoLSN, '\0');
+            in.seekg(static_cast<std::streamoff>(HEADER_SIZE + (redoLSN - baseLSN)));
+            if (!in.read(kept.data(), kept.size())) {
+                std::cerr << "Error RedoLog: Failed to read " << path << " for a checkpoint" << std::endl;
+                return false;
+            }
+            bytes += kept;
+        }
+        std::string payload;
+        uint32_t dirtyCount = static_cast<uint32_t>(dirtyPages.size());
+        payload.append(reinterpret_cast<const char*>(&redoLSN), sizeof(redoLSN));
+        payload.append(reinterpret_cast<const char*>(&dirtyCount), sizeof(dirtyCount));
+        for (const auto& [pageID, lsn] : dirtyPages) {
+            payload.append(reinterpret_cast<const char*>(&pageID), sizeof(pageID));
+            payload.append(reinterpret_cast<const char*>(&lsn), sizeof(lsn));
+        }
+        appendRecord(bytes, CHECKPOINT, endLSN, payload);
+
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            bumpCounter(engineCounters().fileOpens);
+            out.write(bytes.data(), bytes.size());
+            out.flush();
+            if (!out) {
+                std::cerr << "Error RedoLog: Failed to write " << tmpPath << std::endl;
+                return false;
             }
-  
-        } catch (const std::exception& e) {
-            std::cerr << "Error retrieving tuple at slot " << i << ": " << e.what() << std::endl;
         }
+        if (!syncFile(tmpPath)) {
+            return false;
+        }
+        fs::rename(tmpPath, path);
+        bumpCounter(engineCounters().bytesWritten, bytes.size());
+        baseLSN = redoLSN;
+        endLSN = redoLSN + (bytes.size() - HEADER_SIZE);
+        checkpointLSN = endLSN;
+        created = true;
+        return syncParentDirectory(path);
     }
-    std::cout << "Debug getTuplesFromPage: Retrieved " << tuples.size() << " tuples from the page." << std::endl;
+};
 
-    return tuples;
-}
+// Distinct values of one dictionary-encoded column; a value's code is its position
+class ColumnDictionary {
+private:
+    std::vector<std::string> values;
+    std::unordered_map<std::string, int64_t> codes;
 
-    // Check if a tuple with a specific ID exists in a file
-bool hasTupleWithIDInFile(const std::string& tablePath, int id) {
-    // Open the table file in binary read mode
-    std::fstream dbFile(tablePath,std::ios::in | std::ios::out | std::ios::binary);
-    if (!dbFile.is_open()) {
-        std::cerr << "Failed to open table file: " << tablePath << "\n";
-        return false;
+public:
+    std::optional<int64_t> lookup(const std::string& value) const {
+        auto it = codes.find(value);
+        if (it == codes.end()) {
+            return std::nullopt;
+        }
+        return it->second;
     }
 
-    // Deserialize file metadata from the beginning of the file
-    FileMetadata fileMetadata;
-    try {
-        fileMetadata.deserialize(dbFile);
-        std::cout << "Debug hasTupleWithIDInFile: Successfully deserialized file metadata.\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error during file metadata deserialization: " << e.what() << "\n";
-        dbFile.close();
-        return false;
+    int64_t add(const std::string& value) {
+        int64_t code = static_cast<int64_t>(values.size());
+        values.push_back(value);
+        codes.emplace(value, code);
+        return code;
     }
 
-    // Use the tuple-to-page map to find the page ID associated with the tuple ID
-    const auto& tupleToPageMap = fileMetadata.getTupleToPageMap();
-    std::cout << "Debug hasTupleWithIDInFile: Checking for tuple with ID " << id << " in the tuple-to-page map.\n";
+    // Forget the most recently added value
+    void removeLast() {
+        codes.erase(values.back());
+        values.pop_back();
+    }
 
-    auto it = tupleToPageMap.find(id);
+    const std::string& decode(int64_t code) const {
+        if (code < 0 || static_cast<size_t>(code) >= values.size()) {
+            throw std::out_of_range("Unknown dictionary code: " + std::to_string(code));
+        }
+        return values[code];
+    }
 
-    if (it == tupleToPageMap.end()) {
-        std::cerr << "Error hasTupleWithIDInFile: Tuple ID " << id << " not found in the tuple-to-page map.\n";
-        dbFile.close();
-        return false;
+    size_t size() const {
+        return values.size();
     }
-     // Check if the tuple is marked as deleted (e.g., -2 for deletion)
-    if (it->second == -2) {
-        std::cout << "Debug hasTupleWithIDInFile: Tuple ID " << id << " is marked as deleted.\n";
-        dbFile.close();
-        return false;
+};
+
+// Per-table dictionaries, persisted next to the table as "<table>.HAD.dict":
+// [magic][uint16 column count]{[uint16 length][name]}... followed by one record per
+// new value {[uint16 column index][uint32 length][value]}. Records are only appended,
+// so codes stay stable and adding a value costs one small write.
+class TableDictionary {
+private:
+    std::vector<std::string> columnOrder;               // Column index used by the records
+    std::map<std::string, ColumnDictionary> columns;
+    std::string path;
+    bool unsynced = false;  // Values were appended since the file was last synced
+    std::vector<std::pair<uint16_t, std::string>> staged;  // (column index, value) added by stage(), not in the file yet
+
+public:
+    static std::string dictionaryPath(const std::string& tablePath) {
+        return tablePath + ".dict";
     }
-    // If we found the tuple ID in the map and it's not deleted, return true
-    std::cout << "Debug hasTupleWithIDInFile: Tuple with ID " << id << " found and not deleted.\n";
-    dbFile.close();
-    return true;
-}
 
-std::string loadTuple(const std::string& tablePath, uint16_t tupleID) {
-    // Open the database file in read-binary mode
-    std::fstream dbFile(tablePath, std::ios::in | std::ios::binary);
-    if (!dbFile.is_open()) {
-        std::cerr << "Error loadTuple: Unable to open file: " << tablePath << std::endl;
-        return "";
+    bool create(const std::string& tablePath, const std::set<std::string>& columnNames) {
+        path = dictionaryPath(tablePath);
+        columnOrder.assign(columnNames.begin(), columnNames.end());
+        columns.clear();
+        for (const auto& name : columnOrder) {
+            columns[name];
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        uint32_t magic = DICTIONARY_MAGIC;
+        uint16_t columnCount = static_cast<uint16_t>(columnOrder.size());
+        out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&columnCount), sizeof(columnCount));
+        for (const auto& name : columnOrder) {
+            uint16_t length = static_cast<uint16_t>(name.size());
+            out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.write(name.data(), length);
+        }
+        out.flush();
+        if (!out) {
+            std::cerr << "Error TableDictionary create: Unable to write " << path << std::endl;
+            return false;
+        }
+        return true;
     }
 
-    // Deserialize the file metadata
-    FileMetadata fileMetadata;
-    try {
-        fileMetadata.deserialize(dbFile);
-        std::cout << "Debug loadTuple : Successfully deserialized file metadata." << std::endl;
-    } catch (const std::exception& e) {
-        std::cerr << "Error loadTuple: Failed to deserialize file metadata: " << e.what() << std::endl;
-        dbFile.close();
-        return "";
+    // Load the dictionary of a table; tables without a dictionary file load empty
+    bool load(const std::string& tablePath) {
+        path = dictionaryPath(tablePath);
+        columnOrder.clear();
+        columns.clear();
+
+        std::ifstream in(path, std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        if (!in) {
+            return true;
+        }
+        uint32_t magic = 0;
+        uint16_t columnCount = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&columnCount), sizeof(columnCount));
+        if (!in || magic != DICTIONARY_MAGIC) {
+            std::cerr << "Error TableDictionary load: Corrupt dictionary file " << path << std::endl;
+            return false;
+        }
+        for (uint16_t i = 0; i < columnCount; ++i) {
+            uint16_t length = 0;
+            in.read(reinterpret_cast<char*>(&length), sizeof(length));
+            std::string name(length, '\0');
+            in.read(&name[0], length);
+            columnOrder.push_back(name);
+            columns[name];
+        }
+
+        while (true) {
+            uint16_t columnIndex;
+            uint32_t length;
+            if (!in.read(reinterpret_cast<char*>(&columnIndex), sizeof(columnIndex)) ||
+                !in.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+                break;
+            }
+            std::string value(length, '\0');
+            if (!in.read(&value[0], length) || columnIndex >= columnOrder.size()) {
+                break; // Torn final record
+            }
+            columns[columnOrder[columnIndex]].add(value);
+        }
+        return true;
     }
 
-    // Use the tuple-to-page map to find the page ID associated with the tupleID
-    auto it = fileMetadata.getTupleToPageMap().find(tupleID);
-    if (it == fileMetadata.getTupleToPageMap().end() || it->second == -2) {
-        std::cerr << "Error loadTuple: Tuple ID " << tupleID << " not found or marked as deleted." << std::endl;
-        dbFile.close();
-        return "";
+    bool empty() const {
+        return columnOrder.empty();
     }
 
-    uint16_t pageID = it->second;
-    std::cout << "Debug loadTuple: Found tuple with ID " << tupleID << " on page " << pageID << std::endl;
+    bool isEncoded(const std::string& column) const {
+        return columns.count(column) > 0;
+    }
 
-    // Seek to the page position based on the pageID
-    uint32_t pagePosition = fileMetadata.getPagePosition(pageID);
-    dbFile.seekg(pagePosition, std::ios::beg);
-    if (!dbFile.good()) {
-        std::cerr << "Error loadTuple: Failed to seek to page position " << pagePosition << std::endl;
-        dbFile.close();
-        return "";
+    std::optional<int64_t> lookup(const std::string& column, const std::string& value) const {
+        auto it = columns.find(column);
+        if (it == columns.end()) {
+            return std::nullopt;
+        }
+        return it->second.lookup(value);
     }
 
-    // Deserialize the page
-    Page page(pageID);
-    try {
-        page.deserialize(dbFile);
-        std::cout << "Debug loadTuple: Page with ID " << pageID << " deserialized successfully." << std::endl;
-    } catch (const std::exception& e) {
-        std::cerr << "Error loadTuple: Failed to deserialize page: " << e.what() << std::endl;
-        dbFile.close();
-        return "";
+    // Code for a value, appending it to the dictionary file first if it is new
+    int64_t encode(const std::string& column, const std::string& value) {
+        int64_t code = stage(column, value);
+        if (!writeStaged()) {
+            discardStaged();
+            throw std::runtime_error("Failed to append to dictionary " + path);
+        }
+        return code;
     }
 
-    // Get the tuple data using the tuple index (this assumes the tuple ID is unique per page)
-    int slotIndex = page.getTupleIndexByID(std::to_string(tupleID));
-    if (slotIndex == -1) {
-        std::cerr << "Error loadTuple: Tuple ID " << tupleID << " not found on the page." << std::endl;
-        dbFile.close();
-        return "";
+    // Code for a value, adding it in memory only if it is new. Staged values reach the
+    // file with writeStaged(), or are forgotten again by discardStaged().
+    int64_t stage(const std::string& column, const std::string& value) {
+        ColumnDictionary& dictionary = columns.at(column);
+        if (std::optional<int64_t> code = dictionary.lookup(value)) {
+            return *code;
+        }
+        uint16_t columnIndex = static_cast<uint16_t>(
+            std::find(columnOrder.begin(), columnOrder.end(), column) - columnOrder.begin());
+        staged.emplace_back(columnIndex, value);
+        return dictionary.add(value);
     }
 
-    // Retrieve the tuple data from the page using the slot index
-    std::string tupleData = page.getTupleData(slotIndex);
-    std::cout << "Debug loadTuple: Tuple with ID " << tupleID << " retrieved successfully." << std::endl;
-
-    dbFile.close();
-    return tupleData;
-}
+    // Append the staged values to the file in one write. On failure the file is cut
+    // back to its previous size and the values stay staged.
+    bool writeStaged() {
+        if (staged.empty()) {
+            return true;
+        }
+        std::string records;
+        for (const auto& [columnIndex, value] : staged) {
+            uint32_t length = static_cast<uint32_t>(value.size());
+            records.append(reinterpret_cast<const char*>(&columnIndex), sizeof(columnIndex));
+            records.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            records.append(value);
+        }
+        std::error_code sizeError;
+        uint64_t previousSize = fs::file_size(path, sizeError);
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        bumpCounter(engineCounters().fileOpens);
+        out.write(records.data(), records.size());
+        out.flush();
+        if (!out) {
+            out.close();
+            if (!sizeError) {
+                fs::resize_file(path, previousSize, sizeError);
+            }
+            return false;
+        }
+        staged.clear();
+        unsynced = true;
+        return true;
+    }
 
+    // Forget the staged values, newest first, so codes stay positions
+    void discardStaged() {
+        for (auto it = staged.rbegin(); it != staged.rend(); ++it) {
+            columns.at(columnOrder[it->first]).removeLast();
+        }
+        staged.clear();
+    }
 
-std::map<std::string, std::string> get(const std::string& dbName, const std::string& tableName, const std::string& id) {
-    // Construct the table path
-    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    // Force appended values to disk, before a logged row can refer to their codes
+    bool sync() {
+        if (!unsynced) {
+            return true;
+        }
+        unsynced = !syncFile(path, true);
+        return !unsynced;
+    }
 
-    // Open the table file
-    std::fstream file(tablePath, std::ios::binary | std::ios::in);
-    if (!file) {
-        throw std::runtime_error("Failed to open the table file.");
+    const std::string& decode(const std::string& column, int64_t code) const {
+        return columns.at(column).decode(code);
     }
+};
 
-    // Read file metadata to get the tuple-to-page map
-    FileMetadata fileMetadata;
-    try {
-        fileMetadata.deserialize(file);
-    } catch (const std::exception& e) {
-        file.close();
-        throw std::runtime_error("Error deserializing file metadata: " + std::string(e.what()));
+// Split-block Bloom filter over the row IDs of a table, so lookups of IDs the table
+// does not have are answered without decoding its metadata. An ID sets one bit in
+// each of the eight words of a single 32-byte block, so a probe touches one cache
+// line. Deleted IDs are never removed: the filter only answers "absent" or "maybe".
+// It is sized for capacity IDs at 16 bits each; past that it is rebuilt larger.
+//
+// Persisted as "<table>.HAD.bloom": [magic][u16 version][u16 0][u64 metadata log
+// generation][u64 metadata log size][u64 key count][u64 capacity][blocks]. Every row
+// is added through a metadata log record or a checkpoint, so while the log still has
+// the generation and size it had when the filter was saved, no row is missing from it.
+class IdBloomFilter {
+public:
+    // Identity of a table's metadata log ("<table>.HAD.mlog")
+    struct Stamp {
+        uint64_t generation = 0;
+        uint64_t logSize = 0;
+
+        bool operator==(const Stamp& other) const {
+            return generation == other.generation && logSize == other.logSize;
+        }
+    };
+
+private:
+    struct alignas(32) Block {
+        uint32_t words[8];
+    };
+
+    static constexpr uint32_t SALTS[8] = {0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+                                          0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+
+    std::vector<Block> blocks;
+    uint64_t keyCount = 0;
+    uint64_t capacity = 0;
+
+    // Row IDs are dense integers; spread them over all 64 bits (splitmix64 finalizer)
+    static uint64_t hashId(int64_t id) {
+        uint64_t x = static_cast<uint64_t>(id) + 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
     }
-    
-    uint32_t tupleId;
-    try {
-        tupleId = std::stoi(id);  // Convert string id to integer
-    } catch (const std::invalid_argument& e) {
-        file.close();
-        throw std::invalid_argument("Invalid ID format: " + id);
+
+    // High half of the hash picks the block, low half the bit within each word
+    size_t blockOf(uint64_t hash) const {
+        return static_cast<size_t>(((hash >> 32) * blocks.size()) >> 32);
     }
 
-    // Check if the tuple exists in the map
-    auto it = fileMetadata.getTupleToPageMap().find(stoi(id));
-    if (it == fileMetadata.getTupleToPageMap().end() || it->second == -1) {
-        // Tuple ID not found or is marked as deleted
-        file.close();
-        throw std::out_of_range("Tuple ID not found");
+public:
+    static std::string filterPath(const std::string& tablePath) {
+        return tablePath + ".bloom";
     }
 
-    // Get the page ID from the map
-    uint32_t pageID = it->second;
+    // Current stamp of a table's metadata log, or nullopt if it has none (legacy files)
+    static std::optional<Stamp> currentStamp(const std::string& tablePath) {
+        std::ifstream log(FileMetadata::logPath(tablePath), std::ios::binary | std::ios::ate);
+        bumpCounter(engineCounters().fileOpens);
+        if (!log) {
+            return std::nullopt;
+        }
+        Stamp stamp;
+        stamp.logSize = static_cast<uint64_t>(log.tellg());
+        uint32_t magic = 0;
+        log.seekg(0);
+        log.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        log.read(reinterpret_cast<char*>(&stamp.generation), sizeof(stamp.generation));
+        if (!log || magic != METADATA_LOG_MAGIC) {
+            return std::nullopt;
+        }
+        return stamp;
+    }
 
-    // Calculate the position of the page in the file
-    file.seekg(fileMetadata.getPagePosition(pageID), std::ios::beg);
+    // Empty filter with room for expectedKeys, plus as many again for later inserts
+    void reset(uint64_t expectedKeys) {
+        capacity = std::max(ID_FILTER_MIN_KEYS, expectedKeys * 2);
+        keyCount = 0;
+        blocks.assign(static_cast<size_t>((capacity + 15) / 16), Block{});
+    }
 
-     if (!file.good()) {
-        file.close();
-        throw std::runtime_error("Failed to seek to page position in file.");
+    void add(int64_t id) {
+        uint64_t hash = hashId(id);
+        Block& block = blocks[blockOf(hash)];
+        uint32_t low = static_cast<uint32_t>(hash);
+        for (int i = 0; i < 8; ++i) {
+            block.words[i] |= 1u << ((low * SALTS[i]) >> 27);
+        }
+        keyCount++;
     }
 
-    // Load the page
-    Page page(pageID);
-    try {
-        page.deserialize(file);
-    } catch (const std::exception& e) {
-        file.close();
-        throw std::runtime_error("Error deserializing page with ID " + std::to_string(pageID) + ": " + std::string(e.what()));
+    bool mayContain(int64_t id) const {
+        uint64_t hash = hashId(id);
+        const Block& block = blocks[blockOf(hash)];
+        uint32_t low = static_cast<uint32_t>(hash);
+        for (int i = 0; i < 8; ++i) {
+            if (!(block.words[i] & (1u << ((low * SALTS[i]) >> 27)))) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    // Search for the tuple in the page
-    for (uint16_t i = 0; i < page.getTupleCount(); ++i) {
-        std::string tupleData = page.getTupleData(i);
-        Tuple tuple;
+    // More IDs were added than the filter was sized for
+    bool overfull() const {
+        return keyCount > capacity;
+    }
 
-        // Deserialize the tuple and check if the ID matches
-        if (tuple.deserialize(tupleData) && tuple.getAttributeValue("id") == id) {
-            file.close();
+    bool save(const std::string& tablePath, const Stamp& stamp) const {
+        std::string path = filterPath(tablePath);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        uint32_t magic = ID_FILTER_MAGIC;
+        uint16_t version = ID_FILTER_VERSION;
+        uint16_t padding = 0;
+        out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.write(reinterpret_cast<const char*>(&padding), sizeof(padding));
+        out.write(reinterpret_cast<const char*>(&stamp.generation), sizeof(stamp.generation));
+        out.write(reinterpret_cast<const char*>(&stamp.logSize), sizeof(stamp.logSize));
+        out.write(reinterpret_cast<const char*>(&keyCount), sizeof(keyCount));
+        out.write(reinterpret_cast<const char*>(&capacity), sizeof(capacity));
+        out.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(Block));
+        out.flush();
+        if (!out) {
+            std::cerr << "Error IdBloomFilter save: Unable to write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-            // Create a map to store the tuple's key-value pairs
-            std::map<std::string, std::string> result;
-            for (const auto& attribute : tuple.getAttributes()) {
-                // Assuming tuple.getAttributes() returns a list of attributes as pairs of <key, value>
-                result[attribute.first] = attribute.second.second;
-            }
-            return result; // Return the map of key-value pairs
+    // Load the saved filter of a table; false if there is none or it predates the stamp
+    bool load(const std::string& tablePath, const Stamp& stamp) {
+        std::ifstream in(filterPath(tablePath), std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        if (!in) {
+            return false;
+        }
+        uint32_t magic = 0;
+        uint16_t version = 0;
+        uint16_t padding = 0;
+        Stamp saved;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&padding), sizeof(padding));
+        in.read(reinterpret_cast<char*>(&saved.generation), sizeof(saved.generation));
+        in.read(reinterpret_cast<char*>(&saved.logSize), sizeof(saved.logSize));
+        in.read(reinterpret_cast<char*>(&keyCount), sizeof(keyCount));
+        in.read(reinterpret_cast<char*>(&capacity), sizeof(capacity));
+        if (!in || magic != ID_FILTER_MAGIC || version != ID_FILTER_VERSION || !(saved == stamp) ||
+            capacity < ID_FILTER_MIN_KEYS || capacity > (uint64_t(1) << 40)) {
+            return false;
         }
+        blocks.resize(static_cast<size_t>((capacity + 15) / 16));
+        in.read(reinterpret_cast<char*>(blocks.data()), blocks.size() * sizeof(Block));
+        return static_cast<bool>(in);
     }
+};
 
-    // If the tuple was not found
-    file.close();
-    throw std::out_of_range("Tuple with ID " + id + " not found on page " + std::to_string(pageID));
+// Pages of a table written since the backup named by (chain, sequence), one bit per
+// page ID, and how far the metadata sidecars reached at that backup. Only tables that
+// have been backed up have one. A bit reaches the file before the page it marks is
+// written, so after a crash the map may name pages that did not change, but never
+// misses one that did.
+// Layout: [magic][u16 version][u16 0][u64 backup chain][u64 backup sequence]
+//         [u64 snapshot generation][u64 log generation][u64 log bytes][u64 dictionary bytes][bitmap].
+class PageChangeMap {
+public:
+    // The metadata sidecars as a backup copied them. The log and dictionary only grow
+    // until a checkpoint or a rewrite, so the next backup copies what follows.
+    struct Sidecars {
+        uint64_t snapshotGeneration = 0;  // 0 without a snapshot
+        uint64_t logGeneration = 0;       // 0 without a log
+        uint64_t logBytes = 0;            // Whole records copied (see FileMetadata::wholeLogBytes())
+        uint64_t dictionaryBytes = 0;
+    };
 
-}
+private:
+    uint64_t chain = 0;
+    uint64_t sequence = 0;
+    Sidecars sidecars;
+    std::vector<uint8_t> bits;
 
-    // Add a tuple to the table, ensuring ID uniqueness across the entire file
-bool addTupleToTable(const std::string& dbName, const std::string& tableName, const std::string& tupleSerialized, int id) {
-    std::string tablePath = dbName + "/" + tableName + ".HAD";
-    std::cout << "Debug addTupleToTable: Adding tuple to table file: " << tablePath << std::endl;
+public:
+    static constexpr size_t HEADER_SIZE = 56;
 
-    // Check if the table exists
-    if (!fs::exists(tablePath)) {
-        std::cerr << "Table does not exist: " << tablePath << std::endl;
-        return false;
+    static std::string changesPath(const std::string& tablePath) {
+        return tablePath + ".changes";
     }
 
-    // // Deserialize the tuple to extract the ID
-    // Tuple tuple;
-    // if (!tuple.deserialize(tupleSerialized)) {
-    //     std::cerr << "Failed to deserialize the tuple.\n";
-    //     return false;
-    // }
-
-    // std::string id = tuple.getAttributeValue("id");
-    // std::cout << "Debug addTupleToTable: Deserialized tuple with ID: " << id << std::endl;
-    // if (id.empty()) {
-    //     std::cerr << "Tuple must have a valid 'id' attribute.\n";
-    //     return false;
-    // }
-
-    //  try {
-    //     int tupleID = std::stoi(id);  // Convert string id to integer
-    //     if (hasTupleWithIDInFile(tablePath, tupleID)) {
-    //         std::cerr << "Duplicate ID detected (" << id << "). Skipping insertion.\n";
-    //         return false;
-    //     }
-    // } catch (const std::invalid_argument& e) {
-    //     std::cerr << "Error addTupleToTable: Invalid ID format (" << id << ").\n";
-    //     return false;
-    // }
+    uint64_t backupChain() const {
+        return chain;
+    }
 
-    // Open the table file for reading and writing
-    std::fstream file(tablePath, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file) {
-        std::cerr << "Failed to open table file for reading and writing.\n";
-        return false;
+    uint64_t backupSequence() const {
+        return sequence;
     }
-    std::cout << "Debug addTupleToTable: Successfully opened table file for reading and writing.\n";
 
-    FileMetadata fileMetadata;
-    try {
-        fileMetadata.deserialize(file);
-        std::cout << "Debug addTupleToTable: Deserialized file metadata.\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error deserializing file metadata: " << e.what() << std::endl;
-        file.close();
-        return false;
+    const Sidecars& backedUpSidecars() const {
+        return sidecars;
     }
 
-    // Check if there is space in the existing pages
-    int pageId = fileMetadata.getPageCount(); // Assuming this is the next available page ID
-    size_t pagePosition = fileMetadata.getPagePosition(pageId);  // Calculate the position of the page
+    bool isChanged(uint32_t pageID) const {
+        return pageID / 8 < bits.size() && (bits[pageID / 8] >> (pageID % 8) & 1);
+    }
 
-    // Read the page to check for space
-    file.seekg(pagePosition);
-    Page page(pageId);
-    page.deserialize(file);
+    // Start over from an empty map, relative to a backup just taken
+    bool reset(const std::string& tablePath, uint64_t backupChain, uint64_t backupSequence, const Sidecars& copied) {
+        chain = backupChain;
+        sequence = backupSequence;
+        sidecars = copied;
+        bits.clear();
+        std::string path = changesPath(tablePath);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        uint32_t magic = CHANGE_MAP_MAGIC;
+        uint16_t version = CHANGE_MAP_VERSION;
+        uint16_t padding = 0;
+        out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.write(reinterpret_cast<const char*>(&padding), sizeof(padding));
+        out.write(reinterpret_cast<const char*>(&chain), sizeof(chain));
+        out.write(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+        out.write(reinterpret_cast<const char*>(&sidecars), sizeof(sidecars));
+        out.flush();
+        if (!out) {
+            std::cerr << "Error PageChangeMap reset: Unable to write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-    std::cout << "Debug addTupleToTable: Page deserialized.\n";
-    // Try to add the tuple to this page
-    if (page.addTuple(tupleSerialized, fileMetadata,id)) {
-        std::cout << "Debug addTupleToTable: Writing updated page at position " << pagePosition << "\n";
-        
-        file.seekp(pagePosition);
-        page.serialize(file);
-         std::cout << "Debug addTupleToTable: Updated page serialized and written to file.\n";
-        
-        // Update metadata after adding a tuple to an existing page
-        file.seekp(0);  // Go to the beginning of the file to write metadata
-        fileMetadata.serialize(file,tablePath);  // Update the metadata
-        // Flush and close the file
-        file.flush();
-        file.close();
+    // Load the map of a table; false if it has none or it is unreadable
+    bool load(const std::string& tablePath) {
+        std::ifstream in(changesPath(tablePath), std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        if (!in) {
+            return false;
+        }
+        uint32_t magic = 0;
+        uint16_t version = 0;
+        uint16_t padding = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&padding), sizeof(padding));
+        in.read(reinterpret_cast<char*>(&chain), sizeof(chain));
+        in.read(reinterpret_cast<char*>(&sequence), sizeof(sequence));
+        in.read(reinterpret_cast<char*>(&sidecars), sizeof(sidecars));
+        if (!in || magic != CHANGE_MAP_MAGIC || version != CHANGE_MAP_VERSION) {
+            return false;
+        }
+        bits.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
 
-        std::cout << "Debug addTupleToTable: Tuple successfully added to existing page.\n";
-        return true;  // Tuple successfully added
-    } else {
-        std::cerr << "Error addTupleToTable: Failed to add tuple to page.\n";
+    // Set the bits of pageIDs and write the bytes that changed, in one write; false if
+    // it failed, after which the map can no longer be trusted
+    bool mark(const std::string& tablePath, const std::vector<uint32_t>& pageIDs) {
+        size_t first = std::numeric_limits<size_t>::max();
+        size_t last = 0;
+        for (uint32_t pageID : pageIDs) {
+            if (isChanged(pageID)) {
+                continue;
+            }
+            size_t byte = pageID / 8;
+            if (bits.size() <= byte) {
+                bits.resize(byte + 1, 0);
+            }
+            bits[byte] |= static_cast<uint8_t>(1u << (pageID % 8));
+            first = std::min(first, byte);
+            last = std::max(last, byte);
+        }
+        if (first > last) {
+            return true; // Every page was marked already
+        }
+        std::fstream out(changesPath(tablePath), std::ios::binary | std::ios::in | std::ios::out);
+        bumpCounter(engineCounters().fileOpens);
+        out.seekp(static_cast<std::streamoff>(HEADER_SIZE + first), std::ios::beg);
+        out.write(reinterpret_cast<const char*>(bits.data() + first), static_cast<std::streamsize>(last - first + 1));
+        out.flush();
+        return static_cast<bool>(out);
     }
+};
 
+// Point-in-time totals of EngineCounters across all threads
+struct StorageStats {
+    uint64_t pagesRead = 0;
+    uint64_t pagesWritten = 0;
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t fileOpens = 0;
+    uint64_t metadataDeserializeCalls = 0;
+    uint64_t metadataDeserializeBytes = 0;
+    uint64_t metadataSerializeCalls = 0;
+    uint64_t metadataSerializeBytes = 0;
+    uint64_t rowsDecoded = 0;
+    uint64_t pagesSkipped = 0;
+    uint64_t lookups = 0;
+    uint64_t lookupRowsDecoded = 0;
+    uint64_t bufferPoolHits = 0;
+    uint64_t bufferPoolMisses = 0;
+    uint64_t dictionaryCacheHits = 0;
+    uint64_t dictionaryCacheMisses = 0;
+    uint64_t fileSyncs = 0;
+
+    static double ratio(uint64_t part, uint64_t whole) {
+        return whole == 0 ? 0.0 : static_cast<double>(part) / static_cast<double>(whole);
+    }
 
-    // If no existing page had space, create a new page and append it
-    
-    Page newPage(fileMetadata.getNextPageID()); // Assuming this method gives the next available page ID
-    std::cout << "Debug addTupleToTable: No space on existing pages. Creating a new page with ID: " << newPage.getPageID() << "\n";
-    
-    if (!newPage.addTuple(tupleSerialized, fileMetadata, id)) {
-        std::cerr << "Failed to add tuple to a new page.\n";
-        file.close();
-        return false;
+    double rowsDecodedPerLookup() const {
+        return ratio(lookupRowsDecoded, lookups);
     }
 
-    // Append the new page to the end of the file
-    file.clear();
-    file.seekp(0, std::ios::end);
-    newPage.serialize(file);
-    std::cout << "Debug addTupleToTable: New page serialized and appended to file.\n";
+    double bufferPoolHitRate() const {
+        return ratio(bufferPoolHits, bufferPoolHits + bufferPoolMisses);
+    }
 
-    // Increment the page ID after creating a new page
-    fileMetadata.incrementPageID();
-    file.seekp(0);  // Seek to the beginning of the file to write metadata
-    fileMetadata.serialize(file,tablePath);  // Write updated metadata
-    file.close();
-    
-    std::cout << "Debug addTupleToTable: Tuple successfully added to a new page.\n";;
-    return true;
+    double dictionaryCacheHitRate() const {
+        return ratio(dictionaryCacheHits, dictionaryCacheHits + dictionaryCacheMisses);
+    }
+};
+
+// Storage operations with their own latency histogram
+enum StorageOperation { OP_INSERT, OP_GET, OP_DELETE, OP_UPDATE, OP_SCAN, OP_COUNT };
+
+inline const char* storageOperationName(StorageOperation op) {
+    static const char* names[OP_COUNT] = {"insert", "get", "delete", "update", "scan"};
+    return names[op];
 }
 
-bool checkTupleExists(const std::string& dbName, const std::string& tableName, const std::string& id) {
-    // Check if the database exists
-    if (!fs::exists(dbName)) {
-        std::cerr << "Database '" << dbName << "' not found.\n";
-        return false;
-    }
+// Output file written through a fixed-size buffer, flushed whenever it fills
+class OutputBuffer {
+private:
+    std::ofstream& out;
+    std::vector<char> buffer;
+    size_t used = 0;
 
-    // Check if the table exists
-    std::string tablePath = dbName + "/" + tableName + ".HAD";
-    if (!fs::exists(tablePath)) {
-        std::cerr << "Table '" << tableName << "' not found in database '" << dbName << "'.\n";
-        return false;
+public:
+    OutputBuffer(std::ofstream& stream, size_t capacity) : out(stream), buffer(capacity) {}
+
+    void append(const char* bytes, size_t length) {
+        while (length > 0) {
+            if (used == buffer.size()) {
+                flush();
+            }
+            size_t take = std::min(length, buffer.size() - used);
+            std::memcpy(buffer.data() + used, bytes, take);
+            used += take;
+            bytes += take;
+            length -= take;
+        }
     }
 
-    int tupleID;
-    try {
-        tupleID = std::stoi(id);  // Convert string id to integer
-    } catch (const std::invalid_argument& e) {
-        std::cerr << "Invalid ID format: '" << id << "'. ID must be a valid integer.\n";
-        return false;
-    } catch (const std::out_of_range& e) {
-        std::cerr << "ID '" << id << "' is out of range.\n";
-        return false;
+    void append(std::string_view text) {
+        append(text.data(), text.size());
     }
-    // Open the table file for reading
-    std::fstream file(tablePath, std::ios::binary | std::ios::in);
-    if (!file) {
-        std::cerr << "Failed to open table file: " << tablePath << "\n";
-        return false;
+
+    void push(char c) {
+        append(&c, 1);
     }
 
-    // Read the file metadata
-    FileMetadata fileMetadata;
-    try {
-        fileMetadata.deserialize(file);
-    } catch (const std::exception& e) {
-        std::cerr << "Error deserializing file metadata: " << e.what() << "\n";
-        file.close();
-        return false;
+    template <typename T>
+    void appendRaw(const T& value) {
+        append(reinterpret_cast<const char*>(&value), sizeof(value));
     }
 
-    // Check if the tuple ID exists in the tuple-to-page map in file metadata
-    if (fileMetadata.hasTupleInPageMap(std::stoi(id))) {
-        std::cout << "Tuple with ID '" << id << "' found in table: " << tableName << " (via metadata lookup).\n";
-        file.close();
-        return true; // Tuple found via metadata map
+    bool flush() {
+        out.write(buffer.data(), used);
+        bumpCounter(engineCounters().bytesWritten, used);
+        used = 0;
+        return static_cast<bool>(out);
     }
+};
 
-    std::cerr << "Tuple with ID '" << id << "' not found in table: " << tableName << " (via metadata map).\n";
-    file.close();
-    return false; // Tuple does not exist
-}
+// Output formats of Storage::exportTable()
+enum ExportFormat { EXPORT_CSV, EXPORT_BINARY };
 
-bool insert(const std::string& dbName, const std::string& tableName, const Tuple& tuple) {
+// Tuning of Storage::vacuumTable()
+struct VacuumOptions {
+    uint32_t batchPages = 64;               // Pages compacted per batch while holding the engine mutex
+    std::chrono::milliseconds pause{0};     // Sleep between batches, to throttle a background vacuum
+    double keepFill = 0.9;                  // Pages at least this full are not rewritten while nothing has moved
+};
 
-        std::map<int, std::string> typeMap = {
-        {1, "int"},
-        {2, "string"},
-        {3, "double"},
-        // Add more types as needed
-    };
-    // Validate database existence
-    if (!fs::exists(dbName)) {
-        std::cerr << "Database does not exist: " << dbName << std::endl;
-        return false;
+// Outcome of one vacuum
+struct VacuumStats {
+    uint64_t pagesBefore = 0;
+    uint64_t pagesAfter = 0;
+    uint64_t rowsMoved = 0;
+    uint64_t tombstonesDropped = 0;
+    uint64_t bytesReclaimed = 0;            // Table file plus snapshot
+};
+
+enum PartitionKind : uint8_t { PARTITION_NONE = 0, PARTITION_HASH = 1, PARTITION_RANGE = 2 };
+
+// Outcome of one backup (see Storage::backupDatabase())
+struct BackupStats {
+    uint64_t sequence = 0;          // Position in the backup chain; 1 is the base backup
+    uint64_t tables = 0;
+    uint64_t tablesCopiedWhole = 0; // Tables without change tracking since the previous backup
+    uint64_t pagesCopied = 0;
+    uint64_t bytesWritten = 0;
+};
+
+// Options fixed when a table is created
+struct TableOptions {
+    bool compressPages = false;                 // Store pages LZ-compressed in variable-size extents
+    std::set<std::string> dictionaryColumns;    // String columns stored as dictionary codes
+    PartitionKind partitionBy = PARTITION_NONE; // Spread the rows over partition tables by id (see TablePartitioning)
+    uint32_t hashPartitions = 0;                // PARTITION_HASH: number of partitions
+    std::vector<int64_t> rangeBounds;           // PARTITION_RANGE: ascending ids at which the next partition starts
+    bool autoIncrementId = false;               // Number rows inserted without an id from a persistent sequence
+};
+
+// How a partitioned table spreads its rows, kept in "<table>.HAD.parts". Each
+// partition is an ordinary table "<table>.p<index>" with its own file, metadata,
+// redo log and sidecars, and the same schema and options. Rows go to a partition by
+// a hash of their id, or by id range: with bounds b0 < b1 < ..., partition 0 holds
+// ids below b0, partition i ids in [b(i-1), bi), and the last one the rest.
+// Layout: [magic][u16 version][u8 kind][u8 0][u32 count][u32 bound count][i64 bounds].
+struct TablePartitioning {
+    PartitionKind kind = PARTITION_NONE;
+    uint32_t count = 0;
+    std::vector<int64_t> bounds;
+
+    static std::string descriptorPath(const std::string& tablePath) {
+        return tablePath + ".parts";
     }
 
-    // Validate table existence
-    std::string tablePath = dbName + "/" + tableName + ".HAD";
-    if (!fs::exists(tablePath)) {
-        std::cerr << "Table does not exist: " << tableName << std::endl;
-        return false;
+    static std::string partitionName(const std::string& tableName, uint32_t index) {
+        return tableName + ".p" + std::to_string(index);
     }
 
-    // Open the table file for reading
-    std::fstream file(tablePath, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file) {
-        std::cerr << "Failed to open table file: " << tablePath << "\n";
-        return false;
+    // Murmur3's 64-bit finalizer: a different mix than the row-ID filters use, so the
+    // IDs of one partition still spread over all of its filter's blocks
+    static uint64_t hashId(int64_t id) {
+        uint64_t x = static_cast<uint64_t>(id);
+        x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdull;
+        x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ull;
+        return x ^ (x >> 33);
     }
 
-    // Read file metadata, including schema
-    FileMetadata fileMetadata;
-    fileMetadata.deserialize(file);
+    uint32_t partitionOf(int64_t id) const {
+        if (kind == PARTITION_RANGE) {
+            return static_cast<uint32_t>(std::upper_bound(bounds.begin(), bounds.end(), id) - bounds.begin());
+        }
+        return static_cast<uint32_t>(((hashId(id) >> 32) * count) >> 32);
+    }
 
-    // Extract and validate tuple attributes against schema in file metadata
-    std::map<std::string, std::pair<int, std::string>> attributes = tuple.getAttributes();
-    for (const auto& [key, type] : fileMetadata.getSchema()) {
-        // Check if attribute exists in tuple
-        if (attributes.find(key) == attributes.end()) {
-            std::cerr << "Missing required attribute: " << key << std::endl;
-            return false;
+    // Check the options of a table to be created; the error is empty if they are fine
+    static std::string validate(const TableOptions& options) {
+        if (options.partitionBy == PARTITION_HASH) {
+            if (options.hashPartitions < 1 || options.hashPartitions > MAX_PARTITIONS) {
+                return "Hash partitioning needs 1 to " + std::to_string(MAX_PARTITIONS) + " partitions";
+            }
+        } else if (options.partitionBy == PARTITION_RANGE) {
+            if (options.rangeBounds.empty() || options.rangeBounds.size() >= MAX_PARTITIONS) {
+                return "Range partitioning needs 1 to " + std::to_string(MAX_PARTITIONS - 1) + " bounds";
+            }
+            if (std::adjacent_find(options.rangeBounds.begin(), options.rangeBounds.end(),
+                                   std::greater_equal<int64_t>()) != options.rangeBounds.end()) {
+                return "Range bounds must be strictly ascending";
+            }
+        } else if (options.partitionBy != PARTITION_NONE) {
+            return "Unknown partitioning";
         }
+        return std::string();
+    }
+
+    static TablePartitioning fromOptions(const TableOptions& options) {
+        TablePartitioning partitioning;
+        partitioning.kind = options.partitionBy;
+        partitioning.bounds = options.partitionBy == PARTITION_RANGE ? options.rangeBounds : std::vector<int64_t>();
+        partitioning.count = options.partitionBy == PARTITION_RANGE ? static_cast<uint32_t>(partitioning.bounds.size() + 1)
+                                                                    : options.hashPartitions;
+        return partitioning;
+    }
 
-        // Check data type and length
-        const auto& [attrType, attrValue] = attributes[key];
-        if (typeMap[attrType] != type) {
-            std::cerr << "Type mismatch for attribute: " << key << std::endl;
+    bool save(const std::string& tablePath) const {
+        std::string path = descriptorPath(tablePath);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        uint32_t magic = PARTITION_MAGIC;
+        uint16_t version = PARTITION_VERSION;
+        uint8_t padding = 0;
+        uint32_t boundCount = static_cast<uint32_t>(bounds.size());
+        out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        out.write(reinterpret_cast<const char*>(&kind), sizeof(kind));
+        out.write(reinterpret_cast<const char*>(&padding), sizeof(padding));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char*>(&boundCount), sizeof(boundCount));
+        out.write(reinterpret_cast<const char*>(bounds.data()), bounds.size() * sizeof(int64_t));
+        out.flush();
+        if (!out) {
+            std::cerr << "Error TablePartitioning save: Unable to write " << path << std::endl;
             return false;
         }
+        return true;
     }
 
-    // Check if 'id' is unique using tuple-to-page map in file metadata
-    std::string idValue = attributes["id"].second; // Assuming "id" is always present
-    int id = std::stoi(idValue);
-    if (fileMetadata.hasTupleWithID(id)) {
-        std::cerr << "Duplicate ID: " << id << " for table: " << tableName << std::endl;
-        return false;
+    // Load the descriptor of a table; false if the table is not partitioned
+    bool load(const std::string& tablePath) {
+        std::string path = descriptorPath(tablePath);
+        std::ifstream in(path, std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        if (!in) {
+            return false;
+        }
+        uint32_t magic = 0;
+        uint16_t version = 0;
+        uint8_t padding = 0;
+        uint32_t boundCount = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&kind), sizeof(kind));
+        in.read(reinterpret_cast<char*>(&padding), sizeof(padding));
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        in.read(reinterpret_cast<char*>(&boundCount), sizeof(boundCount));
+        bool valid = in && magic == PARTITION_MAGIC && version == PARTITION_VERSION && count >= 1 && count <= MAX_PARTITIONS &&
+                     ((kind == PARTITION_HASH && boundCount == 0) || (kind == PARTITION_RANGE && boundCount + 1 == count));
+        if (valid) {
+            bounds.resize(boundCount);
+            in.read(reinterpret_cast<char*>(bounds.data()), bounds.size() * sizeof(int64_t));
+            valid = static_cast<bool>(in);
+        }
+        if (!valid) {
+            std::cerr << "Error TablePartitioning load: Corrupt partitioning file " << path << std::endl;
+            return false;
+        }
+        return true;
     }
+};
 
-    // Serialize tuple and add to the table
-    std::string serializedTuple = tuple.serialize();
+constexpr size_t QUERY_BATCH_ROWS = 2048;  // Rows per batch passed between query operators
 
+// Name and type code (TYPE_INT, TYPE_DOUBLE or TYPE_STRING) of a query column
+struct QueryColumn {
+    std::string name;
+    int type = TYPE_STRING;
+};
 
-    if (!addTupleToTable(dbName, tableName, serializedTuple,id)) {
-        std::cerr << "Failed to add tuple to table: " << tableName << std::endl;
-        return false;
+// One column of a query batch. Values sit in the vector of the column's type;
+// strings are packed into one buffer with the end offset of every row. A row that
+// lacks the column, or holds something that is not a value of its type, is absent.
+struct ColumnVector {
+    std::string name;
+    int type = TYPE_STRING;
+    std::vector<int64_t> ints;
+    std::vector<double> doubles;
+    std::string chars;
+    std::vector<uint32_t> ends;
+    std::vector<uint8_t> present;
+
+    size_t size() const {
+        return present.size();
     }
 
-    std::cout << "Debug insert: Tuple successfully added to table: " << tableName << std::endl;
-    file.flush();
-    return true;
-}
-
+    void clear() {
+        ints.clear();
+        doubles.clear();
+        chars.clear();
+        ends.clear();
+        present.clear();
+    }
 
+    std::string_view stringAt(size_t row) const {
+        uint32_t begin = row == 0 ? 0 : ends[row - 1];
+        return std::string_view(chars.data() + begin, ends[row] - begin);
+    }
+
+    void appendAbsent() {
+        present.push_back(0);
+        if (type == TYPE_INT) {
+            ints.push_back(0);
+        } else if (type == TYPE_DOUBLE) {
+            doubles.push_back(0);
+        } else {
+            ends.push_back(static_cast<uint32_t>(chars.size()));
+        }
+    }
+
+    void appendInt(int64_t value) {
+        ints.push_back(value);
+        present.push_back(1);
+    }
+
+    void appendDouble(double value) {
+        doubles.push_back(value);
+        present.push_back(1);
+    }
+
+    void appendString(std::string_view text) {
+        chars.append(text);
+        ends.push_back(static_cast<uint32_t>(chars.size()));
+        present.push_back(1);
+    }
+
+    // Append a value from its stored text form
+    void appendText(std::string_view text) {
+        const char* first = text.data();
+        const char* last = first + text.size();
+        if (type == TYPE_INT) {
+            int64_t value = 0;
+            auto [end, error] = std::from_chars(first, last, value);
+            ints.push_back(value);
+            present.push_back(error == std::errc() && end == last);
+        } else if (type == TYPE_DOUBLE) {
+            double value = 0;
+            auto [end, error] = std::from_chars(first, last, value);
+            doubles.push_back(value);
+            present.push_back(error == std::errc() && end == last);
+        } else {
+            appendString(text);
+        }
+    }
+
+    // Copy row of another column of the same type
+    void appendFrom(const ColumnVector& other, size_t row) {
+        if (!other.present[row]) {
+            appendAbsent();
+        } else if (type == TYPE_INT) {
+            appendInt(other.ints[row]);
+        } else if (type == TYPE_DOUBLE) {
+            appendDouble(other.doubles[row]);
+        } else {
+            appendString(other.stringAt(row));
+        }
+    }
+
+    // Append a value as bytes to out: a presence byte, then the int or double (8 bytes)
+    // or the string ([uint32 length][bytes]). Equal values encode to equal bytes.
+    void encodeValue(size_t row, std::string& out) const {
+        out.push_back(static_cast<char>(present[row]));
+        if (!present[row]) {
+            return;
+        }
+        if (type == TYPE_INT) {
+            out.append(reinterpret_cast<const char*>(&ints[row]), sizeof(int64_t));
+        } else if (type == TYPE_DOUBLE) {
+            double value = doubles[row] + 0.0; // -0.0 encodes as 0.0
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        } else {
+            std::string_view text = stringAt(row);
+            uint32_t length = static_cast<uint32_t>(text.size());
+            out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.append(text);
+        }
+    }
+
+    // Append a value written by encodeValue() and advance in past it
+    void decodeValue(std::string_view& in) {
+        bool isPresent = in[0] != 0;
+        in.remove_prefix(1);
+        if (!isPresent) {
+            appendAbsent();
+        } else if (type == TYPE_INT) {
+            int64_t value;
+            std::memcpy(&value, in.data(), sizeof(value));
+            appendInt(value);
+            in.remove_prefix(sizeof(value));
+        } else if (type == TYPE_DOUBLE) {
+            double value;
+            std::memcpy(&value, in.data(), sizeof(value));
+            appendDouble(value);
+            in.remove_prefix(sizeof(value));
+        } else {
+            uint32_t length;
+            std::memcpy(&length, in.data(), sizeof(length));
+            appendString(in.substr(sizeof(length), length));
+            in.remove_prefix(sizeof(length) + length);
+        }
+    }
+
+    // Text form of a value, as get() returns it ("" when absent)
+    std::string valueString(size_t row) const {
+        if (!present[row]) {
+            return std::string();
+        }
+        if (type == TYPE_INT) {
+            return Tuple::valueToString(ints[row]);
+        }
+        if (type == TYPE_DOUBLE) {
+            return Tuple::valueToString(doubles[row]);
+        }
+        return std::string(stringAt(row));
+    }
+};
+
+// Rows passed between query operators. Once a filter has run, selection holds the
+// rows still in play (ascending); before that every row is selected.
+struct ColumnBatch {
+    std::vector<ColumnVector> columns;
+    size_t rowCount = 0;
+    std::vector<uint32_t> selection;
+    bool selective = false;
+
+    size_t selectedCount() const {
+        return selective ? selection.size() : rowCount;
+    }
+
+    uint32_t selectedRow(size_t i) const {
+        return selective ? selection[i] : static_cast<uint32_t>(i);
+    }
+
+    // The selection as an explicit list that an operator can narrow in place
+    std::vector<uint32_t>& narrowSelection() {
+        if (!selective) {
+            selection.resize(rowCount);
+            std::iota(selection.begin(), selection.end(), 0u);
+            selective = true;
+        }
+        return selection;
+    }
+
+    // Start refilling with the given columns, keeping the buffers' capacity
+    void reset(const std::vector<QueryColumn>& layout) {
+        columns.resize(layout.size());
+        for (size_t i = 0; i < layout.size(); ++i) {
+            columns[i].name = layout[i].name;
+            columns[i].type = layout[i].type;
+            columns[i].clear();
+        }
+        rowCount = 0;
+        selection.clear();
+        selective = false;
+    }
+
+    // Append the selected rows as name -> value maps; absent values are left out
+    void appendRows(std::vector<std::map<std::string, std::string>>& out) const {
+        for (size_t i = 0; i < selectedCount(); ++i) {
+            uint32_t row = selectedRow(i);
+            std::map<std::string, std::string>& values = out.emplace_back();
+            for (const ColumnVector& column : columns) {
+                if (column.present[row]) {
+                    values.emplace(column.name, column.valueString(row));
+                }
+            }
+        }
+    }
+};
+
+// Index of a column in an operator's output; throws std::invalid_argument if missing
+inline size_t queryColumnIndex(const std::vector<QueryColumn>& columns, const std::string& name) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (columns[i].name == name) {
+            return i;
+        }
+    }
+    throw std::invalid_argument("Unknown column: " + name);
+}
+
+// Summary of one column over the rows of one page (see TableZoneMap)
+struct ColumnZone {
+    uint32_t present = 0;    // Rows holding a value of the column's type; the others count as null
+    bool bounded = false;    // The min and max below hold: some value is present and none is NaN
+    bool maxCut = false;     // maxText is only a prefix of the greatest string
+    int64_t minInt = 0;
+    int64_t maxInt = 0;
+    double minDouble = 0;
+    double maxDouble = 0;
+    std::string minText;     // At most ZONE_TEXT_PREFIX bytes; a prefix is still a lower bound
+    std::string maxText;
+};
+
+// Zone map of a table: for every page, its row count and, per schema column, the
+// smallest and largest value and how many rows hold one. A scan skips a page whose
+// zones rule out its filter (QueryExpression::mayMatch()) without reading it. Zones
+// are taken from the rows as a scan decodes them, so they agree with what it would see.
+//
+// "<table>.HAD.zone": [magic][u16 version][u16 column count]{[u16 length][name][u8 type]}
+// [u64 page count], then per page [u8 known] and, if known, [u32 rows] followed per
+// column by [u32 present][u8 flags] and, when bounded, the min and max (8 bytes each,
+// or [u16 length][bytes] for strings). Storage removes the file before it first
+// changes a page of the table and writes it again when it is done, so a file that
+// exists always matches the table.
+class TableZoneMap {
+public:
+    struct PageZone {
+        bool known = false;
+        uint32_t rows = 0;
+        std::vector<ColumnZone> columns;  // Schema order
+    };
+
+private:
+    std::vector<QueryColumn> columns;
+    std::vector<PageZone> pages;
+
+    static constexpr uint8_t BOUNDED = 0x1;
+    static constexpr uint8_t MAX_CUT = 0x2;
+
+    template <typename T>
+    static void put(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void putText(std::string& out, const std::string& text) {
+        put(out, static_cast<uint16_t>(text.size()));
+        out += text;
+    }
+
+    template <typename T>
+    static bool take(std::string_view& in, T& value) {
+        if (in.size() < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, in.data(), sizeof(value));
+        in.remove_prefix(sizeof(value));
+        return true;
+    }
+
+    static bool takeText(std::string_view& in, std::string& text) {
+        uint16_t length = 0;
+        if (!take(in, length) || in.size() < length) {
+            return false;
+        }
+        text.assign(in.data(), length);
+        in.remove_prefix(length);
+        return true;
+    }
+
+public:
+    explicit TableZoneMap(std::vector<QueryColumn> schemaColumns) : columns(std::move(schemaColumns)) {}
+
+    static std::string zonePath(const std::string& tablePath) {
+        return tablePath + ".zone";
+    }
+
+    const std::vector<QueryColumn>& getColumns() const {
+        return columns;
+    }
+
+    // Zones of a page, or null if it has none
+    const PageZone* page(uint64_t pageID) const {
+        return pageID < pages.size() && pages[pageID].known ? &pages[pageID] : nullptr;
+    }
+
+    // Summarize a page from its rows, decoded into batch with every schema column in schema order
+    void setPage(uint32_t pageID, const ColumnBatch& batch) {
+        if (pages.size() <= pageID) {
+            pages.resize(static_cast<size_t>(pageID) + 1);
+        }
+        PageZone& zone = pages[pageID];
+        zone.known = true;
+        zone.rows = static_cast<uint32_t>(batch.rowCount);
+        zone.columns.assign(columns.size(), ColumnZone());
+        for (size_t column = 0; column < columns.size(); ++column) {
+            const ColumnVector& values = batch.columns[column];
+            ColumnZone& summary = zone.columns[column];
+            bool unordered = false;
+            std::string_view minText;
+            std::string_view maxText;
+            for (size_t row = 0; row < batch.rowCount; ++row) {
+                if (!values.present[row]) {
+                    continue;
+                }
+                bool first = summary.present++ == 0;
+                if (values.type == TYPE_INT) {
+                    int64_t value = values.ints[row];
+                    summary.minInt = first ? value : std::min(summary.minInt, value);
+                    summary.maxInt = first ? value : std::max(summary.maxInt, value);
+                } else if (values.type == TYPE_DOUBLE) {
+                    double value = values.doubles[row];
+                    unordered = unordered || std::isnan(value);
+                    summary.minDouble = first ? value : std::min(summary.minDouble, value);
+                    summary.maxDouble = first ? value : std::max(summary.maxDouble, value);
+                } else {
+                    std::string_view value = values.stringAt(row);
+                    minText = first ? value : std::min(minText, value);
+                    maxText = first ? value : std::max(maxText, value);
+                }
+            }
+            summary.bounded = summary.present > 0 && !unordered;
+            summary.minText = std::string(minText.substr(0, ZONE_TEXT_PREFIX));
+            summary.maxText = std::string(maxText.substr(0, ZONE_TEXT_PREFIX));
+            summary.maxCut = maxText.size() > ZONE_TEXT_PREFIX;
+        }
+    }
+
+    bool save(const std::string& tablePath) const {
+        std::string out;
+        put(out, ZONE_MAP_MAGIC);
+        put(out, ZONE_MAP_VERSION);
+        put(out, static_cast<uint16_t>(columns.size()));
+        for (const QueryColumn& column : columns) {
+            putText(out, column.name);
+            put(out, static_cast<uint8_t>(column.type));
+        }
+        put(out, static_cast<uint64_t>(pages.size()));
+        for (const PageZone& zone : pages) {
+            put(out, static_cast<uint8_t>(zone.known));
+            if (!zone.known) {
+                continue;
+            }
+            put(out, zone.rows);
+            for (size_t column = 0; column < columns.size(); ++column) {
+                const ColumnZone& summary = zone.columns[column];
+                put(out, summary.present);
+                put(out, static_cast<uint8_t>((summary.bounded ? BOUNDED : 0) | (summary.maxCut ? MAX_CUT : 0)));
+                if (!summary.bounded) {
+                    continue;
+                }
+                if (columns[column].type == TYPE_INT) {
+                    put(out, summary.minInt);
+                    put(out, summary.maxInt);
+                } else if (columns[column].type == TYPE_DOUBLE) {
+                    put(out, summary.minDouble);
+                    put(out, summary.maxDouble);
+                } else {
+                    putText(out, summary.minText);
+                    putText(out, summary.maxText);
+                }
+            }
+        }
+
+        std::string path = zonePath(tablePath);
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        file.write(out.data(), out.size());
+        file.flush();
+        if (!file) {
+            std::cerr << "Error TableZoneMap save: Unable to write " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Load the saved zones of a table; false if there are none or they were saved for other columns
+    bool load(const std::string& tablePath) {
+        std::ifstream file(zonePath(tablePath), std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        if (!file) {
+            return false;
+        }
+        std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::string_view in = bytes;
+        uint32_t magic = 0;
+        uint16_t version = 0;
+        uint16_t columnCount = 0;
+        if (!take(in, magic) || !take(in, version) || !take(in, columnCount) || magic != ZONE_MAP_MAGIC ||
+            version != ZONE_MAP_VERSION || columnCount != columns.size()) {
+            return false;
+        }
+        for (const QueryColumn& column : columns) {
+            std::string name;
+            uint8_t type = 0;
+            if (!takeText(in, name) || !take(in, type) || name != column.name || type != column.type) {
+                return false;
+            }
+        }
+        uint64_t pageCount = 0;
+        if (!take(in, pageCount) || pageCount > in.size()) {
+            return false;
+        }
+        std::vector<PageZone> loaded(static_cast<size_t>(pageCount));
+        for (PageZone& zone : loaded) {
+            uint8_t known = 0;
+            if (!take(in, known)) {
+                return false;
+            }
+            zone.known = known != 0;
+            if (!zone.known) {
+                continue;
+            }
+            if (!take(in, zone.rows)) {
+                return false;
+            }
+            zone.columns.resize(columns.size());
+            for (size_t column = 0; column < columns.size(); ++column) {
+                ColumnZone& summary = zone.columns[column];
+                uint8_t flags = 0;
+                if (!take(in, summary.present) || !take(in, flags)) {
+                    return false;
+                }
+                summary.bounded = flags & BOUNDED;
+                summary.maxCut = flags & MAX_CUT;
+                if (!summary.bounded) {
+                    continue;
+                }
+                bool ok = columns[column].type == TYPE_INT      ? take(in, summary.minInt) && take(in, summary.maxInt)
+                          : columns[column].type == TYPE_DOUBLE ? take(in, summary.minDouble) && take(in, summary.maxDouble)
+                                                                : takeText(in, summary.minText) && takeText(in, summary.maxText);
+                if (!ok) {
+                    return false;
+                }
+            }
+        }
+        pages.swap(loaded);
+        return true;
+    }
+};
+
+// Predicate over the columns of a batch, parsed from text such as
+//   age >= 30 AND (city = 'Cairo' OR NOT score < 2.5)
+// Comparisons (= != <> < <= > >=) take columns and int, double or 'quoted' string
+// literals ('' is a quote inside a string), combined with AND, OR, NOT and
+// parentheses; keywords are case-insensitive. A comparison is false for rows that
+// lack one of its columns. Evaluation narrows a selection vector a batch at a time,
+// with one tight loop per comparison over the column's values.
+class QueryExpression {
+public:
+    enum Comparison { EQ, NE, LT, LE, GT, GE };
+
+    virtual ~QueryExpression() = default;
+
+    // Parse an expression; throws std::invalid_argument on a syntax error
+    static std::unique_ptr<QueryExpression> parse(const std::string& text);
+
+    // Resolve column names against an operator's output and check the types of
+    // every comparison; throws std::invalid_argument
+    virtual void bind(const std::vector<QueryColumn>& columns) = 0;
+
+    // Columns the expression reads
+    virtual void columnNames(std::set<std::string>& names) const = 0;
+
+    // Keep the rows of selection (ascending row indices of batch) that satisfy the expression
+    virtual void filter(const ColumnBatch& batch, std::vector<uint32_t>& selection) const = 0;
+
+    // False only if no row of a page with these zones can satisfy the expression.
+    // zones is indexed like the bound columns, null where a column has no zone.
+    virtual bool mayMatch(const std::vector<const ColumnZone*>& zones) const = 0;
+};
+
+// <column> <op> <literal or column>
+class ComparisonExpression : public QueryExpression {
+public:
+    struct Operand {
+        std::optional<std::string> column;
+        Tuple::Value literal;
+        int literalType = TYPE_INT;
+        size_t index = 0;  // Bound column position
+    };
+
+private:
+    Comparison comparison;
+    Operand left;
+    Operand right;
+    int columnType = TYPE_INT;   // Type of the left column
+    int compareType = TYPE_INT;  // Type both sides are compared as
+
+    template <typename Compare>
+    static bool holds(Comparison comparison, const Compare& a, const Compare& b) {
+        switch (comparison) {
+        case EQ: return a == b;
+        case NE: return a != b;
+        case LT: return a < b;
+        case LE: return a <= b;
+        case GT: return a > b;
+        default: return a >= b;
+        }
+    }
+
+    // Keep the rows whose value compares true against a constant. The comparison is
+    // a template argument, so each loop compiles to straight-line compare-and-store.
+    template <typename T, typename Op>
+    static void keepIf(const std::vector<T>& values, const std::vector<uint8_t>& present, const T& constant,
+                       std::vector<uint32_t>& selection) {
+        size_t kept = 0;
+        Op op;
+        for (uint32_t row : selection) {
+            selection[kept] = row;
+            kept += present[row] & static_cast<uint8_t>(op(values[row], constant));
+        }
+        selection.resize(kept);
+    }
+
+    template <typename T>
+    void keepIfConstant(const std::vector<T>& values, const std::vector<uint8_t>& present, const T& constant,
+                        std::vector<uint32_t>& selection) const {
+        switch (comparison) {
+        case EQ: keepIf<T, std::equal_to<T>>(values, present, constant, selection); break;
+        case NE: keepIf<T, std::not_equal_to<T>>(values, present, constant, selection); break;
+        case LT: keepIf<T, std::less<T>>(values, present, constant, selection); break;
+        case LE: keepIf<T, std::less_equal<T>>(values, present, constant, selection); break;
+        case GT: keepIf<T, std::greater<T>>(values, present, constant, selection); break;
+        default: keepIf<T, std::greater_equal<T>>(values, present, constant, selection); break;
+        }
+    }
+
+    // Keep the rows for which keep(row) holds
+    template <typename Keep>
+    static void keepRows(std::vector<uint32_t>& selection, const Keep& keep) {
+        size_t kept = 0;
+        for (uint32_t row : selection) {
+            selection[kept] = row;
+            kept += keep(row) ? 1 : 0;
+        }
+        selection.resize(kept);
+    }
+
+    // Whether some value in [low, high] can compare true against constant; high is
+    // ignored unless highKnown
+    template <typename T>
+    bool rangeMayHold(const T& low, const T& high, const T& constant, bool highKnown = true) const {
+        switch (comparison) {
+        case EQ: return low <= constant && (!highKnown || constant <= high);
+        case NE: return !(highKnown && low == high && low == constant);
+        case LT: return low < constant;
+        case LE: return low <= constant;
+        case GT: return !highKnown || high > constant;
+        default: return !highKnown || high >= constant;
+        }
+    }
+
+    static double numberAt(const ColumnVector& column, uint32_t row) {
+        return column.type == TYPE_INT ? static_cast<double>(column.ints[row]) : column.doubles[row];
+    }
+
+    static double literalNumber(const Operand& operand) {
+        if (const int64_t* number = std::get_if<int64_t>(&operand.literal)) {
+            return static_cast<double>(*number);
+        }
+        return std::get<double>(operand.literal);
+    }
+
+public:
+    ComparisonExpression(Comparison op, Operand lhs, Operand rhs) : comparison(op), left(std::move(lhs)), right(std::move(rhs)) {
+        if (!left.column) {
+            // Keep the column on the left: 5 < x is x > 5
+            std::swap(left, right);
+            static const Comparison mirrored[] = {EQ, NE, GT, GE, LT, LE};
+            comparison = mirrored[comparison];
+        }
+    }
+
+    void bind(const std::vector<QueryColumn>& columns) override {
+        if (!left.column) {
+            throw std::invalid_argument("A comparison needs at least one column");
+        }
+        left.index = queryColumnIndex(columns, *left.column);
+        int leftType = columns[left.index].type;
+        int rightType = right.literalType;
+        if (right.column) {
+            right.index = queryColumnIndex(columns, *right.column);
+            rightType = columns[right.index].type;
+        }
+        if ((leftType == TYPE_STRING) != (rightType == TYPE_STRING)) {
+            throw std::invalid_argument("Cannot compare a string with a number in a comparison on " + *left.column);
+        }
+        columnType = leftType;
+        compareType = leftType == TYPE_STRING ? TYPE_STRING
+                      : leftType == TYPE_INT && rightType == TYPE_INT ? TYPE_INT
+                                                                      : TYPE_DOUBLE;
+    }
+
+    void columnNames(std::set<std::string>& names) const override {
+        names.insert(*left.column);
+        if (right.column) {
+            names.insert(*right.column);
+        }
+    }
+
+    void filter(const ColumnBatch& batch, std::vector<uint32_t>& selection) const override {
+        const ColumnVector& lhs = batch.columns[left.index];
+        if (right.column) {
+            const ColumnVector& rhs = batch.columns[right.index];
+            if (compareType == TYPE_STRING) {
+                keepRows(selection, [&](uint32_t row) {
+                    return lhs.present[row] && rhs.present[row] && holds(comparison, lhs.stringAt(row), rhs.stringAt(row));
+                });
+            } else if (compareType == TYPE_INT) {
+                keepRows(selection, [&](uint32_t row) {
+                    return lhs.present[row] && rhs.present[row] && holds(comparison, lhs.ints[row], rhs.ints[row]);
+                });
+            } else {
+                keepRows(selection, [&](uint32_t row) {
+                    return lhs.present[row] && rhs.present[row] && holds(comparison, numberAt(lhs, row), numberAt(rhs, row));
+                });
+            }
+        } else if (compareType == TYPE_STRING) {
+            std::string_view constant = std::get<std::pmr::string>(right.literal);
+            keepRows(selection, [&](uint32_t row) { return lhs.present[row] && holds(comparison, lhs.stringAt(row), constant); });
+        } else if (compareType == TYPE_INT) {
+            keepIfConstant(lhs.ints, lhs.present, std::get<int64_t>(right.literal), selection);
+        } else if (lhs.type == TYPE_DOUBLE) {
+            keepIfConstant(lhs.doubles, lhs.present, literalNumber(right), selection);
+        } else {
+            double constant = literalNumber(right); // Integer column against a fractional constant
+            keepRows(selection, [&](uint32_t row) {
+                return lhs.present[row] && holds(comparison, static_cast<double>(lhs.ints[row]), constant);
+            });
+        }
+    }
+
+    bool mayMatch(const std::vector<const ColumnZone*>& zones) const override {
+        // A comparison is false on rows that lack one of its columns
+        const ColumnZone* zone = zones[left.index];
+        if (zone && zone->present == 0) {
+            return false;
+        }
+        if (right.column) {
+            const ColumnZone* other = zones[right.index];
+            return !(other && other->present == 0);
+        }
+        if (!zone || !zone->bounded) {
+            return true;
+        }
+        if (compareType == TYPE_STRING) {
+            std::string_view constant = std::get<std::pmr::string>(right.literal);
+            return rangeMayHold<std::string_view>(zone->minText, zone->maxText, constant, !zone->maxCut);
+        }
+        if (compareType == TYPE_INT) {
+            return rangeMayHold(zone->minInt, zone->maxInt, std::get<int64_t>(right.literal));
+        }
+        if (columnType == TYPE_INT) {
+            return rangeMayHold(static_cast<double>(zone->minInt), static_cast<double>(zone->maxInt), literalNumber(right));
+        }
+        return rangeMayHold(zone->minDouble, zone->maxDouble, literalNumber(right));
+    }
+};
+
+// AND narrows the selection through each side in turn
+class AndExpression : public QueryExpression {
+private:
+    std::unique_ptr<QueryExpression> left;
+    std::unique_ptr<QueryExpression> right;
+
+public:
+    AndExpression(std::unique_ptr<QueryExpression> lhs, std::unique_ptr<QueryExpression> rhs)
+        : left(std::move(lhs)), right(std::move(rhs)) {}
+
+    void bind(const std::vector<QueryColumn>& columns) override {
+        left->bind(columns);
+        right->bind(columns);
+    }
+
+    void columnNames(std::set<std::string>& names) const override {
+        left->columnNames(names);
+        right->columnNames(names);
+    }
+
+    void filter(const ColumnBatch& batch, std::vector<uint32_t>& selection) const override {
+        left->filter(batch, selection);
+        if (!selection.empty()) {
+            right->filter(batch, selection);
+        }
+    }
+
+    bool mayMatch(const std::vector<const ColumnZone*>& zones) const override {
+        return left->mayMatch(zones) && right->mayMatch(zones);
+    }
+};
+
+// OR tests the right side only on the rows the left side rejected, then merges
+class OrExpression : public QueryExpression {
+private:
+    std::unique_ptr<QueryExpression> left;
+    std::unique_ptr<QueryExpression> right;
+
+public:
+    OrExpression(std::unique_ptr<QueryExpression> lhs, std::unique_ptr<QueryExpression> rhs)
+        : left(std::move(lhs)), right(std::move(rhs)) {}
+
+    void bind(const std::vector<QueryColumn>& columns) override {
+        left->bind(columns);
+        right->bind(columns);
+    }
+
+    void columnNames(std::set<std::string>& names) const override {
+        left->columnNames(names);
+        right->columnNames(names);
+    }
+
+    void filter(const ColumnBatch& batch, std::vector<uint32_t>& selection) const override {
+        std::vector<uint32_t> matched = selection;
+        left->filter(batch, matched);
+        std::vector<uint32_t> rest;
+        rest.reserve(selection.size() - matched.size());
+        std::set_difference(selection.begin(), selection.end(), matched.begin(), matched.end(), std::back_inserter(rest));
+        right->filter(batch, rest);
+        selection.clear();
+        std::merge(matched.begin(), matched.end(), rest.begin(), rest.end(), std::back_inserter(selection));
+    }
+
+    bool mayMatch(const std::vector<const ColumnZone*>& zones) const override {
+        return left->mayMatch(zones) || right->mayMatch(zones);
+    }
+};
+
+class NotExpression : public QueryExpression {
+private:
+    std::unique_ptr<QueryExpression> operand;
+
+public:
+    explicit NotExpression(std::unique_ptr<QueryExpression> inner) : operand(std::move(inner)) {}
+
+    void bind(const std::vector<QueryColumn>& columns) override {
+        operand->bind(columns);
+    }
+
+    void columnNames(std::set<std::string>& names) const override {
+        operand->columnNames(names);
+    }
+
+    void filter(const ColumnBatch& batch, std::vector<uint32_t>& selection) const override {
+        std::vector<uint32_t> matched = selection;
+        operand->filter(batch, matched);
+        std::vector<uint32_t> rest;
+        rest.reserve(selection.size() - matched.size());
+        std::set_difference(selection.begin(), selection.end(), matched.begin(), matched.end(), std::back_inserter(rest));
+        selection.swap(rest);
+    }
+
+    // NOT holds on rows that lack a column, which zones do not bound, so it rules out nothing
+    bool mayMatch(const std::vector<const ColumnZone*>&) const override {
+        return true;
+    }
+};
+
+// Recursive-descent parser of the expression language:
+//   or := and (OR and)*    and := not (AND not)*    not := NOT not | ( or ) | comparison
+class QueryExpressionParser {
+private:
+    std::string_view text;
+    size_t position = 0;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::invalid_argument("Query expression: " + message + " at position " + std::to_string(position));
+    }
+
+    void skipSpaces() {
+        while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+            ++position;
+        }
+    }
+
+    static bool isWordChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    // Consume a case-insensitive keyword that is not the start of a longer name
+    bool keyword(std::string_view word) {
+        skipSpaces();
+        if (text.size() - position < word.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < word.size(); ++i) {
+            if (std::toupper(static_cast<unsigned char>(text[position + i])) != word[i]) {
+                return false;
+            }
+        }
+        if (position + word.size() < text.size() && isWordChar(text[position + word.size()])) {
+            return false;
+        }
+        position += word.size();
+        return true;
+    }
+
+    bool symbol(char c) {
+        skipSpaces();
+        if (position < text.size() && text[position] == c) {
+            ++position;
+            return true;
+        }
+        return false;
+    }
+
+    ComparisonExpression::Operand operand() {
+        skipSpaces();
+        ComparisonExpression::Operand result;
+        if (position >= text.size()) {
+            fail("expected a column or a value");
+        }
+        char c = text[position];
+        if (c == '\'') {
+            std::string value;
+            for (++position;; ++position) {
+                if (position >= text.size()) {
+                    fail("unterminated string");
+                }
+                if (text[position] == '\'') {
+                    if (position + 1 < text.size() && text[position + 1] == '\'') {
+                        ++position;
+                    } else {
+                        ++position;
+                        break;
+                    }
+                }
+                value.push_back(text[position]);
+            }
+            result.literal = std::pmr::string(value);
+            result.literalType = TYPE_STRING;
+        } else if (std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '+' || c == '.') {
+            size_t start = position;
+            while (position < text.size() && (std::isalnum(static_cast<unsigned char>(text[position])) ||
+                                              text[position] == '.' || text[position] == '-' || text[position] == '+')) {
+                ++position;
+            }
+            std::string_view number = text.substr(start, position - start);
+            if (!number.empty() && number[0] == '+') {
+                number.remove_prefix(1);
+            }
+            if (Tuple::parseValue(TYPE_INT, number, result.literal, nullptr)) {
+                result.literalType = TYPE_INT;
+            } else if (Tuple::parseValue(TYPE_DOUBLE, number, result.literal, nullptr)) {
+                result.literalType = TYPE_DOUBLE;
+            } else {
+                fail("invalid number '" + std::string(number) + "'");
+            }
+        } else if (isWordChar(c)) {
+            size_t start = position;
+            while (position < text.size() && isWordChar(text[position])) {
+                ++position;
+            }
+            result.column = std::string(text.substr(start, position - start));
+        } else {
+            fail(std::string("unexpected '") + c + "'");
+        }
+        return result;
+    }
+
+    QueryExpression::Comparison comparisonOperator() {
+        skipSpaces();
+        static const std::pair<std::string_view, QueryExpression::Comparison> operators[] = {
+            {"==", QueryExpression::EQ}, {"!=", QueryExpression::NE}, {"<>", QueryExpression::NE},
+            {"<=", QueryExpression::LE}, {">=", QueryExpression::GE}, {"=", QueryExpression::EQ},
+            {"<", QueryExpression::LT},  {">", QueryExpression::GT},
+        };
+        for (const auto& [spelling, comparison] : operators) {
+            if (text.substr(position, spelling.size()) == spelling) {
+                position += spelling.size();
+                return comparison;
+            }
+        }
+        fail("expected a comparison operator");
+    }
+
+    std::unique_ptr<QueryExpression> parseNot() {
+        if (keyword("NOT")) {
+            return std::make_unique<NotExpression>(parseNot());
+        }
+        if (symbol('(')) {
+            std::unique_ptr<QueryExpression> inner = parseOr();
+            if (!symbol(')')) {
+                fail("expected ')'");
+            }
+            return inner;
+        }
+        ComparisonExpression::Operand lhs = operand();
+        QueryExpression::Comparison comparison = comparisonOperator();
+        ComparisonExpression::Operand rhs = operand();
+        if (!lhs.column && !rhs.column) {
+            fail("a comparison needs at least one column");
+        }
+        return std::make_unique<ComparisonExpression>(comparison, std::move(lhs), std::move(rhs));
+    }
+
+    std::unique_ptr<QueryExpression> parseAnd() {
+        std::unique_ptr<QueryExpression> result = parseNot();
+        while (keyword("AND")) {
+            result = std::make_unique<AndExpression>(std::move(result), parseNot());
+        }
+        return result;
+    }
+
+    std::unique_ptr<QueryExpression> parseOr() {
+        std::unique_ptr<QueryExpression> result = parseAnd();
+        while (keyword("OR")) {
+            result = std::make_unique<OrExpression>(std::move(result), parseAnd());
+        }
+        return result;
+    }
+
+public:
+    explicit QueryExpressionParser(std::string_view source) : text(source) {}
+
+    std::unique_ptr<QueryExpression> parse() {
+        std::unique_ptr<QueryExpression> result = parseOr();
+        skipSpaces();
+        if (position != text.size()) {
+            fail("unexpected text");
+        }
+        return result;
+    }
+};
+
+inline std::unique_ptr<QueryExpression> QueryExpression::parse(const std::string& text) {
+    return QueryExpressionParser(text).parse();
+}
+
+// Pull-based query operator. next() refills batch with the following rows that have
+// at least one row selected, and returns false once there are none.
+class QueryOperator {
+public:
+    virtual ~QueryOperator() = default;
+    virtual const std::vector<QueryColumn>& outputColumns() const = 0;
+    virtual bool next(ColumnBatch& batch) = 0;
+
+    // A filter directly above offers its predicate, bound to this operator's columns
+    // and valid while this operator is in use; a table scan uses it to skip pages
+    virtual void pushDownPredicate(const QueryExpression&) {}
+};
+
+// Rows of the input that satisfy a QueryExpression
+class FilterOperator : public QueryOperator {
+private:
+    std::unique_ptr<QueryOperator> input;
+    std::unique_ptr<QueryExpression> predicate;
+
+public:
+    // Throws std::invalid_argument if the predicate does not parse or bind
+    FilterOperator(std::unique_ptr<QueryOperator> child, const std::string& predicateText)
+        : FilterOperator(std::move(child), QueryExpression::parse(predicateText)) {}
+
+    FilterOperator(std::unique_ptr<QueryOperator> child, std::unique_ptr<QueryExpression> expression)
+        : input(std::move(child)), predicate(std::move(expression)) {
+        predicate->bind(input->outputColumns());
+        input->pushDownPredicate(*predicate);
+    }
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return input->outputColumns();
+    }
+
+    bool next(ColumnBatch& batch) override {
+        while (input->next(batch)) {
+            std::vector<uint32_t>& selection = batch.narrowSelection();
+            predicate->filter(batch, selection);
+            if (!selection.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// A subset of the input's columns, in the given order. Columns are handed over by
+// swapping buffers with the input batch, so nothing is copied.
+class ProjectOperator : public QueryOperator {
+private:
+    std::unique_ptr<QueryOperator> input;
+    std::vector<size_t> indices;
+    std::vector<QueryColumn> columns;
+    ColumnBatch inputBatch;
+
+public:
+    // Throws std::invalid_argument for an unknown or repeated column
+    ProjectOperator(std::unique_ptr<QueryOperator> child, const std::vector<std::string>& names) : input(std::move(child)) {
+        std::set<std::string> seen;
+        for (const std::string& name : names) {
+            if (!seen.insert(name).second) {
+                throw std::invalid_argument("Column listed twice: " + name);
+            }
+            indices.push_back(queryColumnIndex(input->outputColumns(), name));
+            columns.push_back(input->outputColumns()[indices.back()]);
+        }
+    }
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return columns;
+    }
+
+    bool next(ColumnBatch& batch) override {
+        if (!input->next(inputBatch)) {
+            return false;
+        }
+        batch.columns.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i) {
+            std::swap(batch.columns[i], inputBatch.columns[indices[i]]);
+        }
+        batch.rowCount = inputBatch.rowCount;
+        batch.selection.swap(inputBatch.selection);
+        batch.selective = inputBatch.selective;
+        return true;
+    }
+};
+
+// The first count selected rows of the input
+class LimitOperator : public QueryOperator {
+private:
+    std::unique_ptr<QueryOperator> input;
+    uint64_t remaining;
+
+public:
+    LimitOperator(std::unique_ptr<QueryOperator> child, uint64_t count) : input(std::move(child)), remaining(count) {}
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return input->outputColumns();
+    }
+
+    bool next(ColumnBatch& batch) override {
+        if (remaining == 0 || !input->next(batch)) {
+            return false;
+        }
+        if (batch.selectedCount() > remaining) {
+            batch.narrowSelection().resize(remaining);
+        }
+        remaining -= batch.selectedCount();
+        return true;
+    }
+};
+
+constexpr size_t UNION_QUEUE_BATCHES = 8;  // Batches a UnionOperator's inputs may run ahead of its reader
+
+// Rows of several inputs with the same columns, each input run on a thread of its
+// own from the first next() on. Batches are returned as the inputs produce them, so
+// rows of different inputs interleave. The inputs must allow next() on another
+// thread; they are destroyed with this operator, on the thread that destroys it.
+class UnionOperator : public QueryOperator {
+private:
+    std::vector<std::unique_ptr<QueryOperator>> inputs;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<ColumnBatch> ready;       // Filled batches not yet returned
+    std::vector<ColumnBatch> spare;      // Returned batches, whose buffers the inputs refill
+    std::vector<std::thread> workers;
+    size_t running = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void run(size_t input) {
+        try {
+            ColumnBatch batch;
+            while (inputs[input]->next(batch)) {
+                std::unique_lock<std::mutex> guard(mutex);
+                changed.wait(guard, [this]() { return stopping || ready.size() < UNION_QUEUE_BATCHES; });
+                if (stopping) {
+                    break;
+                }
+                ready.push_back(std::move(batch));
+                batch = ColumnBatch();
+                if (!spare.empty()) {
+                    batch = std::move(spare.back());
+                    spare.pop_back();
+                }
+                changed.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        --running;
+        changed.notify_all();
+    }
+
+public:
+    // Throws std::invalid_argument if the inputs do not have the same columns
+    explicit UnionOperator(std::vector<std::unique_ptr<QueryOperator>> children) : inputs(std::move(children)) {
+        if (inputs.empty()) {
+            throw std::invalid_argument("Union: no inputs");
+        }
+        for (const std::unique_ptr<QueryOperator>& input : inputs) {
+            const std::vector<QueryColumn>& columns = input->outputColumns();
+            if (columns.size() != inputs[0]->outputColumns().size() ||
+                !std::equal(columns.begin(), columns.end(), inputs[0]->outputColumns().begin(),
+                            [](const QueryColumn& a, const QueryColumn& b) { return a.name == b.name && a.type == b.type; })) {
+                throw std::invalid_argument("Union: inputs have different columns");
+            }
+        }
+    }
+
+    ~UnionOperator() override {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return inputs[0]->outputColumns();
+    }
+
+    bool next(ColumnBatch& batch) override {
+        if (workers.empty()) {
+            running = inputs.size();
+            for (size_t input = 0; input < inputs.size(); ++input) {
+                workers.emplace_back(&UnionOperator::run, this, input);
+            }
+        }
+        std::unique_lock<std::mutex> guard(mutex);
+        changed.wait(guard, [this]() { return error || !ready.empty() || running == 0; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if (ready.empty()) {
+            batch.reset(outputColumns());
+            return false;
+        }
+        std::swap(batch, ready.front());
+        spare.push_back(std::move(ready.front()));
+        ready.pop_front();
+        changed.notify_all();
+        return true;
+    }
+};
+
+class Storage;
+
+// Decodes chosen schema columns of stored rows ("key(type|value)" tokens) straight
+// into the columns of a batch; other attributes are skipped without being converted.
+// Dictionary codes are decoded back to their strings.
+class RowDecoder {
+private:
+    const TableDictionary* dictionary = nullptr;
+    std::vector<QueryColumn> columns;
+    std::vector<std::string> schemaNames;  // Schema position -> column name (the usual row layout)
+    std::vector<int> columnAtPosition;     // Schema position -> output column, -1 if not read
+    std::vector<uint8_t> seen;
+    std::string scratch;                   // A string value with its doubled ')' undone
+
+public:
+    RowDecoder() = default;
+
+    // Decode columnNames (all schema columns, in schema order, if empty). Throws
+    // std::invalid_argument for a column outside the schema or listed twice.
+    RowDecoder(const std::map<std::string, std::string>& schema, const std::vector<std::string>& columnNames,
+               const TableDictionary* tableDictionary);
+
+    const std::vector<QueryColumn>& outputColumns() const {
+        return columns;
+    }
+
+    // Schema position of every output column
+    std::vector<size_t> schemaPositions() const;
+
+    // Append one row to batch, which must be laid out as outputColumns()
+    void decode(std::string_view row, ColumnBatch& batch);
+};
+
+// Reads the pages [firstPage, endPage) of a table in order and decodes the requested
+// columns (all schema columns by default) into batches of QUERY_BATCH_ROWS rows.
+// Holds the engine lock from construction until the scan ends or is destroyed, so
+// it sees one state of the table; use it on the thread that created it. Once a
+// filter pushes its predicate down, pages the table's zone map rules out are skipped.
+class TableScanOperator : public QueryOperator {
+private:
+    std::unique_lock<std::recursive_mutex> lock;
+    bool releaseAtEnd = true;              // Unlock once exhausted; off once the lock is shared with other threads
+    bool finished = false;
+    std::string tablePath;
+    std::fstream file;
+    std::shared_ptr<const FileMetadata> fileMetadata;
+    std::shared_ptr<const TableZoneMap> zoneMap;   // Null until a predicate is pushed down
+    Storage* storage = nullptr;
+    RowDecoder decoder;
+    const QueryExpression* predicate = nullptr;
+    std::vector<size_t> zoneColumns;       // Output column -> column of the zone map
+    std::vector<const ColumnZone*> zones;  // Zones of the page being tested, by output column
+    uint64_t nextPage = 0;
+    uint64_t endPage = 0;
+    Page page{0};
+    size_t nextSlot = 0;                   // Next slot of page to decode; page is done when past its slots
+    bool pageLoaded = false;
+
+    // A scan of pages [firstPage, lastPage) that shares owner's table state and lock
+    TableScanOperator(const TableScanOperator& owner, uint64_t firstPage, uint64_t lastPage);
+
+    // Whether the predicate can hold on some row of a page, going by its zones
+    bool pageMayMatch(uint64_t pageID);
+
+public:
+    // Throws std::runtime_error if the table cannot be opened and
+    // std::invalid_argument for a column outside the schema
+    TableScanOperator(Storage& storage, const std::string& dbName, const std::string& tableName,
+                      const std::vector<std::string>& columnNames = {}, uint64_t firstPage = 0,
+                      uint64_t lastPage = std::numeric_limits<uint64_t>::max());
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return decoder.outputColumns();
+    }
+
+    bool next(ColumnBatch& batch) override;
+
+    void pushDownPredicate(const QueryExpression& expression) override;
+
+    uint64_t pagesLeft() const {
+        return endPage - std::min(nextPage, endPage);
+    }
+
+    // Keep the lock until this scan is destroyed instead of until it ends, so next()
+    // may run on another thread (see UnionOperator) while the creating thread owns it
+    void holdLockUntilDestroyed() {
+        releaseAtEnd = false;
+    }
+
+    // Divide the pages not read yet into up to parts contiguous ranges. This scan keeps
+    // the first; the others are returned as scans that read the rest without taking
+    // the lock, so they may run on other threads, but only while this scan is alive.
+    // This scan then holds the lock until it is destroyed, not just until it ends.
+    std::vector<std::unique_ptr<QueryOperator>> split(size_t parts);
+};
+
+constexpr size_t AGGREGATE_MEMORY_BUDGET = 64 << 20;  // Default bytes of group state held before spilling
+constexpr size_t AGGREGATE_SPILL_PARTITIONS = 16;     // Hash partitions of spilled groups
+constexpr size_t AGGREGATE_MAX_SPILL_LEVEL = 15;      // Deepest re-spill; each level uses 4 more hash bits
+
+// One aggregate of a GROUP BY query, written COUNT(*), COUNT(column), SUM(column),
+// MIN(column), MAX(column) or AVG(column); function names are case-insensitive.
+// Aggregates other than COUNT(*) skip rows that lack the column.
+struct AggregateSpec {
+    enum Function { COUNT, SUM, MIN, MAX, AVG };
+
+    Function function = COUNT;
+    std::string column;  // Empty for COUNT(*)
+    std::string name;    // Output column, e.g. "SUM(score)"
+
+    // Throws std::invalid_argument for anything else
+    static AggregateSpec parse(const std::string& text) {
+        auto trim = [](std::string_view view) {
+            while (!view.empty() && std::isspace(static_cast<unsigned char>(view.front()))) {
+                view.remove_prefix(1);
+            }
+            while (!view.empty() && std::isspace(static_cast<unsigned char>(view.back()))) {
+                view.remove_suffix(1);
+            }
+            return view;
+        };
+        std::string_view whole = trim(text);
+        size_t open = whole.find('(');
+        if (open == std::string_view::npos || whole.back() != ')') {
+            throw std::invalid_argument("Aggregate: expected FUNCTION(column) in '" + text + "'");
+        }
+        std::string function(trim(whole.substr(0, open)));
+        std::transform(function.begin(), function.end(), function.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+        std::string_view argument = trim(whole.substr(open + 1, whole.size() - open - 2));
+
+        static const std::map<std::string, Function> functions = {
+            {"COUNT", COUNT}, {"SUM", SUM}, {"MIN", MIN}, {"MAX", MAX}, {"AVG", AVG}};
+        auto found = functions.find(function);
+        if (found == functions.end()) {
+            throw std::invalid_argument("Aggregate: unknown function '" + function + "'");
+        }
+        if (argument.empty() || (argument == "*" && found->second != COUNT)) {
+            throw std::invalid_argument("Aggregate: " + function + " needs a column");
+        }
+        AggregateSpec spec;
+        spec.function = found->second;
+        if (argument != "*") {
+            spec.column = std::string(argument);
+        }
+        spec.name = function + "(" + std::string(argument) + ")";
+        return spec;
+    }
+};
+
+// Running state of one aggregate for one group. count is the number of values seen;
+// the sum or extreme sits in i, d or s depending on the function and column type.
+struct AggregateCell {
+    int64_t count = 0;
+    int64_t i = 0;
+    double d = 0;
+    std::string s;
+};
+
+// Groups of a hash aggregation: open addressing with linear probing over a power-of-
+// two slot array of group numbers. Keys (encoded group values) and the cells of every
+// group are stored densely by group number, so a probe touches one small array.
+class AggregateHashTable {
+private:
+    size_t width;                  // Cells per group
+    std::vector<uint32_t> slots;   // Group number + 1; 0 is an empty slot
+    std::string keys;
+    std::vector<uint32_t> keyEnds;
+    std::vector<uint64_t> hashes;
+    std::vector<AggregateCell> cells;
+    size_t stringBytes = 0;        // Heap held by string cells
+
+    void grow() {
+        std::vector<uint32_t> larger(slots.size() * 2, 0);
+        size_t mask = larger.size() - 1;
+        for (size_t group = 0; group < hashes.size(); ++group) {
+            size_t slot = hashes[group] & mask;
+            while (larger[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            larger[slot] = static_cast<uint32_t>(group + 1);
+        }
+        slots.swap(larger);
+    }
+
+public:
+    explicit AggregateHashTable(size_t cellsPerGroup) : width(cellsPerGroup), slots(1024, 0) {}
+
+    static uint64_t hashKey(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    // Spill partition of a key hash at a spill level: four bits per level from the
+    // top, as slots use the low ones
+    static size_t partitionOf(uint64_t hash, size_t level = 0) {
+        return static_cast<size_t>(hash >> (60 - 4 * level)) % AGGREGATE_SPILL_PARTITIONS;
+    }
+
+    size_t groupCount() const {
+        return hashes.size();
+    }
+
+    std::string_view key(size_t group) const {
+        uint32_t begin = group == 0 ? 0 : keyEnds[group - 1];
+        return std::string_view(keys.data() + begin, keyEnds[group] - begin);
+    }
+
+    uint64_t hash(size_t group) const {
+        return hashes[group];
+    }
+
+    AggregateCell& cell(size_t group, size_t aggregate) {
+        return cells[group * width + aggregate];
+    }
+
+    const AggregateCell& cell(size_t group, size_t aggregate) const {
+        return cells[group * width + aggregate];
+    }
+
+    // Group number of key, added with empty cells if it is new
+    uint32_t findOrAdd(std::string_view groupKey, uint64_t keyHash) {
+        size_t mask = slots.size() - 1;
+        size_t slot = keyHash & mask;
+        while (slots[slot] != 0) {
+            uint32_t group = slots[slot] - 1;
+            if (hashes[group] == keyHash && key(group) == groupKey) {
+                return group;
+            }
+            slot = (slot + 1) & mask;
+        }
+        uint32_t group = static_cast<uint32_t>(hashes.size());
+        slots[slot] = group + 1;
+        keys.append(groupKey);
+        keyEnds.push_back(static_cast<uint32_t>(keys.size()));
+        hashes.push_back(keyHash);
+        cells.resize(cells.size() + width);
+        if (hashes.size() * 2 > slots.size()) {
+            grow(); // Keep the load factor at most 1/2
+        }
+        return group;
+    }
+
+    void setString(AggregateCell& target, std::string_view value) {
+        stringBytes -= target.s.capacity();
+        target.s.assign(value);
+        stringBytes += target.s.capacity();
+    }
+
+    // Approximate bytes held, checked against the memory budget
+    size_t memoryBytes() const {
+        return slots.capacity() * sizeof(uint32_t) + keys.capacity() + keyEnds.capacity() * sizeof(uint32_t) +
+               hashes.capacity() * sizeof(uint64_t) + cells.capacity() * sizeof(AggregateCell) + stringBytes;
+    }
+
+    void clear() {
+        slots.assign(1024, 0);
+        slots.shrink_to_fit();
+        keys = std::string();
+        keyEnds = std::vector<uint32_t>();
+        hashes = std::vector<uint64_t>();
+        cells = std::vector<AggregateCell>();
+        stringBytes = 0;
+    }
+};
+
+// GROUP BY over the rows of its inputs, which all have the same columns: typically
+// the page ranges of one table scan (TableScanOperator::split()), each behind its own
+// filter. Every input is aggregated on its own thread into a private hash table, the
+// first on the calling thread; the tables are merged once all inputs are done, and
+// the inputs are released then, which ends the scan. A table that outgrows its share
+// of the memory budget is written out in AGGREGATE_SPILL_PARTITIONS hash partitions,
+// which are then merged one at a time; a partition that still does not fit is split
+// again on further hash bits. Output columns are the group columns followed
+// by the aggregates; groups come out in no particular order. Without group columns
+// there is exactly one output row.
+class HashAggregateOperator : public QueryOperator {
+private:
+    std::vector<std::unique_ptr<QueryOperator>> inputs;
+    std::vector<size_t> groupIndices;     // Group columns in the inputs' columns
+    std::vector<AggregateSpec> aggregates;
+    std::vector<int> argumentIndices;     // Aggregate column in the inputs' columns, -1 for COUNT(*)
+    std::vector<int> argumentTypes;
+    std::vector<QueryColumn> columns;
+    size_t memoryBudget;
+    std::string spillPrefix;              // Spill files are <prefix>.<input>.<partition>
+    std::vector<std::string> spillPaths;
+    std::atomic<bool> spilled{false};
+    std::vector<AggregateHashTable> partials;
+    bool aggregated = false;
+    std::optional<AggregateHashTable> output;  // Groups being emitted
+    size_t nextGroup = 0;
+    uint64_t groupsEmitted = 0;
+
+    // Spilled groups not merged yet: those whose hash falls in partition at level (see
+    // AggregateHashTable::partitionOf()), held in paths and, at level 0, in the partials
+    struct SpilledPartition {
+        size_t level;
+        size_t partition;
+        std::vector<std::string> paths;
+    };
+    std::vector<SpilledPartition> pending;  // The next one to merge at the back
+    size_t respills = 0;                    // Partitions spilled again, which names their files
+
+    std::string spillPath(size_t input, size_t partition) const {
+        return spillPrefix + "." + std::to_string(input) + "." + std::to_string(partition);
+    }
+
+    // Group values of a row as bytes (see ColumnVector::encodeValue)
+    void encodeKey(const ColumnBatch& batch, uint32_t row, std::string& key) const {
+        key.clear();
+        for (size_t index : groupIndices) {
+            batch.columns[index].encodeValue(row, key);
+        }
+    }
+
+    void decodeKey(std::string_view key, ColumnBatch& batch) const {
+        for (size_t i = 0; i < groupIndices.size(); ++i) {
+            batch.columns[i].decodeValue(key);
+        }
+    }
+
+    // Call update(cell, row) for every selected row that has the aggregate's column
+    template <typename Update>
+    void eachValue(AggregateHashTable& table, const ColumnBatch& batch, size_t aggregate,
+                   const std::vector<uint32_t>& groupOf, Update update) const {
+        const std::vector<uint8_t>& present = batch.columns[argumentIndices[aggregate]].present;
+        for (size_t i = 0; i < groupOf.size(); ++i) {
+            uint32_t row = batch.selectedRow(i);
+            if (present[row]) {
+                update(table.cell(groupOf[i], aggregate), row);
+            }
+        }
+    }
+
+    // Fold one aggregate's column of a batch into the groups, one loop per function and type
+    void accumulate(AggregateHashTable& table, const ColumnBatch& batch, size_t aggregate,
+                    const std::vector<uint32_t>& groupOf) const {
+        if (argumentIndices[aggregate] < 0) {
+            for (uint32_t group : groupOf) {
+                ++table.cell(group, aggregate).count;
+            }
+            return;
+        }
+        const ColumnVector& column = batch.columns[argumentIndices[aggregate]];
+        const std::vector<int64_t>& ints = column.ints;
+        const std::vector<double>& doubles = column.doubles;
+        AggregateSpec::Function function = aggregates[aggregate].function;
+        if (function == AggregateSpec::COUNT) {
+            eachValue(table, batch, aggregate, groupOf, [](AggregateCell& cell, uint32_t) { ++cell.count; });
+        } else if (function == AggregateSpec::SUM && column.type == TYPE_INT) {
+            eachValue(table, batch, aggregate, groupOf, [&](AggregateCell& cell, uint32_t row) {
+                cell.i += ints[row];
+                ++cell.count;
+            });
+        } else if (function == AggregateSpec::SUM || function == AggregateSpec::AVG) {
+            if (column.type == TYPE_INT) {
+                eachValue(table, batch, aggregate, groupOf, [&](AggregateCell& cell, uint32_t row) {
+                    cell.d += static_cast<double>(ints[row]);
+                    ++cell.count;
+                });
+            } else {
+                eachValue(table, batch, aggregate, groupOf, [&](AggregateCell& cell, uint32_t row) {
+                    cell.d += doubles[row];
+                    ++cell.count;
+                });
+            }
+        } else {
+            bool wantMax = function == AggregateSpec::MAX;
+            if (column.type == TYPE_INT) {
+                eachValue(table, batch, aggregate, groupOf, [&](AggregateCell& cell, uint32_t row) {
+                    if (cell.count++ == 0 || (wantMax ? ints[row] > cell.i : ints[row] < cell.i)) {
+                        cell.i = ints[row];
+                    }
+                });
+            } else if (column.type == TYPE_DOUBLE) {
+                eachValue(table, batch, aggregate, groupOf, [&](AggregateCell& cell, uint32_t row) {
+                    if (cell.count++ == 0 || (wantMax ? doubles[row] > cell.d : doubles[row] < cell.d)) {
+                        cell.d = doubles[row];
+                    }
+                });
+            } else {
+                eachValue(table, batch, aggregate, groupOf, [&](AggregateCell& cell, uint32_t row) {
+                    std::string_view text = column.stringAt(row);
+                    if (cell.count++ == 0 || (wantMax ? text > cell.s : text < cell.s)) {
+                        table.setString(cell, text);
+                    }
+                });
+            }
+        }
+    }
+
+    // Combine the cells of one group from another table (or a spill file) into table
+    void mergeGroup(AggregateHashTable& table, std::string_view key, uint64_t hash, const AggregateCell* from) const {
+        uint32_t group = table.findOrAdd(key, hash);
+        for (size_t aggregate = 0; aggregate < aggregates.size(); ++aggregate) {
+            AggregateCell& into = table.cell(group, aggregate);
+            const AggregateCell& other = from[aggregate];
+            AggregateSpec::Function function = aggregates[aggregate].function;
+            if (other.count == 0) {
+                continue;
+            }
+            if (function == AggregateSpec::MIN || function == AggregateSpec::MAX) {
+                bool wantMax = function == AggregateSpec::MAX;
+                bool replace = into.count == 0;
+                if (!replace && argumentTypes[aggregate] == TYPE_INT) {
+                    replace = wantMax ? other.i > into.i : other.i < into.i;
+                } else if (!replace && argumentTypes[aggregate] == TYPE_DOUBLE) {
+                    replace = wantMax ? other.d > into.d : other.d < into.d;
+                } else if (!replace) {
+                    replace = wantMax ? other.s > into.s : other.s < into.s;
+                }
+                if (replace) {
+                    into.i = other.i;
+                    into.d = other.d;
+                    table.setString(into, other.s);
+                }
+            } else {
+                into.i += other.i;
+                into.d += other.d;
+            }
+            into.count += other.count;
+        }
+    }
+
+    // Spill record: [uint32 key length][key] then per aggregate
+    // [int64 count][int64 i][double d][uint32 length][string]
+    void writeGroups(const AggregateHashTable& table, std::vector<std::ofstream>& files, size_t level = 0) const {
+        for (size_t group = 0; group < table.groupCount(); ++group) {
+            std::ofstream& file = files[AggregateHashTable::partitionOf(table.hash(group), level)];
+            std::string_view key = table.key(group);
+            uint32_t length = static_cast<uint32_t>(key.size());
+            file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            file.write(key.data(), key.size());
+            for (size_t aggregate = 0; aggregate < aggregates.size(); ++aggregate) {
+                const AggregateCell& cell = table.cell(group, aggregate);
+                length = static_cast<uint32_t>(cell.s.size());
+                file.write(reinterpret_cast<const char*>(&cell.count), sizeof(cell.count));
+                file.write(reinterpret_cast<const char*>(&cell.i), sizeof(cell.i));
+                file.write(reinterpret_cast<const char*>(&cell.d), sizeof(cell.d));
+                file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                file.write(cell.s.data(), cell.s.size());
+            }
+        }
+        for (std::ofstream& file : files) {
+            if (!file) {
+                throw std::runtime_error("Failed to write aggregate spill file: " + spillPrefix);
+            }
+        }
+    }
+
+    // Call merge(key, hash, cells) for every group of a spill file
+    template <typename Merge>
+    void readGroups(const std::string& path, Merge merge) const {
+        std::ifstream file(path, std::ios::binary);
+        std::string key;
+        std::vector<AggregateCell> cells(aggregates.size());
+        uint32_t length;
+        while (file.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            key.resize(length);
+            file.read(key.data(), length);
+            for (AggregateCell& cell : cells) {
+                file.read(reinterpret_cast<char*>(&cell.count), sizeof(cell.count));
+                file.read(reinterpret_cast<char*>(&cell.i), sizeof(cell.i));
+                file.read(reinterpret_cast<char*>(&cell.d), sizeof(cell.d));
+                file.read(reinterpret_cast<char*>(&length), sizeof(length));
+                cell.s.resize(length);
+                file.read(cell.s.data(), length);
+            }
+            if (!file) {
+                throw std::runtime_error("Truncated aggregate spill file: " + path);
+            }
+            merge(key, AggregateHashTable::hashKey(key), cells.data());
+        }
+    }
+
+    // Drain one input into its partial table, spilling it whenever it passes its share of the budget
+    void aggregateInput(size_t input) {
+        AggregateHashTable& table = partials[input];
+        size_t budget = std::max<size_t>(memoryBudget / inputs.size(), 1);
+        std::vector<std::ofstream> files;
+        ColumnBatch batch;
+        std::string key;
+        std::vector<uint32_t> groupOf;
+        while (inputs[input]->next(batch)) {
+            groupOf.resize(batch.selectedCount());
+            for (size_t i = 0; i < groupOf.size(); ++i) {
+                encodeKey(batch, batch.selectedRow(i), key);
+                groupOf[i] = table.findOrAdd(key, AggregateHashTable::hashKey(key));
+            }
+            for (size_t aggregate = 0; aggregate < aggregates.size(); ++aggregate) {
+                accumulate(table, batch, aggregate, groupOf);
+            }
+            if (table.memoryBytes() > budget) {
+                if (files.empty()) {
+                    for (size_t partition = 0; partition < AGGREGATE_SPILL_PARTITIONS; ++partition) {
+                        files.emplace_back(spillPath(input, partition), std::ios::binary | std::ios::trunc);
+                    }
+                }
+                std::cout << "Debug aggregate: Spilling " << table.groupCount() << " groups of input " << input
+                          << std::endl;
+                writeGroups(table, files);
+                table.clear();
+                spilled = true;
+            }
+        }
+    }
+
+    // Run every input to the end, each on its own thread, then release them
+    void aggregateInputs() {
+        TraceSpan span("aggregate_build");
+        for (size_t input = 0; input < inputs.size(); ++input) {
+            partials.emplace_back(aggregates.size());
+            for (size_t partition = 0; partition < AGGREGATE_SPILL_PARTITIONS; ++partition) {
+                spillPaths.push_back(spillPath(input, partition));
+            }
+        }
+        std::vector<std::exception_ptr> errors(inputs.size());
+        auto run = [this, &errors](size_t input) {
+            try {
+                aggregateInput(input);
+            } catch (...) {
+                errors[input] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t input = 1; input < inputs.size(); ++input) {
+            workers.emplace_back(run, input);
+        }
+        run(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        inputs.clear(); // Ends the scan, and with it the engine lock
+        for (const std::exception_ptr& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        if (!spilled) {
+            // Everything fits: fold the partials into the first
+            for (size_t input = 1; input < partials.size(); ++input) {
+                const AggregateHashTable& partial = partials[input];
+                for (size_t group = 0; group < partial.groupCount(); ++group) {
+                    mergeGroup(partials[0], partial.key(group), partial.hash(group), &partial.cell(group, 0));
+                }
+            }
+            output.emplace(std::move(partials[0]));
+            partials.clear();
+            return;
+        }
+        for (size_t partition = AGGREGATE_SPILL_PARTITIONS; partition-- > 0;) {
+            pending.push_back({0, partition, {}});
+            for (size_t input = 0; input < partials.size(); ++input) {
+                pending.back().paths.push_back(spillPath(input, partition));
+            }
+        }
+    }
+
+    // Assemble the next spilled partition from the partials and its spill files. If it
+    // outgrows the memory budget it is spilled again, split on the next four bits of
+    // the hashes, and its parts are merged next, one at a time.
+    void loadPartition() {
+        TraceSpan span("aggregate_merge");
+        SpilledPartition current = std::move(pending.back());
+        pending.pop_back();
+        output.emplace(aggregates.size());
+        nextGroup = 0;
+        bool canRespill = current.level < AGGREGATE_MAX_SPILL_LEVEL;
+        std::vector<std::string> paths;
+        std::vector<std::ofstream> files;
+        auto merge = [&](std::string_view key, uint64_t hash, const AggregateCell* cells) {
+            mergeGroup(*output, key, hash, cells);
+            if (canRespill && output->groupCount() > 1 && output->memoryBytes() > memoryBudget) {
+                if (files.empty()) {
+                    std::string prefix = spillPrefix + ".r" + std::to_string(respills++);
+                    for (size_t partition = 0; partition < AGGREGATE_SPILL_PARTITIONS; ++partition) {
+                        paths.push_back(prefix + "." + std::to_string(partition));
+                        spillPaths.push_back(paths.back());
+                        files.emplace_back(paths.back(), std::ios::binary | std::ios::trunc);
+                    }
+                }
+                std::cout << "Debug aggregate: Spilling " << output->groupCount() << " groups of partition "
+                          << current.partition << " at level " << current.level << std::endl;
+                writeGroups(*output, files, current.level + 1);
+                output->clear();
+            }
+        };
+
+        if (current.level == 0) {
+            for (const AggregateHashTable& partial : partials) {
+                for (size_t group = 0; group < partial.groupCount(); ++group) {
+                    if (AggregateHashTable::partitionOf(partial.hash(group)) == current.partition) {
+                        merge(partial.key(group), partial.hash(group), &partial.cell(group, 0));
+                    }
+                }
+            }
+        }
+        for (const std::string& path : current.paths) {
+            std::error_code error;
+            if (fs::exists(path, error)) {
+                readGroups(path, merge);
+                fs::remove(path, error);
+            }
+        }
+        if (files.empty()) {
+            return;
+        }
+        writeGroups(*output, files, current.level + 1);
+        output.reset();
+        for (std::ofstream& file : files) {
+            file.close();
+            if (!file) {
+                throw std::runtime_error("Failed to write aggregate spill file: " + spillPrefix);
+            }
+        }
+        for (size_t partition = AGGREGATE_SPILL_PARTITIONS; partition-- > 0;) {
+            pending.push_back({current.level + 1, partition, {paths[partition]}});
+        }
+    }
+
+    // Append one group's row: its group values, then each aggregate's result (absent
+    // when no value was seen, except for COUNT)
+    void appendGroup(std::string_view key, const AggregateCell* cells, ColumnBatch& batch) const {
+        decodeKey(key, batch);
+        for (size_t aggregate = 0; aggregate < aggregates.size(); ++aggregate) {
+            ColumnVector& column = batch.columns[groupIndices.size() + aggregate];
+            const AggregateCell& cell = cells[aggregate];
+            AggregateSpec::Function function = aggregates[aggregate].function;
+            if (function == AggregateSpec::COUNT) {
+                column.appendInt(cell.count);
+            } else if (cell.count == 0) {
+                column.appendAbsent();
+            } else if (function == AggregateSpec::AVG) {
+                column.appendDouble(cell.d / static_cast<double>(cell.count));
+            } else if (column.type == TYPE_INT) {
+                column.appendInt(cell.i);
+            } else if (column.type == TYPE_DOUBLE) {
+                column.appendDouble(cell.d);
+            } else {
+                column.appendString(cell.s);
+            }
+        }
+        ++batch.rowCount;
+    }
+
+public:
+    // Throws std::invalid_argument for an unknown column or an aggregate that does not
+    // fit its column (SUM or AVG of a string column, a repeated output column)
+    HashAggregateOperator(std::vector<std::unique_ptr<QueryOperator>> children, const std::vector<std::string>& groupBy,
+                          std::vector<AggregateSpec> specs, size_t budget = AGGREGATE_MEMORY_BUDGET,
+                          std::string spillFilePrefix = "aggregate")
+        : inputs(std::move(children)), aggregates(std::move(specs)), memoryBudget(budget),
+          spillPrefix(std::move(spillFilePrefix)) {
+        if (inputs.empty()) {
+            throw std::invalid_argument("Aggregate: no input");
+        }
+        const std::vector<QueryColumn>& inputColumns = inputs.front()->outputColumns();
+        std::set<std::string> names;
+        for (const std::string& name : groupBy) {
+            groupIndices.push_back(queryColumnIndex(inputColumns, name));
+            columns.push_back(inputColumns[groupIndices.back()]);
+            if (!names.insert(name).second) {
+                throw std::invalid_argument("Column listed twice: " + name);
+            }
+        }
+        for (const AggregateSpec& spec : aggregates) {
+            if (!names.insert(spec.name).second) {
+                throw std::invalid_argument("Column listed twice: " + spec.name);
+            }
+            int type = TYPE_INT;
+            argumentIndices.push_back(-1);
+            if (!spec.column.empty()) {
+                argumentIndices.back() = static_cast<int>(queryColumnIndex(inputColumns, spec.column));
+                type = inputColumns[argumentIndices.back()].type;
+            }
+            argumentTypes.push_back(type);
+            if ((spec.function == AggregateSpec::SUM || spec.function == AggregateSpec::AVG) && type == TYPE_STRING) {
+                throw std::invalid_argument("Aggregate: " + spec.name + " needs a numeric column");
+            }
+            int outputType = type;
+            if (spec.function == AggregateSpec::COUNT) {
+                outputType = TYPE_INT;
+            } else if (spec.function == AggregateSpec::AVG) {
+                outputType = TYPE_DOUBLE;
+            }
+            columns.push_back({spec.name, outputType});
+        }
+    }
+
+    ~HashAggregateOperator() override {
+        inputs.clear();
+        std::error_code error;
+        for (const std::string& path : spillPaths) {
+            fs::remove(path, error);
+        }
+    }
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return columns;
+    }
+
+    bool next(ColumnBatch& batch) override {
+        batch.reset(columns);
+        if (!aggregated) {
+            aggregated = true;
+            aggregateInputs();
+        }
+        while (batch.rowCount < QUERY_BATCH_ROWS) {
+            if (output && nextGroup < output->groupCount()) {
+                appendGroup(output->key(nextGroup), &output->cell(nextGroup, 0), batch);
+                ++nextGroup;
+                ++groupsEmitted;
+                continue;
+            }
+            if (!pending.empty()) {
+                loadPartition();
+                continue;
+            }
+            if (groupsEmitted == 0 && groupIndices.empty()) {
+                // No rows: the one global group still reports COUNT 0
+                std::vector<AggregateCell> empty(aggregates.size());
+                appendGroup(std::string_view(), empty.data(), batch);
+                ++groupsEmitted;
+            }
+            output.reset();
+            partials.clear();
+            break;
+        }
+        return batch.rowCount > 0;
+    }
+};
+
+constexpr size_t JOIN_MEMORY_BUDGET = 64 << 20;  // Default bytes of build rows held before partitioning
+constexpr size_t JOIN_PARTITIONS = 16;            // Radix partitions of a join too large for memory
+constexpr size_t JOIN_MAX_PARTITION_LEVEL = 15;   // Deepest repartitioning; each level uses 4 more hash bits
+
+// One table of a join: its join column, the columns to return (every schema column
+// if empty) and a filter on its rows (see QueryExpression; empty keeps every row)
+struct JoinInput {
+    std::string table;
+    std::string key;
+    std::vector<std::string> columns;
+    std::string where;
+};
+
+// Equi-join of two inputs on one column each. The build input is read first into a
+// hash table of its rows; the probe input then streams past it, and every probe row
+// is paired with each build row of the same key. Rows that lack the key match
+// nothing, and an int key matches a double key of the same value. If the build rows
+// outgrow the memory budget, both inputs are radix-partitioned on the key hash into
+// JOIN_PARTITIONS temporary files instead, and the partitions are joined one pair at
+// a time; a pair whose build rows still outgrow the budget is partitioned again on
+// further hash bits. Output columns are the left input's then the right input's, named
+// "<left name>.<column>" and "<right name>.<column>"; rows come out in probe order
+// within each partition.
+class HashJoinOperator : public QueryOperator {
+private:
+    // A build row; rows of the same key are chained through next
+    struct Entry {
+        uint64_t hash;
+        size_t offset;   // Record in rows: [uint32 key length][key][encoded columns]
+        uint32_t length;
+        uint32_t next;   // Following entry of the same key, or NONE
+    };
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    std::unique_ptr<QueryOperator> build;
+    std::unique_ptr<QueryOperator> probe;
+    bool buildIsLeft;
+    size_t buildKey;
+    size_t probeKey;
+    bool keyAsDouble = false;       // The key columns differ in numeric type
+    std::vector<QueryColumn> buildColumns;
+    std::vector<QueryColumn> probeColumns;
+    std::vector<QueryColumn> columns;
+    size_t memoryBudget;
+    std::string spillPrefix;        // Partition files are <prefix>[.r<n>].build.<n> and <prefix>[.r<n>].probe.<n>
+
+    std::string rows;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> slots;    // Entry number + 1 of the first row of a key; 0 is empty
+    size_t keyCount = 0;            // Distinct keys in the table
+
+    // A pair of partition files: the rows whose key hash falls in the same partition
+    // at level (see partitionOf())
+    struct PartitionPair {
+        size_t level;
+        std::string buildPath;
+        std::string probePath;
+    };
+
+    bool built = false;
+    bool partitioned = false;
+    std::vector<std::ofstream> buildFiles;
+    std::vector<PartitionPair> pending;      // Pairs to join, the next one at the back
+    std::vector<std::string> partitionFiles; // Every partition file created, removed at the end
+    size_t repartitions = 0;                 // Pairs partitioned again, which names their files
+    std::ifstream probeFile;
+    std::string probePath;          // Of the pair being joined
+    ColumnBatch probeBatch;
+    size_t probeIndex = 0;          // Next selected row of probeBatch
+    uint32_t probeRow = 0;          // Row of probeBatch being matched
+    uint32_t match = NONE;          // Next build entry to pair with probeRow
+    std::string key;
+    std::string record;
+
+    static std::string partitionPath(const std::string& prefix, const char* side, size_t partition) {
+        return prefix + "." + side + "." + std::to_string(partition);
+    }
+
+    // Create (empty) the JOIN_PARTITIONS files of one side of a partitioning
+    std::vector<std::ofstream> createPartitionFiles(const std::string& prefix, const char* side) {
+        std::vector<std::ofstream> files;
+        for (size_t partition = 0; partition < JOIN_PARTITIONS; ++partition) {
+            partitionFiles.push_back(partitionPath(prefix, side, partition));
+            files.emplace_back(partitionFiles.back(), std::ios::binary | std::ios::trunc);
+        }
+        return files;
+    }
+
+    // Partition of a key hash at a partitioning level: four bits per level from the top,
+    // as slots use the low ones
+    static size_t partitionOf(uint64_t hash, size_t level = 0) {
+        return static_cast<size_t>(hash >> (60 - 4 * level)) % JOIN_PARTITIONS;
+    }
+
+    static uint64_t hashKey(std::string_view keyBytes) {
+        return std::hash<std::string_view>{}(keyBytes);
+    }
+
+    // Key of a row as bytes, false if the row lacks it. Double keys are encoded by
+    // value: -0.0 as 0.0, and ints as doubles when the other key is a double.
+    bool encodeKey(const ColumnVector& column, uint32_t row, std::string& out) const {
+        out.clear();
+        if (!column.present[row]) {
+            return false;
+        }
+        if (column.type == TYPE_DOUBLE || (keyAsDouble && column.type == TYPE_INT)) {
+            double value = column.type == TYPE_INT ? static_cast<double>(column.ints[row]) : column.doubles[row];
+            if (value == 0.0) {
+                value = 0.0;
+            }
+            out.push_back(1); // Present, as ColumnVector::encodeValue() writes it
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        } else {
+            column.encodeValue(row, out);
+        }
+        return true;
+    }
+
+    // Record of a row: [uint32 key length][key][every column encoded]
+    static void encodeRecord(const ColumnBatch& batch, uint32_t row, const std::string& rowKey, std::string& out) {
+        uint32_t length = static_cast<uint32_t>(rowKey.size());
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(rowKey);
+        for (const ColumnVector& column : batch.columns) {
+            column.encodeValue(row, out);
+        }
+    }
+
+    static std::string_view recordKey(std::string_view recordBytes) {
+        uint32_t length;
+        std::memcpy(&length, recordBytes.data(), sizeof(length));
+        return recordBytes.substr(sizeof(length), length);
+    }
+
+    size_t memoryBytes() const {
+        return rows.capacity() + entries.capacity() * sizeof(Entry) + slots.capacity() * sizeof(uint32_t);
+    }
+
+    void insertEntry(size_t offset, size_t length) {
+        std::string_view entryKey = recordKey(std::string_view(rows).substr(offset));
+        uint64_t hash = hashKey(entryKey);
+        if ((entries.size() + 1) * 2 > slots.size()) {
+            // Rehash into twice the slots; chains move with their first entry
+            std::vector<uint32_t> larger(std::max<size_t>(slots.size() * 2, 1024), 0);
+            size_t mask = larger.size() - 1;
+            for (uint32_t head : slots) {
+                if (head != 0) {
+                    size_t slot = entries[head - 1].hash & mask;
+                    while (larger[slot] != 0) {
+                        slot = (slot + 1) & mask;
+                    }
+                    larger[slot] = head;
+                }
+            }
+            slots.swap(larger);
+        }
+        uint32_t number = static_cast<uint32_t>(entries.size());
+        entries.push_back({hash, offset, static_cast<uint32_t>(length), NONE});
+        size_t mask = slots.size() - 1;
+        size_t slot = hash & mask;
+        while (slots[slot] != 0) {
+            Entry& head = entries[slots[slot] - 1];
+            if (head.hash == hash && recordKey(std::string_view(rows).substr(head.offset)) == entryKey) {
+                entries.back().next = head.next; // Join the chain of this key
+                head.next = number;
+                return;
+            }
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = number + 1;
+        ++keyCount;
+    }
+
+    uint32_t lookup(std::string_view probeKeyBytes) const {
+        if (slots.empty()) {
+            return NONE;
+        }
+        uint64_t hash = hashKey(probeKeyBytes);
+        size_t mask = slots.size() - 1;
+        for (size_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+            const Entry& head = entries[slots[slot] - 1];
+            if (head.hash == hash && recordKey(std::string_view(rows).substr(head.offset)) == probeKeyBytes) {
+                return slots[slot] - 1;
+            }
+        }
+        return NONE;
+    }
+
+    void clearTable() {
+        rows = std::string();
+        entries = std::vector<Entry>();
+        slots = std::vector<uint32_t>();
+        keyCount = 0;
+    }
+
+    // Move the rows held so far into the build partition files; later build rows go straight there
+    void startPartitioning() {
+        std::cout << "Debug join: Build side passed " << memoryBudget << " bytes; partitioning both inputs" << std::endl;
+        partitioned = true;
+        buildFiles = createPartitionFiles(spillPrefix, "build");
+        for (const Entry& entry : entries) {
+            writeRecord(buildFiles[partitionOf(entry.hash)], std::string_view(rows).substr(entry.offset, entry.length));
+        }
+        clearTable();
+    }
+
+    // Partition files hold [uint32 length][record] per row
+    void writeRecord(std::ofstream& file, std::string_view recordBytes) const {
+        uint32_t length = static_cast<uint32_t>(recordBytes.size());
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(recordBytes.data(), recordBytes.size());
+        if (!file) {
+            throw std::runtime_error("Failed to write join partition file: " + spillPrefix);
+        }
+    }
+
+    bool readRecord(std::ifstream& file, std::string& out) {
+        uint32_t length;
+        if (!file.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            return false;
+        }
+        out.resize(length);
+        if (!file.read(out.data(), length)) {
+            throw std::runtime_error("Truncated join partition file: " + spillPrefix);
+        }
+        return true;
+    }
+
+    // Read the build input into the table, switching to partition files past the budget
+    void buildTable() {
+        TraceSpan span("join_build");
+        ColumnBatch batch;
+        while (build->next(batch)) {
+            for (size_t i = 0; i < batch.selectedCount(); ++i) {
+                uint32_t row = batch.selectedRow(i);
+                if (!encodeKey(batch.columns[buildKey], row, key)) {
+                    continue;
+                }
+                if (partitioned) {
+                    record.clear();
+                    encodeRecord(batch, row, key, record);
+                    writeRecord(buildFiles[partitionOf(hashKey(key))], record);
+                    continue;
+                }
+                size_t offset = rows.size();
+                encodeRecord(batch, row, key, rows);
+                insertEntry(offset, rows.size() - offset);
+            }
+            if (!partitioned && memoryBytes() > memoryBudget) {
+                startPartitioning();
+            }
+        }
+        build.reset(); // Ends the build scan
+        if (partitioned) {
+            buildFiles.clear();
+            partitionProbe();
+            for (size_t partition = JOIN_PARTITIONS; partition-- > 0;) {
+                pending.push_back({0, partitionPath(spillPrefix, "build", partition),
+                                   partitionPath(spillPrefix, "probe", partition)});
+            }
+        }
+    }
+
+    // Write the whole probe input to its partition files
+    void partitionProbe() {
+        TraceSpan span("join_partition");
+        std::vector<std::ofstream> files = createPartitionFiles(spillPrefix, "probe");
+        ColumnBatch batch;
+        while (probe->next(batch)) {
+            for (size_t i = 0; i < batch.selectedCount(); ++i) {
+                uint32_t row = batch.selectedRow(i);
+                if (!encodeKey(batch.columns[probeKey], row, key)) {
+                    continue;
+                }
+                record.clear();
+                encodeRecord(batch, row, key, record);
+                writeRecord(files[partitionOf(hashKey(key))], record);
+            }
+        }
+        probe.reset(); // Ends the probe scan
+    }
+
+    // Split a pair whose build rows outgrow the budget on the next four bits of the key
+    // hashes: the rows in the table, the rest of buildFile and the whole probe file go
+    // to new pairs, which are joined next
+    void repartition(const PartitionPair& pair, std::ifstream& buildFile) {
+        std::cout << "Debug join: Partition at level " << pair.level << " passed " << memoryBudget
+                  << " bytes; partitioning it again" << std::endl;
+        size_t level = pair.level + 1;
+        std::string prefix = spillPrefix + ".r" + std::to_string(repartitions++);
+        {
+            std::vector<std::ofstream> files = createPartitionFiles(prefix, "build");
+            for (const Entry& entry : entries) {
+                writeRecord(files[partitionOf(entry.hash, level)], std::string_view(rows).substr(entry.offset, entry.length));
+            }
+            clearTable();
+            while (readRecord(buildFile, record)) {
+                writeRecord(files[partitionOf(hashKey(recordKey(record)), level)], record);
+            }
+        }
+        {
+            std::vector<std::ofstream> files = createPartitionFiles(prefix, "probe");
+            std::ifstream probeIn(pair.probePath, std::ios::binary);
+            while (readRecord(probeIn, record)) {
+                writeRecord(files[partitionOf(hashKey(recordKey(record)), level)], record);
+            }
+        }
+        std::error_code error;
+        fs::remove(pair.probePath, error);
+        for (size_t partition = JOIN_PARTITIONS; partition-- > 0;) {
+            pending.push_back({level, partitionPath(prefix, "build", partition), partitionPath(prefix, "probe", partition)});
+        }
+    }
+
+    // Load the next partition pair: its build rows into the table, its probe file for reading
+    bool loadPartition() {
+        probeFile.close();
+        std::error_code error;
+        if (!probePath.empty()) {
+            fs::remove(probePath, error); // The pair just joined
+            probePath.clear();
+        }
+        while (!pending.empty()) {
+            PartitionPair pair = std::move(pending.back());
+            pending.pop_back();
+            clearTable();
+            bool split = false;
+            {
+                std::ifstream buildFile(pair.buildPath, std::ios::binary);
+                while (!split && readRecord(buildFile, record)) {
+                    size_t offset = rows.size();
+                    rows += record;
+                    insertEntry(offset, record.size());
+                    if (memoryBytes() > memoryBudget && keyCount > 1 && pair.level < JOIN_MAX_PARTITION_LEVEL) {
+                        repartition(pair, buildFile);
+                        split = true;
+                    }
+                }
+            }
+            fs::remove(pair.buildPath, error);
+            if (split) {
+                continue;
+            }
+            if (entries.empty()) {
+                fs::remove(pair.probePath, error);
+                continue; // Nothing on the build side can match this partition's probe rows
+            }
+            probePath = pair.probePath;
+            probeFile.clear();
+            probeFile.open(probePath, std::ios::binary);
+            return true;
+        }
+        return false;
+    }
+
+    // Refill probeBatch from the probe input or the current partition's probe file
+    bool nextProbeBatch() {
+        probeIndex = 0;
+        if (!partitioned) {
+            return probe && probe->next(probeBatch);
+        }
+        for (;;) {
+            probeBatch.reset(probeColumns);
+            while (probeFile.is_open() && probeBatch.rowCount < QUERY_BATCH_ROWS && readRecord(probeFile, record)) {
+                std::string_view rest = std::string_view(record).substr(sizeof(uint32_t) + recordKey(record).size());
+                for (ColumnVector& column : probeBatch.columns) {
+                    column.decodeValue(rest);
+                }
+                ++probeBatch.rowCount;
+            }
+            if (probeBatch.rowCount > 0) {
+                return true;
+            }
+            if (!loadPartition()) {
+                return false;
+            }
+        }
+    }
+
+    // Append probeRow paired with build entry
+    void appendMatch(const Entry& entry, ColumnBatch& batch) const {
+        std::string_view buildRow = std::string_view(rows).substr(entry.offset);
+        buildRow.remove_prefix(sizeof(uint32_t) + recordKey(buildRow).size());
+        size_t buildFirst = buildIsLeft ? 0 : probeColumns.size();
+        size_t probeFirst = buildIsLeft ? buildColumns.size() : 0;
+        for (size_t i = 0; i < buildColumns.size(); ++i) {
+            batch.columns[buildFirst + i].decodeValue(buildRow);
+        }
+        for (size_t i = 0; i < probeColumns.size(); ++i) {
+            batch.columns[probeFirst + i].appendFrom(probeBatch.columns[i], probeRow);
+        }
+        ++batch.rowCount;
+    }
+
+public:
+    // Throws std::invalid_argument for an unknown key column or keys of a string and
+    // a numeric column
+    HashJoinOperator(std::unique_ptr<QueryOperator> left, const std::string& leftName, const std::string& leftKey,
+                     std::unique_ptr<QueryOperator> right, const std::string& rightName, const std::string& rightKey,
+                     bool buildLeft = true, size_t budget = JOIN_MEMORY_BUDGET, std::string partitionFilePrefix = "join")
+        : buildIsLeft(buildLeft), memoryBudget(budget), spillPrefix(std::move(partitionFilePrefix)) {
+        size_t leftIndex = queryColumnIndex(left->outputColumns(), leftKey);
+        size_t rightIndex = queryColumnIndex(right->outputColumns(), rightKey);
+        int leftType = left->outputColumns()[leftIndex].type;
+        int rightType = right->outputColumns()[rightIndex].type;
+        if ((leftType == TYPE_STRING) != (rightType == TYPE_STRING)) {
+            throw std::invalid_argument("Join: cannot match string column " +
+                                        (leftType == TYPE_STRING ? leftKey : rightKey) + " with a number");
+        }
+        keyAsDouble = leftType != rightType;
+        for (const QueryColumn& column : left->outputColumns()) {
+            columns.push_back({leftName + "." + column.name, column.type});
+        }
+        for (const QueryColumn& column : right->outputColumns()) {
+            columns.push_back({rightName + "." + column.name, column.type});
+        }
+        buildKey = buildLeft ? leftIndex : rightIndex;
+        probeKey = buildLeft ? rightIndex : leftIndex;
+        build = std::move(buildLeft ? left : right);
+        probe = std::move(buildLeft ? right : left);
+        buildColumns = build->outputColumns();
+        probeColumns = probe->outputColumns();
+    }
+
+    ~HashJoinOperator() override {
+        build.reset();
+        probe.reset();
+        probeFile.close();
+        buildFiles.clear();
+        std::error_code error;
+        for (const std::string& path : partitionFiles) {
+            fs::remove(path, error);
+        }
+    }
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return columns;
+    }
+
+    bool next(ColumnBatch& batch) override {
+        batch.reset(columns);
+        if (!built) {
+            built = true;
+            buildTable();
+            if (partitioned && !loadPartition()) {
+                return false;
+            }
+        }
+        TraceSpan span("join_probe");
+        while (batch.rowCount < QUERY_BATCH_ROWS) {
+            if (match != NONE) {
+                appendMatch(entries[match], batch);
+                match = entries[match].next;
+                continue;
+            }
+            if (probeIndex < probeBatch.selectedCount()) {
+                probeRow = probeBatch.selectedRow(probeIndex++);
+                if (encodeKey(probeBatch.columns[probeKey], probeRow, key)) {
+                    match = lookup(key);
+                }
+                continue;
+            }
+            if (!nextProbeBatch()) {
+                probe.reset(); // Ends the probe scan
+                break;
+            }
+        }
+        return batch.rowCount > 0;
+    }
+};
+
+constexpr size_t SORT_MEMORY_BUDGET = 64 << 20;  // Default bytes of rows sorted in memory before a run spills
+
+// One key of an ORDER BY list, written "column", "column ASC" or "column DESC"
+struct SortKey {
+    std::string column;
+    bool descending = false;
+
+    // Parse a comma-separated list such as "city, score DESC"; keywords are
+    // case-insensitive. Throws std::invalid_argument on anything else.
+    static std::vector<SortKey> parseList(const std::string& text) {
+        std::vector<SortKey> keys;
+        std::stringstream list(text);
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            std::istringstream words(item);
+            SortKey key;
+            std::string direction;
+            std::string extra;
+            if (!(words >> key.column) || ((words >> direction) && (words >> extra))) {
+                throw std::invalid_argument("Order by: expected 'column [ASC|DESC]' in '" + item + "'");
+            }
+            std::transform(direction.begin(), direction.end(), direction.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+            if (!direction.empty() && direction != "ASC" && direction != "DESC") {
+                throw std::invalid_argument("Order by: expected ASC or DESC, got '" + direction + "'");
+            }
+            key.descending = direction == "DESC";
+            keys.push_back(key);
+        }
+        if (keys.empty()) {
+            throw std::invalid_argument("Order by: no columns");
+        }
+        return keys;
+    }
+};
+
+// Rows of the input ordered by a list of SortKeys. The whole input is read on the
+// first next(): rows are sorted in memory up to the memory budget, each full buffer
+// is written to a temporary run file, and the runs (with the last buffer) are then
+// merged through a loser tree, reading each run sequentially. With a limit only the
+// first limit rows are kept, in a bounded heap, unless those alone outgrow the budget.
+// Rows with equal keys keep their input order. Absent values sort before every
+// value, so they come first in ascending and last in descending order.
+class SortOperator : public QueryOperator {
+private:
+    // A row: its key (byte-comparable, see appendSortKey) and its encoded columns
+    struct Record {
+        size_t offset;       // In arena: key then payload
+        uint32_t keyLength;
+        uint32_t length;
+    };
+
+    // A sorted sequence of rows being merged: a run file or the in-memory records
+    struct Source {
+        std::ifstream file;
+        const std::vector<Record>* records = nullptr;
+        size_t position = 0;
+        std::string current;  // Current row from a run file
+        std::string_view key;
+        std::string_view payload;
+        bool done = false;
+    };
+
+    std::unique_ptr<QueryOperator> input;
+    std::vector<std::pair<size_t, bool>> keyColumns;  // Input column, descending
+    std::vector<QueryColumn> columns;
+    size_t memoryBudget;
+    uint64_t limit;
+    std::string spillPrefix;     // Runs are <prefix>.<n>
+    size_t runCount = 0;
+
+    std::string arena;
+    std::vector<Record> records;
+    bool topN = false;           // records is a max-heap of the best limit rows
+    bool sorted = false;
+    std::vector<Source> sources;
+    std::vector<int> tree;       // Loser tree: tree[0] is the winner, tree[1..k) the losers
+    uint64_t emitted = 0;
+    std::string key;
+
+    // Append the order-preserving bytes of one value: a presence byte, then ints with
+    // the sign bit flipped, doubles mapped to the same order, and strings with 0x00
+    // escaped as 0x00 0xFF and ended by 0x00 0x00; all big-endian and, for a
+    // descending key, inverted. memcmp then orders whole keys.
+    static void appendSortKey(const ColumnVector& column, size_t row, bool descending, std::string& out) {
+        size_t start = out.size();
+        out.push_back(static_cast<char>(column.present[row]));
+        if (column.present[row]) {
+            auto appendBigEndian = [&out](uint64_t bits) {
+                for (int shift = 56; shift >= 0; shift -= 8) {
+                    out.push_back(static_cast<char>(bits >> shift));
+                }
+            };
+            if (column.type == TYPE_INT) {
+                appendBigEndian(static_cast<uint64_t>(column.ints[row]) ^ (uint64_t(1) << 63));
+            } else if (column.type == TYPE_DOUBLE) {
+                double value = column.doubles[row] + 0.0;
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                appendBigEndian(bits >> 63 ? ~bits : bits | (uint64_t(1) << 63));
+            } else {
+                for (char c : column.stringAt(row)) {
+                    out.push_back(c);
+                    if (c == '\0') {
+                        out.push_back('\xff');
+                    }
+                }
+                out.append(2, '\0');
+            }
+        }
+        if (descending) {
+            for (size_t i = start; i < out.size(); ++i) {
+                out[i] = static_cast<char>(~out[i]);
+            }
+        }
+    }
+
+    std::string_view keyOf(const Record& record) const {
+        return std::string_view(arena).substr(record.offset, record.keyLength);
+    }
+
+    size_t memoryBytes() const {
+        return arena.capacity() + records.capacity() * sizeof(Record);
+    }
+
+    void addRow(const ColumnBatch& batch, uint32_t row) {
+        key.clear();
+        for (const auto& [index, descending] : keyColumns) {
+            appendSortKey(batch.columns[index], row, descending, key);
+        }
+        auto heapLess = [this](const Record& a, const Record& b) { return inputOrderLess(a, b); };
+        if (topN && records.size() == limit) {
+            if (key >= keyOf(records.front())) {
+                return; // Not among the first limit rows; an equal key came earlier
+            }
+            std::pop_heap(records.begin(), records.end(), heapLess);
+            records.pop_back();
+        }
+        Record record{arena.size(), static_cast<uint32_t>(key.size()), 0};
+        arena += key;
+        for (const ColumnVector& column : batch.columns) {
+            column.encodeValue(row, arena);
+        }
+        record.length = static_cast<uint32_t>(arena.size() - record.offset);
+        records.push_back(record);
+        if (topN) {
+            std::push_heap(records.begin(), records.end(), heapLess);
+            if (arena.size() > 2 * memoryBudget / 3 && arena.size() > 4 * liveBytes()) {
+                compactArena(); // Rows pushed out of the heap left their bytes behind
+            }
+        }
+    }
+
+    size_t liveBytes() const {
+        size_t bytes = 0;
+        for (const Record& record : records) {
+            bytes += record.length;
+        }
+        return bytes;
+    }
+
+    // Drop the bytes of rows no longer held, keeping the rest in arena order
+    void compactArena() {
+        std::vector<Record*> byOffset;
+        for (Record& record : records) {
+            byOffset.push_back(&record);
+        }
+        std::sort(byOffset.begin(), byOffset.end(), [](const Record* a, const Record* b) { return a->offset < b->offset; });
+        std::string compacted;
+        compacted.reserve(liveBytes());
+        for (Record* record : byOffset) {
+            size_t offset = compacted.size();
+            compacted.append(arena, record->offset, record->length);
+            record->offset = offset;
+        }
+        arena.swap(compacted);
+    }
+
+    // Key order, then arena order, which is input order
+    bool inputOrderLess(const Record& a, const Record& b) const {
+        int order = keyOf(a).compare(keyOf(b));
+        return order < 0 || (order == 0 && a.offset < b.offset);
+    }
+
+    void sortRecords() {
+        std::sort(records.begin(), records.end(),
+                  [this](const Record& a, const Record& b) { return inputOrderLess(a, b); });
+    }
+
+    // Sort the buffered rows into a new run file: [uint32 key length][uint32 length][row] per row
+    void spillRun() {
+        sortRecords();
+        std::string path = spillPrefix + "." + std::to_string(runCount++);
+        std::cout << "Debug sort: Writing run of " << records.size() << " rows to " << path << std::endl;
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        for (const Record& record : records) {
+            file.write(reinterpret_cast<const char*>(&record.keyLength), sizeof(record.keyLength));
+            file.write(reinterpret_cast<const char*>(&record.length), sizeof(record.length));
+            file.write(arena.data() + record.offset, record.length);
+        }
+        if (!file) {
+            throw std::runtime_error("Failed to write sort run: " + path);
+        }
+        arena.clear();
+        records.clear();
+    }
+
+    // Move a source to its next row; false once it has none
+    bool advance(Source& source) {
+        if (source.records) {
+            if (source.position == source.records->size()) {
+                source.done = true;
+                return false;
+            }
+            const Record& record = (*source.records)[source.position++];
+            std::string_view row = std::string_view(arena).substr(record.offset, record.length);
+            source.key = row.substr(0, record.keyLength);
+            source.payload = row.substr(record.keyLength);
+            return true;
+        }
+        uint32_t keyLength;
+        uint32_t length;
+        if (!source.file.read(reinterpret_cast<char*>(&keyLength), sizeof(keyLength)) ||
+            !source.file.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            source.done = true;
+            return false;
+        }
+        source.current.resize(length);
+        if (!source.file.read(source.current.data(), length) || keyLength > length) {
+            throw std::runtime_error("Truncated sort run: " + spillPrefix);
+        }
+        source.key = std::string_view(source.current).substr(0, keyLength);
+        source.payload = std::string_view(source.current).substr(keyLength);
+        return true;
+    }
+
+    // Whether source a's row goes before source b's; finished sources go last and
+    // equal keys go by source, as earlier runs hold earlier rows
+    bool before(int a, int b) const {
+        if (sources[a].done != sources[b].done) {
+            return sources[b].done;
+        }
+        if (sources[a].done) {
+            return a < b;
+        }
+        int order = sources[a].key.compare(sources[b].key);
+        return order < 0 || (order == 0 && a < b);
+    }
+
+    // Play the tournament below node; returns the winner, leaving the loser at each node
+    int playInitial(size_t node) {
+        size_t k = sources.size();
+        if (node >= k) {
+            return static_cast<int>(node - k);
+        }
+        int left = playInitial(2 * node);
+        int right = playInitial(2 * node + 1);
+        bool leftWins = before(left, right);
+        tree[node] = leftWins ? right : left;
+        return leftWins ? left : right;
+    }
+
+    // Read the input, then set up the merge over every run plus the records still in memory
+    void sortInput() {
+        TraceSpan span("sort_build");
+        topN = limit > 0;
+        ColumnBatch batch;
+        while (input->next(batch)) {
+            for (size_t i = 0; i < batch.selectedCount(); ++i) {
+                addRow(batch, batch.selectedRow(i));
+            }
+            if (memoryBytes() > memoryBudget) {
+                if (topN) {
+                    compactArena();
+                    if (memoryBytes() <= memoryBudget) {
+                        continue;
+                    }
+                    topN = false; // The first limit rows alone do not fit: sort everything externally
+                }
+                spillRun();
+            }
+        }
+        input.reset(); // Ends the scan
+        sortRecords();
+
+        sources.resize(runCount + 1);
+        for (size_t run = 0; run < runCount; ++run) {
+            sources[run].file.open(spillPrefix + "." + std::to_string(run), std::ios::binary);
+            advance(sources[run]);
+        }
+        sources[runCount].records = &records;
+        advance(sources[runCount]);
+        tree.assign(sources.size(), -1);
+        tree[0] = playInitial(1);
+    }
+
+public:
+    // Throws std::invalid_argument for an unknown column
+    SortOperator(std::unique_ptr<QueryOperator> child, const std::vector<SortKey>& keys, uint64_t rowLimit = 0,
+                 size_t budget = SORT_MEMORY_BUDGET, std::string runFilePrefix = "sort")
+        : input(std::move(child)), columns(input->outputColumns()), memoryBudget(budget), limit(rowLimit),
+          spillPrefix(std::move(runFilePrefix)) {
+        for (const SortKey& sortKey : keys) {
+            keyColumns.emplace_back(queryColumnIndex(columns, sortKey.column), sortKey.descending);
+        }
+    }
+
+    ~SortOperator() override {
+        input.reset();
+        sources.clear();
+        std::error_code error;
+        for (size_t run = 0; run < runCount; ++run) {
+            fs::remove(spillPrefix + "." + std::to_string(run), error);
+        }
+    }
+
+    const std::vector<QueryColumn>& outputColumns() const override {
+        return columns;
+    }
+
+    bool next(ColumnBatch& batch) override {
+        batch.reset(columns);
+        if (!sorted) {
+            sorted = true;
+            sortInput();
+        }
+        TraceSpan span("sort_merge");
+        while (batch.rowCount < QUERY_BATCH_ROWS && (limit == 0 || emitted < limit) && !sources.empty()) {
+            int winner = tree[0];
+            Source& source = sources[winner];
+            if (source.done) {
+                break; // The best remaining row is from a finished source, so all are finished
+            }
+            std::string_view payload = source.payload;
+            for (ColumnVector& column : batch.columns) {
+                column.decodeValue(payload);
+            }
+            ++batch.rowCount;
+            ++emitted;
+            advance(source);
+            // Replay the winner's path, leaving the loser at each node
+            for (size_t node = (winner + sources.size()) / 2; node > 0; node /= 2) {
+                if (before(tree[node], winner)) {
+                    std::swap(tree[node], winner);
+                }
+            }
+            tree[0] = winner;
+        }
+        return batch.rowCount > 0;
+    }
+};
+
+#ifdef YARAB_HAS_COROUTINES
+// Where async work runs. post() may run the task before returning (InlineExecutor),
+// on another thread (ThreadPoolExecutor) or later, on the thread that drains the
+// queue (RunLoopExecutor).
+class Executor {
+public:
+    virtual ~Executor() = default;
+    virtual void post(std::function<void()> task) = 0;
+};
+
+// Runs every task right away on the posting thread
+class InlineExecutor : public Executor {
+public:
+    void post(std::function<void()> task) override {
+        task();
+    }
+};
+
+// Worker threads draining a shared queue. The default I/O backend of the async
+// API: blocking storage calls run here instead of on the caller's thread.
+class ThreadPoolExecutor : public Executor {
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> queue;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+
+public:
+    explicit ThreadPoolExecutor(unsigned threads = std::max(1u, std::thread::hardware_concurrency())) {
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back([this]() {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+                        if (queue.empty()) {
+                            return;
+                        }
+                        task = std::move(queue.front());
+                        queue.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    // Finishes the queued tasks, then joins the workers
+    ~ThreadPoolExecutor() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void post(std::function<void()> task) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+};
+
+// Queue drained by the thread that owns it, typically an event loop calling poll()
+// once per iteration, so coroutines resumed here run on that thread only
+class RunLoopExecutor : public Executor {
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> queue;
+
+public:
+    void post(std::function<void()> task) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+
+    // Run the tasks queued so far; returns how many ran
+    size_t poll() {
+        std::deque<std::function<void()>> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch.swap(queue);
+        }
+        for (std::function<void()>& task : batch) {
+            task();
+        }
+        return batch.size();
+    }
+
+    // Block running tasks as they arrive until done() holds (checked after each batch)
+    void runUntil(const std::function<bool()>& done) {
+        while (!done()) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return !queue.empty(); });
+            }
+            poll();
+        }
+    }
+};
+
+// Lazily started coroutine producing a T. co_await it from another coroutine, or
+// hand it to startTask(); the awaiting coroutine resumes wherever the task finishes.
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+        template <typename U>
+        void return_value(U&& result) {
+            value.emplace(std::forward<U>(result));
+        }
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle; // Start the task; it resumes the awaiting coroutine when done
+    }
+    T await_resume() {
+        if (handle.promise().error) {
+            std::rethrow_exception(handle.promise().error);
+        }
+        return std::move(*handle.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> coroutine) : handle(coroutine) {}
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Fire-and-forget coroutine: runs eagerly and frees itself when it finishes
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+// Start a task from ordinary code; its result or exception arrives through the
+// future. Do not block on the future from the thread that drains the task's resume
+// executor: the task needs that thread to finish.
+template <typename T>
+std::future<T> startTask(Task<T> task) {
+    std::promise<T> promise;
+    std::future<T> future = promise.get_future();
+    [](Task<T> task, std::promise<T> promise) -> DetachedCoroutine {
+        try {
+            promise.set_value(co_await task);
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }(std::move(task), std::move(promise));
+    return future;
+}
+
+// Awaitable that runs a blocking call on one executor and resumes the awaiting
+// coroutine on another. onPosted, if set, runs on the I/O executor once the resumption
+// is posted, when the call no longer needs either executor.
+template <typename Fn>
+class OffloadAwaiter {
+private:
+    using Result = std::invoke_result_t<Fn&>;
+    Executor& io;
+    Executor& resume;
+    Fn fn;
+    std::function<void()> onPosted;
+    std::optional<Result> result;
+    std::exception_ptr error;
+
+public:
+    OffloadAwaiter(Executor& ioExecutor, Executor& resumeExecutor, Fn call, std::function<void()> posted = {})
+        : io(ioExecutor), resume(resumeExecutor), fn(std::move(call)), onPosted(std::move(posted)) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        io.post([this, awaiting]() {
+            try {
+                result.emplace(fn());
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::function<void()> posted = std::move(onPosted); // This awaiter may be gone once resumed
+            resume.post([awaiting]() { awaiting.resume(); });
+            if (posted) {
+                posted();
+            }
+        });
+    }
+    Result await_resume() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*result);
+    }
+};
+#endif
+
+class Storage {
+    friend class TableScanOperator;
+    friend class RowDecoder;
+
+    private:
+    std::vector<Page> pages;
+    uint32_t nextPageID = 1; // Unique page ID counter
+
+    private:
+    std::map<std::string, std::map<std::string, std::map<std::string, Tuple>>> databases;
+
+    // Serializes storage operations, so maintenance such as vacuum can run on a
+    // background thread between them. Recursive: operations call each other.
+    std::recursive_mutex engineMutex;
+
+    BufferPool bufferPool; // Decoded pages of every table touched through this instance
+    std::array<LatencyHistogram, OP_COUNT> operationLatency; // Per-operation latency, in nanoseconds
+
+#ifdef YARAB_HAS_COROUTINES
+    // Executors of the *Async operations (see setAsyncExecutors())
+    std::once_flag asyncInit;
+    std::unique_ptr<ThreadPoolExecutor> defaultIoExecutor;
+    InlineExecutor inlineExecutor;
+    Executor* ioExecutor = nullptr;
+    Executor* resumeExecutor = &inlineExecutor;
+    std::mutex offloadMutex;
+    std::condition_variable offloadsDone;
+    size_t offloadsRunning = 0; // Offloaded steps posted to the I/O executor and not finished
+#endif
+
+    // Open a table file, counted and traced as the "open" phase
+    static std::fstream openTableFile(const std::string& tablePath, std::ios::openmode mode) {
+        TraceSpan span("open");
+        bumpCounter(engineCounters().fileOpens);
+        return std::fstream(tablePath, mode);
+    }
+    // Metadata of the tables the point operations have used, keyed by table path. Each
+    // use refreshes it from the metadata log (see FileMetadata::refresh()), so it stays
+    // current whatever wrote the table since, without reading the snapshot again.
+    std::map<std::string, FileMetadata> metadataCache;
+
+    // Current metadata of a table, through the cache. An operation that fails after
+    // changing it must call dropMetadata().
+    FileMetadata& metadataFor(const std::string& tablePath, std::fstream& file) {
+        auto it = metadataCache.find(tablePath);
+        try {
+            if (it == metadataCache.end()) {
+                it = metadataCache.try_emplace(tablePath).first;
+                it->second.deserialize(file, tablePath);
+            } else {
+                it->second.refresh(file, tablePath);
+            }
+        } catch (...) {
+            metadataCache.erase(tablePath);
+            throw;
+        }
+        return it->second;
+    }
+
+    void dropMetadata(const std::string& tablePath) {
+        metadataCache.erase(tablePath);
+    }
+
+    std::map<std::string, TableDictionary> dictionaries; // Loaded dictionaries, keyed by table path
+
+    // Dictionary of a table, loaded on first use
+    TableDictionary& dictionaryFor(const std::string& tablePath) {
+        auto it = dictionaries.find(tablePath);
+        if (it != dictionaries.end()) {
+            bumpCounter(engineCounters().dictionaryCacheHits);
+        } else {
+            bumpCounter(engineCounters().dictionaryCacheMisses);
+            it = dictionaries.emplace(tablePath, TableDictionary()).first;
+            if (!it->second.load(tablePath)) {
+                dictionaries.erase(it);
+                throw std::runtime_error("Failed to load dictionary for " + tablePath);
+            }
+        }
+        return it->second;
+    }
+
+    std::map<std::string, RedoLog> redoLogs; // Redo logs of the tables this instance has touched, keyed by table path
+
+    // Redo log of a table. The first time this instance touches the table, whatever a
+    // previous process logged but may not have finished writing is replayed.
+    RedoLog& redoLogFor(const std::string& tablePath) {
+        auto it = redoLogs.find(tablePath);
+        if (it != redoLogs.end()) {
+            return it->second;
+        }
+        it = redoLogs.emplace(tablePath, RedoLog(tablePath)).first;
+        if (fs::exists(RedoLog::logPath(tablePath)) && !replayRedoLog(tablePath, it->second)) {
+            redoLogs.erase(it);
+            throw std::runtime_error("Failed to recover " + tablePath + " from its redo log");
+        }
+        return it->second;
+    }
+
+    // Row-ID filters of the tables this instance has looked rows up in, keyed by table
+    // path. dirty: IDs were added since the filter was saved; ~Storage() saves it again.
+    struct IdFilterEntry {
+        IdBloomFilter filter;
+        bool dirty = false;
+    };
+    std::map<std::string, IdFilterEntry> idFilters;
+
+    // Row-ID filter of a table, loaded on first use. A saved filter is used while the
+    // metadata log has not changed since; otherwise one is rebuilt from the row map.
+    IdBloomFilter& idFilterFor(const std::string& tablePath) {
+        auto it = idFilters.find(tablePath);
+        if (it != idFilters.end()) {
+            return it->second.filter;
+        }
+        recoverIfNeeded(tablePath);
+        IdFilterEntry entry;
+        std::optional<IdBloomFilter::Stamp> stamp = IdBloomFilter::currentStamp(tablePath);
+        if (!stamp || !entry.filter.load(tablePath, *stamp)) {
+            std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+            if (!file) {
+                throw std::runtime_error("Failed to open " + tablePath);
+            }
+            FileMetadata fileMetadata;
+            fileMetadata.deserialize(file, tablePath);
+            buildIdFilter(entry.filter, fileMetadata);
+            if (stamp) {
+                entry.filter.save(tablePath, *stamp);
+            }
+        }
+        return idFilters.emplace(tablePath, std::move(entry)).first->second.filter;
+    }
+
+    static void buildIdFilter(IdBloomFilter& filter, const FileMetadata& fileMetadata) {
+        const auto& tupleToPageMap = fileMetadata.getTupleToPageMap();
+        filter.reset(tupleToPageMap.size());
+        for (const auto& entry : tupleToPageMap) {
+            filter.add(entry.first);
+        }
+    }
+
+    // False only if the table certainly has no row with this ID. A filter that cannot
+    // be loaded answers "maybe" and leaves the error to the caller's normal path.
+    bool mayHaveRow(const std::string& tablePath, int64_t id) {
+        try {
+            return idFilterFor(tablePath).mayContain(id);
+        } catch (const std::exception&) {
+            return true;
+        }
+    }
+
+    // Add the rows a redo record maps to pages to the table's loaded filter
+    void addToIdFilter(const std::string& tablePath, const std::vector<MetadataDelta>& deltas) {
+        auto it = idFilters.find(tablePath);
+        if (it == idFilters.end()) {
+            return;
+        }
+        for (const MetadataDelta& delta : deltas) {
+            if (delta.kind == MetadataDelta::MAP_ENTRY && delta.value >= 0) {
+                it->second.filter.add(delta.key);
+                it->second.dirty = true;
+            }
+        }
+        if (it->second.filter.overfull()) {
+            idFilters.erase(it); // Rebuilt larger on next use
+        }
+    }
+
+    // Forget a table's filter, in memory and on disk
+    void dropIdFilter(const std::string& tablePath) {
+        idFilters.erase(tablePath);
+        fs::remove(IdBloomFilter::filterPath(tablePath));
+    }
+
+    // Zone maps of the tables this instance has scanned with a filter or written to,
+    // keyed by table path. fileRemoved: the table's zone file was removed before its
+    // pages were first changed, and ~Storage() writes the maintained map back.
+    struct ZoneMapEntry {
+        std::shared_ptr<TableZoneMap> map;  // Null while the zones are not known
+        RowDecoder decoder;                 // Every schema column, to summarize pages
+        bool fileRemoved = false;
+    };
+    std::map<std::string, ZoneMapEntry> zoneMaps;
+
+    // Zone map entry of a table, with the saved zones if there are any
+    ZoneMapEntry& zoneMapEntry(const std::string& tablePath, const FileMetadata& fileMetadata) {
+        auto it = zoneMaps.find(tablePath);
+        if (it != zoneMaps.end()) {
+            return it->second;
+        }
+        ZoneMapEntry entry;
+        entry.decoder = RowDecoder(fileMetadata.getSchema(), {}, &dictionaryFor(tablePath));
+        auto map = std::make_shared<TableZoneMap>(entry.decoder.outputColumns());
+        if (map->load(tablePath)) {
+            entry.map = std::move(map);
+        }
+        return zoneMaps.emplace(tablePath, std::move(entry)).first->second;
+    }
+
+    // Zone map of a table for a scan, built from its pages if it is not known yet
+    std::shared_ptr<const TableZoneMap> zoneMapFor(const std::string& tablePath, const FileMetadata& fileMetadata) {
+        ZoneMapEntry& entry = zoneMapEntry(tablePath, fileMetadata);
+        if (!entry.map) {
+            TraceSpan span("zone_map_build");
+            std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+            if (!file) {
+                throw std::runtime_error("Failed to open the table file: " + tablePath);
+            }
+            entry.map = std::make_shared<TableZoneMap>(entry.decoder.outputColumns());
+            Page page(0);
+            for (uint64_t pageID = 0; pageID < fileMetadata.getPageCount(); ++pageID) {
+                if (readPageFromDisk(file, fileMetadata, tablePath, static_cast<uint32_t>(pageID), page)) {
+                    updateZones(entry, page);
+                }
+            }
+            if (!entry.fileRemoved) {
+                entry.map->save(tablePath);
+            }
+        }
+        return entry.map;
+    }
+
+    // Call before writing pages of a table: its zone file stops matching the table file,
+    // so it is removed until ~Storage() saves the zones again. After a crash the zones
+    // are rebuilt instead.
+    ZoneMapEntry& beginZoneUpdate(const std::string& tablePath, const FileMetadata& fileMetadata) {
+        ZoneMapEntry& entry = zoneMapEntry(tablePath, fileMetadata);
+        if (!entry.fileRemoved) {
+            fs::remove(TableZoneMap::zonePath(tablePath));
+            entry.fileRemoved = true;
+        }
+        return entry;
+    }
+
+    // Summarize a page as written
+    void updateZones(ZoneMapEntry& entry, const Page& page) {
+        if (!entry.map) {
+            return;
+        }
+        if (entry.map.use_count() > 1) {
+            entry.map = std::make_shared<TableZoneMap>(*entry.map); // A scan still reads the old zones
+        }
+        ColumnBatch batch;
+        batch.reset(entry.decoder.outputColumns());
+        for (size_t slot = 0; slot < page.getSlots().size(); ++slot) {
+            std::string_view row = page.rowAt(slot);
+            if (!row.empty()) {
+                entry.decoder.decode(row, batch);
+            }
+        }
+        entry.map->setPage(page.getPageID(), batch);
+    }
+
+    // Forget a table's zones, in memory and on disk
+    void dropZoneMap(const std::string& tablePath) {
+        zoneMaps.erase(tablePath);
+        fs::remove(TableZoneMap::zonePath(tablePath));
+    }
+
+    // Change maps of the tables looked up, nullopt for tables without one (never backed
+    // up, or tracking lost), whose pages are not tracked
+    std::map<std::string, std::optional<PageChangeMap>> changeMaps;
+
+    PageChangeMap* changeMapFor(const std::string& tablePath) {
+        auto it = changeMaps.find(tablePath);
+        if (it == changeMaps.end()) {
+            std::optional<PageChangeMap> changes;
+            PageChangeMap loaded;
+            if (loaded.load(tablePath)) {
+                changes = std::move(loaded);
+            }
+            it = changeMaps.emplace(tablePath, std::move(changes)).first;
+        }
+        return it->second ? &*it->second : nullptr;
+    }
+
+    // Call before writing pages of a table: a backed-up table records them for the next
+    // incremental backup. If that fails the map is dropped, and the next backup copies
+    // the whole table. Pages read with the engine lock released are checked against the
+    // buffer pool's count of writes (see prefetchPage()).
+    void markPagesChanged(const std::string& tablePath, const std::vector<uint32_t>& pageIDs) {
+        bufferPool.noteWrite(tablePath);
+        PageChangeMap* changes = changeMapFor(tablePath);
+        if (changes && !changes->mark(tablePath, pageIDs)) {
+            std::cerr << "Error markPagesChanged: Lost track of the changed pages of " << tablePath << std::endl;
+            dropChangeMap(tablePath);
+        }
+    }
+
+    void dropChangeMap(const std::string& tablePath) {
+        changeMaps[tablePath] = std::nullopt;
+        std::error_code error;
+        fs::remove(PageChangeMap::changesPath(tablePath), error);
+    }
+
+    // Backup files: [magic][u16 version][u16 0][u64 chain][u64 sequence][u32 entry count],
+    // then per entry [u16 name length][name][u8 kind] and
+    //   BACKUP_FILE:   [u64 length][bytes][u32 checksum]                   a whole file
+    //   BACKUP_RANGES: [u8 whole][u64 file size][u32 range count]          the parts of a file
+    //                  ranges of [u64 offset][u32 length][bytes][u32 checksum]   that changed
+    // A database directory holds exactly the files named by its latest backup.
+    enum BackupEntryKind : uint8_t { BACKUP_FILE = 1, BACKUP_RANGES = 2 };
+
+    // Generation at the start of a metadata snapshot or log, 0 if it is missing
+    static uint64_t sidecarGeneration(const std::string& path, uint32_t expectedMagic) {
+        std::ifstream in(path, std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        uint32_t magic = 0;
+        uint64_t generation = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&generation), sizeof(generation));
+        return in && magic == expectedMagic ? generation : 0;
+    }
+
+    struct BackupHeader {
+        uint64_t chain = 0;
+        uint64_t sequence = 0;
+        uint32_t entries = 0;
+    };
+
+    static constexpr std::streamoff BACKUP_ENTRY_COUNT_OFFSET = 24;
+
+    // Backups in a backup directory, by sequence
+    static std::map<uint64_t, fs::path> listBackups(const std::string& backupDir) {
+        std::map<uint64_t, fs::path> backups;
+        std::error_code error;
+        if (!fs::is_directory(backupDir, error)) {
+            return backups;
+        }
+        const std::string prefix = "backup.";
+        for (const auto& entry : fs::directory_iterator(backupDir, error)) {
+            std::string name = entry.path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) != 0) {
+                continue;
+            }
+            uint64_t sequence = 0;
+            const char* end = name.data() + name.size();
+            auto [parsed, status] = std::from_chars(name.data() + prefix.size(), end, sequence);
+            if (status == std::errc() && parsed == end && sequence > 0) {
+                backups.emplace(sequence, entry.path());
+            }
+        }
+        return backups;
+    }
+
+    static bool readBackupHeader(std::istream& in, BackupHeader& header) {
+        uint32_t magic = 0;
+        uint16_t version = 0;
+        uint16_t padding = 0;
+        in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&padding), sizeof(padding));
+        in.read(reinterpret_cast<char*>(&header.chain), sizeof(header.chain));
+        in.read(reinterpret_cast<char*>(&header.sequence), sizeof(header.sequence));
+        in.read(reinterpret_cast<char*>(&header.entries), sizeof(header.entries));
+        return in && magic == BACKUP_MAGIC && version == BACKUP_VERSION;
+    }
+
+    // Apply one backup of a chain to dbName: write its files and table ranges, then
+    // remove the files it does not name (deleted before it was taken). Throws on a
+    // malformed or corrupt backup.
+    static void applyBackup(const fs::path& backupPath, const std::string& dbName, uint64_t sequence,
+                            uint64_t& chain, std::set<std::string>& restored) {
+        std::ifstream in(backupPath, std::ios::binary);
+        bumpCounter(engineCounters().fileOpens);
+        BackupHeader header;
+        if (!readBackupHeader(in, header) || header.sequence != sequence) {
+            throw std::runtime_error("Unreadable backup " + backupPath.string());
+        }
+        if (sequence > 1 && header.chain != chain) {
+            throw std::runtime_error(backupPath.string() + " belongs to another backup chain");
+        }
+        chain = header.chain;
+
+        auto get = [&](auto& value) {
+            in.read(reinterpret_cast<char*>(&value), sizeof(value));
+            if (!in) {
+                throw std::runtime_error("Truncated backup " + backupPath.string());
+            }
+        };
+        std::string bytes;
+        auto getChecked = [&](uint64_t length) {
+            bytes.resize(length);
+            in.read(bytes.data(), static_cast<std::streamsize>(length));
+            uint32_t stored = 0;
+            get(stored);
+            if (stored != RedoLog::checksum(bytes)) {
+                throw std::runtime_error("Checksum mismatch in backup " + backupPath.string());
+            }
+        };
+
+        std::set<std::string> present;
+        for (uint32_t entry = 0; entry < header.entries; ++entry) {
+            uint16_t nameLength = 0;
+            get(nameLength);
+            std::string name(nameLength, '\0');
+            in.read(name.data(), nameLength);
+            uint8_t kind = 0;
+            get(kind);
+            if (name.empty() || name == "." || name == ".." || name.find('/') != std::string::npos) {
+                throw std::runtime_error("Bad file name in backup " + backupPath.string());
+            }
+            present.insert(name);
+            restored.insert(name);
+            std::string path = dbName + "/" + name;
+
+            if (kind == BACKUP_FILE) {
+                uint64_t length = 0;
+                get(length);
+                if (length > static_cast<uint64_t>(std::numeric_limits<std::streamsize>::max())) {
+                    throw std::runtime_error("Bad file length in backup " + backupPath.string());
+                }
+                getChecked(length);
+                std::ofstream out(path, std::ios::binary | std::ios::trunc);
+                out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+                if (!out) {
+                    throw std::runtime_error("Failed to write " + path);
+                }
+            } else if (kind == BACKUP_RANGES) {
+                uint8_t whole = 0;
+                uint64_t fileSize = 0;
+                uint32_t ranges = 0;
+                get(whole);
+                get(fileSize);
+                get(ranges);
+                if (whole || !fs::exists(path)) {
+                    std::ofstream(path, std::ios::binary | std::ios::trunc);
+                }
+                std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+                for (uint32_t range = 0; range < ranges; ++range) {
+                    uint64_t offset = 0;
+                    uint32_t length = 0;
+                    get(offset);
+                    get(length);
+                    if (offset > fileSize || length > fileSize - offset) {
+                        throw std::runtime_error("Bad file range in backup " + backupPath.string());
+                    }
+                    getChecked(length);
+                    file.seekp(static_cast<std::streamoff>(offset), std::ios::beg);
+                    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+                }
+                file.close();
+                if (!file) {
+                    throw std::runtime_error("Failed to write " + path);
+                }
+                fs::resize_file(path, fileSize);
+            } else {
+                throw std::runtime_error("Unknown entry in backup " + backupPath.string());
+            }
+        }
+
+        for (const auto& entry : fs::directory_iterator(dbName)) {
+            if (!present.count(entry.path().filename().string())) {
+                fs::remove(entry.path());
+            }
+        }
+    }
+
+    // Ids this instance has reserved from the sequences of auto-increment tables and not
+    // yet handed out, keyed by table path. Ids left over at exit are never used.
+    struct IdRange {
+        int64_t next = 0;
+        int64_t end = 0;
+    };
+    std::map<std::string, IdRange> idRanges;
+
+    // Next id of an auto-increment table. Ids are reserved ID_SEQUENCE_CHUNK at a time,
+    // so only one insert in a chunk writes the sequence; it is written before any of
+    // the chunk's ids is used, so none is handed out twice, even after a crash.
+    int64_t allocateId(const std::string& tablePath) {
+        IdRange& range = idRanges[tablePath];
+        if (range.next >= range.end) {
+            std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+            if (!file) {
+                throw std::runtime_error("Failed to open table file: " + tablePath);
+            }
+            FileMetadata& fileMetadata = metadataFor(tablePath, file);
+            int64_t first = fileMetadata.reserveIds(ID_SEQUENCE_CHUNK);
+            try {
+                fileMetadata.serialize(file, tablePath);
+            } catch (...) {
+                dropMetadata(tablePath);
+                throw;
+            }
+            range = {first, first + ID_SEQUENCE_CHUNK};
+        }
+        return range.next++;
+    }
+
+    // Partitioning of every table path looked up, nullopt for tables that are not partitioned
+    std::map<std::string, std::optional<TablePartitioning>> partitionings;
+
+    // Partitioning of a table, or null if it is not partitioned
+    const TablePartitioning* partitioningOf(const std::string& dbName, const std::string& tableName) {
+        std::string tablePath = dbName + "/" + tableName + ".HAD";
+        auto it = partitionings.find(tablePath);
+        if (it == partitionings.end()) {
+            std::optional<TablePartitioning> partitioning;
+            TablePartitioning loaded;
+            if (loaded.load(tablePath)) {
+                partitioning = std::move(loaded);
+            }
+            it = partitionings.emplace(tablePath, std::move(partitioning)).first;
+        }
+        return it->second ? &*it->second : nullptr;
+    }
+
+    // Partition table of the row with this id. An id that does not parse goes to the
+    // first partition, whose own checks then reject it.
+    static std::string partitionForRow(const std::string& tableName, const TablePartitioning& partitioning,
+                                       const std::string& id) {
+        uint32_t index = 0;
+        try {
+            index = partitioning.partitionOf(std::stoll(id));
+        } catch (const std::exception&) {
+        }
+        return TablePartitioning::partitionName(tableName, index);
+    }
+
+    // Scans of every partition of a partitioned table, each split into up to parts page
+    // ranges (see TableScanOperator::split()) and filtered on where; pages is set to the
+    // pages they will read. The scans keep the engine lock until destroyed, so each may
+    // run on a thread of its own. Empty if the table is not partitioned.
+    std::vector<std::unique_ptr<QueryOperator>> partitionScans(const std::string& dbName, const std::string& tableName,
+                                                               const std::vector<std::string>& columns,
+                                                               const std::string& where, size_t parts, uint64_t& pages) {
+        std::lock_guard<std::recursive_mutex> lock(engineMutex); // Every partition is read in one state
+        std::vector<std::unique_ptr<QueryOperator>> scans;
+        pages = 0;
+        if (!partitioningOf(dbName, tableName)) {
+            return scans;
+        }
+        for (const std::string& partition : partitionsOf(dbName, tableName)) {
+            auto scan = std::make_unique<TableScanOperator>(*this, dbName, partition, columns);
+            scan->holdLockUntilDestroyed();
+            pages += scan->pagesLeft();
+            std::vector<std::unique_ptr<QueryOperator>> ranges = scan->split(parts);
+            scans.push_back(std::move(scan));
+            std::move(ranges.begin(), ranges.end(), std::back_inserter(scans));
+        }
+        if (!where.empty()) {
+            for (std::unique_ptr<QueryOperator>& scan : scans) {
+                scan = std::make_unique<FilterOperator>(std::move(scan), where);
+            }
+        }
+        return scans;
+    }
+
+    // Bulk load a partitioned table: the CSV is split by partition into temporary files
+    // next to the table, which are then loaded one partition at a time. A row without a
+    // valid id fails the load before any partition is touched; after that, each
+    // partition's load is all-or-nothing on its own.
+    bool bulkLoadPartitions(const std::string& dbName, const std::string& tableName,
+                            const TablePartitioning& partitioning, const std::string& csvPath) {
+        std::ifstream csv(csvPath, std::ios::binary);
+        if (!csv) {
+            std::cerr << "Error bulkLoad: Failed to open " << csvPath << std::endl;
+            return false;
+        }
+        std::string headerLine;
+        std::getline(csv, headerLine);
+        std::vector<std::string> fields;
+        size_t idField = 0;
+        if (!splitCsvLine(headerLine, fields) ||
+            (idField = std::find(fields.begin(), fields.end(), "id") - fields.begin()) == fields.size()) {
+            std::cerr << "Error bulkLoad: Header must name the id column" << std::endl;
+            return false;
+        }
+
+        std::random_device random;
+        std::string splitPrefix = dbName + "/" + tableName + ".HAD.load" +
+                                  std::to_string(static_cast<uint64_t>(random()) << 32 | random());
+        std::vector<std::string> splitPaths;
+        std::vector<std::ofstream> splits;
+        std::vector<uint64_t> rowCounts(partitioning.count, 0);
+        for (uint32_t index = 0; index < partitioning.count; ++index) {
+            splitPaths.push_back(splitPrefix + "." + std::to_string(index));
+            splits.emplace_back(splitPaths.back(), std::ios::binary | std::ios::trunc);
+            splits.back() << headerLine << '\n';
+        }
+        std::string error;
+        uint64_t lineNumber = 1;
+        Tuple::Value id;
+        for (std::string line; error.empty() && std::getline(csv, line);) {
+            ++lineNumber;
+            if (line.empty() || line == "\r") {
+                continue;
+            }
+            if (!splitCsvLine(line, fields) || idField >= fields.size() ||
+                !Tuple::parseValue(TYPE_INT, fields[idField], id, std::pmr::get_default_resource())) {
+                error = "line " + std::to_string(lineNumber) + ": missing integer id";
+                break;
+            }
+            uint32_t index = partitioning.partitionOf(std::get<int64_t>(id));
+            splits[index] << line << '\n';
+            ++rowCounts[index];
+        }
+        for (std::ofstream& split : splits) {
+            split.close();
+            if (error.empty() && !split) {
+                error = "failed to write " + splitPrefix;
+            }
+        }
+        bool loaded = error.empty();
+        if (!loaded) {
+            std::cerr << "Error bulkLoad: " << error << std::endl;
+        }
+        for (uint32_t index = 0; loaded && index < partitioning.count; ++index) {
+            if (rowCounts[index] > 0) {
+                loaded = bulkLoad(dbName, TablePartitioning::partitionName(tableName, index), splitPaths[index]);
+            }
+        }
+        for (const std::string& path : splitPaths) {
+            std::error_code removeError;
+            fs::remove(path, removeError);
+        }
+        return loaded;
+    }
+
+    // Create every partition of a new partitioned table, then its descriptor, which is
+    // what makes the table exist. Partitions created before a failure are removed.
+    bool createPartitionedTable(const std::string& dbName, const std::string& tableName,
+                                const std::map<std::string, std::string>& schema, const TableOptions& options) {
+        std::string tablePath = dbName + "/" + tableName + ".HAD";
+        std::string error = TablePartitioning::validate(options);
+        auto id = schema.find("id");
+        if (error.empty() && (id == schema.end() || id->second != "int")) {
+            error = "A partitioned table needs an int id column";
+        }
+        if (error.empty() && options.autoIncrementId) {
+            error = "A partitioned table cannot have an auto-increment id; rows are routed by their id";
+        }
+        if (!error.empty()) {
+            std::cerr << "Error createTable: " << error << std::endl;
+            return false;
+        }
+        TablePartitioning partitioning = TablePartitioning::fromOptions(options);
+        TableOptions partitionOptions = options;
+        partitionOptions.partitionBy = PARTITION_NONE;
+        partitionOptions.hashPartitions = 0;
+        partitionOptions.rangeBounds.clear();
+        partitionings.erase(tablePath);
+        for (uint32_t index = 0; index < partitioning.count; ++index) {
+            std::string partitionPath = dbName + "/" + TablePartitioning::partitionName(tableName, index) + ".HAD";
+            if (fs::exists(partitionPath) || !createTable(dbName, TablePartitioning::partitionName(tableName, index), schema,
+                                                          partitionOptions)) {
+                std::cerr << "Error createTable: Failed to create partition " << index << " of " << tableName << std::endl;
+                for (uint32_t created = 0; created < index; ++created) {
+                    deleteTable(dbName + "/" + TablePartitioning::partitionName(tableName, created) + ".HAD");
+                }
+                return false;
+            }
+        }
+        if (!partitioning.save(tablePath)) {
+            for (uint32_t index = 0; index < partitioning.count; ++index) {
+                deleteTable(dbName + "/" + TablePartitioning::partitionName(tableName, index) + ".HAD");
+            }
+            fs::remove(TablePartitioning::descriptorPath(tablePath));
+            return false;
+        }
+        partitionings[tablePath] = std::move(partitioning);
+        std::cout << "Created partitioned table " << tablePath << " with " << partitionings[tablePath]->count
+                  << " partitions" << std::endl;
+        return true;
+    }
+
+    // Bring a table up to date with its redo log: re-apply the metadata deltas of every
+    // record, then rewrite the newest logged image of each page the table file may be
+    // missing. Uncompressed pages live at fixed offsets and are rewritten in parallel,
+    // one range of pages per thread; compressed pages go through writePage(), which
+    // may have to give them new extents. Ends with a metadata checkpoint and an empty log.
+    bool replayRedoLog(const std::string& tablePath, RedoLog& log) {
+        TraceSpan span("recovery");
+        std::vector<RedoLog::Record> records;
+        uint64_t nextLSN = 0;
+        if (!RedoLog::readRecords(tablePath, records, nextLSN)) {
+            return false;
+        }
+
+        // Records older than the last checkpoint only matter for the pages it listed as dirty
+        uint64_t checkpointLSN = 0;
+        std::map<uint32_t, uint64_t> dirtyPages;
+        for (const RedoLog::Record& record : records) {
+            if (record.kind != RedoLog::CHECKPOINT) {
+                continue;
+            }
+            checkpointLSN = record.lsn;
+            dirtyPages.clear();
+            uint32_t dirtyCount = 0;
+            const char* p = record.payload.data() + sizeof(uint64_t);
+            std::memcpy(&dirtyCount, p, sizeof(dirtyCount));
+            p += sizeof(dirtyCount);
+            for (uint32_t i = 0; i < dirtyCount; ++i, p += sizeof(uint32_t) + sizeof(uint64_t)) {
+                uint32_t pageID;
+                uint64_t lsn;
+                std::memcpy(&pageID, p, sizeof(pageID));
+                std::memcpy(&lsn, p + sizeof(pageID), sizeof(lsn));
+                dirtyPages[pageID] = lsn;
+            }
+        }
+
+        std::map<uint32_t, const char*> images;  // Newest image of every page to rewrite
+        std::vector<MetadataDelta> deltas;
+        size_t commits = 0;
+        for (const RedoLog::Record& record : records) {
+            const char* p = record.payload.data();
+            const char* end = p + record.payload.size();
+            if (record.kind == RedoLog::TRANSACTION) {
+                // Part of a multi-table transaction: skipped unless the transaction
+                // got as far as its decision file, i.e. every table logged its part
+                uint32_t pathLength = 0;
+                std::memcpy(&pathLength, p, sizeof(pathLength));
+                p += sizeof(pathLength);
+                if (pathLength > static_cast<size_t>(end - p) ||
+                    !fs::exists(resolveFrom(fs::path(tablePath).parent_path(), std::string(p, pathLength)))) {
+                    continue;
+                }
+                p += pathLength;
+            } else if (record.kind != RedoLog::COMMIT) {
+                continue;
+            }
+            ++commits;
+            uint32_t pageCount = 0;
+            std::memcpy(&pageCount, p, sizeof(pageCount));
+            p += sizeof(pageCount);
+            for (uint32_t i = 0; i < pageCount && p + sizeof(uint32_t) + PAGE_SIZE <= end; ++i) {
+                uint32_t pageID;
+                std::memcpy(&pageID, p, sizeof(pageID));
+                auto dirty = dirtyPages.find(pageID);
+                if (record.lsn > checkpointLSN || (dirty != dirtyPages.end() && record.lsn >= dirty->second)) {
+                    images[pageID] = p + sizeof(pageID);
+                }
+                p += sizeof(pageID) + PAGE_SIZE;
+            }
+            uint32_t deltaCount = 0;
+            std::memcpy(&deltaCount, p, sizeof(deltaCount));
+            p += sizeof(deltaCount);
+            for (uint32_t i = 0; i < deltaCount && p + MetadataDelta::RECORD_SIZE <= end; ++i, p += MetadataDelta::RECORD_SIZE) {
+                MetadataDelta delta;
+                delta.kind = static_cast<uint8_t>(p[0]);
+                std::memcpy(&delta.key, p + 1, sizeof(delta.key));
+                std::memcpy(&delta.value, p + 1 + sizeof(delta.key), sizeof(delta.value));
+                deltas.push_back(delta);
+            }
+        }
+        log.restart(nextLSN);
+        if (commits == 0) {
+            return true; // Clean shutdown: the log holds nothing but a checkpoint
+        }
+
+        try {
+            std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+            if (!file) {
+                std::cerr << "Error replayRedoLog: Unable to open " << tablePath << std::endl;
+                return false;
+            }
+            FileMetadata fileMetadata;
+            fileMetadata.deserialize(file, tablePath);
+            for (const MetadataDelta& delta : deltas) {
+                fileMetadata.replayDelta(delta);
+            }
+            dropZoneMap(tablePath); // Pages below are written without summarizing them
+            // Pages past the end were dropped after they were logged
+            images.erase(images.lower_bound(static_cast<uint32_t>(std::min<uint64_t>(fileMetadata.getPageCount(),
+                                                                                     std::numeric_limits<uint32_t>::max()))),
+                         images.end());
+
+            bool ok = true;
+            if (fileMetadata.isCompressed()) {
+                for (const auto& [pageID, frame] : images) {
+                    Page page(pageID);
+                    ok = ok && page.fromFrame(frame) && writePage(file, fileMetadata, tablePath, page);
+                }
+            } else {
+                std::vector<std::pair<uint32_t, const char*>> work(images.begin(), images.end());
+                std::vector<uint32_t> workPages;
+                for (const auto& [pageID, frame] : work) {
+                    workPages.push_back(pageID);
+                }
+                markPagesChanged(tablePath, workPages);
+                size_t parts = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), work.size()));
+                std::vector<char> results(parts, 0);
+                std::vector<std::thread> workers;
+                for (size_t part = 0; part < parts; ++part) {
+                    auto run = [&, part]() {
+                        std::fstream out = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+                        for (size_t i = work.size() * part / parts; i < work.size() * (part + 1) / parts && out; ++i) {
+                            out.seekp(fileMetadata.getPagePosition(work[i].first), std::ios::beg);
+                            out.write(work[i].second, PAGE_SIZE);
+                            bumpCounter(engineCounters().pagesWritten);
+                            bumpCounter(engineCounters().bytesWritten, PAGE_SIZE);
+                        }
+                        out.flush();
+                        results[part] = static_cast<bool>(out);
+                    };
+                    if (part + 1 == parts) {
+                        run(); // The last range runs on the calling thread
+                    } else {
+                        workers.emplace_back(run);
+                    }
+                }
+                for (std::thread& worker : workers) {
+                    worker.join();
+                }
+                ok = std::all_of(results.begin(), results.end(), [](char result) { return result != 0; });
+            }
+            bufferPool.invalidateTable(tablePath);
+            if (!ok) {
+                std::cerr << "Error replayRedoLog: Failed to rewrite the logged pages of " << tablePath << std::endl;
+                return false;
+            }
+            file.clear();
+            fileMetadata.checkpoint(file, tablePath);
+        } catch (const std::exception& e) {
+            std::cerr << "Error replayRedoLog: " << e.what() << std::endl;
+            return false;
+        }
+        if (!log.checkpoint()) {
+            return false;
+        }
+        std::cout << "Debug replayRedoLog: Replayed " << commits << " records (" << images.size() << " pages, "
+                  << deltas.size() << " metadata deltas) into " << tablePath << std::endl;
+        return true;
+    }
+
+    // Append one redo record holding the images of pages and the given metadata
+    // deltas, and mark the pages dirty until their writes are done. A decision file
+    // makes it a TRANSACTION record, replayed only if that file exists.
+    std::optional<uint64_t> logPages(const std::string& tablePath, const std::vector<const Page*>& pages,
+                                     const std::vector<MetadataDelta>& deltas, const std::string& decisionPath = "") {
+        RedoLog& log = redoLogFor(tablePath);
+        std::string payload;
+        if (!decisionPath.empty()) {
+            std::string stored = relativeTo(fs::path(tablePath).parent_path(), decisionPath);
+            uint32_t pathLength = static_cast<uint32_t>(stored.size());
+            payload.append(reinterpret_cast<const char*>(&pathLength), sizeof(pathLength));
+            payload += stored;
+        }
+        uint32_t pageCount = static_cast<uint32_t>(pages.size());
+        payload.append(reinterpret_cast<const char*>(&pageCount), sizeof(pageCount));
+        char frame[PAGE_SIZE];
+        for (const Page* page : pages) {
+            uint32_t pageID = page->getPageID();
+            if (!page->toFrame(frame)) {
+                return std::nullopt;
+            }
+            payload.append(reinterpret_cast<const char*>(&pageID), sizeof(pageID));
+            payload.append(frame, PAGE_SIZE);
+        }
+        uint32_t deltaCount = static_cast<uint32_t>(deltas.size());
+        payload.append(reinterpret_cast<const char*>(&deltaCount), sizeof(deltaCount));
+        for (const MetadataDelta& delta : deltas) {
+            payload.push_back(static_cast<char>(delta.kind));
+            payload.append(reinterpret_cast<const char*>(&delta.key), sizeof(delta.key));
+            payload.append(reinterpret_cast<const char*>(&delta.value), sizeof(delta.value));
+        }
+
+        auto dictionary = dictionaries.find(tablePath);
+        if (dictionary != dictionaries.end() && !dictionary->second.sync()) {
+            return std::nullopt;
+        }
+        std::optional<uint64_t> lsn = log.append(decisionPath.empty() ? RedoLog::COMMIT : RedoLog::TRANSACTION, payload);
+        if (lsn) {
+            for (const Page* page : pages) {
+                log.markDirty(page->getPageID(), *lsn);
+            }
+            addToIdFilter(tablePath, deltas);
+        }
+        return lsn;
+    }
+
+    // Apply a change to a table: log the images of the changed pages and the pending
+    // metadata deltas as one redo record, then write the pages and the metadata. If
+    // the process dies in between, the record is replayed on the next start, so the
+    // row map never points at a page write that was lost.
+    bool commitPages(std::fstream& file, FileMetadata& fileMetadata, const std::string& tablePath,
+                     const std::vector<const Page*>& pages) {
+        if (!logPages(tablePath, pages, loggedDeltas(fileMetadata))) {
+            return false;
+        }
+        return writeLoggedPages(file, fileMetadata, tablePath, pages);
+    }
+
+    // Metadata deltas that go into a redo record. Extent placement is not logged:
+    // replay writes the pages through writePage() again.
+    static std::vector<MetadataDelta> loggedDeltas(const FileMetadata& fileMetadata) {
+        std::vector<MetadataDelta> deltas;
+        for (const MetadataDelta& delta : fileMetadata.getPendingDeltas()) {
+            if (delta.kind != MetadataDelta::PAGE_EXTENT) {
+                deltas.push_back(delta);
+            }
+        }
+        return deltas;
+    }
+
+    // Second half of commitPages(): write pages already in the redo log, then the metadata
+    bool writeLoggedPages(std::fstream& file, FileMetadata& fileMetadata, const std::string& tablePath,
+                          const std::vector<const Page*>& pages) {
+        RedoLog& log = redoLogFor(tablePath);
+        for (const Page* page : pages) {
+            if (!writePage(file, fileMetadata, tablePath, *page)) {
+                return false;
+            }
+        }
+        file.flush();
+        file.seekp(0);
+        fileMetadata.serialize(file, tablePath);
+        for (const Page* page : pages) {
+            log.markClean(page->getPageID());
+        }
+        if (log.checkpointDue() && !log.checkpoint()) {
+            std::cerr << "Warning commitPages: Redo log checkpoint failed for " << tablePath << std::endl;
+        }
+        return true;
+    }
+
+    // Write set of one table in the open transaction
+    struct TransactionTable {
+        FileMetadata metadata;  // As read when the transaction first touched the table
+        std::map<int64_t, std::optional<std::string>> writes;  // Row ID -> new row (serialized, not yet
+                                                                // dictionary encoded), or nullopt if deleted
+    };
+
+    // Open transaction (see beginTransaction()), keyed by table path
+    std::optional<std::map<std::string, TransactionTable>> transaction;
+    std::function<void(const std::string& step)> commitStepHook;  // See setCommitStepHook()
+
+    void commitStep(const std::string& step) {
+        if (commitStepHook) {
+            commitStepHook(step);
+        }
+    }
+
+    // Write set of a table in the open transaction, reading its metadata on first use
+    TransactionTable& transactionTable(const std::string& tablePath) {
+        auto it = transaction->find(tablePath);
+        if (it != transaction->end()) {
+            return it->second;
+        }
+        recoverIfNeeded(tablePath);
+        std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+        if (!file) {
+            throw std::runtime_error("Failed to open table file: " + tablePath);
+        }
+        TransactionTable table;
+        table.metadata.deserialize(file, tablePath);
+        return transaction->emplace(tablePath, std::move(table)).first->second;
+    }
+
+    // The open transaction's write to a row, or null if it has not written it
+    const std::optional<std::string>* transactionWrite(const std::string& tablePath, int64_t id) const {
+        if (!transaction) {
+            return nullptr;
+        }
+        auto table = transaction->find(tablePath);
+        if (table == transaction->end()) {
+            return nullptr;
+        }
+        auto it = table->second.writes.find(id);
+        return it != table->second.writes.end() ? &it->second : nullptr;
+    }
+
+    // Whether a row exists as the open transaction sees it
+    static bool transactionRowExists(const TransactionTable& table, int64_t id) {
+        auto it = table.writes.find(id);
+        return it != table.writes.end() ? it->second.has_value() : table.metadata.hasTupleWithID(id);
+    }
+
+    // Operations that rewrite a table wholesale cannot be part of a transaction
+    bool outsideTransaction(const char* operation) const {
+        if (transaction) {
+            std::cerr << "Error " << operation << ": Not allowed inside a transaction" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // A table's part of a commit: its changed pages and metadata, not yet written
+    struct PreparedTable {
+        std::string tablePath;
+        std::fstream file;
+        FileMetadata metadata;
+        std::map<uint32_t, Page> pages;
+
+        std::vector<const Page*> pageList() const {
+            std::vector<const Page*> list;
+            for (const auto& [pageID, page] : pages) {
+                list.push_back(&page);
+            }
+            return list;
+        }
+    };
+
+    // Page of a prepared table, read on first use
+    Page* preparedPage(PreparedTable& prepared, uint32_t pageID) {
+        auto it = prepared.pages.find(pageID);
+        if (it == prepared.pages.end()) {
+            it = prepared.pages.try_emplace(pageID, pageID).first;
+            if (!readPage(prepared.file, prepared.metadata, prepared.tablePath, pageID, it->second)) {
+                std::cerr << "Error preparedPage: Failed to read page " << pageID << " of " << prepared.tablePath
+                          << std::endl;
+                prepared.pages.erase(it);
+                return nullptr;
+            }
+        }
+        return &it->second;
+    }
+
+    // First phase of a commit: apply a table's write set to its pages and metadata in
+    // memory, reading every page it touches once. Rows written again lose their old
+    // version first; new rows fill the tail page, then new pages.
+    bool prepareTransactionTable(PreparedTable& prepared, const TransactionTable& table) {
+        const std::string& tablePath = prepared.tablePath;
+        prepared.file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+        if (!prepared.file) {
+            std::cerr << "Error prepareTransactionTable: Unable to open " << tablePath << std::endl;
+            return false;
+        }
+        FileMetadata& fileMetadata = prepared.metadata;
+        fileMetadata.deserialize(prepared.file, tablePath);
+
+        Tuple tuple(operationResource());
+        for (const auto& [id, row] : table.writes) {
+            if (!fileMetadata.hasTupleWithID(id)) {
+                continue;
+            }
+            Page* page = preparedPage(prepared, static_cast<uint32_t>(fileMetadata.getPageIDForTuple(id)));
+            if (!page) {
+                return false;
+            }
+            bool deleted = false;
+            for (uint16_t i = 0; i < page->getSlots().size() && !deleted; ++i) {
+                if (page->getSlots()[i].length != 0 && tuple.deserialize(page->getTupleView(i)) && tuple.getInt("id") == id) {
+                    deleted = page->clearSlot(i);
+                }
+            }
+            if (!deleted) {
+                std::cerr << "Error prepareTransactionTable: Tuple " << id << " is not on its page in " << tablePath
+                          << std::endl;
+                return false;
+            }
+            fileMetadata.setTupleAsDeleted(id);
+        }
+
+        Page* tail = nullptr;
+        if (fileMetadata.getPageCount() > 0) {
+            tail = preparedPage(prepared, static_cast<uint32_t>(fileMetadata.getPageCount() - 1));
+            if (!tail) {
+                return false;
+            }
+        }
+        for (const auto& [id, row] : table.writes) {
+            if (!row) {
+                continue;
+            }
+            Tuple encoded(operationResource());
+            if (!tuple.deserialize(*row) || !encodeRow(tablePath, fileMetadata, tuple, encoded, true)) {
+                return false;
+            }
+            std::string serialized = encoded.serialize();
+            if (tail && tail->addTuple(serialized, fileMetadata, id)) {
+                continue;
+            }
+            uint32_t pageID = fileMetadata.getNextPageID();
+            fileMetadata.incrementPageID();
+            tail = &prepared.pages.try_emplace(pageID, pageID).first->second;
+            if (!tail->addTuple(serialized, fileMetadata, id)) {
+                std::cerr << "Error prepareTransactionTable: Tuple " << id << " does not fit in a page" << std::endl;
+                return false;
+            }
+        }
+        std::cout << "Debug prepareTransactionTable: " << table.writes.size() << " rows of " << tablePath << " touch "
+                  << prepared.pages.size() << " pages" << std::endl;
+        return true;
+    }
+
+    // Paths stored in redo records and decision files are relative to the directory of
+    // the file holding them, so they do not depend on the working directory
+    static std::string relativeTo(const fs::path& directory, const std::string& path) {
+        return fs::path(path).lexically_relative(directory).generic_string();
+    }
+
+    static std::string resolveFrom(const fs::path& directory, const std::string& stored) {
+        return (directory / stored).string();
+    }
+
+    // Decision file of a multi-table commit, listing the tables involved. Written to
+    // a temporary file and renamed, so it appears complete or not at all, and synced
+    // with its directory before any table is written.
+    static bool writeDecisionFile(const std::string& decisionPath, const std::vector<PreparedTable>& prepared) {
+        std::string tmpPath = decisionPath + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            bumpCounter(engineCounters().fileOpens);
+            for (const PreparedTable& table : prepared) {
+                out << relativeTo(fs::path(decisionPath).parent_path(), table.tablePath) << '\n';
+            }
+            out.flush();
+            if (!out) {
+                std::cerr << "Error writeDecisionFile: Failed to write " << tmpPath << std::endl;
+                return false;
+            }
+        }
+        try {
+            renameDurably(tmpPath, decisionPath);
+        } catch (const std::exception& e) {
+            std::cerr << "Error writeDecisionFile: " << e.what() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Validate a row against the table schema and lay it out in schema order, with
+    // attributes outside the schema after the schema columns. Values were already
+    // parsed into their native types when the tuple was built. Dictionary-encoded
+    // columns get their codes if encodeDictionary; new values are added to the
+    // dictionary only once the whole row has been validated, so a rejected row leaves
+    // no codes behind. Callers check for a duplicate id before encoding.
+    bool encodeRow(const std::string& tablePath, const FileMetadata& fileMetadata, const Tuple& tuple, Tuple& encoded,
+                   bool encodeDictionary) {
+        std::map<int, std::string> typeMap = {
+            {1, "int"},
+            {2, "string"},
+            {3, "double"},
+            // Add more types as needed
+        };
+        const auto& schema = fileMetadata.getSchema();
+        for (const Tuple::Attribute& attribute : tuple.getAttributes()) {
+            if (!Tuple::isValidKey(attribute.key)) {
+                std::cerr << "Invalid attribute name: " << attribute.key << std::endl;
+                return false;
+            }
+        }
+        for (const auto& [key, type] : schema) {
+            // Check if attribute exists in tuple
+            if (!tuple.findValue(key)) {
+                std::cerr << "Missing required attribute: " << key << std::endl;
+                return false;
+            }
+
+            // Check data type
+            int attrType = tuple.at(*tuple.columnIndex(key)).type;
+            if (typeMap[attrType] != type) {
+                std::cerr << "Type mismatch for attribute: " << key << std::endl;
+                return false;
+            }
+        }
+        if (!tuple.getInt("id")) {
+            std::cerr << "Invalid ID format: " << tuple.getAttributeValue("id") << std::endl;
+            return false;
+        }
+
+        TableDictionary& dictionary = dictionaryFor(tablePath);
+        for (const auto& [key, type] : schema) {
+            const Tuple::Value* value = tuple.findValue(key);
+            int attrType = tuple.at(*tuple.columnIndex(key)).type;
+            if (encodeDictionary && dictionary.isEncoded(key)) {
+                try {
+                    int64_t code = dictionary.encode(key, std::string(std::get<std::pmr::string>(*value)));
+                    encoded.addValue(key, TYPE_DICTIONARY_CODE, code);
+                } catch (const std::exception& e) {
+                    std::cerr << "Error encodeRow: " << e.what() << std::endl;
+                    return false;
+                }
+            } else {
+                encoded.addValue(key, attrType, *value);
+            }
+        }
+
+        for (const Tuple::Attribute& attribute : tuple.getAttributes()) {
+            if (schema.find(std::string(attribute.key)) == schema.end()) {
+                encoded.addValue(attribute.key, attribute.type, attribute.value);
+            }
+        }
+        return true;
+    }
+
+    // Replay a crashed process's redo log before an operation reads the table
+    void recoverIfNeeded(const std::string& tablePath) {
+        redoLogFor(tablePath);
+    }
+
+    // Empty the redo log before a change that is not logged page by page (bulk load,
+    // the end of a vacuum): replaying older records over it would undo it.
+    bool truncateRedoLog(const std::string& tablePath) {
+        RedoLog& log = redoLogFor(tablePath);
+        if (log.hasDirtyPages()) {
+            return replayRedoLog(tablePath, log); // A failed change left pages unwritten
+        }
+        return log.checkpoint();
+    }
+
+    // Replace dictionary codes in a row read from disk with their string values
+    void decodeTuple(const std::string& tablePath, Tuple& tuple) {
+        TableDictionary& dictionary = dictionaryFor(tablePath);
+        if (dictionary.empty()) {
+            return;
+        }
+        for (const Tuple::Attribute& attribute : tuple.getAttributes()) {
+            if (attribute.type == TYPE_DICTIONARY_CODE) {
+                std::string key(attribute.key);
+                tuple.setAttribute(key, TYPE_STRING, dictionary.decode(key, std::get<int64_t>(attribute.value)));
+            }
+        }
+    }
+
+    // Type code of a schema column type ("int", "double", anything else is a string)
+    static int schemaTypeCode(const std::string& type) {
+        return type == "int" ? TYPE_INT : type == "double" ? TYPE_DOUBLE : TYPE_STRING;
+    }
+
+    // Split one CSV record into fields. Fields may be double-quoted, with "" for a
+    // literal quote; quoted fields cannot span lines. Returns false on an unterminated quote.
+    static bool splitCsvLine(std::string_view line, std::vector<std::string>& fields) {
+        fields.clear();
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        size_t pos = 0;
+        while (true) {
+            std::string field;
+            if (pos < line.size() && line[pos] == '"') {
+                ++pos;
+                while (true) {
+                    if (pos >= line.size()) {
+                        return false;
+                    }
+                    if (line[pos] == '"') {
+                        if (pos + 1 < line.size() && line[pos + 1] == '"') {
+                            field.push_back('"');
+                            pos += 2;
+                            continue;
+                        }
+                        ++pos;
+                        break;
+                    }
+                    field.push_back(line[pos++]);
+                }
+                size_t comma = line.find(',', pos);
+                pos = comma == std::string_view::npos ? line.size() : comma;
+            } else {
+                size_t comma = line.find(',', pos);
+                size_t end = comma == std::string_view::npos ? line.size() : comma;
+                field.assign(line.substr(pos, end - pos));
+                pos = end;
+            }
+            fields.push_back(std::move(field));
+            if (pos >= line.size()) {
+                return true;
+            }
+            ++pos; // Skip the comma
+        }
+    }
+
+    // Rows parsed from one chunk of a CSV file by a bulk load worker
+    struct BulkChunk {
+        std::string text;          // Whole lines only
+        uint64_t firstLine = 0;    // 1-based line number of the chunk's first line
+        std::vector<Tuple> rows;   // Schema-ordered, typed rows
+        std::string error;         // First validation error, empty if none
+    };
+
+    // Parse and validate every line of a chunk against the schema. columnOrder maps
+    // each CSV field position to its schema column.
+    static void parseBulkChunk(BulkChunk& chunk, const std::vector<std::pair<std::string, int>>& schemaColumns,
+                               const std::vector<size_t>& columnOrder) {
+        std::vector<std::string> fields;
+        std::vector<const std::string*> ordered(schemaColumns.size());
+        std::string_view text = chunk.text;
+        uint64_t lineNumber = chunk.firstLine;
+        for (; !text.empty(); ++lineNumber) {
+            size_t newline = text.find('\n');
+            std::string_view line = text.substr(0, newline);
+            text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+            if (line.empty() || line == "\r") {
+                continue;
+            }
+            std::string where = "line " + std::to_string(lineNumber) + ": ";
+            if (!splitCsvLine(line, fields)) {
+                chunk.error = where + "unterminated quoted field";
+                return;
+            }
+            if (fields.size() != columnOrder.size()) {
+                chunk.error = where + "expected " + std::to_string(columnOrder.size()) + " fields, found " + std::to_string(fields.size());
+                return;
+            }
+            for (size_t i = 0; i < fields.size(); ++i) {
+                ordered[columnOrder[i]] = &fields[i];
+            }
+            Tuple row;
+            for (size_t column = 0; column < schemaColumns.size(); ++column) {
+                const auto& [name, type] = schemaColumns[column];
+                const std::string& field = *ordered[column];
+                Tuple::Value value;
+                if (!Tuple::parseValue(type, field, value, std::pmr::get_default_resource())) {
+                    chunk.error = where + "invalid value for column " + name + ": " + field;
+                    return;
+                }
+                row.addValue(name, type, std::move(value));
+            }
+            if (!row.getInt("id")) {
+                chunk.error = where + "missing integer id";
+                return;
+            }
+            chunk.rows.push_back(std::move(row));
+        }
+    }
+
+    // A CSV field, quoted when it holds a comma, quote or line break
+    static void exportCsvField(std::string_view text, OutputBuffer& out) {
+        if (text.find_first_of(",\"\r\n") == std::string_view::npos) {
+            out.append(text);
+            return;
+        }
+        out.push('"');
+        for (char c : text) {
+            if (c == '"') {
+                out.push('"');
+            }
+            out.push(c);
+        }
+        out.push('"');
+    }
+
+    // exportRow() for a row of a query batch whose columns are the table's schema
+    static void exportBatchRow(const ColumnBatch& batch, uint32_t row, ExportFormat format, OutputBuffer& out) {
+        if (format == EXPORT_BINARY) {
+            std::vector<uint8_t> presence((batch.columns.size() + 7) / 8, 0);
+            for (size_t column = 0; column < batch.columns.size(); ++column) {
+                if (batch.columns[column].present[row]) {
+                    presence[column / 8] |= static_cast<uint8_t>(1u << (column % 8));
+                }
+            }
+            out.append(reinterpret_cast<const char*>(presence.data()), presence.size());
+        }
+        for (size_t column = 0; column < batch.columns.size(); ++column) {
+            const ColumnVector& values = batch.columns[column];
+            if (format == EXPORT_CSV && column > 0) {
+                out.push(',');
+            }
+            if (!values.present[row]) {
+                continue;
+            }
+            if (format == EXPORT_CSV) {
+                exportCsvField(values.valueString(row), out);
+            } else if (values.type == TYPE_INT) {
+                out.appendRaw(values.ints[row]);
+            } else if (values.type == TYPE_DOUBLE) {
+                out.appendRaw(values.doubles[row]);
+            } else {
+                std::string_view text = values.stringAt(row);
+                out.appendRaw(static_cast<uint32_t>(text.size()));
+                out.append(text);
+            }
+        }
+        if (format == EXPORT_CSV) {
+            out.push('\n');
+        }
+    }
+
+    // Append one row to an export, columns in schema order. Dictionary codes are
+    // replaced by their strings; a column the row lacks is left empty (CSV) or
+    // marked absent (binary).
+    static void exportRow(const Tuple& tuple, const std::vector<std::pair<std::string, int>>& columns,
+                          const TableDictionary& dictionary, ExportFormat format, OutputBuffer& out) {
+        std::string text;
+        std::vector<uint8_t> presence((columns.size() + 7) / 8, 0);
+        std::vector<const Tuple::Attribute*> values(columns.size(), nullptr);
+        for (size_t column = 0; column < columns.size(); ++column) {
+            std::optional<size_t> index = tuple.columnIndex(columns[column].first, column);
+            if (index) {
+                values[column] = &tuple.at(*index);
+                presence[column / 8] |= static_cast<uint8_t>(1u << (column % 8));
+            }
+        }
+        if (format == EXPORT_BINARY) {
+            out.append(reinterpret_cast<const char*>(presence.data()), presence.size());
+        }
+
+        for (size_t column = 0; column < columns.size(); ++column) {
+            const Tuple::Attribute* attribute = values[column];
+            if (format == EXPORT_CSV && column > 0) {
+                out.push(',');
+            }
+            if (!attribute) {
+                continue;
+            }
+            text.clear();
+            if (attribute->type == TYPE_DICTIONARY_CODE) {
+                text = dictionary.decode(columns[column].first, std::get<int64_t>(attribute->value));
+            } else if (format == EXPORT_CSV || columns[column].second == TYPE_STRING) {
+                Tuple::formatValue(attribute->value, text);
+            }
+
+            if (format == EXPORT_CSV) {
+                exportCsvField(text, out);
+            } else if (columns[column].second == TYPE_STRING) {
+                uint32_t length = static_cast<uint32_t>(text.size());
+                out.appendRaw(length);
+                out.append(text);
+            } else if (const int64_t* number = std::get_if<int64_t>(&attribute->value)) {
+                columns[column].second == TYPE_DOUBLE ? out.appendRaw(static_cast<double>(*number)) : out.appendRaw(*number);
+            } else if (const double* number = std::get_if<double>(&attribute->value)) {
+                columns[column].second == TYPE_INT ? out.appendRaw(static_cast<int64_t>(*number)) : out.appendRaw(*number);
+            } else {
+                out.appendRaw(int64_t(0)); // Text in a numeric column (pre-typed rows); presence already set
+            }
+        }
+        if (format == EXPORT_CSV) {
+            out.push('\n');
+        }
+    }
+
+    // Export pages [firstPage, endPage) of a table to outputPath, after prefix.
+    // Runs on export worker threads: reads bypass the buffer pool.
+    static bool exportPageRange(const std::string& tablePath, const FileMetadata& fileMetadata,
+                                const TableDictionary& dictionary, const std::vector<std::pair<std::string, int>>& columns,
+                                ExportFormat format, uint64_t firstPage, uint64_t endPage,
+                                const std::string& outputPath, const std::string& prefix, uint64_t& rowCount) {
+        constexpr size_t BUFFER_BYTES = 1 << 20;
+        std::fstream file(tablePath, std::ios::binary | std::ios::in);
+        bumpCounter(engineCounters().fileOpens);
+        std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+        if (!file || !output) {
+            std::cerr << "Error exportTable: Failed to open " << (file ? outputPath : tablePath) << std::endl;
+            return false;
+        }
+        OutputBuffer out(output, BUFFER_BYTES);
+        out.append(prefix);
+
+        Tuple tuple;
+        Page page(0);
+        rowCount = 0;
+        for (uint64_t pageID = firstPage; pageID < endPage; ++pageID) {
+            if (!readPageFromDisk(file, fileMetadata, tablePath, static_cast<uint32_t>(pageID), page)) {
+                std::cerr << "Error exportTable: Failed to read page " << pageID << " of " << tablePath << std::endl;
+                return false;
+            }
+            page.forEachRow([&](std::string_view row) {
+                if (tuple.deserialize(row)) {
+                    exportRow(tuple, columns, dictionary, format, out);
+                    ++rowCount;
+                }
+            });
+        }
+        return out.flush();
+    }
+
+    public:
+    // Sum the counters of every thread that has used the engine
+    StorageStats stats() const {
+        EngineCounters sum;
+        CounterRegistry::instance().sumInto(sum);
+        auto read = [](const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); };
+        StorageStats total;
+        total.pagesRead = read(sum.pagesRead);
+        total.pagesWritten = read(sum.pagesWritten);
+        total.bytesRead = read(sum.bytesRead);
+        total.bytesWritten = read(sum.bytesWritten);
+        total.fileOpens = read(sum.fileOpens);
+        total.metadataDeserializeCalls = read(sum.metadataDeserializeCalls);
+        total.metadataDeserializeBytes = read(sum.metadataDeserializeBytes);
+        total.metadataSerializeCalls = read(sum.metadataSerializeCalls);
+        total.metadataSerializeBytes = read(sum.metadataSerializeBytes);
+        total.rowsDecoded = read(sum.rowsDecoded);
+        total.pagesSkipped = read(sum.pagesSkipped);
+        total.lookups = read(sum.lookups);
+        total.lookupRowsDecoded = read(sum.lookupRowsDecoded);
+        total.bufferPoolHits = read(sum.bufferPoolHits);
+        total.bufferPoolMisses = read(sum.bufferPoolMisses);
+        total.dictionaryCacheHits = read(sum.dictionaryCacheHits);
+        total.dictionaryCacheMisses = read(sum.dictionaryCacheMisses);
+        total.fileSyncs = read(sum.fileSyncs);
+        return total;
+    }
+
+    // Write stats() in the Prometheus text exposition format (for a node-exporter
+    // textfile collector or similar). The file is replaced atomically.
+    bool dumpStatsPrometheus(const std::string& path) const {
+        StorageStats current = stats();
+        std::ostringstream out;
+        auto metric = [&out](const char* name, const char* type, const char* help, auto value) {
+            out << "# HELP " << name << " " << help << "\n";
+            out << "# TYPE " << name << " " << type << "\n";
+            out << name << " " << value << "\n";
+        };
+        metric("yarab_pages_read_total", "counter", "Pages read from table files.", current.pagesRead);
+        metric("yarab_pages_written_total", "counter", "Pages written to table files.", current.pagesWritten);
+        metric("yarab_page_bytes_read_total", "counter", "Page bytes read from disk.", current.bytesRead);
+        metric("yarab_page_bytes_written_total", "counter", "Page bytes written to disk.", current.bytesWritten);
+        metric("yarab_file_opens_total", "counter", "Files opened by the engine.", current.fileOpens);
+        metric("yarab_metadata_deserialize_total", "counter", "FileMetadata::deserialize calls.", current.metadataDeserializeCalls);
+        metric("yarab_metadata_deserialize_bytes_total", "counter", "Bytes read by FileMetadata::deserialize.", current.metadataDeserializeBytes);
+        metric("yarab_metadata_serialize_total", "counter", "FileMetadata serialize/checkpoint writes.", current.metadataSerializeCalls);
+        metric("yarab_metadata_serialize_bytes_total", "counter", "Bytes written by FileMetadata serialize/checkpoint.", current.metadataSerializeBytes);
+        metric("yarab_rows_decoded_total", "counter", "Tuples deserialized.", current.rowsDecoded);
+        metric("yarab_pages_skipped_total", "counter", "Pages table scans skipped by their zone maps.", current.pagesSkipped);
+        metric("yarab_lookups_total", "counter", "Point lookups by id.", current.lookups);
+        metric("yarab_lookup_rows_decoded_total", "counter", "Tuples deserialized by point lookups.", current.lookupRowsDecoded);
+        metric("yarab_rows_decoded_per_lookup", "gauge", "Average tuples deserialized per point lookup.", current.rowsDecodedPerLookup());
+        metric("yarab_buffer_pool_hits_total", "counter", "Buffer pool lookups served from memory.", current.bufferPoolHits);
+        metric("yarab_buffer_pool_misses_total", "counter", "Buffer pool lookups that went to disk.", current.bufferPoolMisses);
+        metric("yarab_buffer_pool_hit_ratio", "gauge", "Buffer pool hit ratio.", current.bufferPoolHitRate());
+        metric("yarab_dictionary_cache_hits_total", "counter", "Dictionary lookups served from memory.", current.dictionaryCacheHits);
+        metric("yarab_dictionary_cache_misses_total", "counter", "Dictionaries loaded from disk.", current.dictionaryCacheMisses);
+        metric("yarab_dictionary_cache_hit_ratio", "gauge", "Dictionary cache hit ratio.", current.dictionaryCacheHitRate());
+        metric("yarab_file_syncs_total", "counter", "fsync/fdatasync calls.", current.fileSyncs);
+
+        out << "# HELP yarab_operation_latency_seconds Storage operation latency.\n";
+        out << "# TYPE yarab_operation_latency_seconds summary\n";
+        for (int op = 0; op < OP_COUNT; ++op) {
+            const LatencyHistogram& histogram = operationLatency[op];
+            const char* name = storageOperationName(static_cast<StorageOperation>(op));
+            for (double q : {0.5, 0.99, 0.999}) {
+                out << "yarab_operation_latency_seconds{op=\"" << name << "\",quantile=\"" << q << "\"} "
+                    << histogram.percentile(q) / 1e9 << "\n";
+            }
+            out << "yarab_operation_latency_seconds_sum{op=\"" << name << "\"} " << histogram.mean() * histogram.count() / 1e9 << "\n";
+            out << "yarab_operation_latency_seconds_count{op=\"" << name << "\"} " << histogram.count() << "\n";
+        }
+
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::trunc);
+            file << out.str();
+            if (!file) {
+                std::cerr << "Error dumpStatsPrometheus: Unable to write " << tmpPath << std::endl;
+                return false;
+            }
+        }
+        fs::rename(tmpPath, path);
+        return true;
+    }
+
+    // Latency of one operation type since the last resetLatency()
+    const LatencyHistogram& latency(StorageOperation op) const {
+        return operationLatency[op];
+    }
+
+    void resetLatency() {
+        for (auto& histogram : operationLatency) {
+            histogram.reset();
+        }
+    }
+
+    // Trace spans cover operations and their phases: open, metadata_decode,
+    // page_load, row_search, page_write, metadata_write (and metadata_checkpoint)
+    void setTracingEnabled(bool enabled) {
+        Tracer::instance().setEnabled(enabled);
+    }
+
+    bool exportTrace(const std::string& path) {
+        return Tracer::instance().exportChromeTrace(path);
+    }
+
+    void clearTrace() {
+        Tracer::instance().clear();
+    }
+
+    // Checkpoint the redo logs written through this instance, so the next start
+    // finds nothing to replay. A transaction still open is discarded.
+    ~Storage() {
+#ifdef YARAB_HAS_COROUTINES
+        // Async steps still queued or running use this instance: let them finish before
+        // anything is torn down, whichever executor runs them
+        {
+            std::unique_lock<std::mutex> lock(offloadMutex);
+            offloadsDone.wait(lock, [this]() { return offloadsRunning == 0; });
+        }
+        defaultIoExecutor.reset();
+#endif
+        if (transaction) {
+            transaction.reset();
+            engineMutex.unlock();
+        }
+        for (auto& [tablePath, log] : redoLogs) {
+            try {
+                if (log.hasNewRecords() && !log.hasDirtyPages() && fs::exists(tablePath)) {
+                    log.checkpoint();
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Error ~Storage: " << e.what() << std::endl;
+            }
+        }
+        // Save filters that gained rows under the log as it now stands. After a crash
+        // the saved stamp no longer matches and the filter is rebuilt instead.
+        for (const auto& [tablePath, entry] : idFilters) {
+            if (!entry.dirty || !fs::exists(tablePath)) {
+                continue;
+            }
+            if (std::optional<IdBloomFilter::Stamp> stamp = IdBloomFilter::currentStamp(tablePath)) {
+                entry.filter.save(tablePath, *stamp);
+            }
+        }
+        for (const auto& [tablePath, entry] : zoneMaps) {
+            if (entry.fileRemoved && entry.map && fs::exists(tablePath)) {
+                entry.map->save(tablePath);
+            }
+        }
+    }
+
+    bool createDatabase(const std::string& dbName) {
+        if (!fs::exists(dbName)) {
+            if (fs::create_directory(dbName)) {
+                std::cout << "Database folder created: " << dbName << std::endl;
+            } else {
+                std::cerr << "Error: Database could not be created.\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool tableExists(const std::string& dbName, const std::string& tableName) {
+        std::string tablePath = dbName + "/" + tableName + ".HAD";
+        return fs::exists(tablePath) || fs::exists(TablePartitioning::descriptorPath(tablePath));
+    }
+
+    // Tables that store a table's rows: its partitions, in index order, if it is
+    // partitioned (see TableOptions::partitionBy), otherwise the table itself
+    std::vector<std::string> partitionsOf(const std::string& dbName, const std::string& tableName) {
+        std::lock_guard<std::recursive_mutex> lock(engineMutex);
+        const TablePartitioning* partitioning = partitioningOf(dbName, tableName);
+        if (!partitioning) {
+            return {tableName};
+        }
+        std::vector<std::string> names;
+        for (uint32_t index = 0; index < partitioning->count; ++index) {
+            names.push_back(TablePartitioning::partitionName(tableName, index));
+        }
+        return names;
+    }
+
+    // Empty one partition of a partitioned table, e.g. a range past its retention, by
+    // replacing its files with those of a new empty table: the cost does not depend on
+    // the rows it held. Refused inside a transaction.
+    bool dropPartition(const std::string& dbName, const std::string& tableName, uint32_t index) {
+        std::lock_guard<std::recursive_mutex> lock(engineMutex);
+        if (!outsideTransaction("dropPartition")) {
+            return false;
+        }
+        const TablePartitioning* partitioning = partitioningOf(dbName, tableName);
+        if (!partitioning || index >= partitioning->count) {
+            std::cerr << "Error dropPartition: " << tableName << " has no partition " << index << std::endl;
+            return false;
+        }
+        std::string partitionName = TablePartitioning::partitionName(tableName, index);
+        std::string partitionPath = dbName + "/" + partitionName + ".HAD";
+        std::map<std::string, std::string> schema;
+        TableOptions options;
+        try {
+            recoverIfNeeded(partitionPath);
+            std::fstream file = openTableFile(partitionPath, std::ios::binary | std::ios::in);
+            if (!file) {
+                throw std::runtime_error("Failed to open the table file: " + partitionPath);
+            }
+            FileMetadata fileMetadata;
+            fileMetadata.deserialize(file, partitionPath);
+            schema = fileMetadata.getSchema();
+            options.compressPages = fileMetadata.isCompressed();
+            for (const auto& [name, type] : schema) {
+                if (dictionaryFor(partitionPath).isEncoded(name)) {
+                    options.dictionaryColumns.insert(name);
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error dropPartition: " << e.what() << std::endl;
+            return false;
+        }
+        if (!deleteTable(partitionPath) || !createTable(dbName, partitionName, schema, options)) {
+            std::cerr << "Error dropPartition: Failed to replace " << partitionPath << std::endl;
+            return false;
+        }
+        std::cout << "Debug dropPartition: Dropped partition " << index << " of " << tableName << std::endl;
+        return true;
+    }
+
+    bool createTable(const std::string& dbName, const std::string& tableName, const std::map<std::string, std::string>& schema,
+                     const TableOptions& options = TableOptions()) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    std::cout << "Debug createTable: Creating table at path: " << tablePath << std::endl;
+
+    // Check if the table file already exists
+    if (fs::exists(tablePath)) {
+        std::cout << "Table already exists: " << tablePath << std::endl;
+        return upgradeTable(dbName, tableName); // Bring older files up to the current format
+    }
+    if (fs::exists(TablePartitioning::descriptorPath(tablePath))) {
+        std::cout << "Table already exists: " << tablePath << " (partitioned)" << std::endl;
+        bool upgraded = true;
+        for (const std::string& partition : partitionsOf(dbName, tableName)) {
+            upgraded = upgradeTable(dbName, partition) && upgraded;
+        }
+        return upgraded;
+    }
+    for (const auto& [column, type] : schema) {
+        if (!Tuple::isValidKey(column)) {
+            std::cerr << "Error createTable: Column names cannot be empty or hold '(', ')' or '|': " << column
+                      << std::endl;
+            return false;
+        }
+    }
+    if (options.partitionBy != PARTITION_NONE) {
+        return createPartitionedTable(dbName, tableName, schema, options);
+    }
+
+    // Only string columns can be dictionary encoded
+    for (const auto& column : options.dictionaryColumns) {
+        auto it = schema.find(column);
+        if (it == schema.end() || it->second != "string") {
+            std::cerr << "Error createTable: Dictionary column must be a string column: " << column << std::endl;
+            return false;
+        }
+    }
+    auto id = schema.find("id");
+    if (options.autoIncrementId && (id == schema.end() || id->second != "int")) {
+        std::cerr << "Error createTable: An auto-increment id needs an int id column" << std::endl;
+        return false;
+    }
+
+    // Create a new table file
+    dropMetadata(tablePath);
+    std::fstream newTable = openTableFile(tablePath, std::ios::binary | std::ios::out | std::ios::in | std::ios::trunc);
+    if (newTable) {
+        dictionaries.erase(tablePath);
+        fs::remove(TableDictionary::dictionaryPath(tablePath));
+        redoLogs.erase(tablePath);
+        fs::remove(RedoLog::logPath(tablePath));
+        dropIdFilter(tablePath);
+        dropZoneMap(tablePath);
+        dropChangeMap(tablePath);
+        idRanges.erase(tablePath);
+        if (!options.dictionaryColumns.empty() &&
+            !dictionaries[tablePath].create(tablePath, options.dictionaryColumns)) {
+            dictionaries.erase(tablePath);
+            return false;
+        }
+
+        // Initialize metadata
+        FileMetadata metadata;
+        metadata.setPageCount(0); // Start with 0 pages
+        metadata.setSchema(schema); // Use the provided schema
+        metadata.setTableFlags((options.compressPages ? TABLE_FLAG_COMPRESSED : 0) |
+                               (options.autoIncrementId ? TABLE_FLAG_AUTO_INCREMENT : 0));
+        std::cout << "Debug createTable: Initialized metadata with 0 pages and provided schema." << std::endl;
+
+        
+        // Serialize metadata to the file
+        metadata.serialize(newTable,tablePath);  // This will write metadata
+        if (newTable) {
+            std::cout << "Debug createTable: Serialized metadata to table file successfully." << std::endl;
+        } else {
+            std::cerr << "Error createTable: Failed to write metadata to table file." << std::endl;
+        }
+        std::cout << "Size of FileMetadata: " << sizeof(metadata) << " bytes" << std::endl;
+        newTable.close();
+
+        // An empty table's zones are all known, so they can be kept from the first write on
+        ZoneMapEntry& zones = zoneMapEntry(tablePath, metadata);
+        zones.map = std::make_shared<TableZoneMap>(zones.decoder.outputColumns());
+        zones.map->save(tablePath);
+        std::cout << "Created new table with metadata: " << tablePath << std::endl;
+        return true;
+    }
+
+    std::cerr << "Error createTable: Failed to create table file at path: " << tablePath << std::endl;
+    return false;
+}
+
+// Bring a table file up to FORMAT_VERSION. Version 2 files only need their metadata
+// moved into the snapshot/log sidecars; version 1 files (16-bit header, overlapping
+// page records) are rewritten page by page. Current files are left untouched.
+bool upgradeTable(const std::string& dbName, const std::string& tableName) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    std::fstream oldFile = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!oldFile) {
+        std::cerr << "Error upgradeTable: Unable to open file: " << tablePath << std::endl;
+        return false;
+    }
+
+    FileMetadata fileMetadata;
+    try {
+        fileMetadata.deserialize(oldFile, tablePath);
+    } catch (const std::exception& e) {
+        std::cerr << "Error upgradeTable: " << e.what() << std::endl;
+        return false;
+    }
+    if (!fileMetadata.isLegacyFormat()) {
+        return true;
+    }
+    std::cout << "Debug upgradeTable: Upgrading " << tablePath << " from format version "
+              << fileMetadata.getFormatVersion() << " to " << FORMAT_VERSION << std::endl;
+    dropIdFilter(tablePath);
+    dropZoneMap(tablePath);
+    dropChangeMap(tablePath); // The file is rewritten, so the next backup copies all of it
+    dropMetadata(tablePath);
+
+    if (fileMetadata.getFormatVersion() >= 2) {
+        // Page frames are unchanged since version 2; rewriting the metadata is enough
+        oldFile.close();
+        std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+        try {
+            fileMetadata.checkpoint(file, tablePath);
+        } catch (const std::exception& e) {
+            std::cerr << "Error upgradeTable: " << e.what() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Version 1 addressed the tail page as pageCount, so pages 0..pageCount may exist
+    std::vector<Page> upgradedPages;
+    uint64_t legacyLastPage = fileMetadata.getPageCount();
+    for (uint64_t id = 0; id <= legacyLastPage; ++id) {
+        oldFile.clear();
+        oldFile.seekg(FileMetadata::getLegacyPagePosition(static_cast<uint32_t>(id)));
+        Page page(static_cast<uint32_t>(id));
+        if (!page.deserializeLegacy(oldFile)) {
+            if (id == legacyLastPage) {
+                break; // The tail page was never written
+            }
+            std::cerr << "Warning upgradeTable: Page " << id << " is unreadable, writing it empty.\n";
+            page = Page(static_cast<uint32_t>(id));
+        }
+        page.setPageID(static_cast<uint32_t>(id));
+        upgradedPages.push_back(page);
+    }
+    oldFile.close();
+
+    // Drop map entries pointing at pages that did not survive the conversion
+    std::map<int64_t, int64_t> tupleToPageMap = fileMetadata.getTupleToPageMap();
+    FileMetadata upgraded;
+    upgraded.setSchema(fileMetadata.getSchema());
+    upgraded.setPageCount(upgradedPages.size());
+    for (const auto& [tupleId, pageId] : tupleToPageMap) {
+        if (pageId < 0 || static_cast<uint64_t>(pageId) >= upgradedPages.size()) {
+            upgraded.setTupleAsDeleted(tupleId);
+        } else {
+            upgraded.addTupleToPageMap(tupleId, pageId);
+        }
+    }
+
+    // Write the new file next to the old one and swap it in
+    std::string tmpPath = tablePath + ".upgrade";
+    {
+        std::fstream newFile(tmpPath, std::ios::binary | std::ios::out | std::ios::in | std::ios::trunc);
+        bumpCounter(engineCounters().fileOpens);
+        if (!newFile) {
+            std::cerr << "Error upgradeTable: Unable to create " << tmpPath << std::endl;
+            return false;
+        }
+        try {
+            upgraded.serialize(newFile, tablePath); // Sidecars are written under the final name
+        } catch (const std::exception& e) {
+            std::cerr << "Error upgradeTable: " << e.what() << std::endl;
+            newFile.close();
+            fs::remove(tmpPath);
+            return false;
+        }
+        for (auto& page : upgradedPages) {
+            newFile.seekp(upgraded.getPagePosition(page.getPageID()));
+            page.serialize(newFile);
+        }
+        newFile.flush();
+        if (!newFile) {
+            std::cerr << "Error upgradeTable: Failed writing " << tmpPath << std::endl;
+            newFile.close();
+            fs::remove(tmpPath);
+            return false;
+        }
+    }
+    bufferPool.invalidateTable(tablePath);
+    try {
+        renameDurably(tmpPath, tablePath);
+    } catch (const std::exception& e) {
+        std::cerr << "Error upgradeTable: " << e.what() << std::endl;
+        return false;
+    }
+    std::cout << "Debug upgradeTable: Upgraded " << tablePath << " (" << upgradedPages.size() << " pages)." << std::endl;
+    return true;
+}
+
+// Fold the table's metadata log into a fresh snapshot (each partition's, if it is partitioned)
+bool checkpointTable(const std::string& dbName, const std::string& tableName) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (partitioningOf(dbName, tableName)) {
+        bool ok = true;
+        for (const std::string& partition : partitionsOf(dbName, tableName)) {
+            ok = checkpointTable(dbName, partition) && ok;
+        }
+        return ok;
+    }
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file) {
+        std::cerr << "Error checkpointTable: Unable to open file: " << tablePath << std::endl;
+        return false;
+    }
+    try {
+        FileMetadata fileMetadata;
+        fileMetadata.deserialize(file, tablePath);
+        fileMetadata.checkpoint(file, tablePath);
+    } catch (const std::exception& e) {
+        std::cerr << "Error checkpointTable: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Replay a table's redo log if this instance has not done so yet. Restart work is
+// bounded by the log, which checkpoints keep short, not by the size of the table.
+bool recoverTable(const std::string& dbName, const std::string& tableName) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (partitioningOf(dbName, tableName)) {
+        bool ok = true;
+        for (const std::string& partition : partitionsOf(dbName, tableName)) {
+            ok = recoverTable(dbName, partition) && ok;
+        }
+        return ok;
+    }
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    try {
+        recoverIfNeeded(tablePath);
+    } catch (const std::exception& e) {
+        std::cerr << "Error recoverTable: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Recover every table of a database that has a redo log; run once at startup
+bool recoverDatabase(const std::string& dbName) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    TraceSpan span("recover_database");
+    if (!fs::is_directory(dbName)) {
+        return true;
+    }
+    const std::string suffix = ".HAD.wal";
+    bool ok = true;
+    std::vector<fs::path> decisionFiles;
+    for (const auto& entry : fs::directory_iterator(dbName)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            ok = recoverTable(dbName, name.substr(0, name.size() - suffix.size())) && ok;
+        } else if (entry.path().extension() == ".txn") {
+            decisionFiles.push_back(entry.path());
+        }
+    }
+
+    // A crash left these transactions' decision files behind. Once every table of a
+    // transaction is recovered (replaying its records), its file can go.
+    for (const fs::path& decisionPath : decisionFiles) {
+        std::ifstream in(decisionPath);
+        bool recovered = static_cast<bool>(in);
+        for (std::string stored; std::getline(in, stored);) {
+            std::string tablePath = resolveFrom(decisionPath.parent_path(), stored);
+            try {
+                if (fs::exists(tablePath)) {
+                    recoverIfNeeded(tablePath);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Error recoverDatabase: " << e.what() << std::endl;
+                recovered = false;
+            }
+        }
+        in.close();
+        if (recovered) {
+            std::error_code error;
+            fs::remove(decisionPath, error);
+        }
+        ok = recovered && ok;
+    }
+    return ok;
+}
+
+// Back up a database into backupDir, as a chain of files "backup.<sequence>". The
+// first backup (sequence 1) copies every table whole; each later one copies only the
+// pages written since the previous one, as recorded by the tables' change maps, the
+// table headers, and what was appended to the metadata logs and dictionaries since.
+// A metadata snapshot is copied again only once a checkpoint has replaced it, and
+// partitioning descriptors are copied whole. A table with no change map relative to
+// the previous backup (created or upgraded since, or tracking lost) is copied whole,
+// with its sidecars. Tables are recovered first, and the engine lock is held
+// throughout, so the backup is one consistent state of the database. See
+// restoreDatabase().
+std::optional<BackupStats> backupDatabase(const std::string& dbName, const std::string& backupDir) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (!outsideTransaction("backupDatabase")) {
+        return std::nullopt;
+    }
+    TraceSpan span("backup");
+    if (!fs::is_directory(dbName)) {
+        std::cerr << "Error backupDatabase: Database not found: " << dbName << std::endl;
+        return std::nullopt;
+    }
+    std::error_code error;
+    fs::create_directories(backupDir, error);
+
+    // Continue the chain in backupDir, or start one
+    BackupStats stats;
+    uint64_t chain = 0;
+    std::map<uint64_t, fs::path> backups = listBackups(backupDir);
+    if (backups.empty()) {
+        std::random_device random;
+        chain = static_cast<uint64_t>(random()) << 32 | random();
+        stats.sequence = 1;
+    } else {
+        std::ifstream in(backups.rbegin()->second, std::ios::binary);
+        BackupHeader header;
+        if (!readBackupHeader(in, header) || header.sequence != backups.rbegin()->first) {
+            std::cerr << "Error backupDatabase: Unreadable backup " << backups.rbegin()->second << std::endl;
+            return std::nullopt;
+        }
+        chain = header.chain;
+        stats.sequence = header.sequence + 1;
+    }
+
+    std::vector<std::string> tableNames;
+    std::vector<std::string> descriptorNames;
+    auto endsWith = [](const std::string& name, const std::string& suffix) {
+        return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    for (const auto& entry : fs::directory_iterator(dbName)) {
+        std::string name = entry.path().filename().string();
+        if (endsWith(name, ".HAD")) {
+            tableNames.push_back(name);
+        } else if (endsWith(name, ".HAD.parts")) {
+            descriptorNames.push_back(name);
+        }
+    }
+    std::sort(tableNames.begin(), tableNames.end());
+    std::sort(descriptorNames.begin(), descriptorNames.end());
+
+    std::string backupPath = backupDir + "/backup." + std::to_string(stats.sequence);
+    std::string tempPath = backupPath + ".tmp";
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    bumpCounter(engineCounters().fileOpens);
+    auto put = [&](auto value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    auto putBytes = [&](std::string_view bytes) {
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        put(RedoLog::checksum(bytes));
+    };
+    auto putName = [&](const std::string& name, BackupEntryKind kind) {
+        put(static_cast<uint16_t>(name.size()));
+        out.write(name.data(), static_cast<std::streamsize>(name.size()));
+        put(static_cast<uint8_t>(kind));
+    };
+    put(BACKUP_MAGIC);
+    put(BACKUP_VERSION);
+    put(uint16_t(0));
+    put(chain);
+    put(stats.sequence);
+    put(uint32_t(0)); // Entry count, filled in at the end
+
+    uint32_t entries = 0;
+    auto putFile = [&](const std::string& name) {
+        std::ifstream in(dbName + "/" + name, std::ios::binary);
+        if (!in) {
+            return; // Not every table has every sidecar
+        }
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        putName(name, BACKUP_FILE);
+        put(static_cast<uint64_t>(bytes.size()));
+        putBytes(bytes);
+        ++entries;
+    };
+    // The bytes of a sidecar from offset on, which the previous backup did not have
+    auto putFileFrom = [&](const std::string& name, uint64_t offset) {
+        std::ifstream in(dbName + "/" + name, std::ios::binary | std::ios::ate);
+        if (!in) {
+            return;
+        }
+        uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+        putName(name, BACKUP_RANGES);
+        put(uint8_t(0));
+        put(fileSize);
+        put(static_cast<uint32_t>(fileSize > offset ? 1 : 0));
+        if (fileSize > offset) {
+            std::string bytes(fileSize - offset, '\0');
+            in.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+            in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            if (!in) {
+                throw std::runtime_error("Failed to read " + dbName + "/" + name);
+            }
+            put(offset);
+            put(static_cast<uint32_t>(bytes.size()));
+            putBytes(bytes);
+        }
+        ++entries;
+    };
+
+    std::vector<std::pair<std::string, PageChangeMap::Sidecars>> tablePaths;
+    try {
+        for (const std::string& name : tableNames) {
+            std::string tablePath = dbName + "/" + name;
+            recoverIfNeeded(tablePath);
+            std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+            if (!file) {
+                throw std::runtime_error("Unable to open file: " + tablePath);
+            }
+            const FileMetadata& fileMetadata = metadataFor(tablePath, file);
+            if (fileMetadata.isLegacyFormat()) {
+                throw std::runtime_error(tablePath + " has an old format; createTable() upgrades it");
+            }
+
+            const PageChangeMap* changes = changeMapFor(tablePath);
+            bool whole = !changes || changes->backupChain() != chain || changes->backupSequence() + 1 != stats.sequence;
+            uint64_t fileSize = fs::file_size(tablePath);
+
+            // The header, then every page to copy. The last extent of a compressed
+            // table may end before its capacity.
+            std::vector<std::pair<uint64_t, uint64_t>> ranges{{0, static_cast<uint64_t>(fileMetadata.getPagePosition(0))}};
+            for (uint32_t pageID = 0; pageID < fileMetadata.getPageCount(); ++pageID) {
+                if (!whole && !changes->isChanged(pageID)) {
+                    continue;
+                }
+                if (!fileMetadata.isCompressed()) {
+                    ranges.emplace_back(static_cast<uint64_t>(fileMetadata.getPagePosition(pageID)), PAGE_SIZE);
+                } else if (std::optional<PageExtent> extent = fileMetadata.getPageExtent(pageID)) {
+                    ranges.emplace_back(extent->offset, extent->capacity);
+                }
+            }
+            putName(name, BACKUP_RANGES);
+            put(static_cast<uint8_t>(whole));
+            put(fileSize);
+            put(static_cast<uint32_t>(ranges.size()));
+            std::string bytes;
+            for (auto [offset, length] : ranges) {
+                length = offset < fileSize ? std::min(length, fileSize - offset) : 0;
+                bytes.resize(length);
+                file.clear();
+                file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+                file.read(bytes.data(), static_cast<std::streamsize>(length));
+                if (!file) {
+                    throw std::runtime_error("Failed to read " + tablePath);
+                }
+                put(offset);
+                put(static_cast<uint32_t>(length));
+                putBytes(bytes);
+            }
+            ++entries;
+            ++stats.tables;
+            stats.tablesCopiedWhole += whole;
+            stats.pagesCopied += ranges.size() - 1;
+
+            // The metadata sidecars, as far as they changed since the previous backup
+            PageChangeMap::Sidecars sidecars;
+            std::error_code sizeError;
+            sidecars.snapshotGeneration = sidecarGeneration(FileMetadata::snapshotPath(tablePath), SNAPSHOT_MAGIC);
+            sidecars.logGeneration = sidecarGeneration(FileMetadata::logPath(tablePath), METADATA_LOG_MAGIC);
+            uint64_t logSize = fs::file_size(FileMetadata::logPath(tablePath), sizeError);
+            sidecars.logBytes = sizeError ? 0 : FileMetadata::wholeLogBytes(logSize);
+            uint64_t dictionarySize = fs::file_size(TableDictionary::dictionaryPath(tablePath), sizeError);
+            sidecars.dictionaryBytes = sizeError ? 0 : dictionarySize;
+            const PageChangeMap::Sidecars* previous = whole ? nullptr : &changes->backedUpSidecars();
+            if (previous && previous->snapshotGeneration == sidecars.snapshotGeneration) {
+                putFileFrom(FileMetadata::snapshotPath(name), std::numeric_limits<uint64_t>::max());
+            } else {
+                putFile(FileMetadata::snapshotPath(name));
+            }
+            if (previous && previous->logGeneration == sidecars.logGeneration && previous->logBytes <= logSize) {
+                putFileFrom(FileMetadata::logPath(name), previous->logBytes);
+            } else {
+                putFile(FileMetadata::logPath(name));
+            }
+            if (previous && previous->dictionaryBytes <= sidecars.dictionaryBytes) {
+                putFileFrom(TableDictionary::dictionaryPath(name), previous->dictionaryBytes);
+            } else {
+                putFile(TableDictionary::dictionaryPath(name));
+            }
+            tablePaths.emplace_back(tablePath, sidecars);
+        }
+        for (const std::string& name : descriptorNames) {
+            putFile(name);
+        }
+        stats.bytesWritten = static_cast<uint64_t>(out.tellp());
+        out.seekp(BACKUP_ENTRY_COUNT_OFFSET, std::ios::beg);
+        put(entries);
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Failed to write " + tempPath);
+        }
+        renameDurably(tempPath, backupPath);
+    } catch (const std::exception& e) {
+        std::cerr << "Error backupDatabase: " << e.what() << std::endl;
+        out.close();
+        fs::remove(tempPath, error);
+        return std::nullopt;
+    }
+
+    // Track the pages written from here on, for the next backup
+    for (const auto& [tablePath, sidecars] : tablePaths) {
+        PageChangeMap changes;
+        if (changes.reset(tablePath, chain, stats.sequence, sidecars)) {
+            changeMaps[tablePath] = std::move(changes);
+        } else {
+            dropChangeMap(tablePath);
+        }
+    }
+    std::cout << "Debug backupDatabase: Wrote " << backupPath << " (" << stats.tables << " tables, "
+              << stats.pagesCopied << " pages)" << std::endl;
+    return stats;
+}
+
+// Rebuild a database from the backups in backupDir: the base backup, then each later
+// one in order up to sequence (by default the latest). dbName must not exist or be
+// empty, and is removed again if the restore fails. Restored tables have no change
+// maps: their next backup, into a new directory, starts a new chain.
+bool restoreDatabase(const std::string& backupDir, const std::string& dbName,
+                     uint64_t sequence = std::numeric_limits<uint64_t>::max()) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (!outsideTransaction("restoreDatabase")) {
+        return false;
+    }
+    TraceSpan span("restore");
+    std::map<uint64_t, fs::path> backups = listBackups(backupDir);
+    if (backups.empty()) {
+        std::cerr << "Error restoreDatabase: No backups in " << backupDir << std::endl;
+        return false;
+    }
+    uint64_t last = std::min(sequence, backups.rbegin()->first);
+    for (uint64_t required = 1; required <= last; ++required) {
+        if (!backups.count(required)) {
+            std::cerr << "Error restoreDatabase: Backup " << required << " is missing from " << backupDir << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    if (fs::exists(dbName, error) && !fs::is_empty(dbName, error)) {
+        std::cerr << "Error restoreDatabase: " << dbName << " exists and is not empty" << std::endl;
+        return false;
+    }
+
+    std::set<std::string> restored;
+    bool ok = true;
+    try {
+        fs::create_directories(dbName);
+        uint64_t chain = 0;
+        for (uint64_t current = 1; current <= last; ++current) {
+            applyBackup(backups[current], dbName, current, chain, restored);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error restoreDatabase: " << e.what() << std::endl;
+        ok = false;
+    }
+
+    // Nothing cached about these paths describes the restored files
+    for (const std::string& name : restored) {
+        std::string path = dbName + "/" + name;
+        bufferPool.invalidateTable(path);
+        dictionaries.erase(path);
+        redoLogs.erase(path);
+        idFilters.erase(path);
+        zoneMaps.erase(path);
+        changeMaps.erase(path);
+        idRanges.erase(path);
+        dropMetadata(path);
+        partitionings.erase(path);
+        if (fs::path(path).extension() == ".parts") {
+            partitionings.erase(fs::path(path).replace_extension().string());
+        }
+    }
+    if (!ok) {
+        fs::remove_all(dbName, error);
+        return false;
+    }
+    std::cout << "Debug restoreDatabase: Restored " << dbName << " from " << last << " backups" << std::endl;
+    return true;
+}
+
+// Function to delete a table from the database
+bool deleteTable(const std::string& tablePath) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (!outsideTransaction("deleteTable")) {
+        return false;
+    }
+    std::cout << "Debug deleteTable: Attempting to delete table at path: " << tablePath << std::endl;
+
+    // A partitioned table goes with all of its partitions
+    std::string descriptorPath = TablePartitioning::descriptorPath(tablePath);
+    if (fs::exists(descriptorPath)) {
+        TablePartitioning partitioning;
+        if (!partitioning.load(tablePath)) {
+            return false;
+        }
+        std::string stem = tablePath.substr(0, tablePath.size() - std::string(".HAD").size());
+        std::string tableName = stem.substr(stem.rfind('/') + 1);
+        std::string dbName = stem.substr(0, stem.rfind('/'));
+        bool deleted = true;
+        for (uint32_t index = 0; index < partitioning.count; ++index) {
+            std::string partitionPath = dbName + "/" + TablePartitioning::partitionName(tableName, index) + ".HAD";
+            if (fs::exists(partitionPath)) {
+                deleted = deleteTable(partitionPath) && deleted;
+            }
+        }
+        if (!deleted) {
+            return false;
+        }
+        fs::remove(descriptorPath);
+        partitionings.erase(tablePath);
+        std::cout << "Debug deleteTable: Partitioned table deleted successfully: " << tablePath << std::endl;
+        return true;
+    }
+
+    if (fs::exists(tablePath)) {
+        std::cout << "Debug deleteTable: Table found, proceeding to delete..." << std::endl;
+
+        try {
+            fs::remove(tablePath); // Remove the table file
+            fs::remove(FileMetadata::snapshotPath(tablePath));
+            fs::remove(FileMetadata::logPath(tablePath));
+            fs::remove(TableDictionary::dictionaryPath(tablePath));
+            fs::remove(RedoLog::logPath(tablePath));
+            bufferPool.invalidateTable(tablePath);
+            dictionaries.erase(tablePath);
+            redoLogs.erase(tablePath);
+            dropIdFilter(tablePath);
+            dropZoneMap(tablePath);
+            dropChangeMap(tablePath);
+            idRanges.erase(tablePath);
+            dropMetadata(tablePath);
+           std::cout << "Debug deleteTable: Table deleted successfully: " << tablePath << std::endl;
+            return true;
+        } catch (const fs::filesystem_error& e) {
+            std::cerr << "Error deleting table: " << e.what() << std::endl;
+        }
+    } else {
+        std::cerr << "Error deleteTable: Table not found: " << tablePath << std::endl;
+    }
+    return false;
+}
+
+// Helper function to load a page from the table
+// Read a page, from the buffer pool when cached. Compressed pages are located through
+// the page directory and decompressed before they enter the pool.
+bool readPage(std::fstream& file, const FileMetadata& fileMetadata, const std::string& tablePath, uint32_t pageID, Page& page) {
+    TraceSpan span("page_load");
+    if (bufferPool.lookup(tablePath, pageID, page)) {
+        return true;
+    }
+    if (!readPageFromDisk(file, fileMetadata, tablePath, pageID, page)) {
+        return false;
+    }
+    bufferPool.put(tablePath, page);
+    return true;
+}
+
+// Where a page is stored in the table file: a compressed table's extent, or a frame
+struct PageLocation {
+    bool compressed = false;
+    uint64_t offset = 0;
+    uint64_t capacity = 0;  // Extent capacity, for compressed tables
+};
+
+static std::optional<PageLocation> locatePage(const FileMetadata& fileMetadata, const std::string& tablePath, uint32_t pageID) {
+    if (pageID >= fileMetadata.getPageCount()) {
+        std::cerr << "Error readPage: Page " << pageID << " does not exist in " << tablePath << std::endl;
+        return std::nullopt;
+    }
+    if (!fileMetadata.isCompressed()) {
+        return PageLocation{false, static_cast<uint64_t>(fileMetadata.getPagePosition(pageID)), 0};
+    }
+    std::optional<PageExtent> extent = fileMetadata.getPageExtent(pageID);
+    if (!extent) {
+        std::cerr << "Error readPage: No extent recorded for page " << pageID << std::endl;
+        return std::nullopt;
+    }
+    return PageLocation{true, extent->offset, extent->capacity};
+}
+
+// Read and decode the page stored at location. Needs no metadata, so it can run
+// without the engine lock on a stream of its own.
+static bool readPageAt(std::fstream& file, const PageLocation& location, uint32_t pageID, Page& page) {
+    file.clear();
+    if (location.compressed) {
+        // Extent layout: [uint8 method][uint16 stored length][stored bytes]
+        std::vector<char> stored(location.capacity);
+        file.seekg(location.offset, std::ios::beg);
+        file.read(stored.data(), std::min<uint64_t>(location.capacity, 3 + PAGE_SIZE));
+        if (!file && file.gcount() < 3) {
+            std::cerr << "Error readPage: Failed to read extent of page " << pageID << std::endl;
+            return false;
+        }
+        file.clear();
+        uint8_t method = static_cast<uint8_t>(stored[0]);
+        uint16_t storedLength;
+        std::memcpy(&storedLength, stored.data() + 1, sizeof(storedLength));
+        if (3u + storedLength > location.capacity) {
+            std::cerr << "Error readPage: Corrupt extent header for page " << pageID << std::endl;
+            return false;
+        }
+
+        char frame[PAGE_SIZE];
+        if (method == 0 && storedLength == PAGE_SIZE) {
+            std::memcpy(frame, stored.data() + 3, PAGE_SIZE);
+        } else if (method != 1 || !PageCodec::decompress(stored.data() + 3, storedLength, frame, PAGE_SIZE)) {
+            std::cerr << "Error readPage: Failed to decompress page " << pageID << std::endl;
+            return false;
+        }
+        page.fromFrame(frame);
+        bumpCounter(engineCounters().bytesRead, 3 + storedLength);
+    } else {
+        file.seekg(location.offset, std::ios::beg);
+        page.deserialize(file);
+        if (!file) {
+            file.clear();
+            return false;
+        }
+        bumpCounter(engineCounters().bytesRead, PAGE_SIZE);
+    }
+    bumpCounter(engineCounters().pagesRead);
+    return true;
+}
+
+// Read and decode a page without going through the buffer pool. Safe to call
+// from several threads, each with its own stream.
+static bool readPageFromDisk(std::fstream& file, const FileMetadata& fileMetadata, const std::string& tablePath, uint32_t pageID, Page& page) {
+    std::optional<PageLocation> location = locatePage(fileMetadata, tablePath, pageID);
+    return location && readPageAt(file, *location, pageID, page);
+}
+
+// Write a page to disk and refresh its cached copy. For compressed tables the page
+// is rewritten in place when it still fits its extent, otherwise it moves to a new
+// extent at the end of the file (recorded in the page directory).
+bool writePage(std::fstream& file, FileMetadata& fileMetadata, const std::string& tablePath, const Page& page) {
+    TraceSpan span("page_write");
+    uint32_t pageID = page.getPageID();
+    char frame[PAGE_SIZE];
+    if (!page.toFrame(frame)) {
+        return false;
+    }
+    ZoneMapEntry& zones = beginZoneUpdate(tablePath, fileMetadata);
+    markPagesChanged(tablePath, {pageID});
+
+    file.clear();
+    if (fileMetadata.isCompressed()) {
+        std::vector<char> stored(3 + PAGE_SIZE);
+        size_t compressedSize = PageCodec::compress(frame, PAGE_SIZE, stored.data() + 3, PAGE_SIZE - 1);
+        uint8_t method = 1;
+        uint16_t storedLength = static_cast<uint16_t>(compressedSize);
+        if (compressedSize == 0) {
+            // Incompressible: store the frame as is
+            method = 0;
+            storedLength = PAGE_SIZE;
+            std::memcpy(stored.data() + 3, frame, PAGE_SIZE);
+        }
+        stored[0] = static_cast<char>(method);
+        std::memcpy(stored.data() + 1, &storedLength, sizeof(storedLength));
+        size_t needed = 3 + storedLength;
+
+        std::optional<PageExtent> extent = fileMetadata.getPageExtent(pageID);
+        if (!extent || extent->capacity < needed) {
+            extent = fileMetadata.allocateExtent(pageID, needed);
+            std::cout << "Debug writePage: Page " << pageID << " moved to extent at " << extent->offset
+                      << " (" << extent->capacity << " bytes)" << std::endl;
+        }
+        file.seekp(extent->offset, std::ios::beg);
+        file.write(stored.data(), needed);
+        bumpCounter(engineCounters().bytesWritten, needed);
+    } else {
+        file.seekp(fileMetadata.getPagePosition(pageID), std::ios::beg);
+        file.write(frame, PAGE_SIZE);
+        bumpCounter(engineCounters().bytesWritten, PAGE_SIZE);
+    }
+    if (!file) {
+        std::cerr << "Error writePage: Failed to write page " << pageID << " of " << tablePath << std::endl;
+        return false;
+    }
+    bumpCounter(engineCounters().pagesWritten);
+    updateZones(zones, page);
+
+    // Cache the page as it now reads back from disk (slot directory compacted)
+    Page written(pageID);
+    written.fromFrame(frame);
+    bufferPool.put(tablePath, written);
+    return true;
+}
+
+Page loadPageByID(const std::string& tablePath, uint32_t pageID) {
+    std::cout << "Debug loadPageByID: Attempting to load page with ID: " << pageID << " from table: " << tablePath << std::endl;
+
+    std::fstream dbFile = openTableFile(tablePath, std::ios::in | std::ios::binary);
+    if (!dbFile.is_open()) {
+        throw std::runtime_error("Failed to open table file: " + tablePath);
+    }
+    std::cout << "Debug loadPageByID: Successfully opened table file." << std::endl;
+
+    // Read file metadata
+    FileMetadata fileMetadata;
+    fileMetadata.deserialize(dbFile, tablePath);
+    std::cout << "Debug loadPageByID: File metadata deserialized successfully." << std::endl;
+
+    // Load the page through the buffer pool
+    Page page(pageID);
+    if (!readPage(dbFile, fileMetadata, tablePath, pageID, page)) {
+        throw std::runtime_error("Failed to read page " + std::to_string(pageID) + " of " + tablePath);
+    }
+    std::cout << "Debug loadPageByID: Page with ID " << pageID << " loaded successfully." << std::endl;
+
+    dbFile.close();
+    return page;
+}
+
+std::vector<Tuple> getTuplesFromPage(const Page& page) {
+    std::vector<Tuple> tuples;
+    std::cout << "Debug getTuplesFromPage: Retrieving tuples from page. Total slot count: " << page.getTupleCount() << std::endl;
+
+    // Iterate through the slots in the page
+    for (size_t i = 0; i < page.getTupleCount(); ++i) {
+        try {
+            // Retrieve tuple data from the page using the slot index
+            std::string tupleData = page.getTupleData(i);
+            std::cout << "Debug getTuplesFromPage: Retrieved tuple data from slot " << i << ". Data length: " << tupleData.size() << std::endl;
+
+            // Deserialize the tuple data into a Tuple object
+            Tuple tuple;
+           if (tuple.deserialize(tupleData)) {
+                tuples.push_back(tuple); // Add the tuple to the result
+                std::cout << "Debug getTuplesFromPage: Tuple deserialized successfully at slot " << i << std::endl;
+            } else {
+                std::cerr << "Error getTuplesFromPage: Failed to deserialize tuple data at slot " << i << std::endl;
+            }
+  
+        } catch (const std::exception& e) {
+            std::cerr << "Error retrieving tuple at slot " << i << ": " << e.what() << std::endl;
+        }
+    }
+    std::cout << "Debug getTuplesFromPage: Retrieved " << tuples.size() << " tuples from the page." << std::endl;
+
+    return tuples;
+}
+
+    // Check if a tuple with a specific ID exists in a file
+bool hasTupleWithIDInFile(const std::string& tablePath, int64_t id) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    // Open the table file in binary read mode
+    recoverIfNeeded(tablePath);
+    std::fstream dbFile = openTableFile(tablePath, std::ios::in | std::ios::out | std::ios::binary);
+    if (!dbFile.is_open()) {
+        std::cerr << "Failed to open table file: " << tablePath << "\n";
+        return false;
+    }
+
+    // Deserialize file metadata from the beginning of the file
+    FileMetadata fileMetadata;
+    try {
+        fileMetadata.deserialize(dbFile, tablePath);
+        std::cout << "Debug hasTupleWithIDInFile: Successfully deserialized file metadata.\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error during file metadata deserialization: " << e.what() << "\n";
+        dbFile.close();
+        return false;
+    }
+
+    // Use the tuple-to-page map to find the page ID associated with the tuple ID
+    const auto& tupleToPageMap = fileMetadata.getTupleToPageMap();
+    std::cout << "Debug hasTupleWithIDInFile: Checking for tuple with ID " << id << " in the tuple-to-page map.\n";
+
+    auto it = tupleToPageMap.find(id);
+
+    if (it == tupleToPageMap.end()) {
+        std::cerr << "Error hasTupleWithIDInFile: Tuple ID " << id << " not found in the tuple-to-page map.\n";
+        dbFile.close();
+        return false;
+    }
+     // Check if the tuple is marked as deleted (e.g., -2 for deletion)
+    if (it->second == -2) {
+        std::cout << "Debug hasTupleWithIDInFile: Tuple ID " << id << " is marked as deleted.\n";
+        dbFile.close();
+        return false;
+    }
+    // If we found the tuple ID in the map and it's not deleted, return true
+    std::cout << "Debug hasTupleWithIDInFile: Tuple with ID " << id << " found and not deleted.\n";
+    dbFile.close();
+    return true;
+}
+
+std::string loadTuple(const std::string& tablePath, int64_t tupleID) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    bumpCounter(engineCounters().lookups);
+    // Open the database file in read-binary mode
+    recoverIfNeeded(tablePath);
+    std::fstream dbFile = openTableFile(tablePath, std::ios::in | std::ios::binary);
+    if (!dbFile.is_open()) {
+        std::cerr << "Error loadTuple: Unable to open file: " << tablePath << std::endl;
+        return "";
+    }
+
+    // Deserialize the file metadata
+    FileMetadata fileMetadata;
+    try {
+        fileMetadata.deserialize(dbFile, tablePath);
+        std::cout << "Debug loadTuple : Successfully deserialized file metadata." << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error loadTuple: Failed to deserialize file metadata: " << e.what() << std::endl;
+        dbFile.close();
+        return "";
+    }
+
+    // Use the tuple-to-page map to find the page ID associated with the tupleID
+    auto it = fileMetadata.getTupleToPageMap().find(tupleID);
+    if (it == fileMetadata.getTupleToPageMap().end() || it->second == -2) {
+        std::cerr << "Error loadTuple: Tuple ID " << tupleID << " not found or marked as deleted." << std::endl;
+        dbFile.close();
+        return "";
+    }
+
+    uint32_t pageID = static_cast<uint32_t>(it->second);
+    std::cout << "Debug loadTuple: Found tuple with ID " << tupleID << " on page " << pageID << std::endl;
+
+    // Load the page
+    Page page(pageID);
+    if (!readPage(dbFile, fileMetadata, tablePath, pageID, page)) {
+        std::cerr << "Error loadTuple: Failed to read page " << pageID << std::endl;
+        dbFile.close();
+        return "";
+    }
+    std::cout << "Debug loadTuple: Page with ID " << pageID << " loaded successfully." << std::endl;
+
+    // Get the tuple data using the tuple index (this assumes the tuple ID is unique per page)
+    int slotIndex = page.getTupleIndexByID(tupleID);
+    if (slotIndex == -1) {
+        std::cerr << "Error loadTuple: Tuple ID " << tupleID << " not found on the page." << std::endl;
+        dbFile.close();
+        return "";
+    }
+
+    // Retrieve the tuple data from the page using the slot index
+    std::string tupleData = page.getTupleData(slotIndex);
+    std::cout << "Debug loadTuple: Tuple with ID " << tupleID << " retrieved successfully." << std::endl;
+
+    dbFile.close();
+    return tupleData;
+}
+
+
+std::map<std::string, std::string> get(const std::string& dbName, const std::string& tableName, const std::string& id) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (const TablePartitioning* partitioning = partitioningOf(dbName, tableName)) {
+        return get(dbName, partitionForRow(tableName, *partitioning, id), id);
+    }
+    bumpCounter(engineCounters().lookups);
+    LatencyTimer timer(operationLatency[OP_GET]);
+    TraceSpan span("get");
+    ArenaScope arena;
+
+    // Construct the table path
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+
+    int64_t tupleId;
+    try {
+        tupleId = std::stoll(id);  // Convert string id to integer
+    } catch (const std::invalid_argument& e) {
+        throw std::invalid_argument("Invalid ID format: " + id);
+    }
+
+    // IDs the table's filter rules out need neither the file nor its metadata
+    if (!transactionWrite(tablePath, tupleId) && !mayHaveRow(tablePath, tupleId)) {
+        throw std::out_of_range("Tuple ID not found");
+    }
+
+    // Open the table file
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
+    }
+
+    // Read file metadata to get the tuple-to-page map
+    const FileMetadata* cached = nullptr;
+    try {
+        cached = &metadataFor(tablePath, file);
+    } catch (const std::exception& e) {
+        file.close();
+        throw std::runtime_error("Error deserializing file metadata: " + std::string(e.what()));
+    }
+    const FileMetadata& fileMetadata = *cached;
+
+    // A row the open transaction wrote reads back as written
+    if (const std::optional<std::string>* write = transactionWrite(tablePath, tupleId)) {
+        if (!*write) {
+            throw std::out_of_range("Tuple ID not found");
+        }
+        Tuple tuple(operationResource());
+        tuple.deserialize(**write);
+        return tuple.getValueMap();
+    }
+
+    // Check if the tuple exists in the map
+    auto it = fileMetadata.getTupleToPageMap().find(tupleId);
+    if (it == fileMetadata.getTupleToPageMap().end() || it->second < 0) {
+        // Tuple ID not found or is marked as deleted
+        file.close();
+        throw std::out_of_range("Tuple ID not found");
+    }
+
+    // Get the page ID from the map
+    uint32_t pageID = static_cast<uint32_t>(it->second);
+
+    // Load the page
+    Page page(pageID);
+    if (!readPage(file, fileMetadata, tablePath, pageID, page)) {
+        file.close();
+        throw std::runtime_error("Error deserializing page with ID " + std::to_string(pageID));
+    }
+
+    // Search for the tuple in the page
+    TraceSpan searchSpan("row_search");
+    Tuple tuple(operationResource());
+    for (uint16_t i = 0; i < page.getTupleCount(); ++i) {
+        bumpCounter(engineCounters().lookupRowsDecoded);
+
+        // Deserialize the tuple and check if the ID matches
+        if (tuple.deserialize(page.getTupleView(i)) && tuple.getInt("id") == tupleId) {
+            file.close();
+            decodeTuple(tablePath, tuple);
+
+            // Return the tuple's key-value pairs
+            return tuple.getValueMap();
+        }
+    }
+
+    // If the tuple was not found
+    file.close();
+    throw std::out_of_range("Tuple with ID " + id + " not found on page " + std::to_string(pageID));
+
+}
+
+// Add a serialized row to the tail page of a table, or to a new page after it. The
+// caller has opened the file and read its metadata, which is updated in place.
+bool addTupleToTable(std::fstream& file, FileMetadata& fileMetadata, const std::string& tablePath,
+                     const std::string& tupleSerialized, int64_t id) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    std::cout << "Debug addTupleToTable: Adding tuple to table file: " << tablePath << std::endl;
+
+    // Check if there is space on the tail page (the last page written)
+    uint64_t pageCount = fileMetadata.getPageCount();
+    uint32_t pageId = pageCount > 0 ? static_cast<uint32_t>(pageCount - 1) : 0;
+
+    // Read the page to check for space
+    Page page(pageId);
+    bool haveTailPage = pageCount > 0 && readPage(file, fileMetadata, tablePath, pageId, page);
+    if (haveTailPage) {
+        std::cout << "Debug addTupleToTable: Page deserialized.\n";
+    }
+
+    // Try to add the tuple to this page
+    if (haveTailPage && page.addTuple(tupleSerialized, fileMetadata,id)) {
+        std::cout << "Debug addTupleToTable: Writing updated page " << pageId << "\n";
+        
+        // Log, write and update the metadata for the page as one change
+        if (!commitPages(file, fileMetadata, tablePath, {&page})) {
+            return false;
+        }
+         std::cout << "Debug addTupleToTable: Updated page serialized and written to file.\n";
+
+        std::cout << "Debug addTupleToTable: Tuple successfully added to existing page.\n";
+        return true;  // Tuple successfully added
+    } else if (haveTailPage) {
+        std::cerr << "Error addTupleToTable: Failed to add tuple to page.\n";
+    }
+
+
+    // If no existing page had space, create a new page and append it
+    
+    Page newPage(fileMetadata.getNextPageID()); // Assuming this method gives the next available page ID
+    std::cout << "Debug addTupleToTable: No space on existing pages. Creating a new page with ID: " << newPage.getPageID() << "\n";
+    
+    if (!newPage.addTuple(tupleSerialized, fileMetadata, id)) {
+        std::cerr << "Failed to add tuple to a new page.\n";
+        return false;
+    }
+
+    // Count the new page first so its record carries the new page count
+    fileMetadata.incrementPageID();
+
+    // Append the new page after the current last page
+    if (!commitPages(file, fileMetadata, tablePath, {&newPage})) {
+        return false;
+    }
+    std::cout << "Debug addTupleToTable: New page serialized and appended to file.\n";
+    
+    std::cout << "Debug addTupleToTable: Tuple successfully added to a new page.\n";;
+    return true;
+}
+
+bool checkTupleExists(const std::string& dbName, const std::string& tableName, const std::string& id) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (const TablePartitioning* partitioning = partitioningOf(dbName, tableName)) {
+        return checkTupleExists(dbName, partitionForRow(tableName, *partitioning, id), id);
+    }
+    // Check if the database exists
+    if (!fs::exists(dbName)) {
+        std::cerr << "Database '" << dbName << "' not found.\n";
+        return false;
+    }
+
+    // Check if the table exists
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    if (!fs::exists(tablePath)) {
+        std::cerr << "Table '" << tableName << "' not found in database '" << dbName << "'.\n";
+        return false;
+    }
+
+    int64_t tupleID;
+    try {
+        tupleID = std::stoll(id);  // Convert string id to integer
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "Invalid ID format: '" << id << "'. ID must be a valid integer.\n";
+        return false;
+    } catch (const std::out_of_range& e) {
+        std::cerr << "ID '" << id << "' is out of range.\n";
+        return false;
+    }
+
+    // The open transaction's writes take precedence over the table file
+    if (const std::optional<std::string>* write = transactionWrite(tablePath, tupleID)) {
+        return write->has_value();
+    }
+
+    // IDs the table's filter rules out need neither the file nor its metadata
+    if (!mayHaveRow(tablePath, tupleID)) {
+        std::cerr << "Tuple with ID '" << id << "' not found in table: " << tableName << " (via row ID filter).\n";
+        return false;
+    }
+
+    // Open the table file for reading
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        std::cerr << "Failed to open table file: " << tablePath << "\n";
+        return false;
+    }
+
+    // Read the file metadata
+    const FileMetadata* fileMetadata = nullptr;
+    try {
+        fileMetadata = &metadataFor(tablePath, file);
+    } catch (const std::exception& e) {
+        std::cerr << "Error deserializing file metadata: " << e.what() << "\n";
+        file.close();
+        return false;
+    }
+
+    // Check if the tuple ID exists in the tuple-to-page map in file metadata
+    if (fileMetadata->hasTupleInPageMap(tupleID)) {
+        std::cout << "Tuple with ID '" << id << "' found in table: " << tableName << " (via metadata lookup).\n";
+        file.close();
+        return true; // Tuple found via metadata map
+    }
+
+    std::cerr << "Tuple with ID '" << id << "' not found in table: " << tableName << " (via metadata map).\n";
+    file.close();
+    return false; // Tuple does not exist
+}
+
+// Insert a row; returns its id, or nullopt if it was rejected. A row without an id
+// inserted into an auto-increment table gets the next id of the table's sequence.
+std::optional<int64_t> insert(const std::string& dbName, const std::string& tableName, const Tuple& tuple) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    // Rows of a partitioned table go to the partition of their id
+    if (const TablePartitioning* partitioning = partitioningOf(dbName, tableName)) {
+        return insert(dbName, partitionForRow(tableName, *partitioning, tuple.getAttributeValue("id")), tuple);
+    }
+    LatencyTimer timer(operationLatency[OP_INSERT]);
+    TraceSpan span("insert");
+    ArenaScope arena;
+
+    // Validate database existence
+    if (!fs::exists(dbName)) {
+        std::cerr << "Database does not exist: " << dbName << std::endl;
+        return std::nullopt;
+    }
+
+    // Validate table existence
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    if (!fs::exists(tablePath)) {
+        std::cerr << "Table does not exist: " << tableName << std::endl;
+        return std::nullopt;
+    }
+
+    // Number the row if it needs an id. Ids taken by rows inserted with an explicit id
+    // are skipped.
+    Tuple numbered;
+    auto numberRow = [&](const FileMetadata& fileMetadata, auto&& taken) -> const Tuple& {
+        if (!fileMetadata.isAutoIncrement() || tuple.findValue("id")) {
+            return tuple;
+        }
+        int64_t id = allocateId(tablePath);
+        while (taken(id)) {
+            id = allocateId(tablePath);
+        }
+        numbered = tuple;
+        numbered.addAttribute("id", TYPE_INT, std::to_string(id));
+        return numbered;
+    };
+
+    // Inside a transaction the row is validated now and written at commit
+    if (transaction) {
+        TransactionTable& table = transactionTable(tablePath);
+        const Tuple& row = numberRow(table.metadata, [&](int64_t id) { return transactionRowExists(table, id); });
+        Tuple validated(operationResource());
+        if (!encodeRow(tablePath, table.metadata, row, validated, false)) {
+            return std::nullopt;
+        }
+        int64_t id = *validated.getInt("id");
+        if (transactionRowExists(table, id)) {
+            std::cerr << "Duplicate ID: " << id << " for table: " << tableName << std::endl;
+            return std::nullopt;
+        }
+        table.writes[id] = row.serialize();
+        std::cout << "Debug insert: Tuple " << id << " added to the transaction for table: " << tableName << std::endl;
+        return id;
+    }
+
+    // Open the table file for reading
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file) {
+        std::cerr << "Failed to open table file: " << tablePath << "\n";
+        return std::nullopt;
+    }
+
+    // Read file metadata, including schema
+    FileMetadata& fileMetadata = metadataFor(tablePath, file);
+    const Tuple& row = numberRow(fileMetadata, [&](int64_t id) { return fileMetadata.hasTupleWithID(id); });
+
+    // Check if 'id' is unique using tuple-to-page map in file metadata, before any
+    // new dictionary code is written for the row
+    std::optional<int64_t> rowId = row.getInt("id");
+    if (rowId && fileMetadata.hasTupleWithID(*rowId)) {
+        std::cerr << "Duplicate ID: " << *rowId << " for table: " << tableName << std::endl;
+        return std::nullopt;
+    }
+
+    // Validate tuple attributes against the schema and lay the row out in schema
+    // order, swapping dictionary-encoded values for their codes
+    Tuple encoded(operationResource());
+    if (!encodeRow(tablePath, fileMetadata, row, encoded, true)) {
+        return std::nullopt;
+    }
+    int64_t id = *encoded.getInt("id");
+
+    // Serialize tuple and add to the table
+    std::string serializedTuple = encoded.serialize();
+
+
+    if (!addTupleToTable(file, fileMetadata, tablePath, serializedTuple, id)) {
+        std::cerr << "Failed to add tuple to table: " << tableName << std::endl;
+        dropMetadata(tablePath);
+        return std::nullopt;
+    }
+
+    std::cout << "Debug insert: Tuple successfully added to table: " << tableName << std::endl;
+    file.flush();
+    return id;
+}
+
+// Load a CSV file (header line naming every schema column, then one row per line)
+// into a table. Chunks of the file are parsed and validated on worker threads, rows
+// are packed into fresh pages in file order, and pages are written sequentially in
+// batches; the current tail page is left as it is. The row map is built once from
+// the sorted ids and saved with a single checkpoint. On any error nothing becomes
+// visible: the file is truncated back to its previous size, and the metadata and the
+// dictionary file are left untouched (new dictionary values are staged in memory until
+// the load succeeds). A partitioned table is loaded partition by partition (see
+// bulkLoadPartitions()).
+bool bulkLoad(const std::string& dbName, const std::string& tableName, const std::string& csvPath) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (!outsideTransaction("bulkLoad")) {
+        return false;
+    }
+    if (const TablePartitioning* partitioning = partitioningOf(dbName, tableName)) {
+        return bulkLoadPartitions(dbName, tableName, *partitioning, csvPath);
+    }
+    TraceSpan span("bulk_load");
+    constexpr size_t CHUNK_BYTES = 4 << 20;   // CSV bytes parsed per worker per round
+    constexpr size_t BATCH_PAGES = 256;       // Uncompressed pages per sequential write
+
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    if (!fs::exists(tablePath)) {
+        std::cerr << "Error bulkLoad: Table does not exist: " << tableName << std::endl;
+        return false;
+    }
+    std::ifstream csv(csvPath, std::ios::binary);
+    if (!csv) {
+        std::cerr << "Error bulkLoad: Failed to open " << csvPath << std::endl;
+        return false;
+    }
+    // Pages are not logged one by one here
+    if (!truncateRedoLog(tablePath)) {
+        std::cerr << "Error bulkLoad: Failed to empty the redo log of " << tablePath << std::endl;
+        return false;
+    }
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file) {
+        std::cerr << "Error bulkLoad: Failed to open table file: " << tablePath << std::endl;
+        return false;
+    }
+    FileMetadata fileMetadata;
+    fileMetadata.deserialize(file, tablePath);
+    const uint64_t originalSize = fs::file_size(tablePath);
+
+    // Map the header's columns onto the schema
+    std::vector<std::pair<std::string, int>> schemaColumns;
+    for (const auto& [name, type] : fileMetadata.getSchema()) {
+        schemaColumns.emplace_back(name, schemaTypeCode(type));
+    }
+    std::string headerLine;
+    std::getline(csv, headerLine);
+    std::vector<std::string> header;
+    if (!splitCsvLine(headerLine, header) || header.size() != schemaColumns.size()) {
+        std::cerr << "Error bulkLoad: Header must name each of the " << schemaColumns.size() << " schema columns" << std::endl;
+        return false;
+    }
+    std::vector<size_t> columnOrder;
+    std::vector<bool> seen(schemaColumns.size(), false);
+    for (const std::string& name : header) {
+        auto it = std::find_if(schemaColumns.begin(), schemaColumns.end(),
+                               [&](const auto& column) { return column.first == name; });
+        if (it == schemaColumns.end() || seen[it - schemaColumns.begin()]) {
+            std::cerr << "Error bulkLoad: Unknown or repeated column in header: " << name << std::endl;
+            return false;
+        }
+        seen[it - schemaColumns.begin()] = true;
+        columnOrder.push_back(it - schemaColumns.begin());
+    }
+
+    TableDictionary& dictionary = dictionaryFor(tablePath);
+    std::vector<size_t> encodedColumns;
+    for (size_t column = 0; column < schemaColumns.size(); ++column) {
+        if (dictionary.isEncoded(schemaColumns[column].first)) {
+            encodedColumns.push_back(column);
+        }
+    }
+
+    ZoneMapEntry& zones = beginZoneUpdate(tablePath, fileMetadata);
+    const size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::pair<int64_t, int64_t>> mappings;  // (row id, page id) of every loaded row
+    std::vector<char> batch;                            // Frames of consecutive uncompressed pages
+    uint32_t batchFirstPage = 0;
+    Page page(fileMetadata.getNextPageID());
+    std::string row;
+    std::string carry;                                  // Partial line left over from the previous chunk
+    uint64_t nextLine = 2;
+    std::string error;
+
+    auto flushBatch = [&]() {
+        if (batch.empty()) {
+            return true;
+        }
+        std::vector<uint32_t> batchPages(batch.size() / PAGE_SIZE);
+        std::iota(batchPages.begin(), batchPages.end(), batchFirstPage);
+        markPagesChanged(tablePath, batchPages);
+        file.clear();
+        file.seekp(fileMetadata.getPagePosition(batchFirstPage), std::ios::beg);
+        file.write(batch.data(), batch.size());
+        bumpCounter(engineCounters().bytesWritten, batch.size());
+        bumpCounter(engineCounters().pagesWritten, batch.size() / PAGE_SIZE);
+        batch.clear();
+        return static_cast<bool>(file);
+    };
+    // Write the filled page (into the batch for uncompressed tables) and start the next one
+    auto finishPage = [&]() {
+        if (fileMetadata.isCompressed()) {
+            if (!writePage(file, fileMetadata, tablePath, page)) {
+                return false;
+            }
+        } else {
+            if (batch.empty()) {
+                batchFirstPage = page.getPageID();
+            }
+            batch.resize(batch.size() + PAGE_SIZE);
+            if (!page.toFrame(batch.data() + batch.size() - PAGE_SIZE)) {
+                return false;
+            }
+            updateZones(zones, page);
+        }
+        fileMetadata.incrementPageID();
+        if (batch.size() >= BATCH_PAGES * PAGE_SIZE && !flushBatch()) {
+            return false;
+        }
+        page = Page(fileMetadata.getNextPageID());
+        return true;
+    };
+
+    while (error.empty() && (csv || !carry.empty())) {
+        // Read one chunk per worker, each cut after its last complete line
+        std::vector<BulkChunk> chunks;
+        while (chunks.size() < workers && (csv || !carry.empty())) {
+            BulkChunk chunk;
+            chunk.text = std::move(carry);
+            carry.clear();
+            size_t filled = chunk.text.size();
+            chunk.text.resize(filled + CHUNK_BYTES);
+            csv.read(chunk.text.data() + filled, CHUNK_BYTES);
+            chunk.text.resize(filled + csv.gcount());
+            if (csv) {
+                size_t lastNewline = chunk.text.rfind('\n');
+                if (lastNewline == std::string::npos) {
+                    carry = std::move(chunk.text); // A line longer than a chunk: keep reading
+                    continue;
+                }
+                carry = chunk.text.substr(lastNewline + 1);
+                chunk.text.resize(lastNewline + 1);
+            }
+            chunk.firstLine = nextLine;
+            nextLine += std::count(chunk.text.begin(), chunk.text.end(), '\n');
+            chunks.push_back(std::move(chunk));
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            threads.emplace_back(parseBulkChunk, std::ref(chunks[i]), std::cref(schemaColumns), std::cref(columnOrder));
+        }
+        if (!chunks.empty()) {
+            parseBulkChunk(chunks[0], schemaColumns, columnOrder);
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        // Encode, serialize and pack the rows into pages in file order
+        try {
+            for (BulkChunk& chunk : chunks) {
+                if (!chunk.error.empty()) {
+                    error = chunk.error;
+                    break;
+                }
+                for (Tuple& tuple : chunk.rows) {
+                    int64_t id = *tuple.getInt("id");
+                    if (fileMetadata.hasTupleWithID(id)) {
+                        error = "duplicate id " + std::to_string(id);
+                        break;
+                    }
+                    for (size_t column : encodedColumns) {
+                        const std::string& name = schemaColumns[column].first;
+                        int64_t code = dictionary.stage(name, std::string(std::get<std::pmr::string>(tuple.at(column).value)));
+                        tuple.setValue(name, TYPE_DICTIONARY_CODE, code);
+                    }
+                    row.clear();
+                    tuple.serializeTo(row);
+                    if (row.size() + sizeof(Slot) > PAGE_SIZE - sizeof(PageMetadata)) {
+                        error = "row " + std::to_string(id) + " does not fit in a page";
+                        break;
+                    }
+                    if (!page.placeTuple(row)) {
+                        if (!finishPage()) {
+                            error = "failed to write page " + std::to_string(page.getPageID());
+                            break;
+                        }
+                        page.placeTuple(row);
+                    }
+                    mappings.emplace_back(id, page.getPageID());
+                }
+                if (!error.empty()) {
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+    }
+
+    if (error.empty() && page.getTupleCount() > 0 && !finishPage()) {
+        error = "failed to write page " + std::to_string(page.getPageID());
+    }
+    if (error.empty() && !flushBatch()) {
+        error = "failed to write pages";
+    }
+
+    // Build the row map once, from the sorted ids
+    std::sort(mappings.begin(), mappings.end());
+    for (size_t i = 1; error.empty() && i < mappings.size(); ++i) {
+        if (mappings[i].first == mappings[i - 1].first) {
+            error = "duplicate id " + std::to_string(mappings[i].first);
+        }
+    }
+    // Every row is valid: the new dictionary values reach disk before the checkpoint
+    // makes the rows that use them visible
+    if (error.empty() && !(dictionary.writeStaged() && dictionary.sync())) {
+        error = "failed to write the dictionary";
+    }
+
+    bufferPool.invalidateTable(tablePath);
+    if (!error.empty()) {
+        dictionary.discardStaged();
+        std::cerr << "Error bulkLoad: " << csvPath << " " << error << std::endl;
+        file.close();
+        fs::resize_file(tablePath, originalSize);
+        return false;
+    }
+
+    // The new rows reach the metadata through a checkpoint, not the log, so the saved
+    // filter goes first; it is rebuilt once the checkpoint is done
+    dropIdFilter(tablePath);
+    fileMetadata.addTupleMappings(mappings);
+    file.clear();
+    fileMetadata.checkpoint(file, tablePath);
+    file.close();
+    if (std::optional<IdBloomFilter::Stamp> stamp = IdBloomFilter::currentStamp(tablePath)) {
+        IdFilterEntry& entry = idFilters[tablePath];
+        buildIdFilter(entry.filter, fileMetadata);
+        entry.filter.save(tablePath, *stamp);
+    }
+    std::cout << "Debug bulkLoad: Loaded " << mappings.size() << " rows into " << tableName << std::endl;
+    return true;
+}
+
+
+
+// Return up to `count` live rows with id >= startId, in id order. Range partitions
+// are read in order from the one holding startId; hash partitions each contribute
+// their first count rows, which are merged by id.
+std::vector<std::map<std::string, std::string>> scanRange(const std::string& dbName, const std::string& tableName,
+                                                          int64_t startId, size_t count) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (const TablePartitioning* partitioning = partitioningOf(dbName, tableName)) {
+        std::vector<std::map<std::string, std::string>> results;
+        if (partitioning->kind == PARTITION_RANGE) {
+            for (uint32_t index = partitioning->partitionOf(startId); index < partitioning->count && results.size() < count;
+                 ++index) {
+                std::vector<std::map<std::string, std::string>> rows =
+                    scanRange(dbName, TablePartitioning::partitionName(tableName, index), startId, count - results.size());
+                std::move(rows.begin(), rows.end(), std::back_inserter(results));
+            }
+            return results;
+        }
+        std::vector<std::pair<int64_t, std::map<std::string, std::string>>> merged;
+        for (uint32_t index = 0; index < partitioning->count; ++index) {
+            for (auto& row : scanRange(dbName, TablePartitioning::partitionName(tableName, index), startId, count)) {
+                int64_t id = std::stoll(row.at("id"));
+                merged.emplace_back(id, std::move(row));
+            }
+        }
+        std::sort(merged.begin(), merged.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (size_t i = 0; i < merged.size() && i < count; ++i) {
+            results.push_back(std::move(merged[i].second));
+        }
+        return results;
+    }
+    LatencyTimer timer(operationLatency[OP_SCAN]);
+    TraceSpan span("scan");
+    ArenaScope arena;
+    std::vector<std::map<std::string, std::string>> results;
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
+    }
+    FileMetadata fileMetadata;
+    fileMetadata.deserialize(file, tablePath);
+
+    Tuple tuple(operationResource());
+    for (std::optional<int64_t> nextId = startId; nextId && results.size() < count;) {
+        nextId = scanRangePage(file, fileMetadata, tablePath, *nextId, count, tuple, results);
+    }
+    return results;
+}
+
+private:
+// One page of scanRange(): the rows of the page holding the first live id >= nextId,
+// taken while the ids after it stay on that page and results holds fewer than count.
+// Returns the id to go on from, or nullopt once no ids are left.
+std::optional<int64_t> scanRangePage(std::fstream& file, const FileMetadata& fileMetadata, const std::string& tablePath,
+                                     int64_t nextId, size_t count, Tuple& tuple,
+                                     std::vector<std::map<std::string, std::string>>& results) {
+    const auto& tupleToPageMap = fileMetadata.getTupleToPageMap();
+    auto it = tupleToPageMap.lower_bound(nextId);
+    while (it != tupleToPageMap.end() && it->second < 0) {
+        ++it; // Deleted
+    }
+    if (it == tupleToPageMap.end()) {
+        return std::nullopt;
+    }
+    uint32_t pageID = static_cast<uint32_t>(it->second);
+    Page page(pageID);
+    bool loaded = readPage(file, fileMetadata, tablePath, pageID, page);
+    TraceSpan searchSpan("row_search");
+    for (; it != tupleToPageMap.end() && results.size() < count && (it->second < 0 || it->second == pageID); ++it) {
+        int slotIndex = loaded && it->second >= 0 ? page.getTupleIndexByID(it->first) : -1;
+        if (slotIndex < 0 || !tuple.deserialize(page.getTupleView(slotIndex))) {
+            continue;
+        }
+        decodeTuple(tablePath, tuple);
+        results.push_back(tuple.getValueMap());
+    }
+    if (it == tupleToPageMap.end()) {
+        return std::nullopt;
+    }
+    return it->first;
+}
+
+public:
+
+// Return every live row whose column equals value. The value is translated once into
+// the column's native type, so ints and doubles compare numerically. On dictionary-encoded
+// columns it is translated to its code and rows are matched on the code, so no row
+// is decoded unless it matches (and a value absent from the dictionary matches nothing).
+// A partitioned table returns the matches of each partition in turn.
+std::vector<std::map<std::string, std::string>> selectWhereEquals(const std::string& dbName, const std::string& tableName,
+                                                                  const std::string& column, const std::string& value) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (partitioningOf(dbName, tableName)) {
+        std::vector<std::map<std::string, std::string>> results;
+        for (const std::string& partition : partitionsOf(dbName, tableName)) {
+            std::vector<std::map<std::string, std::string>> rows = selectWhereEquals(dbName, partition, column, value);
+            std::move(rows.begin(), rows.end(), std::back_inserter(results));
+        }
+        return results;
+    }
+    LatencyTimer timer(operationLatency[OP_SCAN]);
+    TraceSpan span("scan");
+    ArenaScope arena;
+    std::vector<std::map<std::string, std::string>> results;
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
+    }
+    FileMetadata fileMetadata;
+    fileMetadata.deserialize(file, tablePath);
+
+    size_t columnHint = 0;
+    Tuple::Value needle;
+    if (!equalsNeedle(fileMetadata, tablePath, column, value, operationResource(), needle, columnHint)) {
+        return results;
+    }
+    Tuple tuple(operationResource());
+    for (uint64_t pageID = 0; pageID < fileMetadata.getPageCount(); ++pageID) {
+        selectPageWhereEquals(file, fileMetadata, tablePath, static_cast<uint32_t>(pageID), column, columnHint, needle,
+                              tuple, results);
+    }
+    return results;
+}
+
+private:
+// The value selectWhereEquals() matches rows on: value in the column's type, or its
+// dictionary code, allocated from resource. False if no row can match. columnHint is
+// the column's position.
+bool equalsNeedle(const FileMetadata& fileMetadata, const std::string& tablePath, const std::string& column,
+                  const std::string& value, std::pmr::memory_resource* resource, Tuple::Value& needle,
+                  size_t& columnHint) {
+    const auto& schema = fileMetadata.getSchema();
+    auto schemaColumn = schema.find(column);
+    columnHint = std::distance(schema.begin(), schemaColumn); // Schema position is the row position
+    TableDictionary& dictionary = dictionaryFor(tablePath);
+    if (dictionary.isEncoded(column)) {
+        std::optional<int64_t> code = dictionary.lookup(column, value);
+        if (!code) {
+            return false;
+        }
+        needle = *code;
+        return true;
+    }
+    int type = schemaColumn != schema.end() ? schemaTypeCode(schemaColumn->second) : TYPE_STRING;
+    return Tuple::parseValue(type, value, needle, resource); // Nothing matches a value of another type
+}
+
+// Append the rows of one page whose column holds needle
+void selectPageWhereEquals(std::fstream& file, const FileMetadata& fileMetadata, const std::string& tablePath,
+                           uint32_t pageID, const std::string& column, size_t columnHint, const Tuple::Value& needle,
+                           Tuple& tuple, std::vector<std::map<std::string, std::string>>& results) {
+    Page page(pageID);
+    if (!readPage(file, fileMetadata, tablePath, pageID, page)) {
+        return;
+    }
+    for (uint16_t i = 0; i < page.getTupleCount(); ++i) {
+        if (!tuple.deserialize(page.getTupleView(i))) {
+            continue;
+        }
+        std::optional<size_t> index = tuple.columnIndex(column, columnHint);
+        if (!index || tuple.at(*index).value != needle) {
+            continue;
+        }
+        decodeTuple(tablePath, tuple);
+        results.push_back(tuple.getValueMap());
+    }
+}
+
+public:
+
+// Stream every live row, in page order, to a CSV file (header line of column
+// names) or the binary export format (see EXPORT_MAGIC). Output goes through a
+// fixed-size buffer, so memory does not grow with the table. With threads > 1
+// the pages are split into contiguous ranges exported in parallel to part files,
+// which are then appended to the output in order. With orderBy (see SortKey) rows
+// are written in that order instead, through an external sort on one thread. A
+// partitioned table is exported through openQuery(), which reads its partitions in
+// parallel, so without orderBy the rows of different partitions interleave.
+bool exportTable(const std::string& dbName, const std::string& tableName, const std::string& outputPath,
+                 ExportFormat format = EXPORT_CSV, unsigned threads = 1, const std::string& orderBy = "") {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    TraceSpan span("export");
+    bool partitioned = partitioningOf(dbName, tableName) != nullptr;
+    std::string tablePath = dbName + "/" + partitionsOf(dbName, tableName).front() + ".HAD"; // Source of the schema
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        std::cerr << "Error exportTable: Failed to open table file: " << tablePath << std::endl;
+        return false;
+    }
+    FileMetadata fileMetadata;
+    fileMetadata.deserialize(file, tablePath);
+    file.close();
+    const TableDictionary& dictionary = dictionaryFor(tablePath);
+
+    std::vector<std::pair<std::string, int>> columns;
+    for (const auto& [name, type] : fileMetadata.getSchema()) {
+        columns.emplace_back(name, schemaTypeCode(type));
+    }
+
+    // Header, written by the first range
+    std::string prefix;
+    if (format == EXPORT_CSV) {
+        for (size_t i = 0; i < columns.size(); ++i) {
+            prefix += (i ? "," : "") + columns[i].first;
+        }
+        prefix += '\n';
+    } else {
+        auto put = [&prefix](const auto& value) { prefix.append(reinterpret_cast<const char*>(&value), sizeof(value)); };
+        put(EXPORT_MAGIC);
+        put(EXPORT_VERSION);
+        put(static_cast<uint16_t>(columns.size()));
+        for (const auto& [name, type] : columns) {
+            put(static_cast<uint16_t>(name.size()));
+            prefix += name;
+            put(static_cast<uint8_t>(type));
+        }
+    }
+
+    if (!orderBy.empty() || partitioned) {
+        std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+        if (!output) {
+            std::cerr << "Error exportTable: Failed to open " << outputPath << std::endl;
+            return false;
+        }
+        OutputBuffer out(output, 1 << 20);
+        out.append(prefix);
+        uint64_t rows = 0;
+        try {
+            std::unique_ptr<QueryOperator> plan = openQuery(dbName, tableName, "", {}, 0, orderBy);
+            ColumnBatch batch;
+            while (plan->next(batch)) {
+                for (size_t i = 0; i < batch.selectedCount(); ++i) {
+                    exportBatchRow(batch, batch.selectedRow(i), format, out);
+                }
+                rows += batch.selectedCount();
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error exportTable: " << e.what() << std::endl;
+            return false;
+        }
+        if (!out.flush()) {
+            std::cerr << "Error exportTable: Export of " << tableName << " failed" << std::endl;
+            return false;
+        }
+        std::cout << "Debug exportTable: Exported " << rows << " rows of " << tableName << " to " << outputPath
+                  << (orderBy.empty() ? "" : " ordered by ") << orderBy << std::endl;
+        return true;
+    }
+
+    uint64_t pageCount = fileMetadata.getPageCount();
+    size_t parts = std::max<uint64_t>(1, std::min<uint64_t>(threads, pageCount));
+    std::vector<std::string> partPaths(parts, outputPath);
+    std::vector<uint64_t> rowCounts(parts, 0);
+    std::vector<char> results(parts, 0);
+    std::vector<std::thread> workers;
+    for (size_t part = 0; part < parts; ++part) {
+        if (part > 0) {
+            partPaths[part] = outputPath + ".part" + std::to_string(part);
+        }
+        uint64_t firstPage = pageCount * part / parts;
+        uint64_t endPage = pageCount * (part + 1) / parts;
+        auto run = [&, part, firstPage, endPage]() {
+            results[part] = exportPageRange(tablePath, fileMetadata, dictionary, columns, format, firstPage, endPage,
+                                            partPaths[part], part == 0 ? prefix : std::string(), rowCounts[part]);
+        };
+        if (part + 1 == parts) {
+            run(); // The last range runs on the calling thread
+        } else {
+            workers.emplace_back(run);
+        }
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    bool ok = std::all_of(results.begin(), results.end(), [](char result) { return result != 0; });
+    if (ok && parts > 1) {
+        std::ofstream output(outputPath, std::ios::binary | std::ios::app);
+        for (size_t part = 1; part < parts && ok; ++part) {
+            std::ifstream input(partPaths[part], std::ios::binary);
+            output << input.rdbuf();
+            ok = static_cast<bool>(output);
+        }
+    }
+    for (size_t part = 1; part < parts; ++part) {
+        fs::remove(partPaths[part]);
+    }
+    if (!ok) {
+        std::cerr << "Error exportTable: Export of " << tableName << " failed" << std::endl;
+        return false;
+    }
+
+    uint64_t rows = std::accumulate(rowCounts.begin(), rowCounts.end(), uint64_t(0));
+    std::cout << "Debug exportTable: Exported " << rows << " rows of " << tableName << " to " << outputPath << std::endl;
+    return true;
+}
 
 bool deleteTupleFromTable(const std::string& dbName, const std::string& tableName, const std::string& id) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (const TablePartitioning* partitioning = partitioningOf(dbName, tableName)) {
+        return deleteTupleFromTable(dbName, partitionForRow(tableName, *partitioning, id), id);
+    }
+    LatencyTimer timer(operationLatency[OP_DELETE]);
+    TraceSpan span("delete");
+    ArenaScope arena;
     std::string tablePath = dbName + "/" + tableName + ".HAD";
     std::cout << "Debug deleteTupleFromTable: Deleting tuple from table file: " << tablePath << std::endl;
 
-    // Check if the table exists
-    if (!fs::exists(tablePath)) {
-        std::cerr << "Table does not exist: " << tablePath << std::endl;
+    // Check if the table exists
+    if (!fs::exists(tablePath)) {
+        std::cerr << "Table does not exist: " << tablePath << std::endl;
+        return false;
+    }
+
+    // Inside a transaction the delete is recorded now and applied at commit
+    if (transaction) {
+        int64_t tupleID = std::stoll(id);
+        TransactionTable& table = transactionTable(tablePath);
+        if (!transactionRowExists(table, tupleID)) {
+            std::cerr << "Tuple with ID " << id << " does not exist.\n";
+            return false;
+        }
+        table.writes[tupleID] = std::nullopt;
+        std::cout << "Debug deleteTupleFromTable: Delete of tuple " << id << " added to the transaction.\n";
+        return true;
+    }
+
+    // Open the table file for reading and writing
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file) {
+        std::cerr << "Failed to open table file for reading and writing.\n";
+        return false;
+    }
+    std::cout << "Debug deleteTupleFromTable: Table file opened for reading and writing.\n";
+
+
+    // Read file metadata (including tuple-to-page map)
+    FileMetadata& fileMetadata = metadataFor(tablePath, file);
+    std::cout << "Debug deleteTupleFromTable: File metadata deserialized.\n";
+
+    // Check if the tuple exists using the tuple-to-page map
+    int64_t tupleID = std::stoll(id);
+    if (!fileMetadata.hasTupleWithID(tupleID)) {
+        std::cerr << "Tuple with ID " << id << " does not exist.\n";
+        file.close();
+        return false;
+    }
+
+    std::cout << "Debug deleteTupleFromTable: Tuple with ID " << id << " found in the file metadata.\n";
+
+    // Retrieve the page ID from the map
+    uint32_t pageID = static_cast<uint32_t>(fileMetadata.getPageIDForTuple(tupleID));
+    std::cout << "Debug deleteTupleFromTable: Found page ID " << pageID << " for tuple ID " << id << ".\n";
+
+
+    // Locate the corresponding page and find the tuple
+    Page page(pageID);
+    if (!readPage(file, fileMetadata, tablePath, pageID, page)) {
+        std::cerr << "Failed to read page " << pageID << " for tuple " << id << ".\n";
+        file.close();
+        return false;
+    }
+
+    bool tupleFound = false;
+    TraceSpan searchSpan("row_search");
+    Tuple tuple(operationResource());
+    for (uint16_t i = 0; i < page.getTupleCount(); ++i) {
+        if (tuple.deserialize(page.getTupleView(i)) && tuple.getInt("id") == tupleID) {
+            tupleFound = true; // Tuple found, proceed to delete
+             std::cout << "Debug deleteTupleFromTable: Tuple with ID " << id << " found in the page.\n";
+            if (page.deleteTuple(i, tupleID, tablePath)) { // Call deleteTuple from Page class
+                // Update the tuple-to-page map and mark the tuple as deleted
+                fileMetadata.setTupleAsDeleted(tupleID);
+                std::cout << "Debug deleteTupleFromTable: Tuple marked as deleted in file metadata.\n";
+
+                // Write the modified page and the metadata back as one logged change
+                if (!commitPages(file, fileMetadata, tablePath, {&page})) {
+                    file.close();
+                    dropMetadata(tablePath);
+                    return false;
+                }
+                std::cout << "Debug deleteTupleFromTable: Page and file metadata serialized back to file.\n";
+
+                file.close();
+                std::cout << "Successfully deleted tuple with ID: " << id << std::endl;
+                return true; // Tuple successfully deleted
+            }
+        }
+    }
+
+    file.close();
+    if (!tupleFound) {
+        std::cerr << "Failed to delete tuple with ID: " << id << ". It may not exist.\n";
+    }
+    return false; // Tuple with the given ID was not found
+}
+bool updateTupleInTable(const std::string& dbName, const std::string& tableName, const std::string& id, const Tuple& updatedTuple) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    LatencyTimer timer(operationLatency[OP_UPDATE]);
+    TraceSpan span("update");
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    std::cout << "Debug: Attempting to update tuple in table file: " << tablePath << std::endl;
+
+    // Check if the table exists; the delete and insert below route a partitioned table's rows
+    if (!tableExists(dbName, tableName)) {
+        std::cerr << "Table does not exist: " << tablePath << std::endl;
+        return false;
+    }
+    std::cout << "Debug: Table exists: " << tablePath << std::endl;
+
+    // Check if the tuple exists using the tuple-to-page map in Storage class
+    std::cout << "Debug: Checking if the tuple with ID " << id << " exists in the table." << std::endl;
+    if (!deleteTupleFromTable(dbName, tableName, id)) {
+        std::cerr << "Failed to delete the tuple with ID " << id << std::endl;
+        return false; // Exit if the tuple could not be deleted
+    }
+    std::cout << "Debug: Tuple with ID " << id << " marked for deletion.\n";
+
+    // Now that the old tuple is deleted, insert the updated tuple into the table. A
+    // row given without an id keeps the old one (rather than being renumbered by an
+    // auto-increment table).
+    std::cout << "Debug: Attempting to insert the updated tuple." << std::endl;
+    Tuple keptId;
+    if (!updatedTuple.findValue("id")) {
+        keptId = updatedTuple;
+        keptId.addAttribute("id", TYPE_INT, id);
+    }
+    if (!insert(dbName, tableName, updatedTuple.findValue("id") ? updatedTuple : keptId)) {
+        std::cerr << "Failed to insert the updated tuple.\n";
+        return false; // Exit if the updated tuple could not be inserted
+    }
+    std::cout << "Debug: Updated tuple inserted successfully into the table.\n";
+
+    std::cout << "Successfully updated tuple with ID: " << id << std::endl;
+    return true; // Tuple successfully updated
+}
+
+// Build a query as a pipeline of batch operators: a scan of the columns it needs,
+// a filter on where (see QueryExpression; empty keeps every row), a sort on orderBy
+// (see SortKey; empty keeps page order), a projection to columns (every schema
+// column if empty) and a limit (0 for none). The scan holds the engine lock until it
+// is exhausted or the pipeline is destroyed; a sort reads it to the end on the first
+// next(), spilling runs beyond sortMemoryBudget bytes to temporary files next to the
+// table. The partitions of a partitioned table are scanned and filtered in parallel
+// under a UnionOperator, holding the lock until the pipeline is destroyed.
+// Throws std::invalid_argument for a bad expression or an unknown column.
+std::unique_ptr<QueryOperator> openQuery(const std::string& dbName, const std::string& tableName,
+                                         const std::string& where = "", const std::vector<std::string>& columns = {},
+                                         uint64_t limit = 0, const std::string& orderBy = "",
+                                         size_t sortMemoryBudget = SORT_MEMORY_BUDGET) {
+    std::unique_ptr<QueryExpression> predicate;
+    std::vector<SortKey> sortKeys;
+    std::set<std::string> names;
+    if (!where.empty()) {
+        predicate = QueryExpression::parse(where);
+        predicate->columnNames(names);
+    }
+    if (!orderBy.empty()) {
+        sortKeys = SortKey::parseList(orderBy);
+        for (const SortKey& key : sortKeys) {
+            names.insert(key.column);
+        }
+    }
+    std::vector<std::string> scanColumns = columns;
+    for (const std::string& name : names) {
+        if (!columns.empty() && std::find(scanColumns.begin(), scanColumns.end(), name) == scanColumns.end()) {
+            scanColumns.push_back(name);
+        }
+    }
+    std::unique_ptr<QueryOperator> plan;
+    uint64_t pages = 0;
+    std::vector<std::unique_ptr<QueryOperator>> partitions = partitionScans(dbName, tableName, scanColumns, where, 1, pages);
+    if (!partitions.empty()) {
+        plan = std::make_unique<UnionOperator>(std::move(partitions));
+    } else {
+        plan = std::make_unique<TableScanOperator>(*this, dbName, tableName, scanColumns);
+        if (predicate) {
+            plan = std::make_unique<FilterOperator>(std::move(plan), std::move(predicate));
+        }
+    }
+    if (!sortKeys.empty()) {
+        std::random_device random;
+        std::string runPrefix = dbName + "/" + tableName + ".HAD.sort" +
+                                std::to_string(static_cast<uint64_t>(random()) << 32 | random());
+        plan = std::make_unique<SortOperator>(std::move(plan), sortKeys, limit, sortMemoryBudget, runPrefix);
+    }
+    if (scanColumns.size() != columns.size()) {
+        plan = std::make_unique<ProjectOperator>(std::move(plan), columns);
+    }
+    if (limit > 0 && sortKeys.empty()) {
+        plan = std::make_unique<LimitOperator>(std::move(plan), limit);
+    }
+    return plan;
+}
+
+// Run openQuery() to the end; rows hold the query's columns, as get() formats them
+std::vector<std::map<std::string, std::string>> query(const std::string& dbName, const std::string& tableName,
+                                                      const std::string& where = "",
+                                                      const std::vector<std::string>& columns = {}, uint64_t limit = 0,
+                                                      const std::string& orderBy = "",
+                                                      size_t sortMemoryBudget = SORT_MEMORY_BUDGET) {
+    LatencyTimer timer(operationLatency[OP_SCAN]);
+    TraceSpan span("query");
+    std::vector<std::map<std::string, std::string>> results;
+    std::unique_ptr<QueryOperator> plan =
+        openQuery(dbName, tableName, where, columns, limit, orderBy, sortMemoryBudget);
+    ColumnBatch batch;
+    while (plan->next(batch)) {
+        batch.appendRows(results);
+    }
+    return results;
+}
+
+// Build a GROUP BY query: aggregates such as "COUNT(*)" or "AVG(score)" (see
+// AggregateSpec) over the rows that satisfy where, per distinct combination of the
+// groupBy columns. The table's pages are split into up to threads ranges that are
+// scanned, filtered and aggregated in parallel (see HashAggregateOperator); a
+// partitioned table splits the threads among its partitions, each scanned at least
+// once. Group state beyond memoryBudget bytes spills to temporary files next to the table.
+// Throws std::invalid_argument for a bad aggregate, expression or column.
+std::unique_ptr<QueryOperator> openAggregate(const std::string& dbName, const std::string& tableName,
+                                             const std::vector<std::string>& groupBy,
+                                             const std::vector<std::string>& aggregates, const std::string& where = "",
+                                             unsigned threads = std::max(1u, std::thread::hardware_concurrency()),
+                                             size_t memoryBudget = AGGREGATE_MEMORY_BUDGET) {
+    std::vector<AggregateSpec> specs;
+    std::vector<std::string> scanColumns;
+    auto need = [&scanColumns](const std::string& name) {
+        if (!name.empty() && std::find(scanColumns.begin(), scanColumns.end(), name) == scanColumns.end()) {
+            scanColumns.push_back(name);
+        }
+    };
+    for (const std::string& name : groupBy) {
+        need(name);
+    }
+    for (const std::string& text : aggregates) {
+        specs.push_back(AggregateSpec::parse(text));
+        need(specs.back().column);
+    }
+    if (!where.empty()) {
+        std::set<std::string> names;
+        QueryExpression::parse(where)->columnNames(names);
+        for (const std::string& name : names) {
+            need(name);
+        }
+    }
+
+    size_t partitionCount = partitionsOf(dbName, tableName).size();
+    uint64_t pages = 0;
+    std::vector<std::unique_ptr<QueryOperator>> inputs =
+        partitionScans(dbName, tableName, scanColumns, where, std::max<size_t>(1, threads / partitionCount), pages);
+    if (inputs.empty()) {
+        auto scan = std::make_unique<TableScanOperator>(*this, dbName, tableName, scanColumns);
+        inputs = scan->split(std::max(1u, threads));
+        inputs.insert(inputs.begin(), std::move(scan));
+        if (!where.empty()) {
+            for (std::unique_ptr<QueryOperator>& input : inputs) {
+                input = std::make_unique<FilterOperator>(std::move(input), where);
+            }
+        }
+    }
+    std::random_device random;
+    std::string spillPrefix = dbName + "/" + tableName + ".HAD.aggregate" +
+                              std::to_string(static_cast<uint64_t>(random()) << 32 | random());
+    return std::make_unique<HashAggregateOperator>(std::move(inputs), groupBy, std::move(specs), memoryBudget,
+                                                   spillPrefix);
+}
+
+// Run openAggregate() to the end; each row holds a group's values and its aggregates
+std::vector<std::map<std::string, std::string>> aggregate(const std::string& dbName, const std::string& tableName,
+                                                          const std::vector<std::string>& groupBy,
+                                                          const std::vector<std::string>& aggregates,
+                                                          const std::string& where = "",
+                                                          unsigned threads = std::max(1u, std::thread::hardware_concurrency()),
+                                                          size_t memoryBudget = AGGREGATE_MEMORY_BUDGET) {
+    LatencyTimer timer(operationLatency[OP_SCAN]);
+    TraceSpan span("aggregate");
+    std::vector<std::map<std::string, std::string>> results;
+    std::unique_ptr<QueryOperator> plan = openAggregate(dbName, tableName, groupBy, aggregates, where, threads, memoryBudget);
+    ColumnBatch batch;
+    while (plan->next(batch)) {
+        batch.appendRows(results);
+    }
+    return results;
+}
+
+// Build an equi-join of two tables of a database on left.key = right.key (see
+// HashJoinOperator). Each table is read by one streaming scan, filtered by its where
+// (a partitioned table by a UnionOperator of its partitions' scans); the one with
+// fewer pages is the build side. Output columns are named
+// "<table>.<column>", left's first. Build rows beyond memoryBudget bytes make both
+// sides partition to temporary files next to the tables. Throws
+// std::invalid_argument for a bad expression, an unknown column or mismatched keys.
+std::unique_ptr<QueryOperator> openJoin(const std::string& dbName, const JoinInput& left, const JoinInput& right,
+                                        size_t memoryBudget = JOIN_MEMORY_BUDGET) {
+    if (left.table == right.table) {
+        throw std::invalid_argument("Join: a table cannot be joined with itself: " + left.table);
+    }
+    std::vector<std::unique_ptr<QueryOperator>> sides;
+    std::vector<uint64_t> sidePages;
+    std::vector<std::string> outputNames;
+    for (const JoinInput* input : {&left, &right}) {
+        std::vector<std::string> scanColumns = input->columns;
+        auto need = [&scanColumns](const std::string& name) {
+            if (std::find(scanColumns.begin(), scanColumns.end(), name) == scanColumns.end()) {
+                scanColumns.push_back(name);
+            }
+        };
+        std::set<std::string> names;
+        if (!input->columns.empty()) {
+            need(input->key);
+            if (!input->where.empty()) {
+                QueryExpression::parse(input->where)->columnNames(names);
+            }
+            for (const std::string& name : names) {
+                need(name);
+            }
+        }
+        uint64_t pages = 0;
+        std::unique_ptr<QueryOperator> plan;
+        std::vector<std::unique_ptr<QueryOperator>> partitions =
+            partitionScans(dbName, input->table, scanColumns, input->where, 1, pages);
+        if (!partitions.empty()) {
+            plan = std::make_unique<UnionOperator>(std::move(partitions));
+        } else {
+            auto scan = std::make_unique<TableScanOperator>(*this, dbName, input->table, scanColumns);
+            pages = scan->pagesLeft();
+            plan = std::move(scan);
+            if (!input->where.empty()) {
+                plan = std::make_unique<FilterOperator>(std::move(plan), input->where);
+            }
+        }
+        if (input->columns.empty()) {
+            for (const QueryColumn& column : plan->outputColumns()) {
+                outputNames.push_back(input->table + "." + column.name);
+            }
+        }
+        for (const std::string& name : input->columns) {
+            outputNames.push_back(input->table + "." + name);
+        }
+        sides.push_back(std::move(plan));
+        sidePages.push_back(pages);
+    }
+    bool buildLeft = sidePages[0] <= sidePages[1];
+    std::random_device random;
+    std::string partitionPrefix = dbName + "/" + left.table + "." + right.table + ".join" +
+                                  std::to_string(static_cast<uint64_t>(random()) << 32 | random());
+    std::unique_ptr<QueryOperator> plan =
+        std::make_unique<HashJoinOperator>(std::move(sides[0]), left.table, left.key, std::move(sides[1]), right.table,
+                                           right.key, buildLeft, memoryBudget, partitionPrefix);
+    if (plan->outputColumns().size() != outputNames.size()) {
+        plan = std::make_unique<ProjectOperator>(std::move(plan), outputNames);
+    }
+    return plan;
+}
+
+// Run openJoin() to the end; each row holds the columns of a matching pair
+std::vector<std::map<std::string, std::string>> join(const std::string& dbName, const JoinInput& left,
+                                                     const JoinInput& right, size_t memoryBudget = JOIN_MEMORY_BUDGET) {
+    LatencyTimer timer(operationLatency[OP_SCAN]);
+    TraceSpan span("join");
+    std::vector<std::map<std::string, std::string>> results;
+    std::unique_ptr<QueryOperator> plan = openJoin(dbName, left, right, memoryBudget);
+    ColumnBatch batch;
+    while (plan->next(batch)) {
+        batch.appendRows(results);
+    }
+    return results;
+}
+
+// Start a transaction. Until commit() or abort(), insert(), deleteTupleFromTable() and
+// updateTupleInTable() only record their changes, checked against the tables plus the
+// transaction's earlier changes; get() and checkTupleExists() see them, scans do not.
+// The transaction holds the engine lock from here to commit() or abort(), which must
+// run on the same thread: other threads' operations, *Async ones included, wait for
+// it. Bulk loads, vacuum and table deletes are refused inside a transaction.
+bool beginTransaction() {
+    engineMutex.lock();
+    if (transaction) {
+        std::cerr << "Error beginTransaction: A transaction is already open" << std::endl;
+        engineMutex.unlock();
         return false;
     }
+    transaction.emplace();
+    std::cout << "Debug beginTransaction: Transaction started" << std::endl;
+    return true;
+}
 
-    // Open the table file for reading and writing
-    std::fstream file(tablePath, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file) {
-        std::cerr << "Failed to open table file for reading and writing.\n";
+// Apply the open transaction. Each table it touched gets one redo record, one write
+// of every changed page and one metadata write. With several tables, every table's
+// record is logged before any table is written, and the records only count once the
+// transaction's decision file exists: a crash before that changes no table, a crash
+// after it is finished by recovery. The transaction is closed either way.
+bool commit() {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (!transaction) {
+        std::cerr << "Error commit: No transaction is open" << std::endl;
         return false;
     }
-    std::cout << "Debug deleteTupleFromTable: Table file opened for reading and writing.\n";
+    std::map<std::string, TransactionTable> writeSet = std::move(*transaction);
+    transaction.reset();
+    engineMutex.unlock(); // The hold taken by beginTransaction(); `lock` keeps the engine until we return
+    TraceSpan span("commit");
+    ArenaScope arena;
+
+    std::vector<PreparedTable> prepared;
+    prepared.reserve(writeSet.size());
+    try {
+        for (const auto& [tablePath, table] : writeSet) {
+            if (table.writes.empty()) {
+                continue;
+            }
+            prepared.emplace_back();
+            prepared.back().tablePath = tablePath;
+            if (!prepareTransactionTable(prepared.back(), table)) {
+                std::cerr << "Error commit: Transaction rolled back" << std::endl;
+                return false;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error commit: " << e.what() << "; transaction rolled back" << std::endl;
+        return false;
+    }
+    if (prepared.empty()) {
+        return true;
+    }
 
+    if (prepared.size() == 1) {
+        PreparedTable& table = prepared.front();
+        if (!commitPages(table.file, table.metadata, table.tablePath, table.pageList())) {
+            std::cerr << "Error commit: Failed to commit to " << table.tablePath << std::endl;
+            return false;
+        }
+        std::cout << "Debug commit: Committed " << writeSet.begin()->second.writes.size() << " rows to "
+                  << table.tablePath << std::endl;
+        return true;
+    }
 
-    // Read file metadata (including tuple-to-page map)
-    FileMetadata fileMetadata;
-    fileMetadata.deserialize(file);
-    std::cout << "Debug deleteTupleFromTable: File metadata deserialized.\n";
+    // Log every table's part, then make the decision
+    std::random_device random;
+    uint64_t transactionID = static_cast<uint64_t>(random()) << 32 | random();
+    std::string decisionPath =
+        (fs::path(prepared.front().tablePath).parent_path() / (std::to_string(transactionID) + ".txn")).string();
+    size_t logged = 0;
+    while (logged < prepared.size() &&
+           logPages(prepared[logged].tablePath, prepared[logged].pageList(), loggedDeltas(prepared[logged].metadata),
+                    decisionPath)) {
+        ++logged;
+    }
+    if (logged == prepared.size()) {
+        commitStep("logged");
+    }
+    if (logged < prepared.size() || !writeDecisionFile(decisionPath, prepared)) {
+        // Without the decision file the records already logged are never replayed
+        std::error_code error;
+        fs::remove(decisionPath, error); // In case only syncing its directory failed
+        for (size_t i = 0; i < logged; ++i) {
+            RedoLog& log = redoLogFor(prepared[i].tablePath);
+            for (const auto& [pageID, page] : prepared[i].pages) {
+                log.markClean(pageID);
+            }
+        }
+        std::cerr << "Error commit: Failed to log the transaction; no table was changed" << std::endl;
+        return false;
+    }
 
-    // Check if the tuple exists using the tuple-to-page map
-    int tupleID = std::stoi(id);
-    if (!fileMetadata.hasTupleWithID(tupleID)) {
-        std::cerr << "Tuple with ID " << id << " does not exist.\n";
-        file.close();
+    commitStep("decided");
+
+    bool written = true;
+    for (PreparedTable& table : prepared) {
+        written = writeLoggedPages(table.file, table.metadata, table.tablePath, table.pageList()) && written;
+        commitStep("written");
+    }
+    if (!written) {
+        std::cerr << "Error commit: Some pages were not written; recovery rewrites them from the redo logs" << std::endl;
         return false;
     }
 
-    std::cout << "Debug deleteTupleFromTable: Tuple with ID " << id << " found in the file metadata.\n";
+    // The decision file is only needed while a redo log still holds the records
+    bool logsClean = true;
+    for (const PreparedTable& table : prepared) {
+        RedoLog& log = redoLogFor(table.tablePath);
+        logsClean = logsClean && !log.hasDirtyPages() && log.checkpoint();
+    }
+    if (logsClean) {
+        std::error_code error;
+        fs::remove(decisionPath, error);
+    }
+    std::cout << "Debug commit: Committed a transaction across " << prepared.size() << " tables" << std::endl;
+    return true;
+}
 
-    // Retrieve the page ID from the map
-    int pageID = fileMetadata.getPageIDForTuple(tupleID);
-    std::cout << "Debug deleteTupleFromTable: Found page ID " << pageID << " for tuple ID " << id << ".\n";
+// Observe the steps of multi-table commits: "logged" once every table's record is in its
+// redo log, "decided" once the decision file is on disk, then "written" after each
+// table's pages and metadata. The files as they stand at a step are what a crash there
+// would leave behind, which is what crash tests copy.
+void setCommitStepHook(std::function<void(const std::string& step)> hook) {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    commitStepHook = std::move(hook);
+}
 
+// Discard the open transaction's changes
+bool abort() {
+    std::lock_guard<std::recursive_mutex> lock(engineMutex);
+    if (!transaction) {
+        std::cerr << "Error abort: No transaction is open" << std::endl;
+        return false;
+    }
+    transaction.reset();
+    engineMutex.unlock(); // The hold taken by beginTransaction()
+    std::cout << "Debug abort: Transaction discarded" << std::endl;
+    return true;
+}
 
-    // Locate the corresponding page and find the tuple
-    Page page(pageID);
-    std::streampos pagePos = file.tellg();
-    file.seekg(fileMetadata.getPagePosition(pageID), std::ios::beg); // Move to the correct page position
-    page.deserialize(file);
+// Compact a table online. Live rows are packed, in page order, into the lowest
+// pages: the write cursor never passes the read cursor, so pages are rewritten in
+// place. Work is done in batches of options.batchPages pages under the engine
+// mutex, with options.pause between batches; every batch is one logged change, after
+// which the table is consistent (moved rows are remapped and the pages they left are emptied).
+// Pages still at least options.keepFill full are left where they are until some
+// earlier page has shrunk. The last batch drops the tombstones from the row map,
+// repacks compressed extents, checkpoints and truncates the file. The partitions of a
+// partitioned table are compacted one after another, and their stats added up.
+std::optional<VacuumStats> vacuumTable(const std::string& dbName, const std::string& tableName,
+                                       const VacuumOptions& options = VacuumOptions()) {
+    std::vector<std::string> partitions = partitionsOf(dbName, tableName);
+    if (partitions.size() > 1 || partitions.front() != tableName) {
+        VacuumStats total;
+        for (const std::string& partition : partitions) {
+            std::optional<VacuumStats> stats = vacuumTable(dbName, partition, options);
+            if (!stats) {
+                return std::nullopt;
+            }
+            total.pagesBefore += stats->pagesBefore;
+            total.pagesAfter += stats->pagesAfter;
+            total.rowsMoved += stats->rowsMoved;
+            total.tombstonesDropped += stats->tombstonesDropped;
+            total.bytesReclaimed += stats->bytesReclaimed;
+        }
+        return total;
+    }
+    TraceSpan span("vacuum");
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    const size_t usableBytes = PAGE_SIZE - sizeof(PageMetadata);
+    auto storedBytes = [](const std::string& path) {
+        std::error_code error;
+        uint64_t tableBytes = fs::file_size(path, error);
+        uint64_t snapshotBytes = fs::file_size(FileMetadata::snapshotPath(path), error);
+        return (tableBytes == static_cast<uint64_t>(-1) ? 0 : tableBytes) + (snapshotBytes == static_cast<uint64_t>(-1) ? 0 : snapshotBytes);
+    };
+    VacuumStats stats;
+    uint64_t sizeBefore = 0;
+    uint64_t readCursor = 0;   // Next page to compact
+    uint32_t writeCursor = 0;  // Page receiving live rows
+    uint64_t emptiedEnd = 0;   // Pages below this that were left behind have been emptied
+
+    for (bool firstBatch = true;; firstBatch = false) {
+        if (!firstBatch && options.pause.count() > 0) {
+            std::this_thread::sleep_for(options.pause);
+        }
+        std::lock_guard<std::recursive_mutex> lock(engineMutex);
+        if (!outsideTransaction("vacuumTable")) {
+            return std::nullopt;
+        }
+        TraceSpan batchSpan("vacuum_batch");
+        ArenaScope arena;
+        recoverIfNeeded(tablePath);
+        std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file) {
+            std::cerr << "Error vacuumTable: Failed to open table file: " << tablePath << std::endl;
+            return std::nullopt;
+        }
+        FileMetadata fileMetadata;
+        fileMetadata.deserialize(file, tablePath);
+        if (firstBatch) {
+            stats.pagesBefore = fileMetadata.getPageCount();
+            sizeBefore = storedBytes(tablePath);
+        }
 
-    bool tupleFound = false;
-    for (uint16_t i = 0; i < page.getTupleCount(); ++i) {
-        std::string tupleData = page.getTupleData(i);
-        Tuple tuple;
-        if (tuple.deserialize(tupleData) && tuple.getAttributeValue("id") == id) {
-            tupleFound = true; // Tuple found, proceed to delete
-             std::cout << "Debug deleteTupleFromTable: Tuple with ID " << id << " found in the page.\n";
-            if (page.deleteTuple(i, tupleID, tablePath)) { // Call deleteTuple from Page class
-                // Update the tuple-to-page map and mark the tuple as deleted
-                fileMetadata.setTupleAsDeleted(tupleID);
-                std::cout << "Debug deleteTupleFromTable: Tuple marked as deleted in file metadata.\n";
+        // Resume filling the page the previous batch stopped at (it may have changed since)
+        Page output(writeCursor);
+        if (writeCursor < readCursor && !readPage(file, fileMetadata, tablePath, writeCursor, output)) {
+            return std::nullopt;
+        }
 
-                // Write the modified page back to the file
-                file.seekp(pagePos); // Move the write pointer to the start of the page
-                page.serialize(file);
-                fileMetadata.serialize(file,tablePath); // Re-serialize the metadata
-                std::cout << "Debug deleteTupleFromTable: Page and file metadata serialized back to file.\n";
+        bool failed = false;
+        Tuple tuple(operationResource());
+        std::vector<Page> filled;  // Output pages completed in this batch, written with it
+        uint64_t batchEnd = std::min<uint64_t>(fileMetadata.getPageCount(), readCursor + options.batchPages);
+        for (; readCursor < batchEnd && !failed; ++readCursor) {
+            Page input(static_cast<uint32_t>(readCursor));
+            if (!readPage(file, fileMetadata, tablePath, static_cast<uint32_t>(readCursor), input)) {
+                return std::nullopt;
+            }
+            if (writeCursor == readCursor) {
+                // Nothing has moved yet: a full enough page stays as it is
+                if (input.liveBytes() >= options.keepFill * usableBytes) {
+                    output = Page(++writeCursor);
+                    continue;
+                }
+            }
+            input.forEachRow([&](std::string_view row) {
+                if (failed) {
+                    return;
+                }
+                if (!output.placeTuple(row)) {
+                    if (writeCursor + 1 > readCursor) {
+                        failed = true;
+                        return;
+                    }
+                    filled.push_back(output);
+                    output = Page(++writeCursor);
+                    output.placeTuple(row);
+                }
+                if (writeCursor != readCursor) {
+                    std::optional<int64_t> id = tuple.deserialize(row) ? tuple.getInt("id") : std::nullopt;
+                    if (!id) {
+                        failed = true;
+                        return;
+                    }
+                    fileMetadata.relocateTuple(*id, writeCursor);
+                    ++stats.rowsMoved;
+                }
+            });
+        }
+        if (failed) {
+            std::cerr << "Error vacuumTable: Failed to compact page " << readCursor << " of " << tablePath << std::endl;
+            return std::nullopt;
+        }
 
-                file.close();
-                std::cout << "Successfully deleted tuple with ID: " << id << std::endl;
-                return true; // Tuple successfully deleted
+        std::vector<const Page*> changed;
+        for (const Page& page : filled) {
+            changed.push_back(&page);
+        }
+        bool finished = readCursor >= fileMetadata.getPageCount();
+        if (!finished) {
+            // Leave a consistent table: the filled pages, the partly filled page and every
+            // page whose rows moved are written, with the row map, as one logged change
+            if (writeCursor < readCursor) {
+                changed.push_back(&output);
+            }
+            std::vector<Page> emptied;
+            for (uint64_t pageID = std::max<uint64_t>(writeCursor + 1, emptiedEnd); pageID < readCursor; ++pageID) {
+                emptied.emplace_back(static_cast<uint32_t>(pageID));
+            }
+            for (const Page& page : emptied) {
+                changed.push_back(&page);
+            }
+            if (!changed.empty() && !commitPages(file, fileMetadata, tablePath, changed)) {
+                return std::nullopt;
             }
+            emptiedEnd = readCursor;
+            continue;
+        }
+
+        // Last batch: shrink the table to the pages that now hold rows. The new page
+        // count goes into the same logged change as the last pages.
+        uint64_t pageCount = writeCursor;
+        if (output.getTupleCount() > 0) {
+            changed.push_back(&output);
+            pageCount = writeCursor + 1;
+        }
+        fileMetadata.truncatePages(pageCount);
+        if (!commitPages(file, fileMetadata, tablePath, changed)) {
+            return std::nullopt;
+        }
+        stats.tombstonesDropped = fileMetadata.dropTombstones();
+
+        uint64_t fileEnd = fileMetadata.getPagePosition(static_cast<int64_t>(pageCount));
+        std::vector<Page> moving;  // Compressed pages whose extents slide down
+        if (fileMetadata.isCompressed()) {
+            // Slide extents down, in file order, over the space freed behind them
+            std::vector<std::pair<uint64_t, uint32_t>> byOffset;
+            for (uint32_t pageID = 0; pageID < pageCount; ++pageID) {
+                if (std::optional<PageExtent> extent = fileMetadata.getPageExtent(pageID)) {
+                    byOffset.emplace_back(extent->offset, pageID);
+                }
+            }
+            std::sort(byOffset.begin(), byOffset.end());
+
+            // Log the pages that will move first: if the process dies mid-slide, replay
+            // rewrites them wherever the surviving metadata places them
+            fileEnd = fileMetadata.getPagePosition(0);
+            for (const auto& [offset, pageID] : byOffset) {
+                if (offset != fileEnd) {
+                    moving.emplace_back(pageID);
+                    if (!readPage(file, fileMetadata, tablePath, pageID, moving.back())) {
+                        return std::nullopt;
+                    }
+                }
+                fileEnd += fileMetadata.getPageExtent(pageID)->capacity;
+            }
+            std::vector<const Page*> movingPages;
+            for (const Page& page : moving) {
+                movingPages.push_back(&page);
+            }
+            if (!moving.empty() && (!truncateRedoLog(tablePath) || !logPages(tablePath, movingPages, {}))) {
+                std::cerr << "Error vacuumTable: Failed to log the extents to move for " << tablePath << std::endl;
+                return std::nullopt;
+            }
+            std::vector<uint32_t> movingIDs;
+            for (const Page& page : moving) {
+                movingIDs.push_back(page.getPageID());
+            }
+            markPagesChanged(tablePath, movingIDs);
+            fileEnd = fileMetadata.getPagePosition(0);
+            std::vector<char> bytes;
+            for (const auto& [offset, pageID] : byOffset) {
+                PageExtent extent = *fileMetadata.getPageExtent(pageID);
+                if (offset != fileEnd) {
+                    bytes.resize(extent.capacity);
+                    file.clear();
+                    file.seekg(offset, std::ios::beg);
+                    file.read(bytes.data(), bytes.size());
+                    file.clear(); // The last extent may end before its capacity
+                    file.seekp(fileEnd, std::ios::beg);
+                    file.write(bytes.data(), bytes.size());
+                    if (!file) {
+                        std::cerr << "Error vacuumTable: Failed to move extent of page " << pageID << std::endl;
+                        return std::nullopt;
+                    }
+                    fileMetadata.setPageExtent(pageID, {fileEnd, extent.capacity});
+                }
+                fileEnd += extent.capacity;
+            }
+            fileMetadata.truncatePages(pageCount);
+        }
+
+        file.clear();
+        fileMetadata.checkpoint(file, tablePath);
+        file.close();
+        bufferPool.invalidateTable(tablePath);
+        if (fs::file_size(tablePath) > fileEnd) {
+            fs::resize_file(tablePath, fileEnd);
+        }
+        RedoLog& log = redoLogFor(tablePath);
+        for (const Page& page : moving) {
+            log.markClean(page.getPageID());
         }
+        log.checkpoint();
+
+        stats.pagesAfter = pageCount;
+        uint64_t sizeAfter = storedBytes(tablePath);
+        stats.bytesReclaimed = sizeBefore > sizeAfter ? sizeBefore - sizeAfter : 0;
+        std::cout << "Debug vacuumTable: " << tableName << " " << stats.pagesBefore << " -> " << stats.pagesAfter
+                  << " pages, " << stats.rowsMoved << " rows moved, " << stats.tombstonesDropped << " tombstones dropped" << std::endl;
+        return stats;
     }
+}
 
-    file.close();
-    if (!tupleFound) {
-        std::cerr << "Failed to delete tuple with ID: " << id << ". It may not exist.\n";
+// Run vacuumTable() on a background thread. The Storage must outlive the future.
+std::future<std::optional<VacuumStats>> vacuumTableAsync(const std::string& dbName, const std::string& tableName,
+                                                         const VacuumOptions& options = VacuumOptions()) {
+    return std::async(std::launch::async, [this, dbName, tableName, options]() {
+        return vacuumTable(dbName, tableName, options);
+    });
+}
+
+#ifdef YARAB_HAS_COROUTINES
+// Executors of the *Async operations: the blocking call runs on io and the awaiting
+// coroutine resumes on resume. By default io is a thread pool owned by this Storage
+// and coroutines resume on the I/O thread; an event loop passes its own executor
+// (e.g. a RunLoopExecutor it polls) as resume so completions come back to the loop
+// thread. Passing nullptr keeps the default. Executors must outlive the operations
+// in flight, and must be set before the first async operation.
+void setAsyncExecutors(Executor* io, Executor* resume) {
+    ioExecutor = io;
+    resumeExecutor = resume ? resume : &inlineExecutor;
+}
+
+private:
+// Awaitable running fn on the I/O executor, counted until its resumption is posted
+// so ~Storage() can wait for it
+template <typename Fn>
+OffloadAwaiter<Fn> offload(Fn fn) {
+    std::call_once(asyncInit, [this]() {
+        if (!ioExecutor) {
+            defaultIoExecutor = std::make_unique<ThreadPoolExecutor>();
+            ioExecutor = defaultIoExecutor.get();
+        }
+    });
+    {
+        std::lock_guard<std::mutex> lock(offloadMutex);
+        ++offloadsRunning;
     }
-    return false; // Tuple with the given ID was not found
+    return OffloadAwaiter<Fn>(*ioExecutor, *resumeExecutor, std::move(fn), [this]() {
+        std::lock_guard<std::mutex> lock(offloadMutex);
+        if (--offloadsRunning == 0) {
+            offloadsDone.notify_all();
+        }
+    });
 }
-bool updateTupleInTable(const std::string& dbName, const std::string& tableName, const std::string& id, const Tuple& updatedTuple) {
+
+// Bring a page into the buffer pool for a scan step, reading it from disk with the
+// engine lock released so other operations run meanwhile; lock holds the engine
+// mutex again on return. The page is only cached if no page of the table was written
+// in the meantime (see BufferPool::writeCount()), otherwise the step reads it again
+// under the lock. The caller must look the table's metadata up again afterwards.
+void prefetchPage(std::unique_lock<std::recursive_mutex>& lock, const std::string& tablePath,
+                  const FileMetadata& fileMetadata, uint32_t pageID) {
+    if (bufferPool.contains(tablePath, pageID)) {
+        return;
+    }
+    std::optional<PageLocation> location = locatePage(fileMetadata, tablePath, pageID);
+    if (!location) {
+        return;
+    }
+    uint64_t writes = bufferPool.writeCount(tablePath);
+    Page page(pageID);
+    bool loaded = false;
+    lock.unlock();
+    {
+        TraceSpan span("page_load");
+        std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+        loaded = file && readPageAt(file, *location, pageID, page);
+    }
+    lock.lock();
+    if (loaded && bufferPool.writeCount(tablePath) == writes) {
+        bufferPool.put(tablePath, page);
+    }
+}
+
+// One page of scanRangeAsync(). The page is read with the engine lock released (see
+// prefetchPage()) and its rows are taken under the lock. A partitioned table is
+// scanned whole, as scanRange() does it.
+std::optional<int64_t> scanRangeStep(const std::string& dbName, const std::string& tableName, int64_t startId,
+                                     int64_t nextId, size_t count,
+                                     std::vector<std::map<std::string, std::string>>& results) {
+    std::unique_lock<std::recursive_mutex> lock(engineMutex);
+    if (partitioningOf(dbName, tableName)) {
+        results = scanRange(dbName, tableName, startId, count);
+        return std::nullopt;
+    }
+    TraceSpan span("scan");
+    ArenaScope arena;
     std::string tablePath = dbName + "/" + tableName + ".HAD";
-    std::cout << "Debug: Attempting to update tuple in table file: " << tablePath << std::endl;
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
+    }
+    {
+        const FileMetadata& fileMetadata = metadataFor(tablePath, file);
+        const auto& tupleToPageMap = fileMetadata.getTupleToPageMap();
+        auto it = tupleToPageMap.lower_bound(nextId);
+        while (it != tupleToPageMap.end() && it->second < 0) {
+            ++it; // Deleted
+        }
+        if (it == tupleToPageMap.end()) {
+            return std::nullopt;
+        }
+        prefetchPage(lock, tablePath, fileMetadata, static_cast<uint32_t>(it->second));
+    }
 
-    // Check if the table exists
-    if (!fs::exists(tablePath)) {
-        std::cerr << "Table does not exist: " << tablePath << std::endl;
+    // The table may have been written, replaced or dropped while the lock was released
+    file.close();
+    recoverIfNeeded(tablePath);
+    file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
+    }
+    Tuple tuple(operationResource());
+    return scanRangePage(file, metadataFor(tablePath, file), tablePath, nextId, count, tuple, results);
+}
+
+// Where selectWhereEqualsAsync() is between its steps
+struct EqualsScan {
+    bool started = false;
+    size_t columnHint = 0;
+    Tuple::Value needle;
+    uint32_t nextPage = 0;
+};
+
+// One page of selectWhereEqualsAsync(); false once the scan is done. The page is
+// read with the engine lock released (see prefetchPage()) and matched under the lock.
+// A partitioned table is scanned whole, as selectWhereEquals() does it.
+bool selectWhereEqualsStep(const std::string& dbName, const std::string& tableName, const std::string& column,
+                           const std::string& value, EqualsScan& scan,
+                           std::vector<std::map<std::string, std::string>>& results) {
+    std::unique_lock<std::recursive_mutex> lock(engineMutex);
+    if (partitioningOf(dbName, tableName)) {
+        results = selectWhereEquals(dbName, tableName, column, value);
         return false;
     }
-    std::cout << "Debug: Table exists: " << tablePath << std::endl;
+    TraceSpan span("scan");
+    ArenaScope arena;
+    std::string tablePath = dbName + "/" + tableName + ".HAD";
+    recoverIfNeeded(tablePath);
+    std::fstream file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
+    }
+    if (!scan.started) {
+        scan.started = true;
+        if (!equalsNeedle(metadataFor(tablePath, file), tablePath, column, value, std::pmr::get_default_resource(),
+                          scan.needle, scan.columnHint)) {
+            return false;
+        }
+    }
+    if (scan.nextPage >= metadataFor(tablePath, file).getPageCount()) {
+        return false;
+    }
+    prefetchPage(lock, tablePath, metadataFor(tablePath, file), scan.nextPage);
 
-    // Check if the tuple exists using the tuple-to-page map in Storage class
-    std::cout << "Debug: Checking if the tuple with ID " << id << " exists in the table." << std::endl;
-    if (!deleteTupleFromTable(dbName, tableName, id)) {
-        std::cerr << "Failed to delete the tuple with ID " << id << std::endl;
-        return false; // Exit if the tuple could not be deleted
+    // The table may have been written, replaced or dropped while the lock was released
+    file.close();
+    recoverIfNeeded(tablePath);
+    file = openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file.");
     }
-    std::cout << "Debug: Tuple with ID " << id << " marked for deletion.\n";
+    const FileMetadata& fileMetadata = metadataFor(tablePath, file);
+    if (scan.nextPage >= fileMetadata.getPageCount()) {
+        return false;
+    }
+    Tuple tuple(operationResource());
+    selectPageWhereEquals(file, fileMetadata, tablePath, scan.nextPage++, column, scan.columnHint, scan.needle, tuple,
+                          results);
+    return scan.nextPage < fileMetadata.getPageCount();
+}
 
-    // Now that the old tuple is deleted, insert the updated tuple into the table
-    std::cout << "Debug: Attempting to insert the updated tuple." << std::endl;
-    if (!insert(dbName, tableName, updatedTuple)) {
-        std::cerr << "Failed to insert the updated tuple.\n";
-        return false; // Exit if the updated tuple could not be inserted
+public:
+// Awaitable forms of the storage operations. Each suspends while the operation runs
+// on the I/O executor, so the calling thread can keep many in flight. Point
+// operations run whole under the engine mutex, as one step. The scans take one step
+// per page and release the mutex in between, and also while the step reads its page
+// from disk, so scans in flight interleave page by page with each other and with point
+// operations, and their disk reads overlap other work. A scan sees each page as it
+// stands when its rows are taken. Scans of partitioned tables still run as one step.
+// Arguments are taken by value because they must live in the coroutine frame.
+Task<std::optional<int64_t>> insertAsync(std::string dbName, std::string tableName, Tuple tuple) {
+    co_return co_await offload([&]() { return insert(dbName, tableName, tuple); });
+}
+
+Task<std::map<std::string, std::string>> getAsync(std::string dbName, std::string tableName, std::string id) {
+    co_return co_await offload([&]() { return get(dbName, tableName, id); });
+}
+
+Task<bool> deleteTupleFromTableAsync(std::string dbName, std::string tableName, std::string id) {
+    co_return co_await offload([&]() { return deleteTupleFromTable(dbName, tableName, id); });
+}
+
+Task<bool> updateTupleInTableAsync(std::string dbName, std::string tableName, std::string id, Tuple updatedTuple) {
+    co_return co_await offload([&]() { return updateTupleInTable(dbName, tableName, id, updatedTuple); });
+}
+
+Task<std::vector<std::map<std::string, std::string>>> scanRangeAsync(std::string dbName, std::string tableName,
+                                                                     int64_t startId, size_t count) {
+    std::vector<std::map<std::string, std::string>> results;
+    for (std::optional<int64_t> nextId = startId; nextId && results.size() < count;) {
+        nextId = co_await offload([&]() { return scanRangeStep(dbName, tableName, startId, *nextId, count, results); });
     }
-    std::cout << "Debug: Updated tuple inserted successfully into the table.\n";
+    co_return results;
+}
 
-    std::cout << "Successfully updated tuple with ID: " << id << std::endl;
-    return true; // Tuple successfully updated
+Task<std::vector<std::map<std::string, std::string>>> selectWhereEqualsAsync(std::string dbName, std::string tableName,
+                                                                             std::string column, std::string value) {
+    std::vector<std::map<std::string, std::string>> results;
+    EqualsScan scan;
+    while (co_await offload([&]() { return selectWhereEqualsStep(dbName, tableName, column, value, scan, results); })) {
+    }
+    co_return results;
 }
+#endif
 
 };
 
 
+// Tools that link the engine (bench.cpp) define YARAB_NO_MAIN and supply their own main()
+
+inline TableScanOperator::TableScanOperator(Storage& storage, const std::string& dbName, const std::string& tableName,
+                                            const std::vector<std::string>& columnNames, uint64_t firstPage,
+                                            uint64_t lastPage)
+    : lock(storage.engineMutex), tablePath(dbName + "/" + tableName + ".HAD"), storage(&storage), nextPage(firstPage) {
+    storage.recoverIfNeeded(tablePath);
+    file = Storage::openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file: " + tablePath);
+    }
+    auto metadata = std::make_shared<FileMetadata>();
+    metadata->deserialize(file, tablePath);
+    fileMetadata = metadata;
+    endPage = std::min(lastPage, fileMetadata->getPageCount());
+    decoder = RowDecoder(fileMetadata->getSchema(), columnNames, &storage.dictionaryFor(tablePath));
+}
+
+inline TableScanOperator::TableScanOperator(const TableScanOperator& owner, uint64_t firstPage, uint64_t lastPage)
+    : tablePath(owner.tablePath), fileMetadata(owner.fileMetadata), zoneMap(owner.zoneMap), storage(owner.storage),
+      decoder(owner.decoder), nextPage(firstPage), endPage(lastPage) {
+    file = Storage::openTableFile(tablePath, std::ios::binary | std::ios::in);
+    if (!file) {
+        throw std::runtime_error("Failed to open the table file: " + tablePath);
+    }
+}
+
+// Called on the thread that built the scan, while the engine lock is held
+inline void TableScanOperator::pushDownPredicate(const QueryExpression& expression) {
+    predicate = &expression;
+    if (!zoneMap) {
+        zoneMap = storage->zoneMapFor(tablePath, *fileMetadata);
+    }
+    zoneColumns = decoder.schemaPositions();
+    zones.assign(zoneColumns.size(), nullptr);
+}
+
+inline bool TableScanOperator::pageMayMatch(uint64_t pageID) {
+    const TableZoneMap::PageZone* zone = zoneMap->page(pageID);
+    if (!zone) {
+        return true;
+    }
+    if (zone->rows == 0) {
+        return false;
+    }
+    for (size_t column = 0; column < zoneColumns.size(); ++column) {
+        zones[column] = &zone->columns[zoneColumns[column]];
+    }
+    return predicate->mayMatch(zones);
+}
+
+inline std::vector<std::unique_ptr<QueryOperator>> TableScanOperator::split(size_t parts) {
+    std::vector<std::unique_ptr<QueryOperator>> others;
+    uint64_t firstPage = nextPage; // Rows left on a page already loaded stay with this scan
+    uint64_t pages = endPage - std::min(firstPage, endPage);
+    parts = static_cast<size_t>(std::max<uint64_t>(1, std::min<uint64_t>(parts, pages)));
+    for (size_t part = 1; part < parts; ++part) {
+        others.push_back(std::unique_ptr<QueryOperator>(new TableScanOperator(
+            *this, firstPage + pages * part / parts, firstPage + pages * (part + 1) / parts)));
+    }
+    endPage = firstPage + pages / parts;
+    releaseAtEnd = false;
+    return others;
+}
+
+inline RowDecoder::RowDecoder(const std::map<std::string, std::string>& schema, const std::vector<std::string>& columnNames,
+                              const TableDictionary* tableDictionary)
+    : dictionary(tableDictionary) {
+    for (const auto& [name, type] : schema) {
+        schemaNames.push_back(name);
+    }
+    columnAtPosition.assign(schemaNames.size(), -1);
+    for (const std::string& name : columnNames.empty() ? schemaNames : columnNames) {
+        auto it = schema.find(name);
+        if (it == schema.end()) {
+            throw std::invalid_argument("Unknown column: " + name);
+        }
+        int& column = columnAtPosition[std::distance(schema.begin(), it)];
+        if (column >= 0) {
+            throw std::invalid_argument("Column listed twice: " + name);
+        }
+        column = static_cast<int>(columns.size());
+        columns.push_back({name, Storage::schemaTypeCode(it->second)});
+    }
+    seen.resize(columns.size());
+}
+
+inline std::vector<size_t> RowDecoder::schemaPositions() const {
+    std::vector<size_t> positions(columns.size());
+    for (size_t position = 0; position < columnAtPosition.size(); ++position) {
+        if (columnAtPosition[position] >= 0) {
+            positions[columnAtPosition[position]] = position;
+        }
+    }
+    return positions;
+}
+
+// Rows lay out the schema columns first, in schema order, so a token is matched
+// against the column at its position before the schema is searched.
+inline void RowDecoder::decode(std::string_view row, ColumnBatch& batch) {
+    std::fill(seen.begin(), seen.end(), 0);
+    for (size_t position = 0; !row.empty(); ++position) {
+        size_t close = Tuple::tokenEnd(row);
+        std::string_view token = row.substr(0, close);
+        row.remove_prefix(close == std::string_view::npos ? row.size() : close + 1);
+        size_t open = token.find('(');
+        size_t bar = token.find('|', open);
+        if (open == std::string_view::npos || bar == std::string_view::npos || bar + 1 == token.size()) {
+            continue;
+        }
+        std::string_view key = token.substr(0, open);
+        int column = -1;
+        if (position < schemaNames.size() && schemaNames[position] == key) {
+            column = columnAtPosition[position];
+        } else {
+            auto it = std::find(schemaNames.begin(), schemaNames.end(), key);
+            column = it == schemaNames.end() ? -1 : columnAtPosition[it - schemaNames.begin()];
+        }
+        if (column < 0 || seen[column]) {
+            continue;
+        }
+        seen[column] = 1;
+        std::string_view type = token.substr(open + 1, bar - open - 1);
+        std::string_view value = token.substr(bar + 1);
+        ColumnVector& target = batch.columns[column];
+        int64_t code = 0;
+        if (type.size() == 1 && type[0] == '0' + TYPE_DICTIONARY_CODE &&
+            std::from_chars(value.data(), value.data() + value.size(), code).ec == std::errc()) {
+            target.appendText(dictionary->decode(target.name, code));
+        } else {
+            target.appendText(Tuple::unescapeValue(value, scratch));
+        }
+    }
+    for (size_t column = 0; column < seen.size(); ++column) {
+        if (!seen[column]) {
+            batch.columns[column].appendAbsent();
+        }
+    }
+    ++batch.rowCount;
+}
+
+inline bool TableScanOperator::next(ColumnBatch& batch) {
+    batch.reset(decoder.outputColumns());
+    if (finished) {
+        return false;
+    }
+    TraceSpan span("query_scan");
+    while (batch.rowCount < QUERY_BATCH_ROWS) {
+        if (pageLoaded && nextSlot < page.getSlots().size()) {
+            std::string_view row = page.rowAt(nextSlot++);
+            if (!row.empty()) {
+                decoder.decode(row, batch);
+            }
+            continue;
+        }
+        if (nextPage >= endPage) {
+            break;
+        }
+        if (predicate && !pageMayMatch(nextPage)) {
+            ++nextPage;
+            bumpCounter(engineCounters().pagesSkipped);
+            continue;
+        }
+        // Full scans read past the buffer pool, as exports do, so they do not evict hot pages
+        pageLoaded = Storage::readPageFromDisk(file, *fileMetadata, tablePath, static_cast<uint32_t>(nextPage++), page);
+        nextSlot = 0;
+    }
+    if (batch.rowCount == 0) {
+        finished = true;
+        file.close();
+        zoneMap.reset(); // Later writes need not copy the zones to keep this scan's view
+        if (releaseAtEnd && lock.owns_lock()) {
+            lock.unlock(); // The table is free for other threads once the scan ends
+        }
+        return false;
+    }
+    bumpCounter(engineCounters().rowsDecoded, batch.rowCount);
+    return true;
+}
+
+#ifndef YARAB_NO_MAIN
 int main() {
     // Create a Storage object to manage databases
     Storage storage;
@@ -1470,8 +10982,8 @@ int main() {
         {"age", "int"}
     };
     
-    // Step 1: Create the database if it doesn't exist
-    if (!storage.createDatabase(dbName)) {
+    // Step 1: Create the database if it doesn't exist, and finish any changes a crash interrupted
+    if (!storage.createDatabase(dbName) || !storage.recoverDatabase(dbName)) {
         std::cerr << "Failed to create the database." << std::endl;
         return -1;
     }
@@ -1504,3 +11016,4 @@ int main() {
 
     return 0;
 }
+#endif
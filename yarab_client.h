@@ -0,0 +1,273 @@
+// Client for the Storage server (server.cpp). Header-only; it does not link the engine.
+//
+//   YarabClient client;
+//   client.connectUnix("/tmp/yarab.sock");          // or connectTcp("127.0.0.1", 7070)
+//   client.insert("db", "users", {{"id", 1, "7"}, {"name", 2, "Ada"}});  // Returns the row's id
+//   std::optional<WireRow> row = client.get("db", "users", "7");
+//
+// The one-call helpers each wait for their response. To pipeline, queue any number
+// of requests with the queue*() functions, send them with flush(), and read the
+// responses, in the same order, with receive().
+#pragma once
+
+#include "yarab_protocol.h"
+
+#include <cerrno>
+#include <charconv>
+#include <optional>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+class YarabClient {
+public:
+    struct Response {
+        uint32_t requestId = 0;
+        uint8_t status = WIRE_FAILED;
+        std::vector<WireRow> rows;
+    };
+
+private:
+    int fd = -1;
+    uint32_t nextRequestId = 1;
+    std::string output;        // Queued requests not yet sent
+    std::string input;         // Received bytes not yet parsed
+    size_t inputOffset = 0;
+
+    uint32_t beginRequest(WireWriter& writer, uint8_t opcode, const std::string& dbName, const std::string& tableName) {
+        uint32_t requestId = nextRequestId++;
+        writer.beginFrame();
+        writer.put(requestId);
+        writer.put(opcode);
+        writer.putString(dbName);
+        writer.putString(tableName);
+        return requestId;
+    }
+
+    bool connectTo(int domain, const sockaddr* address, socklen_t length) {
+        close();
+        fd = socket(domain, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        if (::connect(fd, address, length) < 0) {
+            close();
+            return false;
+        }
+        if (domain != AF_UNIX) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        return true;
+    }
+
+    // Send one request and wait for its response
+    std::optional<Response> roundTrip() {
+        Response response;
+        if (!flush() || !receive(response)) {
+            return std::nullopt;
+        }
+        return response;
+    }
+
+public:
+    YarabClient() = default;
+    YarabClient(const YarabClient&) = delete;
+    YarabClient& operator=(const YarabClient&) = delete;
+    ~YarabClient() {
+        close();
+    }
+
+    bool connectTcp(const std::string& host, int port) {
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || !found) {
+            return false;
+        }
+        bool connected = connectTo(AF_INET, found->ai_addr, found->ai_addrlen);
+        freeaddrinfo(found);
+        return connected;
+    }
+
+    bool connectUnix(const std::string& path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return connectTo(AF_UNIX, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+    }
+
+    bool isConnected() const {
+        return fd >= 0;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        output.clear();
+        input.clear();
+        inputOffset = 0;
+    }
+
+    // Queue requests without sending them; each returns the request id its response carries
+    uint32_t queueInsert(const std::string& dbName, const std::string& tableName, const std::vector<WireAttribute>& row) {
+        WireWriter writer(output);
+        uint32_t requestId = beginRequest(writer, WIRE_INSERT, dbName, tableName);
+        writer.putTypedRow(row);
+        writer.endFrame();
+        return requestId;
+    }
+
+    uint32_t queueGet(const std::string& dbName, const std::string& tableName, const std::string& id) {
+        WireWriter writer(output);
+        uint32_t requestId = beginRequest(writer, WIRE_GET, dbName, tableName);
+        writer.putString(id);
+        writer.endFrame();
+        return requestId;
+    }
+
+    uint32_t queueDelete(const std::string& dbName, const std::string& tableName, const std::string& id) {
+        WireWriter writer(output);
+        uint32_t requestId = beginRequest(writer, WIRE_DELETE, dbName, tableName);
+        writer.putString(id);
+        writer.endFrame();
+        return requestId;
+    }
+
+    uint32_t queueUpdate(const std::string& dbName, const std::string& tableName, const std::string& id,
+                         const std::vector<WireAttribute>& row) {
+        WireWriter writer(output);
+        uint32_t requestId = beginRequest(writer, WIRE_UPDATE, dbName, tableName);
+        writer.putString(id);
+        writer.putTypedRow(row);
+        writer.endFrame();
+        return requestId;
+    }
+
+    uint32_t queueScan(const std::string& dbName, const std::string& tableName, int64_t startId, uint32_t count) {
+        WireWriter writer(output);
+        uint32_t requestId = beginRequest(writer, WIRE_SCAN, dbName, tableName);
+        writer.put(startId);
+        writer.put(count);
+        writer.endFrame();
+        return requestId;
+    }
+
+    // Send every queued request
+    bool flush() {
+        size_t offset = 0;
+        while (offset < output.size()) {
+            ssize_t sent = send(fd, output.data() + offset, output.size() - offset, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                close();
+                return false;
+            }
+            offset += static_cast<size_t>(sent);
+        }
+        output.clear();
+        return true;
+    }
+
+    // Wait for the next response
+    bool receive(Response& response) {
+        char buffer[64 << 10];
+        for (;;) {
+            size_t available = input.size() - inputOffset;
+            uint32_t length = 0;
+            if (available >= sizeof(length)) {
+                std::memcpy(&length, input.data() + inputOffset, sizeof(length));
+                if (length > WIRE_MAX_FRAME) {
+                    close();
+                    return false;
+                }
+            }
+            if (available >= sizeof(length) && available >= sizeof(length) + length) {
+                WireReader reader(input.data() + inputOffset + sizeof(length), length);
+                response.requestId = reader.get<uint32_t>();
+                response.status = reader.get<uint8_t>();
+                response.rows.resize(reader.getCount<uint32_t>(sizeof(uint16_t))); // Each row starts with its field count
+                for (WireRow& row : response.rows) {
+                    row = reader.getRow();
+                }
+                inputOffset += sizeof(length) + length;
+                if (inputOffset == input.size()) {
+                    input.clear();
+                    inputOffset = 0;
+                }
+                return reader.good();
+            }
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                close();
+                return false;
+            }
+            input.append(buffer, static_cast<size_t>(received));
+        }
+    }
+
+    // One-call helpers: send a single request and wait for its response
+    // The id of the inserted row, which an auto-increment table assigns to rows without one
+    std::optional<int64_t> insert(const std::string& dbName, const std::string& tableName,
+                                  const std::vector<WireAttribute>& row) {
+        queueInsert(dbName, tableName, row);
+        std::optional<Response> response = roundTrip();
+        if (!response || response->status != WIRE_OK || response->rows.empty()) {
+            return std::nullopt;
+        }
+        auto field = response->rows.front().find("id");
+        int64_t id = 0;
+        if (field == response->rows.front().end() ||
+            std::from_chars(field->second.data(), field->second.data() + field->second.size(), id).ec != std::errc()) {
+            return std::nullopt;
+        }
+        return id;
+    }
+
+    std::optional<WireRow> get(const std::string& dbName, const std::string& tableName, const std::string& id) {
+        queueGet(dbName, tableName, id);
+        std::optional<Response> response = roundTrip();
+        if (!response || response->status != WIRE_OK || response->rows.empty()) {
+            return std::nullopt;
+        }
+        return std::move(response->rows.front());
+    }
+
+    bool deleteRow(const std::string& dbName, const std::string& tableName, const std::string& id) {
+        queueDelete(dbName, tableName, id);
+        std::optional<Response> response = roundTrip();
+        return response && response->status == WIRE_OK;
+    }
+
+    bool update(const std::string& dbName, const std::string& tableName, const std::string& id,
+                const std::vector<WireAttribute>& row) {
+        queueUpdate(dbName, tableName, id, row);
+        std::optional<Response> response = roundTrip();
+        return response && response->status == WIRE_OK;
+    }
+
+    std::optional<std::vector<WireRow>> scan(const std::string& dbName, const std::string& tableName, int64_t startId,
+                                             uint32_t count) {
+        queueScan(dbName, tableName, startId, count);
+        std::optional<Response> response = roundTrip();
+        if (!response || response->status != WIRE_OK) {
+            return std::nullopt;
+        }
+        return std::move(response->rows);
+    }
+};
@@ -0,0 +1,171 @@
+// Wire protocol of the Storage server (server.cpp) and its client (yarab_client.h).
+//
+// Every message is a frame: [u32 body length][body]. Integers are in host byte order
+// (little-endian on every supported target), like the table files.
+//
+//   Request body:   [u32 request id][u8 opcode][arguments]
+//   Response body:  [u32 request id][u8 status][u32 row count][rows]
+//
+// Strings are [u32 length][bytes]. Response rows are [u16 field count][(name, value)
+// strings], the same maps Storage::get() returns. INSERT and UPDATE carry a typed row:
+// [u16 attribute count][(name string, u8 type, value string)], with the engine's
+// attribute type codes (1 int, 2 string, 3 double).
+//
+//   INSERT  db, table, typed row     -> one row holding the id (assigned if the row had none)
+//   GET     db, table, id            -> one row
+//   DELETE  db, table, id
+//   UPDATE  db, table, id, typed row
+//   SCAN    db, table, i64 first id, u32 count   -> up to count rows in id order
+//
+// A connection's requests are answered in the order they were sent, so clients may
+// pipeline any number of them; the request id is echoed back for matching.
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum WireOpcode : uint8_t { WIRE_INSERT = 1, WIRE_GET = 2, WIRE_DELETE = 3, WIRE_UPDATE = 4, WIRE_SCAN = 5 };
+enum WireStatus : uint8_t { WIRE_OK = 0, WIRE_NOT_FOUND = 1, WIRE_FAILED = 2, WIRE_BAD_REQUEST = 3 };
+
+constexpr uint32_t WIRE_MAX_FRAME = 16 << 20;  // Larger frames are rejected and the connection closed
+
+struct WireAttribute {
+    std::string name;
+    uint8_t type;
+    std::string value;
+};
+
+using WireRow = std::map<std::string, std::string>;
+
+inline const char* wireStatusName(uint8_t status) {
+    switch (status) {
+        case WIRE_OK: return "ok";
+        case WIRE_NOT_FOUND: return "not found";
+        case WIRE_FAILED: return "failed";
+        case WIRE_BAD_REQUEST: return "bad request";
+        default: return "unknown";
+    }
+}
+
+// Appends frames to a buffer. beginFrame() reserves the length word, endFrame() fills it in.
+class WireWriter {
+private:
+    std::string& out;
+    size_t frameStart = 0;
+
+public:
+    explicit WireWriter(std::string& buffer) : out(buffer) {}
+
+    template <typename T>
+    void put(T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void putString(std::string_view text) {
+        put(static_cast<uint32_t>(text.size()));
+        out.append(text.data(), text.size());
+    }
+
+    void putTypedRow(const std::vector<WireAttribute>& row) {
+        put(static_cast<uint16_t>(row.size()));
+        for (const WireAttribute& attribute : row) {
+            putString(attribute.name);
+            put(attribute.type);
+            putString(attribute.value);
+        }
+    }
+
+    void putRow(const WireRow& row) {
+        put(static_cast<uint16_t>(row.size()));
+        for (const auto& [name, value] : row) {
+            putString(name);
+            putString(value);
+        }
+    }
+
+    void beginFrame() {
+        frameStart = out.size();
+        put(uint32_t(0));
+    }
+
+    void endFrame() {
+        uint32_t length = static_cast<uint32_t>(out.size() - frameStart - sizeof(uint32_t));
+        std::memcpy(&out[frameStart], &length, sizeof(length));
+    }
+};
+
+// Reads the fields of one frame body. A read past the end clears good() and yields zeros.
+class WireReader {
+private:
+    const char* cursor;
+    const char* end;
+    bool ok = true;
+
+public:
+    WireReader(const char* data, size_t length) : cursor(data), end(data + length) {}
+
+    bool good() const {
+        return ok;
+    }
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (static_cast<size_t>(end - cursor) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, cursor, sizeof(T));
+        cursor += sizeof(T);
+        return value;
+    }
+
+    // A count of items that each take at least itemBytes of the frame. A count the rest
+    // of the frame cannot hold clears good() and yields zero, so a corrupt or hostile
+    // count never sizes a container.
+    template <typename T>
+    T getCount(size_t itemBytes) {
+        T count = get<T>();
+        if (ok && static_cast<size_t>(end - cursor) / itemBytes < count) {
+            ok = false;
+            return 0;
+        }
+        return count;
+    }
+
+    std::string getString() {
+        uint32_t length = get<uint32_t>();
+        if (!ok || static_cast<size_t>(end - cursor) < length) {
+            ok = false;
+            return std::string();
+        }
+        std::string text(cursor, length);
+        cursor += length;
+        return text;
+    }
+
+    std::vector<WireAttribute> getTypedRow() {
+        // Name length, type, value length
+        std::vector<WireAttribute> row(getCount<uint16_t>(sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t)));
+        for (WireAttribute& attribute : row) {
+            attribute.name = getString();
+            attribute.type = get<uint8_t>();
+            attribute.value = getString();
+        }
+        return row;
+    }
+
+    WireRow getRow() {
+        WireRow row;
+        uint16_t fields = get<uint16_t>();
+        for (uint16_t i = 0; i < fields && ok; ++i) {
+            std::string name = getString();
+            row[name] = getString();
+        }
+        return row;
+    }
+};